@@ -0,0 +1,259 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: callerid.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to put caller ID numbers in one form and to keep caller
+ *	ID names once each.
+ *
+ *	The NMBR field may hold ten digits ("8005551234"), eleven
+ *	("18005551234"), a short code ("885"), or "O" (out of area) or
+ *	"P" (private), and list entries are written with or without the
+ *	leading 1 and with dashes or spaces. cidNumber() turns all of the
+ *	ways of writing a North American number into its E.164 form
+ *	(+18005551234), packed into a 64 bit integer, so two numbers are
+ *	the same number if their integers are equal.
+ *
+ *	A name table (cidNames) keeps each different name once, in one
+ *	block of memory, and gives it a small integer id.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "callerid.h"
+
+#define MAX_DIGITS	15		// the longest E.164 number
+
+static uint64_t pack(int kind, int digits, uint64_t value)
+{
+  return (uint64_t)kind << 60 | (uint64_t)digits << 56 | value;
+}
+
+/*
+ * The packed form of the number in 'text' ('len' characters, or up to
+ * "--", '\n' or the end of the string if 'len' is -1). Dashes, spaces,
+ * dots and brackets are ignored. Returns CID_NONE if 'text' is not a
+ * number.
+ */
+uint64_t cidNumber(const char *text, int len)
+{
+  char d[MAX_DIGITS + 1];
+  int i, digits = 0, plus = 0;
+  char c;
+
+  if( len < 0 )
+  {
+    for( len = 0; text[len] != '\0' && text[len] != '\n' &&
+         text[len] != '\r' && !( text[len] == '-' && text[len + 1] == '-' );
+         len++ )
+      ;
+  }
+  while( len > 0 && text[0] == ' ' )
+  {
+    text++;
+    len--;
+  }
+  while( len > 0 && text[len - 1] == ' ' )
+    len--;
+  if( len == 1 && text[0] == 'O' )
+    return pack( CID_OUT_OF_AREA, 0, 0 );
+  if( len == 1 && text[0] == 'P' )
+    return pack( CID_PRIVATE, 0, 0 );
+
+  for( i = 0; i < len; i++ )
+  {
+    c = text[i];
+    if( c >= '0' && c <= '9' )
+    {
+      if( digits == MAX_DIGITS )
+        return CID_NONE;
+      d[digits++] = c;
+    }
+    else if( c == '+' && i == 0 )
+      plus = 1;
+    else if( c != '-' && c != ' ' && c != '.' && c != '(' && c != ')' )
+      return CID_NONE;
+  }
+  d[digits] = '\0';
+  if( digits == 0 )
+    return CID_NONE;
+  if( plus )
+    return pack( CID_E164, digits, strtoull( d, NULL, 10 ) );
+
+  // North American numbers: NXX-NXX-XXXX, with or without the 1
+  if( digits == 10 && d[0] >= '2' )
+    return pack( CID_E164, 11, 10000000000ull + strtoull( d, NULL, 10 ) );
+  if( digits == 11 && d[0] == '1' && d[1] >= '2' )
+    return pack( CID_E164, 11, strtoull( d, NULL, 10 ) );
+
+  // Numbers dialled abroad: 011, then the country code and number
+  if( digits > 7 && strncmp( d, "011", 3 ) == 0 && d[3] != '0' )
+    return pack( CID_E164, digits - 3, strtoull( d + 3, NULL, 10 ) );
+
+  return pack( CID_SHORT, digits, strtoull( d, NULL, 10 ) );
+}
+
+/*
+ * Write 'number' as text ("+18005551234", "885", "O", "P" or "" for
+ * no number) into 'buf' (CID_TEXT_LEN characters). Returns 'buf'.
+ */
+char *cidFormat(uint64_t number, char *buf)
+{
+  unsigned long long value = number & ((1ull << 56) - 1);
+
+  switch( CID_KIND( number ) )
+  {
+    case CID_E164:
+      snprintf( buf, CID_TEXT_LEN, "+%0*llu", CID_DIGITS( number ), value );
+      break;
+    case CID_SHORT:
+      snprintf( buf, CID_TEXT_LEN, "%0*llu", CID_DIGITS( number ), value );
+      break;
+    case CID_OUT_OF_AREA:
+      strcpy( buf, "O" );
+      break;
+    case CID_PRIVATE:
+      strcpy( buf, "P" );
+      break;
+    default:
+      buf[0] = '\0';
+      break;
+  }
+  return buf;
+}
+
+//
+// Name table functions.
+//
+static uint32_t nameHash(const char *name)
+{
+  uint32_t h = 2166136261u;             // FNV-1a
+
+  while( *name )
+  {
+    h = (h ^ (unsigned char)*name++) * 16777619u;
+  }
+  return h;
+}
+
+static void nameInsert(cidNames *t, uint32_t id)
+{
+  uint32_t i;
+
+  for( i = nameHash( t->text + t->offsets[id - 1] ) & (t->tableSize - 1);
+       t->table[i] != 0; i = (i + 1) & (t->tableSize - 1) )
+    ;
+  t->table[i] = id;
+}
+
+/*
+ * Add 'name' to the table, even if it is there already (so ids match
+ * the lines of a file of names). Returns its id, or -1.
+ */
+long cidNameAdd(cidNames *t, const char *name)
+{
+  uint32_t len = strlen( name ) + 1, size, id, *newTable;
+  uint32_t *offsets;
+  char *text;
+
+  if( t->textLen + len > t->textSize )
+  {
+    for( size = t->textSize ? t->textSize : 4096; size < t->textLen + len; )
+      size *= 2;
+    if( (text = realloc( t->text, size )) == NULL )
+    {
+      perror( "callerid: realloc" );
+      return -1;
+    }
+    t->text = text;
+    t->textSize = size;
+  }
+  if( t->numNames == t->namesSize )
+  {
+    size = t->namesSize ? t->namesSize * 2 : 256;
+    if( (offsets = realloc( t->offsets, size * sizeof(uint32_t) )) == NULL )
+    {
+      perror( "callerid: realloc" );
+      return -1;
+    }
+    t->offsets = offsets;
+    t->namesSize = size;
+  }
+
+  // Keep the hash table at most half full
+  if( (t->numNames + 1) * 2 > t->tableSize )
+  {
+    size = t->tableSize ? t->tableSize * 2 : 512;
+    if( (newTable = calloc( size, sizeof(uint32_t) )) == NULL )
+    {
+      perror( "callerid: calloc" );
+      return -1;
+    }
+    free( t->table );
+    t->table = newTable;
+    t->tableSize = size;
+    for( id = 1; id <= t->numNames; id++ )
+      nameInsert( t, id );
+  }
+  memcpy( t->text + t->textLen, name, len );
+  t->offsets[t->numNames++] = t->textLen;
+  t->textLen += len;
+  nameInsert( t, t->numNames );
+  return t->numNames;
+}
+
+/*
+ * The id of 'name' (the first, if it was added more than once), or 0.
+ */
+uint32_t cidNameFind(const cidNames *t, const char *name)
+{
+  uint32_t i, id, best = 0;
+
+  if( t->tableSize == 0 )
+    return 0;
+  for( i = nameHash( name ) & (t->tableSize - 1); (id = t->table[i]) != 0;
+       i = (i + 1) & (t->tableSize - 1) )
+  {
+    if( strcmp( t->text + t->offsets[id - 1], name ) == 0 &&
+        ( best == 0 || id < best ) )
+    {
+      best = id;
+    }
+  }
+  return best;
+}
+
+/*
+ * The text of name 'id' ("" if there is no such name). It moves when
+ * a name is added.
+ */
+const char *cidNameText(const cidNames *t, uint32_t id)
+{
+  return id > 0 && id <= t->numNames ? t->text + t->offsets[id - 1] : "";
+}
+
+void cidNamesFree(cidNames *t)
+{
+  free( t->text );
+  free( t->offsets );
+  free( t->table );
+  memset( t, 0, sizeof(*t) );
+}
@@ -0,0 +1,64 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: callerid.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the caller ID number and name functions in
+ *	callerid.c.
+ */
+#ifndef CALLERID_H
+#define CALLERID_H
+
+#include <stdint.h>
+
+// A packed number: its kind in the top four bits, its digit count in
+// the next four and its digits (as an integer) in the rest. 0 is "no
+// number".
+#define CID_NONE        0
+#define CID_E164        1       // an E.164 number ("+18005551234")
+#define CID_SHORT       2       // a short code or other digits ("885")
+#define CID_OUT_OF_AREA 3       // NMBR = O
+#define CID_PRIVATE     4       // NMBR = P
+
+#define CID_KIND(n)     ((int)((n) >> 60))
+#define CID_DIGITS(n)   ((int)(((n) >> 56) & 15))
+
+#define CID_TEXT_LEN    20      // room for any cidFormat() text
+
+// The names seen, each stored once. Name 'id' (counting from 1) is
+// text + offsets[id - 1]; table is an open addressing hash table of
+// ids.
+typedef struct
+{
+  char *text;
+  uint32_t textLen, textSize;
+  uint32_t *offsets;
+  uint32_t numNames, namesSize;
+  uint32_t *table;
+  uint32_t tableSize;
+} cidNames;
+
+uint64_t cidNumber(const char *text, int len);
+char *cidFormat(uint64_t number, char *buf);
+long cidNameAdd(cidNames *t, const char *name);
+uint32_t cidNameFind(const cidNames *t, const char *name);
+const char *cidNameText(const cidNames *t, uint32_t id);
+void cidNamesFree(cidNames *t);
+
+#endif
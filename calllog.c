@@ -0,0 +1,654 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: calllog.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to append call records to the call log (callerID.dat).
+ *
+ *	The call log is kept in monthly segments: callerID.dat.YYMM holds
+ *	the calls received in month MM of year YY, and callerID.dat is a
+ *	symbolic link to the current month's segment. Removing old calls
+ *	(see truncate.c) is then just removing old segment files. A
+ *	callerID.dat left by an older version (a regular file) is split
+ *	into segments, by the DATE of each record, when the log is
+ *	opened, and kept as callerID.dat.old.
+ *
+ *	callerID.dat may still be edited by hand. An editor (or sed -i)
+ *	that writes a new file replaces the link with a regular file.
+ *	That is seen before the next record is written (and when the log
+ *	is opened): the edited file is merged into the segments the same
+ *	way (the records written to a segment after the file was copied
+ *	for editing are kept), kept as callerID.dat.edited, and the link
+ *	is made again. A regular file is never replaced by the link.
+ *
+ *	The file used to be closed, re-opened, written with fputs() and
+ *	flushed for every call, from the code that handles the call. Now:
+ *	 - One file descriptor, opened with O_APPEND, is kept open. Before
+ *	   each write the file's inode is compared with the open one, so
+ *	   if the file was replaced (edited while the program is running,
+ *	   or removed) it is re-opened. A new month opens a new segment.
+ *	 - Each record is written with a single write(), so a record is
+ *	   never split or interleaved with another.
+ *	 - The writes, and any fdatasync() calls, are done by a writer
+ *	   thread. calllogWrite() just queues the record, so handling a
+ *	   call never waits for the disk (unless LOG_QUEUE records are
+ *	   already waiting).
+ *	 - The durability mode (see calllog.h) selects whether records
+ *	   are left to the kernel, forced to the disk one at a time, or
+ *	   forced to the disk in groups ("group commit"): every groupMsec
+ *	   milliseconds all records written since the last fdatasync()
+ *	   are forced to the disk with one call.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+#include "common.h"
+#include "calllog.h"
+#include "metrics.h"
+#include "safefile.h"
+
+#define LOG_QUEUE	64		// records waiting to be written
+#define LOG_RECORD_MAX	256		// longest record
+
+static char logBase[256];               // callerID.dat
+static char logPath[sizeof(logBase) + 16]; // the current segment
+static int logSegment = -1;             // its YYMM
+static ino_t badEditIno;                // an edited file not merged
+static int logFd = -1;
+static dev_t logDev;
+static ino_t logIno;
+static int logSyncMode;
+static int logGroupMsec;
+static int (*logHook)(const char *record);
+
+static char queue[LOG_QUEUE][LOG_RECORD_MAX];
+static int queueHead, queueTail, queueCount;
+static bool writing;                    // writer is busy (queue popped)
+static bool dirty;                      // written, but not yet synced
+static bool stopWriter;
+static pthread_t writerThread;
+static pthread_mutex_t logMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t logWork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t logDone = PTHREAD_COND_INITIALIZER;
+
+/*
+ * (Re-)open the log file and remember its inode.
+ */
+static int openLog(void)
+{
+  struct stat statBuf;
+
+  if( logFd >= 0 )
+  {
+    close( logFd );
+  }
+  if( (logFd = open( logPath, O_WRONLY | O_APPEND | O_CREAT, 0644 )) < 0 )
+  {
+    perror( logPath );
+    return -1;
+  }
+  if( fstat( logFd, &statBuf ) == 0 )
+  {
+    logDev = statBuf.st_dev;
+    logIno = statBuf.st_ino;
+  }
+  return 0;
+}
+
+/*
+ * The segment (YYMM) for the current month.
+ */
+static int segmentNow(void)
+{
+  struct tm tmBuf;
+  time_t now;
+
+  time( &now );
+  localtime_r( &now, &tmBuf );
+  return (tmBuf.tm_year % 100) * 100 + tmBuf.tm_mon + 1;
+}
+
+/*
+ * The segment (YYMM) for a record's DATE field, or -1.
+ */
+static int segmentOf(const char *record)
+{
+  const char *date;
+  int i;
+
+  if( (date = strstr( record, "DATE = " )) == NULL )
+    return -1;
+  date += 7;
+  for( i = 0; i < 6; i++ )
+  {
+    if( !isdigit( (unsigned char)date[i] ) )
+      return -1;
+  }
+  i = (date[0] - '0') * 10 + date[1] - '0';
+  if( i < 1 || i > 12 )
+    return -1;
+  return ((date[4] - '0') * 10 + date[5] - '0') * 100 + i;
+}
+
+/*
+ * Point the callerID.dat symbolic link at the current segment (a
+ * new link is renamed over the old one, so it is never missing).
+ * The directory is then synced, so that the new segment file and
+ * the link survive a power failure.
+ */
+static void linkSegment(void)
+{
+  char linkTemp[sizeof(logBase) + 8];
+  struct stat statBuf;
+  const char *target;
+
+  // Not over an edited callerID.dat (see checkLog())
+  if( lstat( logBase, &statBuf ) == 0 && !S_ISLNK( statBuf.st_mode ) )
+    return;
+
+  if( (target = strrchr( logPath, '/' )) != NULL )
+    target++;
+  else
+    target = logPath;
+  snprintf( linkTemp, sizeof(linkTemp), "%s.lnk", logBase );
+  unlink( linkTemp );
+  if( symlink( target, linkTemp ) == -1 ||
+      rename( linkTemp, logBase ) == -1 )
+  {
+    perror( "calllog: symlink" );
+  }
+  safeSyncDir( logBase );
+}
+
+static int compareLines(const void *a, const void *b)
+{
+  return strcmp( *(char * const *)a, *(char * const *)b );
+}
+
+/*
+ * Append to 'temp' (a segment's records from a split callerID.dat)
+ * the records of the existing segment 'name' that follow the last
+ * one 'temp' also has: those written to the segment after
+ * callerID.dat was copied for editing. Records the edit removed
+ * before that point stay removed. If 'temp' has none of the
+ * segment's records, it is used as it is.
+ */
+static int mergeTail(const char *temp, const char *name)
+{
+  char line[256], **lines = NULL, **more, *key;
+  long numLines = 0, maxLines = 0, tail = -1, i;
+  FILE *fpTemp, *fpSeg;
+  int rc = 0;
+
+  if( (fpSeg = fopen( name, "r" )) == NULL )
+    return errno == ENOENT ? 0 : -1;
+  if( (fpTemp = fopen( temp, "r+" )) == NULL )
+  {
+    fclose( fpSeg );
+    return -1;
+  }
+
+  // The records in 'temp', sorted for bsearch()
+  while( fgets( line, sizeof(line), fpTemp ) != NULL )
+  {
+    if( numLines == maxLines )
+    {
+      maxLines = maxLines ? maxLines * 2 : 256;
+      if( (more = realloc( lines, maxLines * sizeof(char *) )) == NULL )
+      {
+        rc = -1;
+        goto done;
+      }
+      lines = more;
+    }
+    if( (lines[numLines] = strdup( line )) == NULL )
+    {
+      rc = -1;
+      goto done;
+    }
+    numLines++;
+  }
+  qsort( lines, numLines, sizeof(char *), compareLines );
+
+  // Where the segment's last record that 'temp' has ends
+  while( fgets( line, sizeof(line), fpSeg ) != NULL )
+  {
+    key = line;
+    if( bsearch( &key, lines, numLines, sizeof(char *), compareLines ) != NULL )
+      tail = ftell( fpSeg );
+  }
+
+  // Append the rest of the segment
+  if( tail >= 0 && fseek( fpSeg, tail, SEEK_SET ) == 0 &&
+      fseek( fpTemp, 0, SEEK_END ) == 0 )
+  {
+    while( fgets( line, sizeof(line), fpSeg ) != NULL )
+    {
+      fputs( line, fpTemp );
+    }
+  }
+  if( ferror( fpSeg ) || ferror( fpTemp ) )
+    rc = -1;
+
+done:
+  for( i = 0; i < numLines; i++ )
+    free( lines[i] );
+  free( lines );
+  fclose( fpSeg );
+  if( fclose( fpTemp ) == EOF )
+    rc = -1;
+  return rc;
+}
+
+/*
+ * Split a callerID.dat that is a regular file (from an older version,
+ * or edited; see checkLog()) into monthly segments, then rename it
+ * callerID.dat.old (callerID.dat.edited if that exists, or if the
+ * file was edited while the program ran). Records
+ * for a segment that exists are merged with it (see mergeTail()).
+ * 'editedSeg' is the segment callerID.dat was a copy of (-1: not
+ * known); it is merged even if the edit removed all of its records.
+ * Each segment is written to a temporary file that is forced to the
+ * disk and then renamed into place, so if this is interrupted (even
+ * by a power failure) it is simply done again.
+ */
+static int splitLog(int editedSeg)
+{
+  char line[256], name[sizeof(logBase) + 16], temp[sizeof(logBase) + 16];
+  int touched[1200], numTouched = 0, seg, current = -1, i, fd, lines = 0;
+  struct stat statBuf;
+  FILE *fpIn, *fpOut = NULL;
+
+  if( lstat( logBase, &statBuf ) == -1 || !S_ISREG( statBuf.st_mode ) )
+    return 0;
+  if( (fpIn = fopen( logBase, "r" )) == NULL )
+  {
+    perror( logBase );
+    return -1;
+  }
+  printf("calllog: splitting %s into monthly segments\n", logBase);
+
+  while( fgets( line, sizeof(line), fpIn ) != NULL )
+  {
+    if( line[0] == '#' || line[0] == '\n' )
+      continue;                         // kept in callerID.dat.old
+    if( (seg = segmentOf( line )) == -1 )
+      seg = segmentNow();
+    if( seg != current )
+    {
+      if( fpOut != NULL )
+        fclose( fpOut );
+      for( i = 0; i < numTouched && touched[i] != seg; i++ )
+        ;
+      snprintf( temp, sizeof(temp), "%s.%04d.split", logBase, seg );
+      if( (fpOut = fopen( temp, i < numTouched ? "a" : "w" )) == NULL )
+      {
+        perror( temp );
+        fclose( fpIn );
+        return -1;
+      }
+      if( i == numTouched && numTouched < 1200 )
+        touched[numTouched++] = seg;
+      current = seg;
+    }
+    fputs( line, fpOut );
+    lines++;
+  }
+  fclose( fpIn );
+  if( fpOut != NULL && fclose( fpOut ) == EOF )
+  {
+    perror( temp );
+    return -1;
+  }
+  for( i = 0; i < numTouched && touched[i] != editedSeg; i++ )
+    ;
+  if( editedSeg != -1 && i == numTouched && numTouched < 1200 )
+  {
+    snprintf( temp, sizeof(temp), "%s.%04d.split", logBase, editedSeg );
+    if( (fpOut = fopen( temp, "w" )) == NULL || fclose( fpOut ) == EOF )
+    {
+      perror( temp );
+      return -1;
+    }
+    touched[numTouched++] = editedSeg;
+  }
+
+  // Segments may be written in several pieces, so each is merged
+  // with the existing segment and synced once here, when complete.
+  for( i = 0; i < numTouched; i++ )
+  {
+    snprintf( temp, sizeof(temp), "%s.%04d.split", logBase, touched[i] );
+    snprintf( name, sizeof(name), "%s.%04d", logBase, touched[i] );
+    if( mergeTail( temp, name ) == -1 )
+    {
+      perror( name );
+      return -1;
+    }
+    if( (fd = open( temp, O_RDONLY )) == -1 || fsync( fd ) == -1 )
+    {
+      perror( temp );
+      if( fd != -1 )
+        close( fd );
+      return -1;
+    }
+    close( fd );
+  }
+  for( i = 0; i < numTouched; i++ )
+  {
+    snprintf( temp, sizeof(temp), "%s.%04d.split", logBase, touched[i] );
+    snprintf( name, sizeof(name), "%s.%04d", logBase, touched[i] );
+    if( rename( temp, name ) == -1 )
+    {
+      perror( name );
+      return -1;
+    }
+  }
+  // The segments must be on the disk before the old file is moved.
+  safeSyncDir( logBase );
+  snprintf( name, sizeof(name), "%s.old", logBase );
+  if( editedSeg != -1 || access( name, F_OK ) == 0 )
+    snprintf( name, sizeof(name), "%s.edited", logBase );
+  if( rename( logBase, name ) == -1 )
+  {
+    perror( name );
+    return -1;
+  }
+  printf("calllog: %d records in %d segments, %s kept as %s\n",
+    lines, numTouched, logBase, name);
+  return 0;
+}
+
+/*
+ * Re-open the log file if it was replaced or removed since it was
+ * opened, or if a new month has started. If callerID.dat is no longer
+ * the link (it was edited), merge it into the segments first.
+ */
+static void checkLog(void)
+{
+  struct stat statBuf;
+  int seg;
+
+  if( lstat( logBase, &statBuf ) == 0 && S_ISREG( statBuf.st_mode ) &&
+      statBuf.st_ino != badEditIno )
+  {
+    printf("calllog: %s was edited, merging it into the segments\n", logBase);
+    if( splitLog( logSegment ) == -1 )
+    {
+      // Reported once; the records go on to the segment
+      printf("calllog: %s could not be merged; records are written to %s\n",
+        logBase, logPath);
+      badEditIno = statBuf.st_ino;
+    }
+    else
+    {
+      logSegment = -1;                  // open the segment, link it
+    }
+  }
+
+  if( (seg = segmentNow()) != logSegment )
+  {
+    logSegment = seg;
+    snprintf( logPath, sizeof(logPath), "%s.%04d", logBase, seg );
+    openLog();
+    linkSegment();
+    return;
+  }
+  if( logFd < 0 || stat( logPath, &statBuf ) == -1 ||
+      statBuf.st_dev != logDev || statBuf.st_ino != logIno )
+  {
+#ifdef DEBUG
+    printf("calllog: %s was replaced, re-opening it\n", logPath);
+#endif
+    openLog();
+  }
+}
+
+static void syncLog(void)
+{
+  long start = metricsNow();
+
+  if( logFd >= 0 && fdatasync( logFd ) == -1 )
+  {
+    perror( "calllog: fdatasync" );
+  }
+  dirty = FALSE;
+  metricsObserve( STAGE_LOG_SYNC, start );
+}
+
+/*
+ * Absolute CLOCK_REALTIME time 'msec' milliseconds from now (for
+ * pthread_cond_timedwait()).
+ */
+static void deadline(struct timespec *ts, int msec)
+{
+  clock_gettime( CLOCK_REALTIME, ts );
+  ts->tv_sec += msec / 1000;
+  ts->tv_nsec += (msec % 1000) * 1000000L;
+  if( ts->tv_nsec >= 1000000000L )
+  {
+    ts->tv_sec++;
+    ts->tv_nsec -= 1000000000L;
+  }
+}
+
+/*
+ * The writer thread.
+ */
+static void *writer(void *arg)
+{
+  char record[LOG_RECORD_MAX];
+  struct timespec groupEnd;
+  bool groupOpen = FALSE;
+  size_t len;
+  long start;
+  int rc;
+
+  pthread_mutex_lock( &logMutex );
+  while( TRUE )
+  {
+    // Wait for a record, the end of a group or the stop request
+    while( queueCount == 0 && !stopWriter )
+    {
+      if( groupOpen )
+      {
+        rc = pthread_cond_timedwait( &logWork, &logMutex, &groupEnd );
+        if( rc == ETIMEDOUT )
+          break;
+      }
+      else
+      {
+        pthread_cond_wait( &logWork, &logMutex );
+      }
+    }
+
+    if( queueCount > 0 )
+    {
+      // Write one record (without holding the lock)
+      strcpy( record, queue[queueHead] );
+      queueHead = (queueHead + 1) % LOG_QUEUE;
+      queueCount--;
+      writing = TRUE;
+      pthread_mutex_unlock( &logMutex );
+
+      start = metricsNow();
+      checkLog();
+      len = strlen( record );
+      if( logFd < 0 || write( logFd, record, len ) != (ssize_t)len )
+      {
+        perror( "calllog: write" );
+      }
+      metricsObserve( STAGE_LOG_WRITE, start );
+      if( logHook != NULL )
+      {
+        logHook( record );
+      }
+      dirty = TRUE;
+      if( logSyncMode == LOG_SYNC_RECORD )
+      {
+        syncLog();
+      }
+      else if( logSyncMode == LOG_SYNC_GROUP && !groupOpen )
+      {
+        // The first record of a group starts the group's timer
+        deadline( &groupEnd, logGroupMsec );
+        groupOpen = TRUE;
+      }
+
+      pthread_mutex_lock( &logMutex );
+      writing = FALSE;
+    }
+    else if( groupOpen )
+    {
+      // The group's time is up: commit it
+      pthread_mutex_unlock( &logMutex );
+      syncLog();
+      pthread_mutex_lock( &logMutex );
+      groupOpen = FALSE;
+    }
+
+    if( queueCount == 0 && !writing )
+    {
+      pthread_cond_broadcast( &logDone );
+    }
+    if( stopWriter && queueCount == 0 )
+      break;
+  }
+  pthread_mutex_unlock( &logMutex );
+
+  if( dirty && logSyncMode != LOG_SYNC_NONE )
+  {
+    syncLog();
+  }
+  return NULL;
+}
+
+/*
+ * Open the call log 'path' (callerID.dat; the segments are 'path'
+ * followed by .YYMM) and start the writer thread.
+ * 'syncMode' is one of the LOG_SYNC_ modes in calllog.h; 'groupMsec'
+ * is the group commit interval for LOG_SYNC_GROUP.
+ */
+int calllogOpen(const char *path, int syncMode, int groupMsec)
+{
+  int err;
+
+  strncpy( logBase, path, sizeof(logBase) - 1 );
+  logSyncMode = syncMode;
+  logGroupMsec = groupMsec > 0 ? groupMsec : 1;
+  if( splitLog( -1 ) == -1 )
+  {
+    return -1;
+  }
+  logSegment = segmentNow();
+  snprintf( logPath, sizeof(logPath), "%s.%04d", logBase, logSegment );
+  if( openLog() == -1 )
+  {
+    return -1;
+  }
+  linkSegment();
+
+  stopWriter = FALSE;
+  if( (err = pthread_create( &writerThread, NULL, writer, NULL )) != 0 )
+  {
+    printf("calllogOpen: can't create thread: %s\n", strerror(err));
+    close( logFd );
+    logFd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Queue a record (a string ending in '\n') for the call log.
+ * Returns 0, or -1 if the record could not be queued.
+ */
+int calllogWrite(const char *record)
+{
+  if( strlen( record ) >= LOG_RECORD_MAX )
+  {
+    printf("calllogWrite: record too long\n");
+    return -1;
+  }
+
+  pthread_mutex_lock( &logMutex );
+  while( queueCount == LOG_QUEUE )       // only if the disk is stuck
+  {
+    pthread_cond_wait( &logDone, &logMutex );
+  }
+  strcpy( queue[queueTail], record );
+  queueTail = (queueTail + 1) % LOG_QUEUE;
+  queueCount++;
+  pthread_cond_signal( &logWork );
+  pthread_mutex_unlock( &logMutex );
+  return 0;
+}
+
+/*
+ * Wait until every queued record has been written to the file (e.g.,
+ * before the file is read or replaced by truncate.c).
+ */
+void calllogFlush(void)
+{
+  pthread_mutex_lock( &logMutex );
+  while( queueCount > 0 || writing )
+  {
+    pthread_cond_wait( &logDone, &logMutex );
+  }
+  pthread_mutex_unlock( &logMutex );
+}
+
+/*
+ * Have the writer thread also pass each record to 'hook' (e.g.,
+ * callstoreAppend()) after writing it to the file. Call before the
+ * first calllogWrite().
+ */
+void calllogSetHook(int (*hook)(const char *record))
+{
+  pthread_mutex_lock( &logMutex );
+  logHook = hook;
+  pthread_mutex_unlock( &logMutex );
+}
+
+/*
+ * Write (and, unless LOG_SYNC_NONE, sync) the queued records, stop
+ * the writer thread and close the file.
+ */
+void calllogClose(void)
+{
+  if( logFd < 0 )
+    return;
+
+  pthread_mutex_lock( &logMutex );
+  stopWriter = TRUE;
+  pthread_cond_signal( &logWork );
+  pthread_mutex_unlock( &logMutex );
+  pthread_join( writerThread, NULL );
+
+  close( logFd );
+  logFd = -1;
+}
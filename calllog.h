@@ -0,0 +1,38 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: calllog.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the call log (callerID.dat) writer in calllog.c.
+ */
+#ifndef CALLLOG_H
+#define CALLLOG_H
+
+// Durability modes (how soon a record is forced to the disk)
+#define LOG_SYNC_NONE		0	// left to the kernel (~30 seconds)
+#define LOG_SYNC_RECORD		1	// fdatasync() after every record
+#define LOG_SYNC_GROUP		2	// fdatasync() every 'groupMsec'
+
+int calllogOpen(const char *path, int syncMode, int groupMsec);
+int calllogWrite(const char *record);
+void calllogFlush(void);
+void calllogClose(void);
+void calllogSetHook(int (*hook)(const char *record));
+
+#endif
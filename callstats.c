@@ -0,0 +1,860 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: callstats.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to keep counters for each calling number ("jcblock
+ *	stats").
+ *
+ *	"How many times has this number called in the last week?" used to
+ *	mean reading all of callerID.dat. Instead, a table of counters is
+ *	kept for every number seen: the calls in the last
+ *	STATS_WINDOW_DAYS days, all calls, the first and last call and
+ *	the tags the calls were given. The counters are updated as each
+ *	call is logged (by the call log writer thread, see calllog.c),
+ *	and the main program can look them up (callstatsLookup()) while
+ *	it decides what to do with a call.
+ *
+ *	The table is a hash table (open addressing, linear probing) of
+ *	fixed size slots, at most half full, keyed by the number in its
+ *	packed E.164 form (see callerid.c), so "18005551234" and
+ *	"8005551234" are counted together. The window count is kept as
+ *	one counter per day, in a ring of STATS_WINDOW_DAYS counters, so
+ *	adding a call and counting the window both take constant time.
+ *	The times of the last STATS_RECENT calls are kept too (another
+ *	ring), for callstatsCallsWithin() (calls in the last N minutes).
+ *
+ *	The file callstats.dat holds a copy of the table, slot for slot
+ *	after a header slot. Each change is written to its slot in the
+ *	file at once (pwrite(), not synced), and every
+ *	STATS_CHECKPOINT_CALLS calls (and at exit) the whole table is
+ *	written as a new file that replaces the old one safely (see
+ *	safefile.c). "jcblock stats NUMBER" reads the slots of the file
+ *	directly (a few pread() calls), so it answers in microseconds
+ *	without loading the table. Use "jcblock stats -i" to build the
+ *	file from the callerID.dat segments.
+ *
+ *	The program locks callstats.lock (flock()) while it keeps the
+ *	counters, so "jcblock stats -i" cannot replace callstats.dat
+ *	under it (its next checkpoint would overwrite the new file with
+ *	the old counters). callstats.dat itself cannot be locked, as
+ *	each checkpoint replaces it.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glob.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "common.h"
+#include "callstats.h"
+#include "callerid.h"
+#include "safefile.h"
+
+#define STATS_FILE		"./callstats.dat"
+#define STATS_TEMP		"./callstats.dat.tmp"
+#define STATS_LOCK		"./callstats.lock"
+#define STATS_MAGIC		"JCBSTAT3"
+#define STATS_MIN_SLOTS		1024	// table size (a power of two)
+#define STATS_CHECKPOINT_CALLS	100	// calls between checkpoints
+
+// One slot of the table (and of callstats.dat)
+typedef struct
+{
+  uint64_t number;                      // see callerid.h (CID_NONE if
+                                        // the slot is empty)
+  uint32_t firstSeen;                   // minutes since 1 Jan 2000
+  uint32_t lastSeen;
+  uint32_t totalCalls;
+  uint32_t tagMask;                     // see tagBit()
+  uint32_t lastDay;                     // newest day in dayCalls[]
+  uint16_t dayCalls[STATS_WINDOW_DAYS]; // calls per day, at day % 7
+  uint16_t unused;
+  uint32_t recent[STATS_RECENT];        // latest call minutes, at
+                                        // totalCalls % STATS_RECENT
+} statsSlot;
+
+// The header (in the first slot of callstats.dat)
+typedef struct
+{
+  char magic[8];
+  uint32_t numSlots;
+  uint32_t numUsed;
+} statsHeader;
+
+// Tags are shown in this order (see tagBit())
+static const char tagChars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ-*?";
+
+static statsSlot *table;
+static uint32_t numSlots, numUsed;
+static int statsFd = -1;
+static int lockFd = -1;                 // holds the lock on STATS_LOCK
+static int sinceCheckpoint;
+static bool needCheckpoint;
+static pthread_mutex_t statsMutex = PTHREAD_MUTEX_INITIALIZER;
+
+//
+// Days from 1 Jan 2000 to year/month/day (proleptic Gregorian).
+//
+static long daysFromCivil(int y, int m, int d)
+{
+  long era, yoe, doy, doe;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 730425;   // 730425: 1 Jan 2000
+}
+
+//
+// The inverse of daysFromCivil().
+//
+static void civilFromDays(long z, int *y, int *m, int *d)
+{
+  long era, doe, yoe, doy, mp;
+
+  z += 730425;
+  era = (z >= 0 ? z : z - 146096) / 146097;
+  doe = z - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = yoe + era * 400 + (*m <= 2);
+}
+
+//
+// The current minute (since 1 Jan 2000, local time).
+//
+static long nowMinute(void)
+{
+  struct tm tmBuf;
+  time_t now;
+
+  time( &now );
+  localtime_r( &now, &tmBuf );
+  return (daysFromCivil( tmBuf.tm_year + 1900, tmBuf.tm_mon + 1,
+    tmBuf.tm_mday ) * 24 + tmBuf.tm_hour) * 60 + tmBuf.tm_min;
+}
+
+//
+// Today, as days since 1 Jan 2000 (local time).
+//
+static long today(void)
+{
+  return nowMinute() / (24 * 60);
+}
+
+static int tagBit(char tag)
+{
+  const char *p;
+
+  if( tag == '\0' || (p = strchr( tagChars, tag )) == NULL )
+    return sizeof(tagChars) - 2;        // '?'
+  return p - tagChars;
+}
+
+static uint32_t numberHash(uint64_t number)
+{
+  return (number * 0x9e3779b97f4a7c15ull) >> 32;   // Fibonacci hashing
+}
+
+//
+// Get the number and the minute of a callerID.dat record. Returns
+// -1 if it has no number or no valid DATE and TIME.
+//
+static int parseRecord(const char *record, uint64_t *number, long *minute)
+{
+  const char *date, *time, *nmbr;
+  int i, mm, dd, yy, hh, mi;
+
+  if( (date = strstr( record, "DATE = " )) == NULL ||
+      (time = strstr( record, "TIME = " )) == NULL ||
+      (nmbr = strstr( record, "NMBR = " )) == NULL )
+  {
+    return -1;
+  }
+  date += 7;
+  time += 7;
+  for( i = 0; i < 6; i++ )
+  {
+    if( !isdigit( (unsigned char)date[i] ) ||
+        ( i < 4 && !isdigit( (unsigned char)time[i] ) ) )
+      return -1;
+  }
+  mm = (date[0] - '0') * 10 + date[1] - '0';
+  dd = (date[2] - '0') * 10 + date[3] - '0';
+  yy = (date[4] - '0') * 10 + date[5] - '0';
+  hh = (time[0] - '0') * 10 + time[1] - '0';
+  mi = (time[2] - '0') * 10 + time[3] - '0';
+  if( mm < 1 || mm > 12 || dd < 1 || dd > 31 || hh > 23 || mi > 59 )
+    return -1;
+  *minute = (daysFromCivil( 2000 + yy, mm, dd ) * 24 + hh) * 60 + mi;
+
+  *number = cidNumber( nmbr + 7, -1 );
+  return *number == CID_NONE ? -1 : 0;
+}
+
+//
+// The slot of 'number' in 'tab' (its slot, or the empty slot where
+// it would go).
+//
+static uint32_t findSlot(statsSlot *tab, uint32_t size, uint64_t number)
+{
+  uint32_t i = numberHash( number ) & (size - 1);
+
+  while( tab[i].number != CID_NONE && tab[i].number != number )
+  {
+    i = (i + 1) & (size - 1);
+  }
+  return i;
+}
+
+//
+// Double the size of the table.
+//
+static int growTable(void)
+{
+  statsSlot *newTable;
+  uint32_t i, newSize = numSlots * 2;
+
+  if( (newTable = calloc( newSize, sizeof(statsSlot) )) == NULL )
+  {
+    perror( "callstats: calloc" );
+    return -1;
+  }
+  for( i = 0; i < numSlots; i++ )
+  {
+    if( table[i].number != CID_NONE )
+      newTable[findSlot( newTable, newSize, table[i].number )] = table[i];
+  }
+  free( table );
+  table = newTable;
+  numSlots = newSize;
+  needCheckpoint = TRUE;                // the file's layout changed
+  return 0;
+}
+
+//
+// The calls in the STATS_WINDOW_DAYS days up to 'day'.
+//
+static uint32_t windowOf(const statsSlot *s, long day)
+{
+  long d, from = day - STATS_WINDOW_DAYS + 1;
+  uint32_t n = 0;
+
+  // Only the last STATS_WINDOW_DAYS days before lastDay are kept
+  if( from < (long)s->lastDay - STATS_WINDOW_DAYS + 1 )
+    from = (long)s->lastDay - STATS_WINDOW_DAYS + 1;
+  if( from < 0 )
+    from = 0;
+  for( d = from; d <= day && d <= (long)s->lastDay; d++ )
+  {
+    n += s->dayCalls[d % STATS_WINDOW_DAYS];
+  }
+  return n;
+}
+
+//
+// Count a call. Returns the number's slot, or -1.
+//
+static long addCall(uint64_t number, long minute, char tag)
+{
+  statsSlot *s;
+  uint32_t i, d, day = minute / (24 * 60);
+
+  if( (numUsed + 1) * 2 > numSlots && growTable() == -1 )
+    return -1;
+  i = findSlot( table, numSlots, number );
+  s = &table[i];
+  if( s->number == CID_NONE )
+  {
+    s->number = number;
+    s->firstSeen = s->lastSeen = minute;
+    s->lastDay = day;
+    numUsed++;
+  }
+  if( minute < s->firstSeen )
+    s->firstSeen = minute;
+  if( minute > s->lastSeen )
+    s->lastSeen = minute;
+  s->recent[s->totalCalls % STATS_RECENT] = minute;
+  s->totalCalls++;
+  s->tagMask |= 1u << tagBit( tag );
+
+  // Move the window forward (clearing the days it passes), then
+  // count the call if its day is still in the window.
+  if( day > s->lastDay )
+  {
+    for( d = s->lastDay + 1; d <= day && d <= s->lastDay + STATS_WINDOW_DAYS; d++ )
+    {
+      s->dayCalls[d % STATS_WINDOW_DAYS] = 0;
+    }
+    s->lastDay = day;
+  }
+  if( day + STATS_WINDOW_DAYS > s->lastDay &&
+      s->dayCalls[day % STATS_WINDOW_DAYS] < 0xffff )
+  {
+    s->dayCalls[day % STATS_WINDOW_DAYS]++;
+  }
+  return i;
+}
+
+static void toStats(const statsSlot *s, long day, callStats *stats)
+{
+  int i, n = 0;
+
+  stats->windowCalls = windowOf( s, day );
+  stats->totalCalls = s->totalCalls;
+  stats->firstSeen = s->firstSeen;
+  stats->lastSeen = s->lastSeen;
+  for( i = 0; tagChars[i] != '\0'; i++ )
+  {
+    if( s->tagMask & (1u << i) )
+      stats->tags[n++] = tagChars[i];
+  }
+  stats->tags[n] = '\0';
+}
+
+//
+// Lock STATS_LOCK, so only one program keeps (or replaces) the
+// counters.
+//
+static int lockStats(void)
+{
+  if( (lockFd = open( STATS_LOCK, O_RDWR | O_CREAT, 0644 )) == -1 )
+  {
+    perror( STATS_LOCK );
+    return -1;
+  }
+  if( flock( lockFd, LOCK_EX | LOCK_NB ) == -1 )
+  {
+    if( errno == EWOULDBLOCK )
+      printf( "%s is in use by another program\n", STATS_FILE );
+    else
+      perror( STATS_LOCK );
+    close( lockFd );
+    lockFd = -1;
+    return -1;
+  }
+  return 0;
+}
+
+//
+// Read callstats.dat into the table (an empty table if there is
+// none, or if 'empty' is TRUE).
+//
+static int loadTable(bool empty)
+{
+  statsHeader header;
+  statsSlot headerSlot;
+  size_t size;
+  int fd = -1;
+
+  free( table );
+  table = NULL;
+  numSlots = STATS_MIN_SLOTS;
+  numUsed = 0;
+  if( !empty && (fd = open( STATS_FILE, O_RDONLY )) >= 0 )
+  {
+    if( read( fd, &headerSlot, sizeof(headerSlot) ) == sizeof(headerSlot) )
+    {
+      memcpy( &header, &headerSlot, sizeof(header) );
+      if( memcmp( header.magic, STATS_MAGIC, 8 ) == 0 &&
+          header.numSlots >= STATS_MIN_SLOTS &&
+          (header.numSlots & (header.numSlots - 1)) == 0 )
+      {
+        numSlots = header.numSlots;
+        numUsed = header.numUsed;
+      }
+      else
+      {
+        printf( "callstats: %s is not valid, starting again\n", STATS_FILE );
+      }
+    }
+  }
+  if( (table = calloc( numSlots, sizeof(statsSlot) )) == NULL )
+  {
+    perror( "callstats: calloc" );
+    if( fd >= 0 )
+      close( fd );
+    return -1;
+  }
+  if( fd >= 0 && numUsed > 0 )
+  {
+    size = (size_t)numSlots * sizeof(statsSlot);
+    if( read( fd, table, size ) != (ssize_t)size )
+    {
+      printf( "callstats: %s is short, starting again\n", STATS_FILE );
+      memset( table, 0, size );
+      numUsed = 0;
+    }
+  }
+  if( fd >= 0 )
+    close( fd );
+  return 0;
+}
+
+//
+// Write the whole table as a new callstats.dat.
+//
+static int checkpoint(void)
+{
+  statsSlot headerSlot;
+  statsHeader header;
+  FILE *fp;
+
+  memset( &headerSlot, 0, sizeof(headerSlot) );
+  memcpy( header.magic, STATS_MAGIC, 8 );
+  header.numSlots = numSlots;
+  header.numUsed = numUsed;
+  memcpy( &headerSlot, &header, sizeof(header) );
+
+  if( (fp = fopen( STATS_TEMP, "w" )) == NULL )
+  {
+    perror( STATS_TEMP );
+    return -1;
+  }
+  if( fwrite( &headerSlot, sizeof(headerSlot), 1, fp ) != 1 ||
+      fwrite( table, sizeof(statsSlot), numSlots, fp ) != numSlots )
+  {
+    perror( STATS_TEMP );
+    fclose( fp );
+    remove( STATS_TEMP );
+    return -1;
+  }
+  if( safeCommit( fp, STATS_TEMP, STATS_FILE ) == -1 )
+    return -1;
+  safeSyncDir( STATS_FILE );
+
+  // Slot writes go to the new file
+  if( statsFd >= 0 )
+    close( statsFd );
+  if( (statsFd = open( STATS_FILE, O_RDWR )) == -1 )
+    perror( STATS_FILE );
+  sinceCheckpoint = 0;
+  needCheckpoint = FALSE;
+  return 0;
+}
+
+//
+// Write one slot (and the header) to callstats.dat.
+//
+static void writeSlot(uint32_t i)
+{
+  statsHeader header;
+
+  if( statsFd < 0 )
+    return;
+  memcpy( header.magic, STATS_MAGIC, 8 );
+  header.numSlots = numSlots;
+  header.numUsed = numUsed;
+  if( pwrite( statsFd, &table[i], sizeof(statsSlot),
+        (off_t)(i + 1) * sizeof(statsSlot) ) != sizeof(statsSlot) ||
+      pwrite( statsFd, &header, sizeof(header), 0 ) != sizeof(header) )
+  {
+    perror( "callstats: pwrite" );
+  }
+}
+
+//
+// Load the counters (from callstats.dat) for the main program.
+//
+int callstatsOpen(void)
+{
+  int retVal = 0;
+
+  pthread_mutex_lock( &statsMutex );
+  if( lockStats() == -1 || loadTable( FALSE ) == -1 )
+    retVal = -1;
+  else if( (statsFd = open( STATS_FILE, O_RDWR )) == -1 )
+    retVal = checkpoint();              // a new file
+  pthread_mutex_unlock( &statsMutex );
+  return retVal;
+}
+
+//
+// Count a callerID.dat record (called by the call log writer).
+// Records without a number or a valid DATE and TIME are skipped.
+//
+int callstatsAppend(const char *record)
+{
+  uint64_t number;
+  long minute, i;
+
+  if( parseRecord( record, &number, &minute ) == -1 )
+    return -1;
+
+  pthread_mutex_lock( &statsMutex );
+  if( table == NULL || (i = addCall( number, minute, record[0] )) == -1 )
+  {
+    pthread_mutex_unlock( &statsMutex );
+    return -1;
+  }
+  if( needCheckpoint || ++sinceCheckpoint >= STATS_CHECKPOINT_CALLS )
+    checkpoint();
+  else
+    writeSlot( i );
+  pthread_mutex_unlock( &statsMutex );
+  return 0;
+}
+
+//
+// Get the counters for 'number' (which may end at "--", as in a
+// caller ID string). Numbers written in different ways ("1-800-
+// 555-1234", "8005551234") are the same number. A number that has
+// not called gets zeros. Returns -1 if the counters are not loaded.
+//
+int callstatsLookup(const char *number, callStats *stats)
+{
+  uint64_t key = cidNumber( number, -1 );
+  uint32_t i;
+
+  memset( stats, 0, sizeof(callStats) );
+  pthread_mutex_lock( &statsMutex );
+  if( table == NULL )
+  {
+    pthread_mutex_unlock( &statsMutex );
+    return -1;
+  }
+  i = findSlot( table, numSlots, key );
+  if( key != CID_NONE && table[i].number != CID_NONE )
+    toStats( &table[i], today(), stats );
+  pthread_mutex_unlock( &statsMutex );
+  return 0;
+}
+
+//
+// The calls from 'number' in the last 'minutes' minutes. At most
+// STATS_RECENT calls are counted (only their times are kept).
+// Returns -1 if the counters are not loaded.
+//
+int callstatsCallsWithin(const char *number, long minutes)
+{
+  uint64_t key = cidNumber( number, -1 );
+  statsSlot *s;
+  long from = nowMinute() - minutes;
+  int k, n, calls = 0;
+
+  pthread_mutex_lock( &statsMutex );
+  if( table == NULL )
+  {
+    pthread_mutex_unlock( &statsMutex );
+    return -1;
+  }
+  s = &table[findSlot( table, numSlots, key )];
+  if( key != CID_NONE && s->number != CID_NONE )
+  {
+    n = s->totalCalls < STATS_RECENT ? s->totalCalls : STATS_RECENT;
+    for( k = 0; k < n; k++ )
+    {
+      if( (long)s->recent[k] > from )
+        calls++;
+    }
+  }
+  pthread_mutex_unlock( &statsMutex );
+  return calls;
+}
+
+void callstatsClose(void)
+{
+  pthread_mutex_lock( &statsMutex );
+  if( table != NULL && ( sinceCheckpoint > 0 || needCheckpoint ) )
+    checkpoint();
+  if( statsFd >= 0 )
+    close( statsFd );
+  if( lockFd >= 0 )
+    close( lockFd );
+  statsFd = lockFd = -1;
+  free( table );
+  table = NULL;
+  pthread_mutex_unlock( &statsMutex );
+}
+
+//
+// Query functions ("jcblock stats").
+//
+
+//
+// Find 'number' in callstats.dat without loading the table. Returns
+// 1 if found, 0 if not, -1 on an error.
+//
+static int lookupFile(int fd, uint64_t number, statsSlot *slot)
+{
+  statsHeader header;
+  uint32_t i, n;
+
+  if( pread( fd, &header, sizeof(header), 0 ) != sizeof(header) ||
+      memcmp( header.magic, STATS_MAGIC, 8 ) != 0 ||
+      header.numSlots < STATS_MIN_SLOTS ||
+      (header.numSlots & (header.numSlots - 1)) != 0 )
+  {
+    printf( "%s is not valid (use \"jcblock stats -i\")\n", STATS_FILE );
+    return -1;
+  }
+  i = numberHash( number ) & (header.numSlots - 1);
+  for( n = 0; n < header.numSlots; n++ )
+  {
+    if( pread( fd, slot, sizeof(statsSlot),
+          (off_t)(i + 1) * sizeof(statsSlot) ) != sizeof(statsSlot) )
+    {
+      printf( "%s is short (use \"jcblock stats -i\")\n", STATS_FILE );
+      return -1;
+    }
+    if( slot->number == CID_NONE )
+      return 0;
+    if( slot->number == number )
+      return 1;
+    i = (i + 1) & (header.numSlots - 1);
+  }
+  return 0;
+}
+
+static void formatMinute(uint32_t minute, char *buf)
+{
+  int y, m, d;
+
+  civilFromDays( minute / (24 * 60), &y, &m, &d );
+  sprintf( buf, "%02d%02d%02d %02d%02d", m, d, y % 100,
+    (int)(minute / 60 % 24), (int)(minute % 60) );
+}
+
+static void printStats(uint64_t number, const callStats *stats)
+{
+  char first[16], last[16], text[CID_TEXT_LEN];
+
+  cidFormat( number, text );
+  if( stats->totalCalls == 0 )
+  {
+    printf( "%s: no calls\n", text );
+    return;
+  }
+  formatMinute( stats->firstSeen, first );
+  formatMinute( stats->lastSeen, last );
+  printf( "%s: %u calls in %d days, %u in all, first %s, last %s, tags %s\n",
+    text, stats->windowCalls, STATS_WINDOW_DAYS, stats->totalCalls,
+    first, last, stats->tags );
+}
+
+static long sortDay;
+
+static int compareWindow(const void *a, const void *b)
+{
+  const statsSlot *sa = &table[*(const uint32_t *)a];
+  const statsSlot *sb = &table[*(const uint32_t *)b];
+  uint32_t wa = windowOf( sa, sortDay ), wb = windowOf( sb, sortDay );
+
+  if( wa != wb )
+    return wa < wb ? 1 : -1;
+  if( sa->totalCalls != sb->totalCalls )
+    return sa->totalCalls < sb->totalCalls ? 1 : -1;
+  return sa->number < sb->number ? -1 : sa->number > sb->number;
+}
+
+//
+// Print the 'count' numbers with the most calls in the window.
+//
+static int topNumbers(int count)
+{
+  callStats stats;
+  uint32_t *order, i, n = 0;
+
+  if( loadTable( FALSE ) == -1 )
+    return -1;
+  if( (order = malloc( (numUsed + 1) * sizeof(uint32_t) )) == NULL )
+  {
+    perror( "callstats: malloc" );
+    return -1;
+  }
+  for( i = 0; i < numSlots && n < numUsed; i++ )
+  {
+    if( table[i].number != CID_NONE )
+      order[n++] = i;
+  }
+  sortDay = today();
+  qsort( order, n, sizeof(uint32_t), compareWindow );
+  for( i = 0; i < n && i < (uint32_t)count; i++ )
+  {
+    toStats( &table[order[i]], sortDay, &stats );
+    printStats( table[order[i]].number, &stats );
+  }
+  free( order );
+  return 0;
+}
+
+//
+// Count the calls in callerID.dat segments (all of them if no files
+// are given) in a new callstats.dat. Not while the program is
+// running (it holds the lock). The new file replaces the old one
+// only once it has been written (see checkpoint()).
+//
+static int importFiles(int numFiles, char **files)
+{
+  char line[256];
+  uint64_t number;
+  long added = 0, skipped = 0, minute;
+  glob_t globBuf;
+  FILE *fp;
+  int i;
+
+  if( lockStats() == -1 )
+  {
+    printf( "Stop jcblock, then run this again.\n" );
+    return -1;
+  }
+  memset( &globBuf, 0, sizeof(globBuf) );
+  if( numFiles == 0 )
+  {
+    if( glob( "./callerID.dat.[0-9][0-9][0-9][0-9]", 0, NULL, &globBuf ) != 0 )
+    {
+      printf( "No callerID.dat segments found\n" );
+      return -1;
+    }
+    numFiles = globBuf.gl_pathc;
+    files = globBuf.gl_pathv;
+  }
+
+  if( loadTable( TRUE ) == -1 )
+  {
+    globfree( &globBuf );
+    return -1;
+  }
+  for( i = 0; i < numFiles; i++ )
+  {
+    if( (fp = fopen( files[i], "r" )) == NULL )
+    {
+      perror( files[i] );
+      continue;
+    }
+    while( fgets( line, sizeof(line), fp ) != NULL )
+    {
+      if( line[0] == '#' || line[0] == '\n' )
+        continue;
+      if( parseRecord( line, &number, &minute ) == 0 &&
+          addCall( number, minute, line[0] ) >= 0 )
+        added++;
+      else
+        skipped++;
+    }
+    fclose( fp );
+  }
+  globfree( &globBuf );
+  if( checkpoint() == -1 )
+    return -1;
+  printf( "%ld calls from %u numbers counted (%ld lines skipped)\n",
+    added, numUsed, skipped );
+  return 0;
+}
+
+static void statsUsage(void)
+{
+  fprintf( stderr,
+    "Usage: jcblock stats number ...\n"
+    "       jcblock stats -t count\n"
+    "       jcblock stats -i [file ...]\n"
+    "  number  the calls from this number (in the last %d days, in all,\n"
+    "          the first and last call and the tags they were given)\n"
+    "  -t  the numbers with the most calls in the last %d days\n"
+    "  -i  (re)build the counters from the callerID.dat segments\n",
+    STATS_WINDOW_DAYS, STATS_WINDOW_DAYS );
+}
+
+//
+// "jcblock stats ..." (argv[0] is "stats").
+//
+int callstatsQuery(int argc, char **argv)
+{
+  uint64_t number;
+  statsSlot slot;
+  callStats stats;
+  bool import = FALSE;
+  int optChar, top = 0, fd, found, retVal = 0;
+  long day;
+
+  optind = 1;
+  while( ( optChar = getopt( argc, argv, "t:ih" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 't':
+        top = atoi( optarg );
+        break;
+
+      case 'i':
+        import = TRUE;
+        break;
+
+      case 'h':
+      default:
+        statsUsage();
+        return -1;
+    }
+  }
+
+  if( import )
+    retVal = importFiles( argc - optind, argv + optind );
+  else if( top > 0 )
+    retVal = topNumbers( top );
+  else if( optind == argc )
+  {
+    statsUsage();
+    return -1;
+  }
+  else
+  {
+    if( (fd = open( STATS_FILE, O_RDONLY )) == -1 )
+    {
+      perror( STATS_FILE );
+      return -1;
+    }
+    day = today();
+    for( ; optind < argc; optind++ )
+    {
+      if( (number = cidNumber( argv[optind], -1 )) == CID_NONE )
+      {
+        printf( "%s: not a number\n", argv[optind] );
+        continue;
+      }
+      if( (found = lookupFile( fd, number, &slot )) == -1 )
+      {
+        retVal = -1;
+        break;
+      }
+      memset( &stats, 0, sizeof(stats) );
+      if( found )
+        toStats( &slot, day, &stats );
+      printStats( number, &stats );
+    }
+    close( fd );
+  }
+  free( table );
+  table = NULL;
+  return retVal;
+}
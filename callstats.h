@@ -0,0 +1,49 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: callstats.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the per-number call counters in callstats.c.
+ */
+#ifndef CALLSTATS_H
+#define CALLSTATS_H
+
+#include <stdint.h>
+
+#define STATS_WINDOW_DAYS 7     // the sliding window (days)
+#define STATS_RECENT      16    // call times kept (callstatsCallsWithin())
+
+// The counters for one number
+typedef struct
+{
+  uint32_t windowCalls;         // calls in the last STATS_WINDOW_DAYS days
+  uint32_t totalCalls;          // all calls counted
+  uint32_t firstSeen;           // minutes since 1 Jan 2000 (local time)
+  uint32_t lastSeen;
+  char tags[32];                // the callerID.dat tags seen (e.g. "-B*")
+} callStats;
+
+int callstatsOpen(void);
+int callstatsAppend(const char *record);
+int callstatsLookup(const char *number, callStats *stats);
+int callstatsCallsWithin(const char *number, long minutes);
+void callstatsClose(void);
+int callstatsQuery(int argc, char **argv);
+
+#endif
@@ -0,0 +1,950 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: callstore.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to keep a binary history of calls beside callerID.dat
+ *	and to answer questions about it ("jcblock query").
+ *
+ *	callerID.dat is a text file, so every question about past calls
+ *	(who called this month, how often did this number call) means
+ *	reading and parsing all of it. The call store keeps the same
+ *	calls in files that can be searched:
+ *
+ *	 callstore.dat  one fixed size record (a callRecord, 24 bytes)
+ *	                per call, in the order the calls arrived. The
+ *	                date and time are packed into a minute count, the
+ *	                number into 64 bits by cidNumber() (callerid.c)
+ *	                and the name is replaced by its line number in
+ *	                callstore.nam. The first record is a header.
+ *	 callstore.nam  each different NAME, once, one per line.
+ *	 callstore.idx  the minute of every CS_BLOCK'th call (a sparse
+ *	                time index). A binary search of it finds the
+ *	                block where a time range starts.
+ *	 callstore.nix  (number, call) pairs: a header, the pairs sorted
+ *	                by number and then an unsorted tail, the pairs of
+ *	                the calls added since it was sorted. A binary
+ *	                search of the sorted part and a scan of the tail
+ *	                find all of the calls from one number.
+ *
+ *	The files are only ever appended to, by the call log writer
+ *	thread (see calllog.c). The one exception is callstore.nix,
+ *	which the writer sorts again (into a new file that replaces it)
+ *	when it starts and when the tail reaches NUMBER_TAIL_MAX pairs.
+ *	The program locks callstore.dat (flock()) while it runs, and
+ *	"jcblock query -i", which replaces the files, will not run
+ *	without that lock. Queries never write: they read the files
+ *	with pread(), so a query never has to read more than the records
+ *	it prints plus a few dozen others (and the tail).
+ *
+ *	The time index assumes calls are stored in time order, which
+ *	they are unless the caller ID clock is changed. Use "jcblock
+ *	query -i" to build the store from the callerID.dat segments.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <glob.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+
+#include "common.h"
+#include "callstore.h"
+#include "callerid.h"
+
+#define STORE_FILE	"./callstore.dat"
+#define NAME_FILE	"./callstore.nam"
+#define INDEX_FILE	"./callstore.idx"
+#define NUMBER_FILE	"./callstore.nix"
+#define NEW_SUFFIX	".new"		// the files "query -i" builds
+
+#define STORE_MAGIC	"JCBSTOR2"
+#define NUMBER_MAGIC	0x4a434e32	// "JCN2"
+#define CS_BLOCK	64		// calls per time index entry
+#define NAME_MAX_LEN	80
+#define NUMBER_TAIL_MAX	4096		// unsorted callstore.nix pairs
+
+// One callstore.nix entry (16 bytes). Sorted by number and then
+// recNum.
+typedef struct
+{
+  uint64_t number;
+  uint32_t recNum;
+  uint32_t pad;
+} numberEntry;
+
+// callstore.nix starts with NUMBER_MAGIC and the number of sorted
+// entries
+#define NUMBER_HEADER_LEN (2 * sizeof(uint32_t))
+
+static char storePath[32], namePath[32], indexPath[32], numberPath[32];
+static int storeFd = -1;
+static int indexFd = -1;
+static int numberFd = -1;               // callstore.nix (writer only)
+static FILE *fpNames;
+static bool storeWriter;
+static bool importing;                  // "query -i": sort .nix at the end
+static uint32_t numRecords;             // calls in callstore.dat
+static uint32_t numberSorted, numberCount;  // callstore.nix entries
+
+// The names, each once; name 'id' is line 'id' of callstore.nam
+static cidNames names;
+
+//
+// Days from 1 Jan 2000 to year/month/day (proleptic Gregorian).
+//
+static long daysFromCivil(int y, int m, int d)
+{
+  long era, yoe, doy, doe;
+
+  y -= m <= 2;
+  era = (y >= 0 ? y : y - 399) / 400;
+  yoe = y - era * 400;
+  doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+  doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+  return era * 146097 + doe - 730425;   // 730425: 1 Jan 2000
+}
+
+//
+// The inverse of daysFromCivil().
+//
+static void civilFromDays(long z, int *y, int *m, int *d)
+{
+  long era, doe, yoe, doy, mp;
+
+  z += 730425;
+  era = (z >= 0 ? z : z - 146096) / 146097;
+  doe = z - era * 146097;
+  yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  mp = (5 * doy + 2) / 153;
+  *d = doy - (153 * mp + 2) / 5 + 1;
+  *m = mp < 10 ? mp + 3 : mp - 9;
+  *y = yoe + era * 400 + (*m <= 2);
+}
+
+//
+// Convert "MMDDYY" (and optionally "HHMM") digits to a minute count.
+// Returns -1 if they are not valid.
+//
+static long minuteOf(const char *date, const char *time)
+{
+  int i, mm, dd, yy, hh = 0, mi = 0;
+
+  for( i = 0; i < 6; i++ )
+  {
+    if( !isdigit( (unsigned char)date[i] ) )
+      return -1;
+  }
+  mm = (date[0] - '0') * 10 + date[1] - '0';
+  dd = (date[2] - '0') * 10 + date[3] - '0';
+  yy = (date[4] - '0') * 10 + date[5] - '0';
+  if( time != NULL )
+  {
+    for( i = 0; i < 4; i++ )
+    {
+      if( !isdigit( (unsigned char)time[i] ) )
+        return -1;
+    }
+    hh = (time[0] - '0') * 10 + time[1] - '0';
+    mi = (time[2] - '0') * 10 + time[3] - '0';
+  }
+  if( mm < 1 || mm > 12 || dd < 1 || dd > 31 || hh > 23 || mi > 59 )
+    return -1;
+  return (daysFromCivil( 2000 + yy, mm, dd ) * 24 + hh) * 60 + mi;
+}
+
+//
+// Parse a callerID.dat record into 'rec' and 'name'. Returns -1 if
+// the record has no valid DATE and TIME.
+//
+static int parseRecord(const char *record, callRecord *rec, char *name)
+{
+  const char *date, *time, *nmbr, *nm;
+  long minute;
+  int n;
+
+  memset( rec, 0, sizeof(callRecord) );
+  name[0] = '\0';
+  if( (date = strstr( record, "DATE = " )) == NULL ||
+      (time = strstr( record, "TIME = " )) == NULL )
+  {
+    return -1;
+  }
+  if( (minute = minuteOf( date + 7, time + 7 )) < 0 )
+  {
+    return -1;
+  }
+  rec->minute = minute;
+  rec->tag = record[0];
+
+  if( (nmbr = strstr( record, "NMBR = " )) != NULL )
+  {
+    rec->number = cidNumber( nmbr + 7, -1 );
+  }
+  if( (nm = strstr( record, "NAME = " )) != NULL )
+  {
+    nm += 7;
+    for( n = 0; n < NAME_MAX_LEN - 1 && nm[n] != '\0' && nm[n] != '\n' &&
+           nm[n] != '\r' && !(nm[n] == '-' && nm[n + 1] == '-'); n++ )
+    {
+      name[n] = nm[n];
+    }
+    name[n] = '\0';
+  }
+  return 0;
+}
+
+//
+// Return the id of 'name', adding it to the table (and to file
+// callstore.nam) if it is new. The empty name is id 0.
+//
+static uint32_t internName(const char *name)
+{
+  uint32_t id;
+  long newId;
+
+  if( name[0] == '\0' )
+    return 0;
+  if( (id = cidNameFind( &names, name )) != 0 )
+    return id;
+
+  if( (newId = cidNameAdd( &names, name )) < 0 )
+    return 0;
+  if( fpNames != NULL )
+  {
+    fprintf( fpNames, "%s\n", name );
+    fflush( fpNames );
+  }
+  return newId;
+}
+
+static int loadNames(void)
+{
+  char line[NAME_MAX_LEN + 2];
+
+  if( (fpNames = fopen( namePath, storeWriter ? "a+" : "r" )) == NULL )
+  {
+    if( !storeWriter && errno == ENOENT )
+      return 0;
+    perror( namePath );
+    return -1;
+  }
+  rewind( fpNames );
+  while( fgets( line, sizeof(line), fpNames ) != NULL )
+  {
+    line[strcspn( line, "\n" )] = '\0';
+    if( cidNameAdd( &names, line ) < 0 )
+      return -1;
+  }
+  if( !storeWriter )
+  {
+    fclose( fpNames );
+    fpNames = NULL;
+  }
+  return 0;
+}
+
+static int readRecord(uint32_t recNum, callRecord *rec)
+{
+  if( pread( storeFd, rec, sizeof(callRecord),
+         (off_t)(recNum + 1) * sizeof(callRecord) ) != sizeof(callRecord) )
+  {
+    return -1;
+  }
+  return 0;
+}
+
+//
+// Make callstore.idx match callstore.dat (it is behind if the
+// program stopped between the two writes).
+//
+static int checkIndex(void)
+{
+  struct stat statBuf;
+  uint32_t k, want, have;
+  callRecord rec;
+
+  if( fstat( indexFd, &statBuf ) == -1 )
+    return -1;
+  have = statBuf.st_size / sizeof(uint32_t);
+  want = (numRecords + CS_BLOCK - 1) / CS_BLOCK;
+  if( have > want && ftruncate( indexFd, want * sizeof(uint32_t) ) == -1 )
+    return -1;
+  for( k = have; k < want; k++ )
+  {
+    if( readRecord( k * CS_BLOCK, &rec ) == -1 ||
+        write( indexFd, &rec.minute, sizeof(uint32_t) ) != sizeof(uint32_t) )
+    {
+      perror( "callstore: index" );
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int compareEntries(const void *a, const void *b)
+{
+  const numberEntry *ea = a, *eb = b;
+
+  if( ea->number != eb->number )
+    return ea->number < eb->number ? -1 : 1;
+  return ea->recNum < eb->recNum ? -1 : ea->recNum > eb->recNum;
+}
+
+//
+// Sort callstore.nix again: sort its tail, and the entries of any
+// calls it is missing (the program stopped between the two writes),
+// and merge them with the sorted part. Only the writer does this
+// (it holds the lock), so the new file can have a fixed name.
+//
+static int sortNumberIndex(void)
+{
+  uint32_t header[2], sorted = 0, count = 0, i, j, k;
+  numberEntry *entries, *merged;
+  struct stat statBuf;
+  callRecord rec;
+  char tempPath[40];
+  bool valid = FALSE;
+  FILE *fp;
+
+  if( fstat( numberFd, &statBuf ) == 0 &&
+      pread( numberFd, header, sizeof(header), 0 ) == sizeof(header) &&
+      header[0] == NUMBER_MAGIC &&
+      (statBuf.st_size - NUMBER_HEADER_LEN) % sizeof(numberEntry) == 0 )
+  {
+    count = (statBuf.st_size - NUMBER_HEADER_LEN) / sizeof(numberEntry);
+    sorted = header[1];
+    valid = sorted <= count && count <= numRecords;
+  }
+  if( !valid )
+    sorted = count = 0;                 // new or damaged: make it again
+  else if( sorted == numRecords )
+  {
+    numberSorted = numberCount = sorted;
+    return 0;
+  }
+
+  entries = malloc( (numRecords + 1) * sizeof(numberEntry) );
+  merged = malloc( (numRecords + 1) * sizeof(numberEntry) );
+  if( entries == NULL || merged == NULL )
+  {
+    perror( "callstore: malloc" );
+    free( entries );
+    free( merged );
+    return -1;
+  }
+  if( count > 0 &&
+      pread( numberFd, entries, count * sizeof(numberEntry),
+             NUMBER_HEADER_LEN ) != (ssize_t)(count * sizeof(numberEntry)) )
+  {
+    sorted = count = 0;
+  }
+  for( i = count; i < numRecords; i++ )
+  {
+    if( readRecord( i, &rec ) == -1 )
+    {
+      perror( "callstore: read" );
+      free( entries );
+      free( merged );
+      return -1;
+    }
+    memset( &entries[i], 0, sizeof(numberEntry) );
+    entries[i].number = rec.number;
+    entries[i].recNum = i;
+  }
+  qsort( entries + sorted, numRecords - sorted, sizeof(numberEntry),
+         compareEntries );
+
+  for( i = k = 0, j = sorted; i < sorted || j < numRecords; k++ )
+  {
+    if( j == numRecords ||
+        ( i < sorted && compareEntries( &entries[i], &entries[j] ) <= 0 ) )
+      merged[k] = entries[i++];
+    else
+      merged[k] = entries[j++];
+  }
+  free( entries );
+
+  // Replace the old file (a query that is reading it keeps its copy)
+  header[0] = NUMBER_MAGIC;
+  header[1] = k;
+  snprintf( tempPath, sizeof(tempPath), "%s.tmp", numberPath );
+  if( (fp = fopen( tempPath, "w" )) == NULL )
+  {
+    perror( tempPath );
+    free( merged );
+    return -1;
+  }
+  if( fwrite( header, sizeof(header), 1, fp ) != 1 ||
+      fwrite( merged, sizeof(numberEntry), k, fp ) != k )
+  {
+    perror( tempPath );
+    fclose( fp );
+    remove( tempPath );
+    free( merged );
+    return -1;
+  }
+  free( merged );
+  if( fclose( fp ) == EOF || rename( tempPath, numberPath ) == -1 )
+  {
+    perror( tempPath );
+    remove( tempPath );
+    return -1;
+  }
+
+  // Append to the new file from now on
+  close( numberFd );
+  if( (numberFd = open( numberPath, O_RDWR | O_APPEND )) == -1 )
+  {
+    perror( numberPath );
+    return -1;
+  }
+  numberSorted = numberCount = k;
+  return 0;
+}
+
+//
+// Open (or create) the store. 'writer' is TRUE for the program that
+// appends calls and FALSE for queries. The file names end with
+// 'suffix' ("" for the store in use). A writer locks callstore.dat,
+// so only one program appends to it.
+//
+static int openStore(bool writer, const char *suffix)
+{
+  callRecord header;
+  struct stat statBuf;
+  int flags;
+
+  snprintf( storePath, sizeof(storePath), "%s%s", STORE_FILE, suffix );
+  snprintf( namePath, sizeof(namePath), "%s%s", NAME_FILE, suffix );
+  snprintf( indexPath, sizeof(indexPath), "%s%s", INDEX_FILE, suffix );
+  snprintf( numberPath, sizeof(numberPath), "%s%s", NUMBER_FILE, suffix );
+  storeWriter = writer;
+  flags = writer ? O_RDWR | O_APPEND | O_CREAT : O_RDONLY;
+  if( (storeFd = open( storePath, flags, 0644 )) == -1 )
+  {
+    perror( storePath );
+    return -1;
+  }
+  if( writer && flock( storeFd, LOCK_EX | LOCK_NB ) == -1 )
+  {
+    if( errno == EWOULDBLOCK )
+      printf( "%s is in use by another program\n", storePath );
+    else
+      perror( storePath );
+    return -1;
+  }
+  if( fstat( storeFd, &statBuf ) == -1 )
+  {
+    perror( storePath );
+    return -1;
+  }
+
+  if( statBuf.st_size == 0 && writer )
+  {
+    memset( &header, 0, sizeof(header) );
+    memcpy( &header, STORE_MAGIC, 8 );
+    if( write( storeFd, &header, sizeof(header) ) != sizeof(header) )
+    {
+      perror( storePath );
+      return -1;
+    }
+    statBuf.st_size = sizeof(header);
+  }
+  if( pread( storeFd, &header, sizeof(header), 0 ) != sizeof(header) ||
+      memcmp( &header, STORE_MAGIC, 8 ) != 0 )
+  {
+    printf( "%s is not a call store (\"jcblock query -i\" makes it again)\n",
+      storePath );
+    return -1;
+  }
+  numRecords = statBuf.st_size / sizeof(callRecord) - 1;
+
+  // Drop a partly written last record
+  if( writer && statBuf.st_size % sizeof(callRecord) != 0 &&
+      ftruncate( storeFd, (off_t)(numRecords + 1) * sizeof(callRecord) ) == -1 )
+  {
+    perror( storePath );
+    return -1;
+  }
+
+  if( loadNames() == -1 )
+    return -1;
+
+  if( (indexFd = open( indexPath, flags, 0644 )) == -1 )
+  {
+    if( writer || errno != ENOENT )
+    {
+      perror( indexPath );
+      return -1;
+    }
+  }
+  else if( writer && checkIndex() == -1 )
+  {
+    return -1;
+  }
+
+  if( writer )
+  {
+    if( (numberFd = open( numberPath, O_RDWR | O_APPEND | O_CREAT,
+                          0644 )) == -1 )
+    {
+      perror( numberPath );
+      return -1;
+    }
+    if( sortNumberIndex() == -1 )
+      return -1;
+  }
+  return 0;
+}
+
+//
+// Open (or create) the call store for appending calls.
+//
+int callstoreOpen(void)
+{
+  return openStore( TRUE, "" );
+}
+
+//
+// Add a callerID.dat record to the store. Records without a valid
+// DATE and TIME are skipped.
+//
+int callstoreAppend(const char *record)
+{
+  numberEntry entry;
+  callRecord rec;
+  char name[NAME_MAX_LEN];
+
+  if( storeFd < 0 || parseRecord( record, &rec, name ) == -1 )
+    return -1;
+  rec.nameId = internName( name );
+  if( write( storeFd, &rec, sizeof(rec) ) != sizeof(rec) )
+  {
+    perror( "callstore: write" );
+    return -1;
+  }
+  if( numRecords % CS_BLOCK == 0 &&
+      write( indexFd, &rec.minute, sizeof(uint32_t) ) != sizeof(uint32_t) )
+  {
+    perror( "callstore: index" );
+  }
+  numRecords++;
+
+  // Add the call to the tail of callstore.nix
+  if( numberFd >= 0 )
+  {
+    memset( &entry, 0, sizeof(entry) );
+    entry.number = rec.number;
+    entry.recNum = numRecords - 1;
+    if( write( numberFd, &entry, sizeof(entry) ) != sizeof(entry) )
+    {
+      perror( "callstore: number index" );
+      close( numberFd );                // made again at the next start
+      numberFd = -1;
+    }
+    else if( ++numberCount - numberSorted >= NUMBER_TAIL_MAX && !importing )
+    {
+      sortNumberIndex();
+    }
+  }
+  return 0;
+}
+
+void callstoreClose(void)
+{
+  if( storeFd >= 0 )
+    close( storeFd );
+  if( indexFd >= 0 )
+    close( indexFd );
+  if( numberFd >= 0 )
+    close( numberFd );
+  if( fpNames != NULL )
+    fclose( fpNames );
+  storeFd = indexFd = numberFd = -1;
+  fpNames = NULL;
+  cidNamesFree( &names );
+  numRecords = 0;
+}
+
+/*
+ *	Queries.
+ */
+static void printRecord(callRecord *rec)
+{
+  char number[CID_TEXT_LEN];
+  int y, m, d;
+  long day;
+
+  day = rec->minute / (24 * 60);
+  civilFromDays( day, &y, &m, &d );
+  printf( "%c-DATE = %02d%02d%02d--TIME = %02d%02d--NMBR = %s--NAME = %s--\n",
+    rec->tag, m, d, y % 100,
+    (int)(rec->minute / 60 % 24), (int)(rec->minute % 60),
+    cidFormat( rec->number, number ), cidNameText( &names, rec->nameId ) );
+}
+
+//
+// List (or count) call 'recNum' if it is between 'from' and 'to'.
+// Returns 1 if it is, else 0.
+//
+static int showCall(uint32_t recNum, long from, long to, bool countOnly)
+{
+  callRecord rec;
+
+  if( recNum >= numRecords || readRecord( recNum, &rec ) == -1 ||
+      rec.minute < from || rec.minute > to )
+    return 0;
+  if( !countOnly )
+    printRecord( &rec );
+  return 1;
+}
+
+//
+// List (or count) the calls from 'number' between 'from' and 'to':
+// those in the sorted part of callstore.nix, then those in its tail
+// and then any calls it does not have yet.
+//
+static long queryNumber(uint64_t number, long from, long to, bool countOnly)
+{
+  numberEntry entries[CS_BLOCK];
+  uint32_t header[2], sorted = 0, count = 0, lo, hi, mid, i;
+  struct stat statBuf;
+  callRecord rec;
+  long matches = 0;
+  ssize_t n;
+  int fdN, k;
+
+  // No callstore.nix (or a damaged one) just means a longer search
+  if( (fdN = open( NUMBER_FILE, O_RDONLY )) != -1 &&
+      fstat( fdN, &statBuf ) == 0 &&
+      pread( fdN, header, sizeof(header), 0 ) == sizeof(header) &&
+      header[0] == NUMBER_MAGIC )
+  {
+    count = (statBuf.st_size - NUMBER_HEADER_LEN) / sizeof(numberEntry);
+    sorted = header[1] < count ? header[1] : count;
+  }
+
+  // Binary search for the first entry for the number
+  lo = 0;
+  hi = sorted;
+  while( lo < hi )
+  {
+    mid = lo + (hi - lo) / 2;
+    if( pread( fdN, entries, sizeof(numberEntry), NUMBER_HEADER_LEN +
+               (off_t)mid * sizeof(numberEntry) ) != sizeof(numberEntry) )
+      break;
+    if( entries[0].number < number )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  for( ; lo < sorted; lo++ )
+  {
+    if( pread( fdN, entries, sizeof(numberEntry), NUMBER_HEADER_LEN +
+               (off_t)lo * sizeof(numberEntry) ) != sizeof(numberEntry) ||
+        entries[0].number != number )
+      break;
+    matches += showCall( entries[0].recNum, from, to, countOnly );
+  }
+
+  // The tail, CS_BLOCK entries at a time
+  for( i = sorted; i < count; i += n )
+  {
+    n = pread( fdN, entries, sizeof(entries), NUMBER_HEADER_LEN +
+               (off_t)i * sizeof(numberEntry) ) / (ssize_t)sizeof(numberEntry);
+    if( n <= 0 )
+      break;
+    for( k = 0; k < n; k++ )
+    {
+      if( entries[k].number == number )
+        matches += showCall( entries[k].recNum, from, to, countOnly );
+    }
+  }
+  if( fdN != -1 )
+    close( fdN );
+
+  for( i = count; i < numRecords; i++ )
+  {
+    if( readRecord( i, &rec ) == 0 && rec.number == number )
+      matches += showCall( i, from, to, countOnly );
+  }
+  return matches;
+}
+
+//
+// List (or count) all calls between 'from' and 'to'.
+//
+static long queryTime(long from, long to, bool countOnly)
+{
+  callRecord recs[CS_BLOCK];
+  uint32_t lo, hi, mid, minute, first;
+  struct stat statBuf;
+  long matches = 0;
+  ssize_t n;
+  int i;
+
+  // Binary search of the time index for the first block that
+  // starts at or after 'from'; the range starts in the block before.
+  lo = 0;
+  hi = 0;
+  if( indexFd >= 0 && fstat( indexFd, &statBuf ) == 0 )
+    hi = statBuf.st_size / sizeof(uint32_t);
+  while( lo < hi )
+  {
+    mid = lo + (hi - lo) / 2;
+    pread( indexFd, &minute, sizeof(minute), (off_t)mid * sizeof(uint32_t) );
+    if( minute < from )
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  first = lo > 0 ? (lo - 1) * CS_BLOCK : 0;
+
+  while( first < numRecords )
+  {
+    n = pread( storeFd, recs, sizeof(recs),
+               (off_t)(first + 1) * sizeof(callRecord) ) / sizeof(callRecord);
+    if( n <= 0 )
+      break;
+    for( i = 0; i < n; i++ )
+    {
+      if( recs[i].minute > to )
+        return matches;
+      if( recs[i].minute < from )
+        continue;
+      matches++;
+      if( !countOnly )
+        printRecord( &recs[i] );
+    }
+    first += n;
+  }
+  return matches;
+}
+
+//
+// Build the store from the records in 'files' (by default, all of
+// the monthly callerID.dat segments, oldest first). Not while the
+// program is running (it holds the lock on callstore.dat and appends
+// to the store). The new store is built beside the old one and then
+// renamed into place, so the old one is kept if this fails.
+//
+static int importFiles(int numFiles, char **files)
+{
+  static const char *storeFiles[4] =
+    { NAME_FILE, INDEX_FILE, NUMBER_FILE, STORE_FILE };
+  char line[256], newPath[32];
+  long added = 0, skipped = 0;
+  glob_t globBuf;
+  FILE *fp;
+  int i, lockFd;
+
+  if( (lockFd = open( STORE_FILE, O_RDWR | O_CREAT, 0644 )) == -1 )
+  {
+    perror( STORE_FILE );
+    return -1;
+  }
+  if( flock( lockFd, LOCK_EX | LOCK_NB ) == -1 )
+  {
+    if( errno == EWOULDBLOCK )
+      printf( "The call store is in use. Stop jcblock, then run this again.\n" );
+    else
+      perror( STORE_FILE );
+    close( lockFd );
+    return -1;
+  }
+
+  memset( &globBuf, 0, sizeof(globBuf) );
+  if( numFiles == 0 )
+  {
+    if( glob( "./callerID.dat.[0-9][0-9][0-9][0-9]", 0, NULL, &globBuf ) != 0 )
+    {
+      printf( "No callerID.dat segments found\n" );
+      close( lockFd );
+      return -1;
+    }
+    numFiles = globBuf.gl_pathc;
+    files = globBuf.gl_pathv;
+  }
+
+  for( i = 0; i < 4; i++ )
+  {
+    snprintf( newPath, sizeof(newPath), "%s%s", storeFiles[i], NEW_SUFFIX );
+    remove( newPath );                  // left by an earlier run
+  }
+  importing = TRUE;
+  if( openStore( TRUE, NEW_SUFFIX ) == -1 )
+  {
+    globfree( &globBuf );
+    close( lockFd );
+    return -1;
+  }
+  for( i = 0; i < numFiles; i++ )
+  {
+    if( (fp = fopen( files[i], "r" )) == NULL )
+    {
+      perror( files[i] );
+      continue;
+    }
+    while( fgets( line, sizeof(line), fp ) != NULL )
+    {
+      if( line[0] == '#' || line[0] == '\n' )
+        continue;
+      if( callstoreAppend( line ) == 0 )
+        added++;
+      else
+        skipped++;
+    }
+    fclose( fp );
+  }
+  globfree( &globBuf );
+  if( sortNumberIndex() == -1 )
+  {
+    close( lockFd );
+    return -1;
+  }
+  callstoreClose();
+
+  for( i = 0; i < 4; i++ )
+  {
+    snprintf( newPath, sizeof(newPath), "%s%s", storeFiles[i], NEW_SUFFIX );
+    if( rename( newPath, storeFiles[i] ) == -1 )
+    {
+      perror( newPath );
+      close( lockFd );
+      return -1;
+    }
+  }
+  close( lockFd );
+  printf( "%ld calls added to the call store (%ld lines skipped)\n",
+    added, skipped );
+  return 0;
+}
+
+static void queryUsage(void)
+{
+  fprintf( stderr,
+    "Usage: jcblock query [-n number] [-f MMDDYY[HHMM]] [-t MMDDYY[HHMM]] [-c]\n"
+    "       jcblock query -i [file ...]\n"
+    "  -n  calls from this number\n"
+    "  -f  calls at or after this date (and time)\n"
+    "  -t  calls at or before this date (and time)\n"
+    "  -c  only count the calls\n"
+    "  -i  (re)build the call store from the callerID.dat segments\n" );
+}
+
+//
+// Parse a -f or -t argument. A date without a time means the start
+// of the day for -f and the end of the day for -t.
+//
+static long queryTimeArg(const char *arg, bool end)
+{
+  long minute;
+
+  if( strlen( arg ) == 6 )
+  {
+    if( (minute = minuteOf( arg, NULL )) >= 0 && end )
+      minute += 24 * 60 - 1;
+    return minute;
+  }
+  if( strlen( arg ) == 10 )
+    return minuteOf( arg, arg + 6 );
+  return -1;
+}
+
+//
+// "jcblock query ..." (argv[0] is "query").
+//
+int callstoreQuery(int argc, char **argv)
+{
+  char *number = NULL;
+  uint64_t key = CID_NONE;
+  long from = 0, to = 0x7fffffffL, matches;
+  bool countOnly = FALSE, import = FALSE;
+  int optChar;
+
+  optind = 1;
+  while( ( optChar = getopt( argc, argv, "n:f:t:cih" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'n':
+        number = optarg;
+        if( (key = cidNumber( number, -1 )) == CID_NONE )
+        {
+          fprintf( stderr, "Bad number: %s\n", optarg );
+          return -1;
+        }
+        break;
+
+      case 'f':
+        if( (from = queryTimeArg( optarg, FALSE )) < 0 )
+        {
+          fprintf( stderr, "Bad date: %s\n", optarg );
+          return -1;
+        }
+        break;
+
+      case 't':
+        if( (to = queryTimeArg( optarg, TRUE )) < 0 )
+        {
+          fprintf( stderr, "Bad date: %s\n", optarg );
+          return -1;
+        }
+        break;
+
+      case 'c':
+        countOnly = TRUE;
+        break;
+
+      case 'i':
+        import = TRUE;
+        break;
+
+      case 'h':
+      default:
+        queryUsage();
+        return -1;
+    }
+  }
+
+  if( import )
+  {
+    optChar = importFiles( argc - optind, argv + optind );
+    callstoreClose();
+    return optChar;
+  }
+
+  if( openStore( FALSE, "" ) == -1 )
+    return -1;
+  if( number != NULL )
+    matches = queryNumber( key, from, to, countOnly );
+  else
+    matches = queryTime( from, to, countOnly );
+  if( countOnly && matches >= 0 )
+    printf( "%ld\n", matches );
+  callstoreClose();
+  return matches < 0 ? -1 : 0;
+}
@@ -0,0 +1,44 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: callstore.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the binary call history store in callstore.c.
+ */
+#ifndef CALLSTORE_H
+#define CALLSTORE_H
+
+#include <stdint.h>
+
+// One call, as stored in file callstore.dat (24 bytes)
+typedef struct
+{
+  uint32_t minute;              // minutes since 1 Jan 2000 (local time)
+  uint32_t nameId;              // line of the name in callstore.nam
+  uint64_t number;              // packed by cidNumber() (callerid.c)
+  uint8_t tag;                  // callerID.dat tag character
+  uint8_t pad[7];
+} callRecord;
+
+int callstoreOpen(void);
+int callstoreAppend(const char *record);
+void callstoreClose(void);
+int callstoreQuery(int argc, char **argv);
+
+#endif
@@ -35,9 +35,19 @@ void tonesClearBuffer();
 bool tonesPoll();
 void tonesClose();
 
+// Declarations for functions defined in file voice.c.
+bool voiceStart(int fd);
+bool voicePoll(int fd);
+void voiceStop(int fd);
+
 //Declarations for functions defined in file truncate.c.
 int truncate_records();
+void truncate_wait();
+long days_from_civil( int year, int month, int day );
+long days_from_mmddyy( const char *date );
 
-FILE *fpCa;                // callerID.dat file
-FILE *fpBl;               // blacklist.dat file
+//Declarations for the list file lock defined in file safefile.c.
+void lock_blacklist();
+void unlock_blacklist( bool changed );
+unsigned long blacklist_generation();
 
@@ -0,0 +1,433 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: config.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to read the settings file (jcblock.conf, see
+ *	jcblock.conf.example) at startup and again when the program gets
+ *	a SIGHUP signal ("kill -HUP <pid>"), without stopping it.
+ *
+ *	Each line of the file is "name = value", or a comment ('#' first,
+ *	as modem commands such as "AT#CID=1" may have a '#').
+ *	A setting not in the file has its built-in value (the defines in
+ *	jcblock.c or jcblockAT.c); with no file, all do. If any line is
+ *	not valid the file is not used: at startup the built-in settings
+ *	are, and on a SIGHUP the settings in use are kept.
+ *
+ *	The settings are read by a thread and never changed once read.
+ *	A new set replaces the old by one pointer swap, so the program's
+ *	main thread (the only reader) takes either the old set or the new
+ *	one, never a mix, and takes no lock. The main thread takes the
+ *	settings when it is waiting for a call (configWait() returns as
+ *	soon as there are new ones) and keeps them until the next wait,
+ *	so a call in progress finishes with the settings it started with.
+ *	The old set is freed once the main thread has moved to the new
+ *	one: the main thread says which set it holds (in 'held'), and the
+ *	reader thread looks there before freeing.
+ *
+ *	The list files are not settings: the lists are read again (see
+ *	listindex.c) only when those files change.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "server.h"
+
+#define CONFIG_LINE_LEN     200
+#define RETIRED_POLL_MSEC   100     // how often to see if 'retired' is free
+
+static char configPath[256];
+static jcbConfig defaultConfig;
+static jcbConfig *current;              // the newest settings
+static const jcbConfig *held;           // the settings the main thread uses
+static jcbConfig *retired;              // replaced, maybe still held
+static unsigned long generations;
+static int hupPipe[2] = { -1, -1 };     // SIGHUP to the reader thread
+static int newPipe[2] = { -1, -1 };     // new settings to configWait()
+static pthread_t readerThread;
+static int readerStarted;
+static volatile int stopReader;
+
+//
+// The value of a "yes" or "no" setting, or -1.
+//
+static int yesNo(const char *value)
+{
+  if( strcasecmp( value, "yes" ) == 0 )
+    return 1;
+  if( strcasecmp( value, "no" ) == 0 )
+    return 0;
+  return -1;
+}
+
+//
+// Set modem command 'command' to 'value'. Returns -1 if it is not
+// valid.
+//
+static int setCommand(char *command, const char *value, int optional)
+{
+  if( strlen( value ) >= CONFIG_COMMAND_LEN )
+    return -1;
+  if( value[0] == '\0' ? !optional : strncasecmp( value, "AT", 2 ) != 0 )
+    return -1;
+  strcpy( command, value );
+  return 0;
+}
+
+//
+// Set 'name' to 'value' in 'c'. Returns -1 if the name or the value
+// is not valid.
+//
+static int setValue(jcbConfig *c, const char *name, const char *value)
+{
+  char *end;
+  long n;
+  double d;
+
+  if( strcmp( name, "country_command" ) == 0 )
+    return setCommand( c->countryCommand, value, 1 );
+  if( strcmp( name, "callerid_command" ) == 0 )
+    return setCommand( c->callerIdCommand, value, 0 );
+  if( strcmp( name, "fax_command" ) == 0 )
+    return setCommand( c->faxCommand, value, 0 );
+  if( strcmp( name, "fax_tone" ) == 0 )
+    return (c->faxTone = yesNo( value )) == -1 ? -1 : 0;
+  if( strcmp( name, "answering_machine" ) == 0 )
+    return (c->ansMachine = yesNo( value )) == -1 ? -1 : 0;
+  if( strcmp( name, "star_window" ) == 0 )
+  {
+    n = strtol( value, &end, 10 );
+    if( end == value || *end != '\0' || n < 1 || n > 60 )
+      return -1;
+    c->starWindowSecs = n;
+    return 0;
+  }
+  if( strcmp( name, "tone_threshold" ) == 0 )
+  {
+    d = strtod( value, &end );
+    if( end == value || *end != '\0' || d < 0 )
+      return -1;
+    c->toneThreshold = d;
+    return 0;
+  }
+  return -1;
+}
+
+//
+// Read the settings file into 'c' (starting from the built-in
+// settings). Returns 0, or -1 (with a message for each bad line).
+//
+static int readConfig(jcbConfig *c)
+{
+  char line[CONFIG_LINE_LEN];
+  char *name, *value, *end;
+  int lineNum = 0, errors = 0;
+  FILE *fp;
+
+  *c = defaultConfig;
+  if( (fp = fopen( configPath, "r" )) == NULL )
+  {
+    if( errno == ENOENT )
+      return 0;                         // the built-in settings
+    perror( configPath );
+    return -1;
+  }
+  while( fgets( line, sizeof(line), fp ) != NULL )
+  {
+    lineNum++;
+    for( name = line; isspace( (unsigned char)*name ); name++ )
+      ;
+    if( *name == '\0' || *name == '#' )
+      continue;
+    end = name + strlen( name );
+    while( end > name && isspace( (unsigned char)end[-1] ) )
+      *--end = '\0';
+
+    // "name = value"
+    if( (value = strchr( name, '=' )) == NULL )
+    {
+      printf("config: %s line %d: no '='\n", configPath + 2, lineNum);
+      errors++;
+      continue;
+    }
+    for( end = value; end > name && isspace( (unsigned char)end[-1] ); end-- )
+      ;
+    *end = '\0';
+    for( value++; isspace( (unsigned char)*value ); value++ )
+      ;
+    if( setValue( c, name, value ) == -1 )
+    {
+      printf("config: %s line %d: bad setting: %s = %s\n", configPath + 2,
+        lineNum, name, value);
+      errors++;
+    }
+  }
+  fclose( fp );
+  return errors ? -1 : 0;
+}
+
+static int sameSettings(const jcbConfig *a, const jcbConfig *b)
+{
+  return strcmp( a->countryCommand, b->countryCommand ) == 0 &&
+         strcmp( a->callerIdCommand, b->callerIdCommand ) == 0 &&
+         strcmp( a->faxCommand, b->faxCommand ) == 0 &&
+         a->faxTone == b->faxTone && a->ansMachine == b->ansMachine &&
+         a->starWindowSecs == b->starWindowSecs &&
+         a->toneThreshold == b->toneThreshold;
+}
+
+//
+// Free the replaced settings if the main thread no longer holds them.
+//
+static void freeRetired(void)
+{
+  if( retired != NULL && __atomic_load_n( &held, __ATOMIC_SEQ_CST ) != retired )
+  {
+    free( retired );
+    retired = NULL;
+  }
+}
+
+//
+// Read the settings file again and, if it changed anything, put the
+// new settings in place of the current ones.
+//
+static void reload(void)
+{
+  jcbConfig *c;
+
+  if( (c = malloc( sizeof(jcbConfig) )) == NULL )
+  {
+    perror( "config: malloc" );
+    return;
+  }
+  if( readConfig( c ) == -1 )
+  {
+    printf("config: %s not used. The settings are not changed.\n",
+      configPath + 2);
+    free( c );
+    return;
+  }
+  if( sameSettings( c, current ) )
+  {
+    printf("config: %s read, no settings changed\n", configPath + 2);
+    free( c );
+    return;
+  }
+  c->generation = ++generations;
+  retired = __atomic_exchange_n( &current, c, __ATOMIC_SEQ_CST );
+  printf("config: %s read, settings %lu in use from the next call\n",
+    configPath + 2, c->generation);
+  fflush( stdout );
+
+  // Wake the main thread if it is waiting for a call
+  serverWake( "config", newPipe, 'n' );
+  freeRetired();
+}
+
+//
+// SIGHUP: ask the reader thread to read the settings file again.
+//
+static void hupSignal(int signo)
+{
+  serverWake( NULL, hupPipe, 'h' );
+}
+
+//
+// The reader thread. A reload asked for while the settings it would
+// replace are still held (by a call in progress) waits for the call.
+//
+static void *configReader(void *arg)
+{
+  struct pollfd pfd;
+  sigset_t hup;
+  int pending = 0;
+
+  // This thread alone gets SIGHUP
+  sigemptyset( &hup );
+  sigaddset( &hup, SIGHUP );
+  pthread_sigmask( SIG_UNBLOCK, &hup, NULL );
+
+  pfd.fd = hupPipe[0];
+  pfd.events = POLLIN;
+  while( !stopReader )
+  {
+    if( poll( &pfd, 1, retired != NULL ? RETIRED_POLL_MSEC : -1 ) == -1 )
+    {
+      if( errno == EINTR )
+        continue;
+      perror( "config: poll" );
+      break;
+    }
+    if( (pfd.revents & POLLIN) && serverPipeRead( hupPipe, 'h' ) &&
+        !stopReader )
+    {
+      pending = 1;
+    }
+    freeRetired();
+    if( pending && retired == NULL && !stopReader )
+    {
+      pending = 0;
+      reload();
+    }
+  }
+  return NULL;
+}
+
+//
+// Read settings file 'path' (see readConfig()), with 'defaults' for
+// the settings it does not have, and read it again on each SIGHUP.
+// The settings are in place (configHold()) even if it fails.
+//
+// Only the thread that reads the file gets the SIGHUP (a signal
+// would cut short the main thread's sleeps): it is blocked in the
+// caller. Threads started before this must have it blocked too.
+//
+int configOpen(const char *path, const jcbConfig *defaults)
+{
+  sigset_t hup;
+  int err;
+
+  strncpy( configPath, path, sizeof(configPath) - 1 );
+  defaultConfig = *defaults;
+  if( (current = malloc( sizeof(jcbConfig) )) == NULL )
+  {
+    perror( "config: malloc" );
+    current = &defaultConfig;
+    return -1;
+  }
+  if( readConfig( current ) == -1 )
+  {
+    printf("config: %s not used. The built-in settings are used.\n",
+      configPath + 2);
+    *current = defaultConfig;
+  }
+  current->generation = ++generations;
+
+  if( serverPipeOpen( "config", hupPipe ) == -1 ||
+      serverPipeOpen( "config", newPipe ) == -1 )
+  {
+    configClose();
+    return -1;
+  }
+
+  stopReader = 0;
+  sigemptyset( &hup );
+  sigaddset( &hup, SIGHUP );
+  pthread_sigmask( SIG_BLOCK, &hup, NULL );
+  signal( SIGHUP, hupSignal );
+  if( (err = pthread_create( &readerThread, NULL, configReader, NULL )) != 0 )
+  {
+    printf("config: can't create thread: %s\n", strerror(err));
+    signal( SIGHUP, SIG_DFL );
+    pthread_sigmask( SIG_UNBLOCK, &hup, NULL );
+    configClose();
+    return -1;
+  }
+  readerStarted = 1;
+  return 0;
+}
+
+/*
+ * The newest settings, for the main thread. They stay in place (are
+ * not freed) until the next call.
+ */
+const jcbConfig *configHold(void)
+{
+  const jcbConfig *c;
+
+  // Say which settings are held, then make sure they were not
+  // replaced (and maybe freed) before that was seen
+  do
+  {
+    c = __atomic_load_n( &current, __ATOMIC_SEQ_CST );
+    __atomic_store_n( &held, c, __ATOMIC_SEQ_CST );
+  } while( c != __atomic_load_n( &current, __ATOMIC_SEQ_CST ) );
+  return c;
+}
+
+/*
+ * Wait until modem port 'fd' has characters to read (returns 0),
+ * there are newer settings than the held ones (returns 1; take them
+ * with configHold()) or 'stopFd' has characters to read (returns 2;
+ * -1 for none). Returns -1 if poll() fails.
+ */
+int configWait(int fd, int stopFd)
+{
+  struct pollfd fds[3];
+
+  fds[0].fd = fd;
+  fds[1].fd = newPipe[0];               // -1 is ignored by poll()
+  fds[2].fd = stopFd;
+  fds[0].events = fds[1].events = fds[2].events = POLLIN;
+  while( 1 )
+  {
+    if( __atomic_load_n( &held, __ATOMIC_SEQ_CST ) !=
+        __atomic_load_n( &current, __ATOMIC_SEQ_CST ) )
+    {
+      return 1;
+    }
+    if( poll( fds, 3, -1 ) == -1 )
+    {
+      if( errno == EINTR )
+        continue;
+      perror( "config: poll" );
+      return -1;
+    }
+    if( fds[2].revents )
+      return 2;
+    if( fds[1].revents & POLLIN )
+      serverPipeRead( newPipe, 'n' );
+    if( fds[0].revents )
+      return 0;
+  }
+}
+
+/*
+ * Stop reading the settings file. The settings are freed: call it
+ * when the main thread no longer uses them.
+ */
+void configClose(void)
+{
+  if( readerStarted )
+  {
+    signal( SIGHUP, SIG_IGN );
+    stopReader = 1;
+    serverWake( "config", hupPipe, 's' );
+    pthread_join( readerThread, NULL );
+    readerStarted = 0;
+  }
+  serverPipeClose( hupPipe );
+  serverPipeClose( newPipe );
+  if( current != &defaultConfig )
+    free( current );
+  free( retired );
+  current = &defaultConfig;
+  retired = NULL;
+  held = NULL;
+}
@@ -0,0 +1,48 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: config.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the settings file functions in config.c.
+ */
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#define CONFIG_FILE         "./jcblock.conf"
+#define CONFIG_COMMAND_LEN  40      // longest modem command (with '\0')
+
+// The settings
+typedef struct
+{
+  char countryCommand[CONFIG_COMMAND_LEN];  // e.g. "AT+GCI=B5" ("": none)
+  char callerIdCommand[CONFIG_COMMAND_LEN]; // e.g. "AT+VCID=1"
+  char faxCommand[CONFIG_COMMAND_LEN];      // e.g. "AT+FCLASS=2.0"
+  int faxTone;                  // answer blocked calls with a fax tone
+  int ansMachine;               // an answering machine is on the line
+  int starWindowSecs;           // star (*) key window length
+  double toneThreshold;         // star key tone threshold (0: adaptive)
+  unsigned long generation;     // 1 for the settings read at startup
+} jcbConfig;
+
+int configOpen(const char *path, const jcbConfig *defaults);
+const jcbConfig *configHold(void);
+int configWait(int fd, int stopFd);
+void configClose(void);
+
+#endif
@@ -0,0 +1,456 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: control.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to change the lists while the program runs, through a
+ *	control socket ("jcblock ctl ...").
+ *
+ *	Adding a number used to mean editing blacklist.dat by hand (and
+ *	keeping the date in the 20th column). The program listens on the
+ *	Unix socket CONTROL_SOCKET (readable and writable by its owner
+ *	only) for commands, one per line:
+ *
+ *	 add [-p] white|black STRING[?COMMENT]
+ *	                  add an entry with today's date (or '++++++'
+ *	                  with -p: never removed by truncate.c)
+ *	 remove white|black STRING
+ *	                  remove the entries whose search string is STRING
+ *	 lookup TEXT      which entries match TEXT (e.g. a number), and
+ *	                  would the call be accepted or blocked
+ *	 list-stats       entries and counters of each list
+ *	 flush            wait until all changes are in the files
+ *
+ *	Each answer is zero or more lines of text, then a line starting
+ *	with "OK" or "ERR". The changes are made to the list index
+ *	(listindex.c) at once and written to the files by the list
+ *	writer (safefile.c). One client is served at a time.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "safefile.h"
+#include "listindex.h"
+#include "control.h"
+#include "server.h"
+
+#define CONTROL_IDLE_MSEC 30000         // idle clients are disconnected
+#define CONTROL_LINE_LEN  256
+
+static int listenFd = -1;
+static int wakePipe[2] = { -1, -1 };
+static char socketName[108];
+static bool stopServer, serverStarted;
+static pthread_t serverThread;
+
+static const char *listNames[2] = { "whitelist", "blacklist" };
+
+//
+// Send a line of the answer (the client is local, and a send timeout
+// is set, so this does not wait long).
+//
+static void reply(int fd, const char *format, ...)
+{
+  char buf[CONTROL_LINE_LEN];
+  va_list ap;
+  int len;
+
+  va_start( ap, format );
+  len = vsnprintf( buf, sizeof(buf) - 1, format, ap );
+  va_end( ap );
+  if( len > (int)sizeof(buf) - 2 )
+    len = sizeof(buf) - 2;
+  buf[len++] = '\n';
+  send( fd, buf, len, MSG_NOSIGNAL );
+}
+
+static int listNumber(const char *name)
+{
+  if( name == NULL )
+    return -1;
+  if( strcmp( name, "white" ) == 0 || strcmp( name, "whitelist" ) == 0 )
+    return LIST_WHITE;
+  if( strcmp( name, "black" ) == 0 || strcmp( name, "blacklist" ) == 0 )
+    return LIST_BLACK;
+  return -1;
+}
+
+//
+// "add [-p] white|black STRING[?COMMENT]". The entry is laid out like
+// the ones write_blacklist() makes.
+//
+static void addCommand(int fd, char *args)
+{
+  char line[LIST_LINE_LEN], date[8], *listName, *key, *comment, *save;
+  bool permanent = FALSE;
+  time_t now;
+  int list, keyLen;
+
+  if( args == NULL || (listName = strtok_r( args, " ", &save )) == NULL )
+  {
+    reply( fd, "ERR usage: add [-p] white|black STRING[?COMMENT]" );
+    return;
+  }
+  if( strcmp( listName, "-p" ) == 0 )
+  {
+    permanent = TRUE;
+    listName = strtok_r( NULL, " ", &save );
+  }
+  if( (list = listNumber( listName )) == -1 ||
+      (key = strtok_r( NULL, "", &save )) == NULL )
+  {
+    reply( fd, "ERR usage: add [-p] white|black STRING[?COMMENT]" );
+    return;
+  }
+  if( (comment = strchr( key, '?' )) != NULL )
+    *comment++ = '\0';
+  keyLen = strlen( key );
+  if( keyLen == 0 || keyLen > LIST_KEY_LEN )
+  {
+    reply( fd, "ERR the string must be 1 to %d characters", LIST_KEY_LEN );
+    return;
+  }
+  if( strchr( key, '\t' ) != NULL || (comment != NULL && strchr( comment, '\t' ) != NULL) )
+  {
+    reply( fd, "ERR tabs are not allowed" );
+    return;
+  }
+  if( listHasKey( list, key ) )
+  {
+    reply( fd, "ERR already on the %s", listNames[list] );
+    return;
+  }
+
+  if( permanent )
+    strcpy( date, "++++++" );
+  else
+  {
+    now = time( NULL );
+    strftime( date, sizeof(date), "%m%d%y", localtime( &now ) );
+  }
+  snprintf( line, sizeof(line), "%s?%*s%s%*s%.*s\n", key, 18 - keyLen, "",
+    date, 8, "", LIST_LINE_LEN - 36,
+    comment != NULL && *comment != '\0' ? comment : "CONTROL ENTRY" );
+
+  if( listAdd( list, line ) == -1 )
+  {
+    reply( fd, "ERR can't add the entry" );
+    return;
+  }
+  reply( fd, "%.*s", (int)strcspn( line, "\n" ), line );
+  reply( fd, "OK added to the %s", listNames[list] );
+}
+
+//
+// "remove white|black STRING"
+//
+static void removeCommand(int fd, char *args)
+{
+  char *key, *save;
+  int list, removed;
+
+  if( args == NULL || (list = listNumber( strtok_r( args, " ", &save ) )) == -1 ||
+      (key = strtok_r( NULL, "", &save )) == NULL )
+  {
+    reply( fd, "ERR usage: remove white|black STRING" );
+    return;
+  }
+  if( (removed = listRemove( list, key )) == 0 )
+  {
+    reply( fd, "ERR not on the %s", listNames[list] );
+    return;
+  }
+  reply( fd, "OK removed %d entr%s from the %s", removed,
+    removed == 1 ? "y" : "ies", listNames[list] );
+}
+
+//
+// "lookup TEXT": the whitelist is checked first, as for a call.
+//
+static void lookupCommand(int fd, char *text)
+{
+  char line[LIST_LINE_LEN];
+  bool white, black;
+
+  if( text == NULL || *text == '\0' )
+  {
+    reply( fd, "ERR usage: lookup TEXT" );
+    return;
+  }
+  if( (white = listMatch( LIST_WHITE, text, line )) )
+    reply( fd, "whitelist: %.*s", (int)strcspn( line, "\n" ), line );
+  if( (black = listMatch( LIST_BLACK, text, line )) )
+    reply( fd, "blacklist: %.*s", (int)strcspn( line, "\n" ), line );
+  reply( fd, "OK %s", white ? "accept" : black ? "block" : "no match" );
+}
+
+static void statsCommand(int fd)
+{
+  listStats stats;
+  int list;
+
+  for( list = LIST_WHITE; list <= LIST_BLACK; list++ )
+  {
+    listGetStats( list, &stats );
+    reply( fd, "%s: %lu entries, %lu lookups (%lu cached), %lu matches, %lu reads, %lu changes",
+      stats.path + 2, stats.entries, stats.lookups, stats.cached,
+      stats.matches, stats.reloads, stats.changes );
+  }
+  reply( fd, "OK %s", listEditsPending() ? "changes are being written" :
+    "all changes written" );
+}
+
+static void doCommand(int fd, char *line)
+{
+  char *cmd, *args, *save;
+
+  line[strcspn( line, "\r\n" )] = '\0';
+  cmd = strtok_r( line, " ", &save );
+  args = strtok_r( NULL, "", &save );
+  if( cmd == NULL )
+    return;
+#ifdef DEBUG
+  printf("control: %s %s\n", cmd, args != NULL ? args : "");
+#endif
+  if( strcmp( cmd, "add" ) == 0 )
+    addCommand( fd, args );
+  else if( strcmp( cmd, "remove" ) == 0 )
+    removeCommand( fd, args );
+  else if( strcmp( cmd, "lookup" ) == 0 )
+    lookupCommand( fd, args );
+  else if( strcmp( cmd, "list-stats" ) == 0 )
+    statsCommand( fd );
+  else if( strcmp( cmd, "flush" ) == 0 )
+  {
+    listEditsFlush();
+    reply( fd, "OK all changes written" );
+  }
+  else
+    reply( fd, "ERR commands: add, remove, lookup, list-stats, flush" );
+}
+
+//
+// Serve one client until it closes the connection, is idle for
+// CONTROL_IDLE_MSEC or the server is stopped.
+//
+static void serveClient(int fd)
+{
+  struct pollfd fds[2];
+  struct timeval timeout = { 2, 0 };
+  char buf[CONTROL_LINE_LEN];
+  char *end;
+  int len = 0, n;
+
+  setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout) );
+  while( TRUE )
+  {
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wakePipe[0];
+    fds[1].events = POLLIN;
+    if( poll( fds, 2, CONTROL_IDLE_MSEC ) <= 0 || (fds[1].revents & POLLIN) )
+      return;
+    if( (n = read( fd, buf + len, sizeof(buf) - 1 - len )) <= 0 )
+      return;
+    len += n;
+    buf[len] = '\0';
+
+    // Do each complete line
+    while( (end = strchr( buf, '\n' )) != NULL )
+    {
+      *end++ = '\0';
+      doCommand( fd, buf );
+      len -= end - buf;
+      memmove( buf, end, len + 1 );
+    }
+    if( len == sizeof(buf) - 1 )
+    {
+      reply( fd, "ERR line too long" );
+      return;
+    }
+  }
+}
+
+//
+// The server thread.
+//
+static void *controlServer(void *arg)
+{
+  struct pollfd fds[2];
+  int fd;
+
+  while( !stopServer )
+  {
+    fds[0].fd = listenFd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wakePipe[0];
+    fds[1].events = POLLIN;
+    if( poll( fds, 2, -1 ) == -1 && errno != EINTR )
+    {
+      perror( "control: poll" );
+      break;
+    }
+    if( !(fds[0].revents & POLLIN) )
+      continue;
+    if( (fd = accept( listenFd, NULL, NULL )) == -1 )
+    {
+      if( errno != EAGAIN && errno != EINTR )
+        perror( "control: accept" );
+      continue;
+    }
+    fcntl( fd, F_SETFD, FD_CLOEXEC );
+    serveClient( fd );
+    close( fd );
+  }
+  return NULL;
+}
+
+//
+// Start the server, listening on Unix socket 'socketPath'.
+//
+int controlOpen(const char *socketPath)
+{
+  int err;
+
+  if( (listenFd = serverListenUnix( "control", socketPath )) == -1 )
+    return -1;
+  strncpy( socketName, socketPath, sizeof(socketName) - 1 );
+
+  if( serverPipeOpen( "control", wakePipe ) == -1 )
+  {
+    controlClose();
+    return -1;
+  }
+
+  stopServer = FALSE;
+  if( (err = pthread_create( &serverThread, NULL, controlServer, NULL )) != 0 )
+  {
+    printf("control: can't create thread: %s\n", strerror(err));
+    controlClose();
+    return -1;
+  }
+  serverStarted = TRUE;
+  return 0;
+}
+
+//
+// Stop the server (a client being served is disconnected).
+//
+void controlClose(void)
+{
+  if( serverStarted )
+  {
+    stopServer = TRUE;
+    serverWake( "control", wakePipe, 's' );
+    pthread_join( serverThread, NULL );
+    serverStarted = FALSE;
+  }
+  if( listenFd != -1 )
+  {
+    close( listenFd );
+    unlink( socketName );
+  }
+  listenFd = -1;
+  serverPipeClose( wakePipe );
+}
+
+//
+// "jcblock ctl COMMAND ...": send a command to the running program and
+// print the answer. Returns 0 if the answer was OK.
+//
+int controlQuery(int argc, char **argv)
+{
+  struct sockaddr_un addr;
+  char buf[4096], *line, *end;
+  int fd, i, len = 0, n, cmdLen = 0;
+
+  if( argc < 2 || strcmp( argv[1], "-h" ) == 0 )
+  {
+    fprintf( stderr, "Usage: jcblock ctl add [-p] white|black STRING[?COMMENT]\n" );
+    fprintf( stderr, "       jcblock ctl remove white|black STRING\n" );
+    fprintf( stderr, "       jcblock ctl lookup TEXT\n" );
+    fprintf( stderr, "       jcblock ctl list-stats\n" );
+    fprintf( stderr, "       jcblock ctl flush\n" );
+    fprintf( stderr, "(-p: the entry is never removed by truncation)\n" );
+    return 1;
+  }
+
+  // The command line, as one line
+  for( i = 1; i < argc; i++ )
+  {
+    cmdLen += snprintf( buf + cmdLen, sizeof(buf) - cmdLen - 1, "%s%s",
+      i > 1 ? " " : "", argv[i] );
+    if( cmdLen >= CONTROL_LINE_LEN - 1 )
+    {
+      fprintf( stderr, "jcblock ctl: command too long\n" );
+      return 1;
+    }
+  }
+  buf[cmdLen++] = '\n';
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  strncpy( addr.sun_path, CONTROL_SOCKET, sizeof(addr.sun_path) - 1 );
+  if( (fd = socket( AF_UNIX, SOCK_STREAM, 0 )) == -1 ||
+      connect( fd, (struct sockaddr *)&addr, sizeof(addr) ) == -1 )
+  {
+    perror( CONTROL_SOCKET " (is jcblock running in this directory?)" );
+    return 1;
+  }
+  if( send( fd, buf, cmdLen, MSG_NOSIGNAL ) != cmdLen )
+  {
+    perror( "jcblock ctl: send" );
+    close( fd );
+    return 1;
+  }
+
+  // Print the answer, up to the "OK" or "ERR" line
+  while( (n = read( fd, buf + len, sizeof(buf) - 1 - len )) > 0 )
+  {
+    len += n;
+    buf[len] = '\0';
+    for( line = buf; (end = strchr( line, '\n' )) != NULL; line = end )
+    {
+      *end++ = '\0';
+      printf( "%s\n", line );
+      if( strncmp( line, "OK", 2 ) == 0 || strncmp( line, "ERR", 3 ) == 0 )
+      {
+        close( fd );
+        return line[0] == 'O' ? 0 : 1;
+      }
+    }
+    len -= line - buf;
+    memmove( buf, line, len + 1 );
+  }
+  close( fd );
+  fprintf( stderr, "jcblock ctl: no answer\n" );
+  return 1;
+}
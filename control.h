@@ -0,0 +1,33 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: control.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the control socket in control.c.
+ */
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#define CONTROL_SOCKET    "./jcblock.ctl"   // Unix socket path
+
+int controlOpen(const char *socketPath);
+void controlClose(void);
+int controlQuery(int argc, char **argv);
+
+#endif
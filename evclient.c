@@ -0,0 +1,83 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: evclient.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	A sample client for the binary call messages sent when jcblock
+ *	is compiled with SEND_ON_NETWORK and SEND_BINARY defined (the
+ *	binary counterpart of radioclient.py). It prints each call, and
+ *	how many messages were lost when the sequence numbers show a
+ *	gap. Compile it with:
+ *
+ *	  gcc -o evclient evclient.c evproto.c
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "evproto.h"
+
+int main(void)
+{
+  struct sockaddr_in addr;
+  unsigned char buf[512];
+  callEvent ev;
+  uint32_t expected = 0, lost;
+  int sock, len, haveSeq = 0, on = 1;
+
+  if( (sock = socket( AF_INET, SOCK_DGRAM, 0 )) == -1 )
+  {
+    perror( "socket" );
+    return 1;
+  }
+  setsockopt( sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+  memset( &addr, 0, sizeof(addr) );
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl( INADDR_ANY );
+  addr.sin_port = htons( 9754 );
+  if( bind( sock, (struct sockaddr *)&addr, sizeof(addr) ) == -1 )
+  {
+    perror( "bind" );
+    return 1;
+  }
+
+  while( (len = recv( sock, buf, sizeof(buf), 0 )) >= 0 )
+  {
+    if( evprotoDecode( buf, len, &ev ) == -1 )
+    {
+      printf("(not a version %d message, %d bytes)\n", EVPROTO_VERSION, len);
+      continue;
+    }
+    // The same message comes once for each interface it was sent on
+    if( haveSeq && ev.seq == expected - 1 )
+      continue;
+    if( haveSeq && (lost = evprotoLost( expected, ev.seq )) > 0 )
+      printf("(%u messages lost)\n", lost);
+    expected = ev.seq + 1;
+    haveSeq = 1;
+
+    printf("%c %02d/%02d/%02d %02d:%02d  %-15s %s\n", ev.tag, ev.month,
+      ev.day, ev.year, ev.hour, ev.minute, ev.number, ev.name);
+    fflush( stdout );
+  }
+  perror( "recv" );
+  return 1;
+}
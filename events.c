@@ -0,0 +1,335 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: events.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to send call records (events) to client programs over
+ *	a stream connection.
+ *
+ *	The UDP broadcasts of radio.c can be lost, are IPv4 only and a
+ *	client that starts late has missed the earlier calls. Instead a
+ *	client can connect to the Unix socket EVENT_SOCKET (readable and
+ *	writable by its owner only, as the records hold callers' names
+ *	and numbers) and, if a port is given, to a TCP port, IPv6 or
+ *	IPv4. Connecting
+ *	subscribes: the server first sends the last EVENT_REPLAY events,
+ *	then each new one as it happens. Each event is one callerID.dat
+ *	record (a line of text ending with '\n'). Anything a client sends
+ *	is ignored.
+ *
+ *	The last EVENT_RING events are kept in a ring, each with a
+ *	sequence number. eventsPublish() (called by the main program)
+ *	only adds an event to the ring and wakes the server thread. The
+ *	server thread keeps the position of each client in the ring and
+ *	writes to it when its socket can take more (non-blocking). So a
+ *	client's queue is bounded by the ring: a client that falls more
+ *	than EVENT_RING events behind is too slow and is disconnected.
+ *	Nothing a client does can block the main program.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "events.h"
+#include "server.h"
+
+#define EVENT_RING        256   // events kept
+#define EVENT_MAX_LEN     256   // longest event (with its '\n')
+#define EVENT_MAX_CLIENTS 16
+
+// A connected client
+typedef struct
+{
+  int fd;
+  unsigned long nextSeq;                // the next event to send it
+  char out[EVENT_MAX_LEN];              // the event being sent
+  int outLen, outOff;
+} eventClient;
+
+static char ring[EVENT_RING][EVENT_MAX_LEN];
+static unsigned long pubSeq;            // events published so far
+static pthread_mutex_t ringMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static eventClient clients[EVENT_MAX_CLIENTS];
+static int numClients;
+static int unixFd = -1, tcpFd = -1;
+static int wakePipe[2] = { -1, -1 };
+static char socketName[108];
+static bool stopServer, serverStarted;
+static pthread_t serverThread;
+
+static void dropClient(int i, const char *why)
+{
+#ifdef DEBUG
+  printf("events: client %d dropped (%s)\n", clients[i].fd, why);
+#else
+  if( why != NULL )
+    printf("events: client dropped (%s)\n", why);
+#endif
+  close( clients[i].fd );
+  clients[i] = clients[--numClients];
+}
+
+static void acceptClient(int listenFd)
+{
+  eventClient *c;
+  int fd;
+
+  if( (fd = accept( listenFd, NULL, NULL )) == -1 )
+  {
+    if( errno != EAGAIN && errno != EINTR )
+      perror( "events: accept" );
+    return;
+  }
+  fcntl( fd, F_SETFL, O_NONBLOCK );
+  fcntl( fd, F_SETFD, FD_CLOEXEC );
+  if( numClients == EVENT_MAX_CLIENTS )
+  {
+    printf("events: too many clients\n");
+    close( fd );
+    return;
+  }
+
+  // Start it EVENT_REPLAY events back (or at the oldest kept)
+  c = &clients[numClients++];
+  memset( c, 0, sizeof(eventClient) );
+  c->fd = fd;
+  pthread_mutex_lock( &ringMutex );
+  c->nextSeq = pubSeq > EVENT_REPLAY ? pubSeq - EVENT_REPLAY : 0;
+  pthread_mutex_unlock( &ringMutex );
+}
+
+//
+// Send client 'i' as much as its socket takes. Returns -1 if the
+// client was dropped.
+//
+static int sendClient(int i)
+{
+  eventClient *c = &clients[i];
+  ssize_t n;
+
+  while( TRUE )
+  {
+    if( c->outOff < c->outLen )
+    {
+      n = send( c->fd, c->out + c->outOff, c->outLen - c->outOff,
+        MSG_NOSIGNAL | MSG_DONTWAIT );
+      if( n == -1 )
+      {
+        if( errno == EAGAIN || errno == EWOULDBLOCK )
+          return 0;                     // wait for POLLOUT
+        dropClient( i, NULL );          // it went away
+        return -1;
+      }
+      c->outOff += n;
+      continue;
+    }
+
+    // Take its next event from the ring
+    pthread_mutex_lock( &ringMutex );
+    if( c->nextSeq == pubSeq )
+    {
+      pthread_mutex_unlock( &ringMutex );
+      return 0;                         // up to date
+    }
+    if( pubSeq - c->nextSeq > EVENT_RING )
+    {
+      pthread_mutex_unlock( &ringMutex );
+      dropClient( i, "too slow" );
+      return -1;
+    }
+    strcpy( c->out, ring[c->nextSeq % EVENT_RING] );
+    c->nextSeq++;
+    pthread_mutex_unlock( &ringMutex );
+    c->outLen = strlen( c->out );
+    c->outOff = 0;
+  }
+}
+
+//
+// The server thread.
+//
+static void *eventServer(void *arg)
+{
+  struct pollfd fds[3 + EVENT_MAX_CLIENTS];
+  unsigned long seq;
+  char buf[512];
+  int numFds, i, n;
+
+  while( TRUE )
+  {
+    pthread_mutex_lock( &ringMutex );
+    seq = pubSeq;
+    pthread_mutex_unlock( &ringMutex );
+
+    fds[0].fd = wakePipe[0];
+    fds[0].events = POLLIN;
+    fds[1].fd = unixFd;                 // -1 is ignored by poll()
+    fds[1].events = POLLIN;
+    fds[2].fd = tcpFd;
+    fds[2].events = POLLIN;
+    numFds = 3;
+    for( i = 0; i < numClients; i++ )
+    {
+      fds[numFds].fd = clients[i].fd;
+      fds[numFds].events = POLLIN;
+      if( clients[i].outOff < clients[i].outLen || clients[i].nextSeq != seq )
+        fds[numFds].events |= POLLOUT;
+      numFds++;
+    }
+
+    if( poll( fds, numFds, -1 ) == -1 )
+    {
+      if( errno == EINTR )
+        continue;
+      perror( "events: poll" );
+      break;
+    }
+
+    if( fds[0].revents & POLLIN )
+    {
+      serverPipeRead( wakePipe, 's' );
+      if( stopServer )
+        break;
+    }
+
+    // Clients first (the new ones are not in fds[])
+    for( i = numClients - 1; i >= 0; i-- )
+    {
+      if( fds[3 + i].revents & POLLIN )
+      {
+        // Read (and ignore) anything sent; 0 means it closed
+        while( (n = read( clients[i].fd, buf, sizeof(buf) )) > 0 )
+          ;
+        if( n == 0 || (errno != EAGAIN && errno != EWOULDBLOCK) )
+        {
+          dropClient( i, NULL );
+          continue;
+        }
+      }
+      if( fds[3 + i].revents & (POLLERR | POLLHUP) )
+      {
+        dropClient( i, NULL );
+        continue;
+      }
+    }
+    if( fds[1].revents & POLLIN )
+      acceptClient( unixFd );
+    if( fds[2].revents & POLLIN )
+      acceptClient( tcpFd );
+
+    for( i = numClients - 1; i >= 0; i-- )
+    {
+      sendClient( i );
+    }
+  }
+  return NULL;
+}
+
+//
+// Start the server: listen on Unix socket 'socketPath' and, if
+// 'tcpPort' is not zero, on that TCP port.
+//
+int eventsOpen(const char *socketPath, int tcpPort)
+{
+  int err;
+
+  if( (unixFd = serverListenUnix( "events", socketPath )) == -1 )
+    return -1;
+  strncpy( socketName, socketPath, sizeof(socketName) - 1 );
+  if( tcpPort != 0 )
+    tcpFd = serverListenTcp( "events", tcpPort, FALSE );  // not required
+
+  if( serverPipeOpen( "events", wakePipe ) == -1 )
+  {
+    eventsClose();
+    return -1;
+  }
+
+  stopServer = FALSE;
+  if( (err = pthread_create( &serverThread, NULL, eventServer, NULL )) != 0 )
+  {
+    printf("events: can't create thread: %s\n", strerror(err));
+    eventsClose();
+    return -1;
+  }
+  serverStarted = TRUE;
+  return 0;
+}
+
+//
+// Add a call record to the ring and wake the server thread. Never
+// waits for a client.
+//
+int eventsPublish(const char *record)
+{
+  char *event;
+  size_t len;
+
+  if( !serverStarted )
+    return -1;
+  pthread_mutex_lock( &ringMutex );
+  event = ring[pubSeq % EVENT_RING];
+  len = strcspn( record, "\r\n" );
+  if( len > EVENT_MAX_LEN - 2 )
+    len = EVENT_MAX_LEN - 2;
+  memcpy( event, record, len );
+  event[len] = '\n';
+  event[len + 1] = '\0';
+  pubSeq++;
+  pthread_mutex_unlock( &ringMutex );
+
+  serverWake( "events", wakePipe, 'e' );
+  return 0;
+}
+
+//
+// Stop the server and disconnect the clients.
+//
+void eventsClose(void)
+{
+  if( serverStarted )
+  {
+    stopServer = TRUE;
+    serverWake( "events", wakePipe, 's' );
+    pthread_join( serverThread, NULL );
+    serverStarted = FALSE;
+  }
+  while( numClients > 0 )
+  {
+    close( clients[--numClients].fd );
+  }
+  if( unixFd != -1 )
+  {
+    close( unixFd );
+    unlink( socketName );
+  }
+  if( tcpFd != -1 )
+    close( tcpFd );
+  unixFd = tcpFd = -1;
+  serverPipeClose( wakePipe );
+}
@@ -0,0 +1,34 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: events.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the call event server in events.c.
+ */
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#define EVENT_SOCKET      "./jcblock.sock"  // Unix socket path
+#define EVENT_REPLAY      50    // events sent to a new client first
+
+int eventsOpen(const char *socketPath, int tcpPort);
+int eventsPublish(const char *record);
+void eventsClose(void);
+
+#endif
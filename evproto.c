@@ -0,0 +1,224 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: evproto.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to encode and decode the binary call event format.
+ *
+ *	The text records broadcast by radio.c must be taken apart with
+ *	regular expressions, are cut to 80 characters and a client can
+ *	not tell whether it missed any. A binary message carries the
+ *	same call in fixed places, with a sequence number. All numbers
+ *	are big-endian:
+ *
+ *	 offset  size
+ *	  0       4    "JCBE"
+ *	  4       1    version (EVPROTO_VERSION)
+ *	  5       1    tag ('-', 'W', 'B', '*', 'R', ...)
+ *	  6       5    month, day, year (0-99), hour, minute (0 if the
+ *	               record had no valid DATE and TIME)
+ *	 11       1    zero
+ *	 12       4    sequence number (one more for each message)
+ *	 16       8    the sender's monotonic clock, in milliseconds
+ *	 24       1    number length n (digits)
+ *	 25   (n+1)/2  the number, four bits per digit, first digit in
+ *	               the high bits: 0-9 are the digits, then 'O',
+ *	               'P', 'X' (any other character), '*' and '#'
+ *	  .       1    name length m
+ *	  .       m    the name (not '\0' terminated)
+ *
+ *	A receiver that sees a sequence number jump knows how many
+ *	messages it lost (evprotoLost()). Messages with another version
+ *	number have a different layout and are rejected by
+ *	evprotoDecode(); the magic and version will stay where they are.
+ *
+ *	This file does not use the rest of jcblock, so client programs
+ *	can be compiled with just it and evproto.h.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "evproto.h"
+
+// The characters a number may contain (as in callstore.c)
+static const char numChars[] = "0123456789OPX*#";
+
+//
+// Copy a record field (ending at "--", '\n' or '\0') of at most 'max'
+// characters. Returns its length.
+//
+static int copyField(const char *field, char *out, int max)
+{
+  int n;
+
+  for( n = 0; n < max && field[n] != '\0' && field[n] != '\n' &&
+         field[n] != '\r' && !(field[n] == '-' && field[n + 1] == '-'); n++ )
+  {
+    out[n] = field[n];
+  }
+  out[n] = '\0';
+  return n;
+}
+
+//
+// Two digits as a number, or -1.
+//
+static int twoDigits(const char *p)
+{
+  if( !isdigit( (unsigned char)p[0] ) || !isdigit( (unsigned char)p[1] ) )
+    return -1;
+  return (p[0] - '0') * 10 + p[1] - '0';
+}
+
+static void put32(unsigned char *p, uint32_t v)
+{
+  p[0] = v >> 24;
+  p[1] = v >> 16;
+  p[2] = v >> 8;
+  p[3] = v;
+}
+
+static uint32_t get32(const unsigned char *p)
+{
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) |
+         ((uint32_t)p[2] << 8) | p[3];
+}
+
+//
+// Encode a callerID.dat record into 'buf' (of 'size' bytes; at most
+// EVPROTO_MAX_LEN are used). Returns the message length, or -1 if
+// 'buf' is too small.
+//
+int evprotoEncode(const char *record, uint32_t seq, uint64_t msec,
+                  unsigned char *buf, int size)
+{
+  char number[EVPROTO_NUMBER_LEN + 1], name[EVPROTO_NAME_LEN + 1];
+  const char *date, *time, *field, *p;
+  int numLen, nameLen, len, n, nibble, i;
+
+  number[0] = name[0] = '\0';
+  numLen = nameLen = 0;
+  if( (field = strstr( record, "NMBR = " )) != NULL )
+    numLen = copyField( field + 7, number, EVPROTO_NUMBER_LEN );
+  if( (field = strstr( record, "NAME = " )) != NULL )
+    nameLen = copyField( field + 7, name, EVPROTO_NAME_LEN );
+
+  len = EVPROTO_HEADER_LEN + 1 + (numLen + 1) / 2 + 1 + nameLen;
+  if( len > size )
+    return -1;
+  memset( buf, 0, EVPROTO_HEADER_LEN + 1 + (numLen + 1) / 2 );
+
+  memcpy( buf, EVPROTO_MAGIC, 4 );
+  buf[4] = EVPROTO_VERSION;
+  buf[5] = record[0];
+
+  // The date and time, if they are all valid digits
+  if( (date = strstr( record, "DATE = " )) != NULL &&
+      (time = strstr( record, "TIME = " )) != NULL )
+  {
+    date += 7;
+    time += 7;
+    if( twoDigits( date ) > 0 && twoDigits( date + 2 ) > 0 &&
+        twoDigits( date + 4 ) >= 0 && twoDigits( time ) >= 0 &&
+        twoDigits( time + 2 ) >= 0 )
+    {
+      buf[6] = twoDigits( date );
+      buf[7] = twoDigits( date + 2 );
+      buf[8] = twoDigits( date + 4 );
+      buf[9] = twoDigits( time );
+      buf[10] = twoDigits( time + 2 );
+    }
+  }
+
+  put32( buf + 12, seq );
+  put32( buf + 16, (uint32_t)(msec >> 32) );
+  put32( buf + 20, (uint32_t)msec );
+
+  // The number, packed
+  i = EVPROTO_HEADER_LEN;
+  buf[i++] = numLen;
+  for( n = 0; n < numLen; n++ )
+  {
+    p = strchr( numChars, toupper( (unsigned char)number[n] ) );
+    nibble = ( p != NULL && *p != '\0' ) ? p - numChars : 12;  // 'X'
+    buf[i + n / 2] |= nibble << ( (n & 1) ? 0 : 4 );
+  }
+  i += (numLen + 1) / 2;
+
+  // The name, length first
+  buf[i++] = nameLen;
+  memcpy( buf + i, name, nameLen );
+  return len;
+}
+
+//
+// Decode the message in 'buf' ('len' bytes) into 'ev'. Returns the
+// message length (a stream may hold more messages after it), or -1
+// if it is not a (complete) message of this version.
+//
+int evprotoDecode(const unsigned char *buf, int len, callEvent *ev)
+{
+  int numLen, nameLen, i, n;
+
+  if( len < EVPROTO_HEADER_LEN + 1 || memcmp( buf, EVPROTO_MAGIC, 4 ) != 0 ||
+      buf[4] != EVPROTO_VERSION )
+  {
+    return -1;
+  }
+  numLen = buf[EVPROTO_HEADER_LEN];
+  i = EVPROTO_HEADER_LEN + 1 + (numLen + 1) / 2;
+  if( numLen > EVPROTO_NUMBER_LEN || i >= len )
+    return -1;
+  nameLen = buf[i++];
+  if( nameLen > EVPROTO_NAME_LEN || i + nameLen > len )
+    return -1;
+
+  ev->version = buf[4];
+  ev->tag = buf[5];
+  ev->month = buf[6];
+  ev->day = buf[7];
+  ev->year = buf[8];
+  ev->hour = buf[9];
+  ev->minute = buf[10];
+  ev->seq = get32( buf + 12 );
+  ev->msec = ((uint64_t)get32( buf + 16 ) << 32) | get32( buf + 20 );
+
+  for( n = 0; n < numLen; n++ )
+  {
+    ev->number[n] = numChars[ ( buf[EVPROTO_HEADER_LEN + 1 + n / 2] >>
+                                ( (n & 1) ? 0 : 4 ) ) & 0x0f ];
+  }
+  ev->number[n] = '\0';
+  memcpy( ev->name, buf + i, nameLen );
+  ev->name[nameLen] = '\0';
+  return i + nameLen;
+}
+
+//
+// The number of messages lost between the one expected next and the
+// one received ('seq'). Zero if 'seq' is the expected one, or is
+// older (a repeat, or the sender was restarted).
+//
+uint32_t evprotoLost(uint32_t expected, uint32_t seq)
+{
+  uint32_t gap = seq - expected;        // wraps around correctly
+
+  return gap < 0x80000000u ? gap : 0;
+}
@@ -0,0 +1,56 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: evproto.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the binary call event format in evproto.c.
+ *	Client programs need only this file and evproto.c.
+ */
+#ifndef EVPROTO_H
+#define EVPROTO_H
+
+#include <stdint.h>
+
+#define EVPROTO_MAGIC       "JCBE"
+#define EVPROTO_VERSION     1
+#define EVPROTO_HEADER_LEN  24      // the fixed part of a message
+#define EVPROTO_NUMBER_LEN  32      // longest number (digits)
+#define EVPROTO_NAME_LEN    63      // longest name
+#define EVPROTO_MAX_LEN     (EVPROTO_HEADER_LEN + 1 + EVPROTO_NUMBER_LEN / 2 \
+                             + 1 + EVPROTO_NAME_LEN)
+
+// A decoded message
+typedef struct
+{
+  int version;
+  char tag;                     // the callerID.dat tag ('-', 'W', 'B', ...)
+  int month, day, year;         // the caller ID date (year 0-99), 0 if none
+  int hour, minute;             // and time
+  uint32_t seq;                 // message sequence number
+  uint64_t msec;                // sender's monotonic clock (milliseconds)
+  char number[EVPROTO_NUMBER_LEN + 1];
+  char name[EVPROTO_NAME_LEN + 1];
+} callEvent;
+
+int evprotoEncode(const char *record, uint32_t seq, uint64_t msec,
+                  unsigned char *buf, int size);
+int evprotoDecode(const unsigned char *buf, int len, callEvent *ev);
+uint32_t evprotoLost(uint32_t expected, uint32_t seq);
+
+#endif
@@ -0,0 +1,653 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: goertzel.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Star (*) key tone detector. The audio front end (tones.c) reads
+ *	and scales the audio; the code here decides whether the star key
+ *	tones (941 Hz and 1209 Hz) are present.
+ *
+ *	Tone detection based on:
+ *	  "The Goretzel Algorithm", Kevin Banks,
+ *	  Embedded Systems Programming, September 2002.
+ *
+ *	Choosing N, the block size (N = SAMPLING_RATE/BIN_WIDTH):
+ *	  The objective is to choose N such that the tone frequency is
+ *	  close to an integer multiple of the bin width.
+ *
+ *	    For 941 Hz, try N = 528:
+ *	     BIN_WIDTH = 8000.0/528 = 15.15 Hz. Then: 941/15.15 = 62.11
+ *	     which is close to integer 62, so we choose it.
+ *
+ *	    For 1209 Hz, try N = 410:
+ *	     BIN_WIDTH = 8000.0/410 = 19.51 Hz. Then 1209/19.51 = 61.97
+ *	     which is close to integer 62, so we choose it.
+ *
+ *	  Note that, subject to the above, the larger N is the better the
+ *	  algorithm works -- but the longer the *-key tones must be
+ *	  present. The chosen values are a compromise.
+ *
+ *	Thresholds:
+ *	  The program used to compare each tone magnitude against a fixed
+ *	  THRESHOLD that had to be tuned by hand for every microphone and
+ *	  modem speaker. Instead, a running noise floor is now kept for
+ *	  every filter bin and a block is declared a star key block only
+ *	  when all of the following hold:
+ *	   1) both tones are at least SNR_MIN_DB above their noise floor,
+ *	   2) the level difference of the two tones (the "twist") is no
+ *	      more than TWIST_MAX_DB,
+ *	   3) each tone is at least GUARD_DB above the other DTMF
+ *	      frequencies of its group (so other keys, speech and music
+ *	      with energy in many bins are rejected),
+ *	   4) the two tones carry at least PURITY of the block's energy.
+ *	  The noise floor of a bin falls quickly and rises slowly, and is
+ *	  not updated while tones are present. None of these values depend
+ *	  on the microphone gain.
+ *
+ *	Call progress tones:
+ *	  Four more bins (350, 440, 480 and 620 Hz) detect the tones the
+ *	  telephone company sends when the far end has hung up, so the
+ *	  star key window can be closed early (see goertzelCallProgress()):
+ *	   dial tone:    350 + 440 Hz, continuous,
+ *	   busy tone:    480 + 620 Hz, 0.5 seconds on, 0.5 seconds off,
+ *	   reorder tone: 480 + 620 Hz, 0.25 seconds on, 0.25 seconds off.
+ *	  A pair is present when both of its tones pass the same SNR and
+ *	  twist tests as the star key tones and are GUARD_DB above the
+ *	  other pair (so ringback, 440 + 480 Hz, is not taken for either).
+ *	  The busy and reorder cadences must repeat CADENCE_CYCLES times.
+ *	  Silence is SILENCE_MSEC of blocks whose energy stays within
+ *	  SILENCE_DB of the quietest block energy seen (which rises very
+ *	  slowly, so steady music or speech is not taken for silence).
+ */
+#include <stdio.h>
+#include <math.h>
+
+#include "common.h"
+#include "goertzel.h"
+
+// For phones that send a time-limited "beep" when the *-key is
+// pressed (e.g., wireless and some wired phones), this option allows
+// the operator to press the *-key twice to indicate that a blacklist
+// entry should be added for the call. Note that there is some risk
+// that a "false positive" result may occur. That is, the algorithm
+// may interpret "audio noise" as a beep and create an unintended
+// blacklist entry for the call. The noise can come from: 1) caller
+// audio, 2) audio in the room where the phone is located or 3) audio
+// from the room where the modem is located. Requiring two beeps helps
+// to mitigate the risk. A way to avoid the risk is to put important
+// calls on the whitelist. This option is activated by default.
+// Note that the original detection method (for phones with non-time-
+// limited tone generation when the *-key is pressed) is still present
+// whether DO_BEEPS is active or not. To deactivate "beep" processing,
+// comment out '#define DO_BEEPS' below.
+#define DO_BEEPS
+
+#define DET_MIN                  10	// blocks for a held *-key
+#define BEEP_DET_MIN              2	// blocks for one *-key beep...
+#define BEEP_DET_MAX              3	// ...depends on the phone
+
+/* Adaptive detection parameters (see "Thresholds:" above) */
+#define SNR_MIN_DB             10.0
+#define TWIST_MAX_DB           10.0
+#define GUARD_DB                6.0
+#define PURITY                  0.5
+#define FLOOR_FALL              0.25	// noise floor fall rate
+#define FLOOR_RISE              (1.0/32.0)	// noise floor rise rate
+#define FLOOR_MIN               1.0e-9	// about -90 dB full scale
+#define TONE_MIN                1.0e-7	// about -70 dB full scale
+
+/* Call progress parameters (see "Call progress tones:" above) */
+#define DIAL_MSEC		1000	// continuous dial tone
+#define BUSY_MSEC_MIN		 350	// busy tone on/off times...
+#define BUSY_MSEC_MAX		 700
+#define REORDER_MSEC_MIN	 150	// reorder tone on/off times...
+#define REORDER_MSEC_MAX	 350
+#define CADENCE_CYCLES		   2
+#define SILENCE_MSEC		6000
+#define SILENCE_DB		 6.0	// above the quietest block
+#define SILENCE_RISE		(1.0/1024.0)	// quietest block rise rate
+#define SILENCE_MIN		1.0e-7	// always silence below this
+
+/* Number of blocks in 'msec' milliseconds */
+#define BLOCKS(msec)	((int)((msec) * SAMPLING_RATE / \
+				(1000.0 * GOERTZEL_BLOCK) + 0.5))
+
+#define PI			3.14159265
+
+// Uncomment the following define to print the bin levels for
+// every block.
+//#define DEBUG
+
+/*
+ * One filter bin. The DTMF row frequencies are evaluated over N_LO
+ * samples and the column frequencies over N_HI samples.
+ */
+struct bin {
+  FLOATING freq;
+  int N;
+  int group;                   // ROW_GROUP or COL_GROUP
+  FLOATING coeff;
+  FLOATING sine;
+  FLOATING cosine;
+  FLOATING power;              // tone power in the last block
+  FLOATING floor;              // running noise floor estimate
+  bool hold;                   // TRUE: tone present, floor not updated
+};
+
+#define ROW_GROUP	0
+#define COL_GROUP	1
+#define CP_GROUP	2
+#define NUM_GROUPS	3
+
+enum { BIN_697, BIN_770, BIN_852, BIN_941,
+       BIN_1209, BIN_1336, BIN_1477, BIN_1633,
+       BIN_350, BIN_440, BIN_480, BIN_620, NUM_BINS };
+
+static struct bin bins[NUM_BINS] = {
+  {  697.0, N_LO, ROW_GROUP },
+  {  770.0, N_LO, ROW_GROUP },
+  {  852.0, N_LO, ROW_GROUP },
+  {  941.0, N_LO, ROW_GROUP },
+  { 1209.0, N_HI, COL_GROUP },
+  { 1336.0, N_HI, COL_GROUP },
+  { 1477.0, N_HI, COL_GROUP },
+  { 1633.0, N_HI, COL_GROUP },
+  {  350.0, N_LO, CP_GROUP },
+  {  440.0, N_LO, CP_GROUP },
+  {  480.0, N_LO, CP_GROUP },
+  {  620.0, N_LO, CP_GROUP },
+};
+
+static bool floorValid = FALSE;
+static FLOATING fixedThreshold = 0.0;   // non-zero: old fixed rule
+static FLOATING magLo, magHi;           // raw magnitudes (fixed rule)
+
+static int numDet = 0;
+static int numDetWas = 0;
+static int numBeeps = 0;
+
+/* Call progress state */
+static FLOATING energyFloor;            // quietest block energy
+static int callProgress = CP_NONE;
+static int dialBlocks;                  // blocks of dial tone
+static bool busyOn;                     // 480 + 620 Hz in last block
+static int busyRun;                     // blocks in the current on/off run
+static int busyOnRun;                   // length of the last on run
+static int cadence;                     // CP_BUSY, CP_REORDER or CP_NONE
+static int cadenceCycles;
+static int silentBlocks;
+
+static char *callProgressNames[] = {
+  "none", "dial tone", "busy tone", "reorder tone", "silence"
+};
+
+/* Call this once for each bin, to precompute the constants. */
+static void InitGoertzel(struct bin *b)
+{
+  int			k;
+  FLOATING		floatN;
+  FLOATING		omega;
+
+  floatN = (FLOATING) b->N;
+  k = (int) (0.5 + ((floatN * b->freq) / SAMPLING_RATE));
+  omega = (2.0 * PI * k) / floatN;
+  b->sine = sin(omega);
+  b->cosine = cos(omega);
+  b->coeff = 2.0 * b->cosine;
+}
+
+/*
+ * Run the Goertzel filter for one bin over its block of samples.
+ * Returns the squared magnitude of the bin.
+ */
+static FLOATING ProcessBin(const struct bin *b, const FLOATING *samples)
+{
+  FLOATING Q0, Q1 = 0, Q2 = 0;
+  FLOATING real, imag;
+  int index;
+
+  for( index = 0; index < b->N; index++ )
+  {
+    Q0 = b->coeff * Q1 - Q2 + samples[index];
+    Q2 = Q1;
+    Q1 = Q0;
+  }
+
+  /* Do the "standard Goertzel" processing */
+  real = (Q1 - Q2 * b->cosine);
+  imag = (Q2 * b->sine);
+
+  return real*real + imag*imag;
+}
+
+/*
+ * Energy (variance) of the samples of one block, with the DC
+ * component removed.
+ */
+static FLOATING BlockEnergy(const FLOATING *samples, int N)
+{
+  FLOATING sum = 0, sumSquares = 0, mean;
+  int i;
+
+  for( i = 0; i < N; i++ )
+  {
+    sum += samples[i];
+    sumSquares += samples[i] * samples[i];
+  }
+  mean = sum / N;
+  return sumSquares / N - mean * mean;
+}
+
+/*
+ * Largest power of the bins in 'group', other than bin 'skip'.
+ */
+static FLOATING GuardPower(int group, int skip)
+{
+  FLOATING max = 0;
+  int i;
+
+  for( i = 0; i < NUM_BINS; i++ )
+  {
+    if( bins[i].group == group && i != skip && bins[i].power > max )
+    {
+      max = bins[i].power;
+    }
+  }
+  return max;
+}
+
+/*
+ * Update the noise floor of every bin from the last block.
+ * The first block primes each floor with the quietest bin of its
+ * group, so a tone that is present at start-up is not taken as noise.
+ */
+static void UpdateFloors(FLOATING energy)
+{
+  FLOATING quietest[NUM_GROUPS] = { -1, -1, -1 };
+  FLOATING diff;
+  int i;
+
+  if( !floorValid )
+  {
+    for( i = 0; i < NUM_BINS; i++ )
+    {
+      if( quietest[bins[i].group] < 0 ||
+              bins[i].power < quietest[bins[i].group] )
+      {
+        quietest[bins[i].group] = bins[i].power;
+      }
+    }
+    for( i = 0; i < NUM_BINS; i++ )
+    {
+      bins[i].floor = quietest[bins[i].group];
+    }
+    energyFloor = energy;
+    floorValid = TRUE;
+    return;
+  }
+
+  for( i = 0; i < NUM_BINS; i++ )
+  {
+    if( bins[i].hold )
+      continue;
+    diff = bins[i].power - bins[i].floor;
+    bins[i].floor += diff * (diff < 0 ? FLOOR_FALL : FLOOR_RISE);
+  }
+  diff = energy - energyFloor;
+  energyFloor += diff * (diff < 0 ? FLOOR_FALL : SILENCE_RISE);
+}
+
+/*
+ * Decide whether the call progress tone pair 'a' + 'b' is present
+ * in the last block. 'c' and 'd' are the bins of the other pair.
+ */
+static bool PairPresent(int a, int b, int c, int d, FLOATING energy)
+{
+  FLOATING pA = bins[a].power;
+  FLOATING pB = bins[b].power;
+  FLOATING snrMin = pow(10.0, SNR_MIN_DB / 10.0);
+  FLOATING twistMax = pow(10.0, TWIST_MAX_DB / 10.0);
+  FLOATING guard = pow(10.0, GUARD_DB / 10.0);
+  FLOATING other;
+
+  if( !floorValid || pA < TONE_MIN || pB < TONE_MIN )
+    return FALSE;
+
+  if( pA < snrMin * (bins[a].floor > FLOOR_MIN ? bins[a].floor : FLOOR_MIN) ||
+      pB < snrMin * (bins[b].floor > FLOOR_MIN ? bins[b].floor : FLOOR_MIN) )
+    return FALSE;
+
+  if( pA > twistMax * pB || pB > twistMax * pA )
+    return FALSE;
+
+  other = bins[c].power > bins[d].power ? bins[c].power : bins[d].power;
+  if( pA < guard * other || pB < guard * other )
+    return FALSE;
+
+  if( pA + pB < PURITY * energy )
+    return FALSE;
+
+  return TRUE;
+}
+
+/*
+ * Return CP_BUSY or CP_REORDER if one on and one off run of the
+ * 480 + 620 Hz pair (in blocks) match that cadence; else CP_NONE.
+ */
+static int Cadence(int onRun, int offRun)
+{
+  if( onRun >= BLOCKS(BUSY_MSEC_MIN) && onRun <= BLOCKS(BUSY_MSEC_MAX) &&
+      offRun >= BLOCKS(BUSY_MSEC_MIN) && offRun <= BLOCKS(BUSY_MSEC_MAX) )
+    return CP_BUSY;
+
+  if( onRun >= BLOCKS(REORDER_MSEC_MIN) && onRun < BLOCKS(REORDER_MSEC_MAX) &&
+      offRun >= BLOCKS(REORDER_MSEC_MIN) && offRun < BLOCKS(REORDER_MSEC_MAX) )
+    return CP_REORDER;
+
+  return CP_NONE;
+}
+
+/*
+ * Update the call progress state from the last block.
+ */
+static void CallProgressBlock(FLOATING energy)
+{
+  bool dial, busy;
+  int c;
+
+  dial = PairPresent( BIN_350, BIN_440, BIN_480, BIN_620, energy );
+  busy = PairPresent( BIN_480, BIN_620, BIN_350, BIN_440, energy );
+
+  // Don't let a tone raise its own noise floor
+  bins[BIN_350].hold = bins[BIN_440].hold = dial;
+  bins[BIN_480].hold = bins[BIN_620].hold = busy;
+
+  // Dial tone is continuous
+  dialBlocks = dial ? dialBlocks + 1 : 0;
+  if( dialBlocks >= BLOCKS(DIAL_MSEC) )
+  {
+    callProgress = CP_DIAL;
+  }
+
+  // Busy and reorder tones are told apart by their cadence. Each
+  // on run followed by an off run is one cycle.
+  if( busy != busyOn )
+  {
+    if( busy )                      // off -> on: a cycle is complete
+    {
+      c = Cadence( busyOnRun, busyRun );
+      if( c != CP_NONE && c == cadence )
+      {
+        cadenceCycles++;
+      }
+      else
+      {
+        cadence = c;
+        cadenceCycles = (c == CP_NONE) ? 0 : 1;
+      }
+      if( cadenceCycles >= CADENCE_CYCLES )
+      {
+        callProgress = cadence;
+      }
+    }
+    else                            // on -> off
+    {
+      busyOnRun = busyRun;
+    }
+    busyOn = busy;
+    busyRun = 0;
+  }
+  busyRun++;
+
+  // Silence
+  if( energy < SILENCE_MIN ||
+      ( floorValid && energy < energyFloor * pow(10.0, SILENCE_DB / 10.0) ) )
+  {
+    silentBlocks++;
+    if( silentBlocks >= BLOCKS(SILENCE_MSEC) && callProgress == CP_NONE )
+    {
+      callProgress = CP_SILENCE;
+    }
+  }
+  else
+  {
+    silentBlocks = 0;
+  }
+}
+
+/*
+ * Decide whether the star key tones are present in the last block.
+ */
+static bool TonesPresent(FLOATING energy)
+{
+  FLOATING pLo = bins[BIN_941].power;
+  FLOATING pHi = bins[BIN_1209].power;
+  FLOATING snrMin = pow(10.0, SNR_MIN_DB / 10.0);
+  FLOATING twistMax = pow(10.0, TWIST_MAX_DB / 10.0);
+  FLOATING guard = pow(10.0, GUARD_DB / 10.0);
+  FLOATING floorLo, floorHi;
+
+  if( fixedThreshold > 0.0 )
+  {
+    return magLo > fixedThreshold && magHi > fixedThreshold;
+  }
+
+  if( pLo < TONE_MIN || pHi < TONE_MIN )
+    return FALSE;
+
+  floorLo = bins[BIN_941].floor > FLOOR_MIN ? bins[BIN_941].floor : FLOOR_MIN;
+  floorHi = bins[BIN_1209].floor > FLOOR_MIN ? bins[BIN_1209].floor : FLOOR_MIN;
+
+  if( pLo < snrMin * floorLo || pHi < snrMin * floorHi )
+    return FALSE;
+
+  if( pLo > twistMax * pHi || pHi > twistMax * pLo )
+    return FALSE;
+
+  if( pLo < guard * GuardPower(ROW_GROUP, BIN_941) ||
+      pHi < guard * GuardPower(COL_GROUP, BIN_1209) )
+    return FALSE;
+
+  if( pLo + pHi < PURITY * energy )
+    return FALSE;
+
+  return TRUE;
+}
+
+/*
+ * Precompute the filter constants. Call once at start-up.
+ */
+void goertzelInit(void)
+{
+  int i;
+
+  for( i = 0; i < NUM_BINS; i++ )
+  {
+    InitGoertzel( &bins[i] );
+  }
+  floorValid = FALSE;
+  goertzelReset();
+}
+
+/*
+ * Zero the detection counters (e.g., at the start of a call). The
+ * noise floors are kept, since the audio path has not changed.
+ */
+void goertzelReset(void)
+{
+  int i;
+
+  numDet = numDetWas = 0;
+  numBeeps = 0;
+
+  callProgress = CP_NONE;
+  dialBlocks = 0;
+  busyOn = FALSE;
+  busyRun = busyOnRun = 0;
+  cadence = CP_NONE;
+  cadenceCycles = 0;
+  silentBlocks = 0;
+  for( i = 0; i < NUM_BINS; i++ )
+  {
+    bins[i].hold = FALSE;
+  }
+}
+
+/*
+ * Return the call progress state: CP_DIAL, CP_BUSY, CP_REORDER or
+ * CP_SILENCE once that has been detected since the last reset
+ * (i.e., the far end has hung up); else CP_NONE.
+ */
+int goertzelCallProgress(void)
+{
+  return callProgress;
+}
+
+/*
+ * Set the call progress state. For front ends whose hardware
+ * detects call progress tones itself (e.g., a voice modem). A
+ * tone (dial, busy or reorder) replaces silence, which may just
+ * have been the gap before it; nothing else replaces a state.
+ */
+void goertzelSetCallProgress(int state)
+{
+  if( callProgress == CP_NONE ||
+      ( callProgress == CP_SILENCE && state != CP_SILENCE ) )
+  {
+    callProgress = state;
+  }
+}
+
+/*
+ * Name of a call progress state, for messages.
+ */
+char *goertzelCallProgressName(int state)
+{
+  if( state < CP_NONE || state > CP_SILENCE )
+    return "unknown";
+  return callProgressNames[state];
+}
+
+/*
+ * Use the old fixed-threshold rule (both tone magnitudes above
+ * 'threshold') instead of the adaptive rule. Zero selects the
+ * adaptive rule (the default). Used to compare the two methods.
+ */
+void goertzelSetFixedThreshold(FLOATING threshold)
+{
+  fixedThreshold = threshold;
+}
+
+/*
+ * Process one block of GOERTZEL_BLOCK samples. Returns TRUE when a
+ * star (*) key press has been detected.
+ */
+bool goertzelBlock(const FLOATING *samples)
+{
+  FLOATING energy;
+  FLOATING magnitudeSquared;
+  bool present;
+  int i;
+
+  for( i = 0; i < NUM_BINS; i++ )
+  {
+    magnitudeSquared = ProcessBin( &bins[i], samples );
+
+    // Keep the raw magnitudes for the fixed rule
+    if( i == BIN_941 )
+      magLo = sqrt( magnitudeSquared );
+    else if( i == BIN_1209 )
+      magHi = sqrt( magnitudeSquared );
+
+    // Tone power (amplitude squared / 2) independent of N
+    bins[i].power = 2.0 * magnitudeSquared /
+                            ((FLOATING)bins[i].N * bins[i].N);
+  }
+  energy = BlockEnergy( samples, N_LO );
+
+  present = TonesPresent( energy );
+
+  CallProgressBlock( energy );
+
+#ifdef DEBUG
+  printf("941: %6.1f dB  1209: %6.1f dB  twist: %5.1f dB  %s\n",
+    10.0 * log10( (bins[BIN_941].power + 1e-20) /
+                          (bins[BIN_941].floor + 1e-20) ),
+    10.0 * log10( (bins[BIN_1209].power + 1e-20) /
+                          (bins[BIN_1209].floor + 1e-20) ),
+    10.0 * log10( (bins[BIN_1209].power + 1e-20) /
+                          (bins[BIN_941].power + 1e-20) ),
+    present ? "detection is TRUE" : "detection is FALSE" );
+#endif
+
+  if( present )
+  {
+    numDet++;
+  }
+  else
+  {
+    UpdateFloors( energy );
+    numDetWas = numDet;
+    numDet = 0;
+  }
+
+  /*
+   * For phones that send the tones continuously as long as the
+   * *-key is pressed...
+   * Require at least DET_MIN consecutive detections of both tones
+   * to declare a *-KEY press detection.
+   */
+  if( numDet >= DET_MIN )
+  {
+#ifdef DEBUG
+    printf("*-KEY press detected\n");
+#endif
+    numDet = numDetWas = 0;
+    return TRUE;
+  }
+#ifdef DO_BEEPS
+  /*
+   * For phones that send a time-limited "beep" when the *-key
+   * is pressed...
+   * Require BEEP_DET_MIN to BEEP_DET_MAX consecutive detections
+   * of both tones twice (two *-key press detections) to declare
+   * an operator auto-blacklist entry request. Note: the number of
+   * detections may have to be adjusted depending on the duration
+   * of your phone's beep.
+   */
+  else if( numDetWas >= BEEP_DET_MIN && numDetWas <= BEEP_DET_MAX )
+  {
+    if(numBeeps == 0)     // If first *-key press detection
+    {
+      numBeeps = 1;
+      numDetWas = 0;
+    }
+    else                  // If second *-key press detection
+    {
+#ifdef DEBUG
+      printf("Two *-key presses detected\n");
+#endif
+      numBeeps = 0;
+      numDet = numDetWas = 0;
+      return TRUE;
+    }
+  }
+#endif                               // end of DO_BEEPS
+  return FALSE;
+}
@@ -0,0 +1,59 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: goertzel.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the star (*) key tone detector in goertzel.c.
+ *	The audio front end (tones.c) delivers blocks of
+ *	GOERTZEL_BLOCK samples scaled to the range -1.0 to +1.0.
+ */
+#ifndef GOERTZEL_H
+#define GOERTZEL_H
+
+#define FLOATING	float
+
+#define SAMPLING_RATE           8000.0		//8kHz
+
+/* Low tone (941 Hz) parameters */
+#define TARGET_FREQ_LO		941.0		//941 Hz
+#define N_LO                    528            //941 Hz block size
+
+/* High (1209 Hz) tone parameters */
+#define TARGET_FREQ_HI         1209.0           //1209 Hz
+#define N_HI                    410             //1209 Hz block size
+
+/* Number of samples needed for one detection block */
+#define GOERTZEL_BLOCK		N_LO
+
+/* Call progress states (see goertzelCallProgress()) */
+#define CP_NONE			0
+#define CP_DIAL			1	// dial tone
+#define CP_BUSY			2	// busy tone
+#define CP_REORDER		3	// reorder (fast busy) tone
+#define CP_SILENCE		4
+
+void goertzelInit(void);
+void goertzelReset(void);
+bool goertzelBlock(const FLOATING *samples);
+void goertzelSetFixedThreshold(FLOATING threshold);
+int goertzelCallProgress(void);
+void goertzelSetCallProgress(int state);
+char *goertzelCallProgressName(int state);
+
+#endif
@@ -0,0 +1,236 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: jcbbench.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Benchmark for the classification library (libjcblock.c). A
+ *	blacklist with random numbers and names (20000 entries by default)
+ *	and a whitelist of 1000 numbers are written, then a million
+ *	caller ID records (about 10% blacklisted and 5% whitelisted) are
+ *	classified three ways: one at a time with jcb_classify(), in
+ *	batches with jcb_classify_batch(), and in batches by several
+ *	threads sharing one handle. Each way must give the same results.
+ *
+ *	Compile with: ./makebench
+ *	Run with:     ./jcbbench [entries [calls [threads]]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "libjcblock.h"
+
+#define WHITE_FILE	"./jcbbench-white.dat"
+#define BLACK_FILE	"./jcbbench-black.dat"
+#define WHITE_ENTRIES	1000
+#define BATCH		64		// records per jcb_classify_batch()
+#define MAX_THREADS	64
+
+static jcb *handle;
+static const char **records;
+static jcb_result *results;
+static long numCalls;
+static int numThreads;
+
+static double secondsNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void randomNumber(char *nmbr)
+{
+  snprintf( nmbr, 11, "%03d%03d%04d", 200 + rand() % 800, rand() % 1000,
+            rand() % 10000 );
+}
+
+static void randomName(char *name)
+{
+  int i, len = 6 + rand() % 8;
+
+  for( i = 0; i < len; i++ )
+    name[i] = 'A' + rand() % 26;
+  name[len] = '\0';
+}
+
+//
+// Write a list file of 'entries' entries, keeping their search strings
+// in 'keys'. Every eighth blacklist entry is a name.
+//
+static void writeList(const char *path, long entries, char (*keys)[16],
+                      int names)
+{
+  char key[16];
+  long i;
+  FILE *fp;
+
+  if( (fp = fopen( path, "w" )) == NULL )
+  {
+    perror( path );
+    exit( 1 );
+  }
+  fprintf( fp, "# jcbbench list\n" );
+  for( i = 0; i < entries; i++ )
+  {
+    if( names && i % 8 == 0 )
+      randomName( key );
+    else
+      randomNumber( key );
+    strcpy( keys[i], key );
+    fprintf( fp, "%s?%*s%s        BENCH\n", key, (int)(18 - strlen( key )),
+             "", "010125" );
+  }
+  fclose( fp );
+}
+
+static int sameResults(const jcb_result *a, const jcb_result *b, long n)
+{
+  long i;
+
+  for( i = 0; i < n; i++ )
+  {
+    if( a[i].tag != b[i].tag || strcmp( a[i].line, b[i].line ) != 0 )
+      return 0;
+  }
+  return 1;
+}
+
+static void *batchThread(void *arg)
+{
+  long t = (long)arg, first, last, i;
+
+  first = numCalls * t / numThreads;
+  last = numCalls * (t + 1) / numThreads;
+  for( i = first; i < last; i += BATCH )
+  {
+    jcb_classify_batch( handle, records + i,
+                        last - i < BATCH ? last - i : BATCH, results + i );
+  }
+  return NULL;
+}
+
+int main(int argc, char **argv)
+{
+  long entries = 20000, i, k, blocked = 0, white = 0;
+  char (*blackKeys)[16], (*whiteKeys)[16];
+  char nmbr[16], name[16], *rec;
+  jcb_result *single;
+  pthread_t threads[MAX_THREADS];
+  jcb_lists lists = { WHITE_FILE, BLACK_FILE };
+  double start, secs;
+  int r;
+
+  numCalls = 1000000;
+  numThreads = sysconf( _SC_NPROCESSORS_ONLN );
+  if( (argc > 1 && (entries = atol( argv[1] )) <= 0) ||
+      (argc > 2 && (numCalls = atol( argv[2] )) <= 0) ||
+      (argc > 3 && (numThreads = atoi( argv[3] )) <= 0) )
+  {
+    fprintf(stderr, "usage: jcbbench [entries [calls [threads]]]\n");
+    return 1;
+  }
+  if( numThreads > MAX_THREADS )
+    numThreads = MAX_THREADS;
+
+  srand( 1 );
+  blackKeys = malloc( entries * sizeof(*blackKeys) );
+  whiteKeys = malloc( WHITE_ENTRIES * sizeof(*whiteKeys) );
+  records = malloc( numCalls * sizeof(char *) );
+  rec = malloc( numCalls * 80 );
+  results = malloc( numCalls * sizeof(jcb_result) );
+  single = malloc( numCalls * sizeof(jcb_result) );
+  if( blackKeys == NULL || whiteKeys == NULL || records == NULL ||
+      rec == NULL || results == NULL || single == NULL )
+  {
+    fprintf(stderr, "jcbbench: out of memory\n");
+    return 1;
+  }
+  writeList( BLACK_FILE, entries, blackKeys, 1 );
+  writeList( WHITE_FILE, WHITE_ENTRIES, whiteKeys, 0 );
+
+  // The calls: mostly unknown numbers, some on each list
+  for( i = 0; i < numCalls; i++ )
+  {
+    randomNumber( nmbr );
+    randomName( name );
+    r = rand() % 100;
+    k = rand() % entries;
+    if( r < 10 && blackKeys[k][0] >= 'A' )
+      strcpy( name, blackKeys[k] );
+    else if( r < 10 )
+      strcpy( nmbr, blackKeys[k] );
+    else if( r < 15 )
+      strcpy( nmbr, whiteKeys[rand() % WHITE_ENTRIES] );
+    records[i] = rec + i * 80;
+    snprintf( rec + i * 80, 80,
+              "--DATE = 0315--TIME = 1412--NMBR = %s--NAME = %s--", nmbr, name );
+  }
+
+  if( (handle = jcb_open( &lists )) == NULL )
+  {
+    fprintf(stderr, "jcb_open() failed\n");
+    return 1;
+  }
+  printf("%ld blacklist entries, %d whitelist entries, %ld calls\n",
+    entries, WHITE_ENTRIES, numCalls);
+
+  start = secondsNow();
+  for( i = 0; i < numCalls; i++ )
+    jcb_classify( handle, records[i], &single[i] );
+  secs = secondsNow() - start;
+  for( i = 0; i < numCalls; i++ )
+  {
+    blocked += single[i].tag == JCB_BLACK;
+    white += single[i].tag == JCB_WHITE;
+  }
+  printf("  %ld blacklisted, %ld whitelisted\n", blocked, white);
+  printf("jcb_classify():           %10.0f classifications per second\n",
+    numCalls / secs);
+
+  start = secondsNow();
+  for( i = 0; i < numCalls; i += BATCH )
+  {
+    jcb_classify_batch( handle, records + i,
+                        numCalls - i < BATCH ? numCalls - i : BATCH, results + i );
+  }
+  secs = secondsNow() - start;
+  printf("jcb_classify_batch():     %10.0f classifications per second%s\n",
+    numCalls / secs, sameResults( single, results, numCalls ) ? "" : " (MISMATCH)");
+
+  memset( results, 0, numCalls * sizeof(jcb_result) );
+  start = secondsNow();
+  for( i = 0; i < numThreads; i++ )
+    pthread_create( &threads[i], NULL, batchThread, (void *)i );
+  for( i = 0; i < numThreads; i++ )
+    pthread_join( threads[i], NULL );
+  secs = secondsNow() - start;
+  printf("batches in %2d threads:   %10.0f classifications per second%s\n",
+    numThreads, numCalls / secs,
+    sameResults( single, results, numCalls ) ? "" : " (MISMATCH)");
+
+  jcb_close( handle );
+  unlink( WHITE_FILE );
+  unlink( BLACK_FILE );
+  return 0;
+}
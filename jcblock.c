@@ -35,6 +35,7 @@
  */
 #include <stdio.h>
 #include <string.h>
+#include <pthread.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <errno.h>
@@ -42,20 +43,39 @@
 #include <time.h>
 
 #include <signal.h>
+#include <poll.h>
 
 #include "common.h"
+#include "calllog.h"
+#include "safefile.h"
+#include "listindex.h"
+#include "metrics.h"
+#include "config.h"
+#include "server.h"
 
 #define DEBUG
 
 // Comment out the following define if you don't have ALSA audio
-// support. Then compile with:
-//     gcc -o jcblock jcblock.c truncate.c -lm
+// support. Then compile with (makejcblock without tones.c, pcmconv.c,
+// goertzel.c and -lasound):
+//     gcc -pthread -o jcblock jcblock.c calllog.c callstore.c callstats.c events.c safefile.c listindex.c listtable.c callerid.c libjcblock.c whatif.c control.c metrics.c config.c server.c truncate.c radio.c -ldl -lm
 // The program will then have all capabilities except the star (*) key
 // feature.
 #define DO_TONES
 
+// Uncomment the following define to detect the star (*) key tones in
+// the line audio sent by a voice modem over the serial port (modem
+// voice mode), rather than with a microphone placed next to the modem
+// speaker. DO_TONES must also be defined. No microphone or ALSA
+// support is needed. Compile with (makejcblock with voice.c instead
+// of tones.c and pcmconv.c, and without -lasound):
+//     gcc -pthread -o jcblock jcblock.c calllog.c callstore.c callstats.c events.c safefile.c listindex.c listtable.c callerid.c libjcblock.c whatif.c control.c metrics.c config.c server.c voice.c goertzel.c truncate.c radio.c -ldl -lm
+// See file voice.c to set the modem's voice sample format.
+//#define DO_VOICE_TONES
+
 // Comment out the following define if you don't have an answering
-// machine attached to the same telephone line.
+// machine attached to the same telephone line (answering_machine in
+// jcblock.conf, see DO_CONFIG).
 #define ANS_MACHINE
 
 // Comment out the following define if you don't want truncation of
@@ -67,8 +87,9 @@
 // that supports fax command: AT+FCLASS=2.0 (or, if this command does
 // not work with your fax modem, try: AT+FCLASS=2). By default this is
 // commented out so that the program will run with fax and non-fax
-// modems.
+// modems. (fax_tone and fax_command in jcblock.conf, see DO_CONFIG.)
 #define DO_FAX_TONE
+#define FAX_COMMAND       "AT+FCLASS=2.0"
 
 // Comment out the following define if you have a modem that does not
 // need a country code to operate with your country's phone system.
@@ -77,7 +98,9 @@
 // without one. Therefore the following define is commented out by
 // default. If you are located in a country with non-US compatible
 // phone system, see the README files for country code details.
+// (country_command in jcblock.conf, see DO_CONFIG.)
 //#define DO_COUNTRY_CODE
+#define COUNTRY_COMMAND   "AT+GCI=B5"
 
 // Comment out the following define if you are NOT using a Robotics
 // USB5637 modem. For this modem, calls must be terminated by using
@@ -91,21 +114,208 @@
 
 #ifdef SEND_ON_NETWORK
 #include "radio.h"
+
+// Uncomment the following define to also send each call record as a
+// binary message (see evproto.c) on port 9754, for clients that
+// should not have to parse the text or want to know if they missed
+// any. Then add evproto.c to the gcc compile command.
+//#define SEND_BINARY
+
+#ifdef SEND_BINARY
+#include "evproto.h"
+#endif
+#endif
+
+// Comment out the following define if client programs should not be
+// able to connect to the program to receive call records (see
+// events.c). Clients connect to the Unix socket jcblock.sock and, if
+// EVENT_TCP_PORT is not zero, to that TCP port. Then remove events.c
+// from the gcc compile command.
+#define DO_EVENTS
+#define EVENT_TCP_PORT    0
+
+#ifdef DO_EVENTS
+#include "events.h"
+#endif
+
+// Comment out the following define if the lists should not be
+// changeable through the control socket jcblock.ctl ("jcblock ctl",
+// see control.c). Then remove control.c from the gcc compile command.
+#define DO_CONTROL
+
+#ifdef DO_CONTROL
+#include "control.h"
+#endif
+
+// Comment out the following define if you don't want the call
+// counters and latency histograms (see metrics.c) served on the Unix
+// socket jcblock.metrics (in the Prometheus text format; also printed
+// on a SIGUSR1 signal). If METRICS_TCP_PORT is not zero (e.g., 9756),
+// they are also served on that port of 127.0.0.1. The counters are
+// still kept (metrics.c must stay in the gcc compile command).
+#define DO_METRICS
+#define METRICS_TCP_PORT  0
+
+// Comment out the following define if you don't want "jcblock
+// whatif", which shows which calls in the call history a whitelist
+// and blacklist (e.g., a new blacklist.dat) would handle differently
+// (see whatif.c). Then remove whatif.c and libjcblock.c from the gcc
+// compile command.
+#define DO_WHATIF
+
+#ifdef DO_WHATIF
+#include "whatif.h"
+#endif
+
+// Comment out the following define if you don't want calls to be
+// added to the binary call history (callstore.dat, see callstore.c)
+// that "jcblock query" searches. Then remove callstore.c from the gcc
+// compile command.
+#define DO_CALLSTORE
+
+#ifdef DO_CALLSTORE
+#include "callstore.h"
+#endif
+
+// Comment out the following define if you don't want counters to be
+// kept for each calling number (callstats.dat, see callstats.c) that
+// "jcblock stats" shows. Then remove callstats.c from the gcc compile
+// command.
+#define DO_CALLSTATS
+
+#ifdef DO_CALLSTATS
+#include "callstats.h"
+#endif
+
+// Uncomment the following define to block numbers that call too
+// often. A number that is not on the whitelist and has already
+// called RATE_MAX_CALLS times in the last RATE_WINDOW_MINUTES minutes
+// is blocked, and the call is tagged 'R' in callerID.dat.
+// DO_CALLSTATS must also be defined, and RATE_MAX_CALLS must not be
+// more than STATS_RECENT (see callstats.h).
+//#define DO_RATE_BLOCK
+#define RATE_MAX_CALLS       4
+#define RATE_WINDOW_MINUTES  (24 * 60)
+
+// Uncomment the following define to block bursts of "neighbor
+// spoofing" calls: unknown numbers (not on the whitelist and, if
+// DO_CALLSTATS is defined, not heard from before) in our own area
+// code and exchange NEIGHBOR_HOME or within NEIGHBOR_SPAN exchanges
+// of it. A call is blocked, and tagged 'N' in callerID.dat, if its
+// exchange has had NEIGHBOR_MAX_EXCHANGE such calls (counting it), or
+// all of those exchanges together NEIGHBOR_MAX_AREA, in the last
+// NEIGHBOR_WINDOW_MINUTES minutes (see neighbor.c). Then add
+// neighbor.c to the gcc compile command.
+//#define DO_NEIGHBOR_BLOCK
+#define NEIGHBOR_HOME            "978-909"
+#define NEIGHBOR_SPAN            1
+#define NEIGHBOR_WINDOW_MINUTES  60
+#define NEIGHBOR_MAX_EXCHANGE    3
+#define NEIGHBOR_MAX_AREA        5
+
+#ifdef DO_NEIGHBOR_BLOCK
+#include "neighbor.h"
 #endif
 
+#ifdef DO_TONES
+#include "goertzel.h"
+#endif
+
+// Comment out the following define if the settings below, and those
+// above that name a jcblock.conf setting, should not be read from the
+// file jcblock.conf (see config.c and jcblock.conf.example). The file
+// is read at startup and again on a SIGHUP signal ("kill -HUP <pid>"),
+// without stopping the program; the defines are the settings it does
+// not have. Then remove config.c from the gcc compile command.
+#define DO_CONFIG
+
+// The caller ID command (callerid_command), the length of the star
+// (*) key window in seconds (star_window) and the star key tone
+// threshold (tone_threshold; 0 selects the adaptive rule, see
+// goertzel.c)
+#define CALLER_ID_COMMAND "AT+VCID=1"
+#define STAR_WINDOW_SECS  10
+#define TONE_THRESHOLD    0
+
+// Dial, busy and reorder tones close the star (*) key window early.
+// Uncomment the following define if a silent line should close it too
+// (a caller who is slow to press the key may be cut off; otherwise the
+// window stays open for its full STAR_WINDOW_SECS seconds).
+//#define CLOSE_ON_SILENCE
+
+// How soon call records are forced to the disk (see calllog.h):
+// LOG_SYNC_NONE, LOG_SYNC_RECORD or LOG_SYNC_GROUP. With
+// LOG_SYNC_GROUP, records are synced LOG_GROUP_MSEC milliseconds
+// after the first record of a group is written.
+#define LOG_SYNC          LOG_SYNC_GROUP
+#define LOG_GROUP_MSEC    1000
+
+// Changes to blacklist.dat and whitelist.dat (date updates and *-key
+// entries) are written LIST_GROUP_MSEC milliseconds after the first
+// change of a group, with one rewrite of each file (see safefile.c).
+#define LIST_GROUP_MSEC   1000
+
 #define OPEN_PORT_BLOCKED 1
 #define OPEN_PORT_POLLED  0
 
+// Ring-stop poll timeouts (msec). See wait_for_response().
+#define RING_TIMEOUT      7000    // until the ring period is measured
+#define RING_TIMEOUT_MIN  2000
+#define RING_TIMEOUT_MAX  10000
+#define RING_MARGIN       1000    // added to the measured ring period
+
+// Uncomment the following define where caller ID is sent before the
+// first ring (as in England). A caller ID record is then used as soon
+// as its last (NAME) line arrives, instead of after the pause that
+// follows it (see read_message()), and a blocked call is answered at
+// once instead of after a one second wait, so that the phone does
+// not ring at all. Other modem messages end at a pause of
+// MESSAGE_GAP_MSEC milliseconds, as before.
+//#define DO_PRE_RING
+#define MESSAGE_GAP_MSEC  100
+
+// Serial port speed. Caller ID is sent at 1200 baud, but the audio
+// stream of modem voice mode needs a much faster port (the modem
+// adapts to the speed of the AT commands it receives).
+#ifdef DO_VOICE_TONES
+#define BAUD_RATE         B115200
+#else
+#define BAUD_RATE         B1200
+#endif
+
 // Default serial port specifier.
 char *serialPort = "/dev/ttyUSB0";
 int fd;                                  // the serial port
 
-FILE *fpWh;                              // whitelist.dat file
 static struct termios options;
 static time_t pollTime, pollStartTime;
 static bool modemInitialized = FALSE;
 static bool inBlockedReadCall = FALSE;
+static volatile bool stopProgram;       // set by cleanup()
+static int stopPipe[2] = { -1, -1 };    // wakes wait_for_modem()
 static int numRings;
+static long callStart;         // caller ID received (metricsNow())
+
+// The settings: the built-in ones (the defines above) or, with
+// DO_CONFIG, those read from jcblock.conf. New settings are taken
+// only between calls (see wait_for_response()).
+static const jcbConfig builtinConfig =
+{
+#ifdef DO_COUNTRY_CODE
+  .countryCommand = COUNTRY_COMMAND,
+#endif
+  .callerIdCommand = CALLER_ID_COMMAND,
+  .faxCommand = FAX_COMMAND,
+#ifdef DO_FAX_TONE
+  .faxTone = TRUE,
+#endif
+#ifdef ANS_MACHINE
+  .ansMachine = TRUE,
+#endif
+  .starWindowSecs = STAR_WINDOW_SECS,
+  .toneThreshold = TONE_THRESHOLD,
+};
+static const jcbConfig *config = &builtinConfig;
 
 static void cleanup( int signo );
 
@@ -113,13 +323,30 @@ static void cleanup( int signo );
 int wait_for_response(int fd);
 int send_modem_command(int fd, char *command );
 int send_timed_modem_command(int fd, char *command, int numSecs );
+static int send_setting_command( int fd, const char *command );
+#ifdef DO_CONFIG
+static void use_config();
+#endif
 static bool check_blacklist( char *callstr );
+static void terminate_call();
+#ifdef DO_RATE_BLOCK
+static bool check_rate( char *callstr );
+#endif
+#ifdef DO_NEIGHBOR_BLOCK
+static bool check_neighbor( char *callstr );
+#endif
 static bool write_blacklist( char *callstr );
 static bool check_whitelist( char * callstr );
 static void open_port( int mode );
 static void close_open_port();
+static long msec_now();
+static bool wait_for_modem( int fd );
+#ifdef DO_PRE_RING
+static int read_message( int fd, char *buffer, int size );
+#endif
 int init_modem(int fd);
 int tag_and_write_callerID_record( char *buffer, char tagChar);
+static int log_hook( const char *record );
 
 static char *copyright = "\n"
 	"jcblock Copyright (C) 2008 Walter S. Heath\n"
@@ -132,8 +359,43 @@ static char *copyright = "\n"
 int main(int argc, char **argv)
 {
   int optChar;
+  sigset_t sigs;
+
+#ifdef DO_CALLSTORE
+  // "jcblock query ..." searches the call history and exits
+  if( argc > 1 && strcmp( argv[1], "query" ) == 0 )
+  {
+    return callstoreQuery( argc - 1, argv + 1 );
+  }
+#endif
+#ifdef DO_CALLSTATS
+  // "jcblock stats ..." shows the counters for numbers and exits
+  if( argc > 1 && strcmp( argv[1], "stats" ) == 0 )
+  {
+    return callstatsQuery( argc - 1, argv + 1 );
+  }
+#endif
+#ifdef DO_CONTROL
+  // "jcblock ctl ..." changes the lists of the running program
+  if( argc > 1 && strcmp( argv[1], "ctl" ) == 0 )
+  {
+    return controlQuery( argc - 1, argv + 1 );
+  }
+#endif
+#ifdef DO_WHATIF
+  // "jcblock whatif ..." classifies the call history again and exits
+  if( argc > 1 && strcmp( argv[1], "whatif" ) == 0 )
+  {
+    return whatifQuery( argc - 1, argv + 1 );
+  }
+#endif
 
-  // Set Ctrl-C and kill terminator signal catchers
+  // Set Ctrl-C and kill terminator signal catchers. The catcher
+  // only asks main() to stop, through stopPipe (see cleanup()).
+  if( serverPipeOpen( "jcblock", stopPipe ) == -1 )
+  {
+    printf("Ctrl-C will not stop the program until the next call.\n");
+  }
   signal( SIGINT, cleanup );
   signal( SIGKILL, cleanup );
 
@@ -151,6 +413,18 @@ int main(int argc, char **argv)
         case 'h':
         default:
           fprintf( stderr, "Usage: jcblock [-p /dev/<portID>]\n" );
+#ifdef DO_CALLSTORE
+          fprintf( stderr, "       jcblock query -h (search the call history)\n" );
+#endif
+#ifdef DO_CALLSTATS
+          fprintf( stderr, "       jcblock stats -h (calls from each number)\n" );
+#endif
+#ifdef DO_CONTROL
+          fprintf( stderr, "       jcblock ctl -h (change the lists while running)\n" );
+#endif
+#ifdef DO_WHATIF
+          fprintf( stderr, "       jcblock whatif -h (try lists on the call history)\n" );
+#endif
           fprintf( stderr, "Default serial port is: /dev/ttyS0.\n" );
           fprintf( stderr, "For another port, use the -p option.\n" );
           _exit(-1);
@@ -161,29 +435,113 @@ int main(int argc, char **argv)
   // Display copyright notice
   printf( "%s", copyright );
 
-#ifdef DO_TONES
+  // SIGHUP (see config.c) and SIGUSR1 (see metrics.c) are only for
+  // the threads that handle them: a signal would cut short this
+  // thread's sleeps. Block them before any thread is started; those
+  // threads unblock them.
+  sigemptyset( &sigs );
+#ifdef DO_CONFIG
+  sigaddset( &sigs, SIGHUP );
+#endif
+#ifdef DO_METRICS
+  sigaddset( &sigs, SIGUSR1 );
+#endif
+  pthread_sigmask( SIG_BLOCK, &sigs, NULL );
+
+#ifdef DO_CONFIG
+  // Read the settings file (see config.c)
+  if( configOpen( CONFIG_FILE, &builtinConfig ) == -1 )
+  {
+    printf("configOpen() failed. The settings will not be read again on a SIGHUP.\n");
+  }
+  config = configHold();
+#endif
+#if defined(DO_TONES) && !defined(DO_VOICE_TONES)
   // Initialize the the star (*) key tones operation
   tonesInit();
 #endif
-  // Open or create a file to append caller ID strings to
-  if( (fpCa = fopen( "./callerID.dat", "a+" ) ) == NULL )
+#ifdef DO_TONES
+  goertzelSetFixedThreshold( config->toneThreshold );
+#endif
+  // Start the call log writer, which appends caller ID strings to
+  // the monthly callerID.dat segments (see calllog.c)
+  if( calllogOpen( "./callerID.dat", LOG_SYNC, LOG_GROUP_MSEC ) == -1 )
   {
-    printf("fopen() of callerID.dat failed\n");
+    printf("calllogOpen() of callerID.dat failed\n");
     return(-1);
   }
+#ifdef DO_CALLSTORE
+  // Also add each call to the call history (not required)
+  if( callstoreOpen() != 0 )
+  {
+    printf("callstoreOpen() failed. Calls will not be added to the call history.\n");
+  }
+#endif
+#ifdef DO_CALLSTATS
+  // And count the calls from each number (not required)
+  if( callstatsOpen() != 0 )
+  {
+    printf("callstatsOpen() failed. Calls will not be counted.\n");
+  }
+#endif
+#ifdef DO_NEIGHBOR_BLOCK
+  // Count the calls from unknown numbers by exchange (see neighbor.c)
+  if( neighborOpen( NEIGHBOR_HOME, NEIGHBOR_SPAN, NEIGHBOR_WINDOW_MINUTES,
+                    NEIGHBOR_MAX_EXCHANGE, NEIGHBOR_MAX_AREA ) != 0 )
+  {
+    printf("neighborOpen() failed. Neighbor spoofing calls will not be blocked.\n");
+  }
+#endif
+  calllogSetHook( log_hook );
+#ifdef SEND_ON_NETWORK
+  // Create the broadcast sockets and start the sender thread
+  // (see radio.c)
+  if( radioOpen() == -1 )
+  {
+    printf("radioOpen() failed. Calls will not be sent on the network.\n");
+  }
+#endif
+#ifdef DO_EVENTS
+  // Start the server that sends call records to client programs
+  if( eventsOpen( EVENT_SOCKET, EVENT_TCP_PORT ) == -1 )
+  {
+    printf("eventsOpen() failed. Clients will not receive calls.\n");
+  }
+#endif
 
-  // Open the whitelist file (for reading & writing)
-  if( (fpWh = fopen( "./whitelist.dat", "r+" ) ) == NULL )
+  // Start the list writer, which makes the changes to the list
+  // files (see safefile.c)
+  if( listEditsStart( LIST_GROUP_MSEC ) == -1 )
   {
-    printf("fopen() of whitelist.dat failed. A whitelist is not required.\n" );
+    printf("listEditsStart() failed\n");
+    return(-1);
   }
 
-  // Open the blacklist file (for reading & writing)
-  if( (fpBl = fopen( "./blacklist.dat", "r+" ) ) == NULL )
+  // Read the list files into memory (see listindex.c)
+  if( listIndexOpen() == -1 )
   {
-    printf("fopen() of blacklist.dat failed. A blacklist must exist.\n" );
+    printf("Reading blacklist.dat failed. A blacklist must exist.\n" );
+    listEditsStop();
     return(-1);
   }
+  if( access( "./whitelist.dat", F_OK ) != 0 )
+  {
+    printf("whitelist.dat not found. A whitelist is not required.\n" );
+  }
+#ifdef DO_CONTROL
+  // Start the server for "jcblock ctl" commands (see control.c)
+  if( controlOpen( CONTROL_SOCKET ) == -1 )
+  {
+    printf("controlOpen() failed. The lists can't be changed with \"jcblock ctl\".\n");
+  }
+#endif
+#ifdef DO_METRICS
+  // Start the metrics server (see metrics.c)
+  if( metricsOpen( METRICS_SOCKET, METRICS_TCP_PORT ) == -1 )
+  {
+    printf("metricsOpen() failed. Metrics are not available.\n");
+  }
+#endif
   // Open the serial port
   open_port( OPEN_PORT_BLOCKED );
 
@@ -192,10 +550,37 @@ int main(int argc, char **argv)
   {
     printf("init_modem() failed\n");
     close(fd);
-    fclose(fpCa);
-    fclose(fpBl);
-    fclose(fpWh);
-#ifdef DO_TONES
+#ifdef DO_CONTROL
+    controlClose();
+#endif
+#ifdef DO_METRICS
+    metricsClose();
+#endif
+#ifdef DO_TRUNCATE
+    truncate_wait();
+#endif
+    listEditsStop();
+    calllogClose();
+#ifdef SEND_ON_NETWORK
+    radioClose();
+#endif
+#ifdef DO_EVENTS
+    eventsClose();
+#endif
+#ifdef DO_CALLSTORE
+    callstoreClose();
+#endif
+#ifdef DO_CALLSTATS
+    callstatsClose();
+#endif
+#ifdef DO_NEIGHBOR_BLOCK
+    neighborClose();
+#endif
+    listIndexClose();
+#ifdef DO_CONFIG
+    configClose();
+#endif
+#if defined(DO_TONES) && !defined(DO_VOICE_TONES)
     tonesClose();
 #endif
     fflush(stdout);
@@ -207,14 +592,46 @@ modemInitialized = TRUE;
 
   printf("Waiting for a call...\n");
 
-  // Wait for calls to come in...
+  // Wait for calls to come in (until Ctrl-C)...
   wait_for_response(fd);
 
+  // Reset the modem and close everything
+#ifdef DEBUG
+  printf("sending ATZ command...\n");
+#endif
+  send_modem_command(fd, "ATZ\r");
   close( fd );
-  fclose(fpCa);
-  fclose(fpBl);
-  fclose(fpWh);
-#ifdef DO_TONES
+#ifdef DO_CONTROL
+  controlClose();
+#endif
+#ifdef DO_METRICS
+  metricsClose();
+#endif
+#ifdef DO_TRUNCATE
+  truncate_wait();
+#endif
+  listEditsStop();
+  calllogClose();
+#ifdef SEND_ON_NETWORK
+  radioClose();
+#endif
+#ifdef DO_EVENTS
+  eventsClose();
+#endif
+#ifdef DO_CALLSTORE
+  callstoreClose();
+#endif
+#ifdef DO_CALLSTATS
+  callstatsClose();
+#endif
+#ifdef DO_NEIGHBOR_BLOCK
+  neighborClose();
+#endif
+  listIndexClose();
+#ifdef DO_CONFIG
+  configClose();
+#endif
+#if defined(DO_TONES) && !defined(DO_VOICE_TONES)
   tonesClose();
 #endif
   fflush(stdout);
@@ -248,19 +665,20 @@ int init_modem(int fd )
     return(-1);
   }
 
-#ifdef DO_COUNTRY_CODE
   // If operating in a non-US telephone system region,
-  // insert an appropriate "AT+GCI=XX\r" modem command here.
-  // See the README2 file for details (the code for the US
-  // is B5).
+  // send an appropriate "AT+GCI=XX" modem command here
+  // (see DO_COUNTRY_CODE). See the README2 file for
+  // details (the code for the US is B5).
+  if( config->countryCommand[0] != '\0' )
+  {
 #ifdef DEBUG
 printf("sending country code command...\n");
 #endif
-  if( send_modem_command(fd, "AT+GCI=B5\r") != 0 )
-  {
-    return(-1);
+    if( send_setting_command(fd, config->countryCommand) != 0 )
+    {
+      return(-1);
+    }
   }
-#endif
 
   // Tell the modem to return caller ID. Note: different
   // modems use different commands here. If this command
@@ -273,19 +691,22 @@ printf("sending country code command...\n");
 #ifdef DEBUG
 printf("sending caller ID command...\n");
 #endif
-  if( send_modem_command(fd, "AT+VCID=1\r") != 0 )
+  if( send_setting_command(fd, config->callerIdCommand) != 0 )
   {
     return(-1);
   }
-#ifdef DO_FAX_TONE
-  // Put modem in FAX service class mode
-  // (note: you may need to send "AT+FCLASS=2\r"
-  // instead).
-  send_modem_command(fd,"AT+FCLASS=2.0\r");
-#else			// non-FAX mode
-  // Make sure modem is in non-FAX command mode.
-  send_modem_command(fd,"AT+FCLASS=0\r");
-#endif
+  if( config->faxTone )
+  {
+    // Put modem in FAX service class mode
+    // (note: you may need to send "AT+FCLASS=2"
+    // instead).
+    send_setting_command(fd, config->faxCommand);
+  }
+  else
+  {
+    // Make sure modem is in non-FAX command mode.
+    send_modem_command(fd,"AT+FCLASS=0\r");
+  }
   return(0);
 }
 
@@ -298,6 +719,7 @@ int send_modem_command(int fd, char *command )
   char *bufptr;         // Current char in buffer
   int nbytes;           // Number of bytes read
   int tries;            // Number of tries so far
+  long start = metricsNow();
 
   // Send an AT command followed by a CR
   if( write(fd, command, strlen(command) ) != strlen(command) )
@@ -327,12 +749,15 @@ int send_modem_command(int fd, char *command )
 #ifdef DEBUG
       printf("got command OK\n");
 #endif
+      metricsObserve( STAGE_MODEM_COMMAND, start );
       return( 0 );
     }
   }
 #ifdef DEBUG
     printf("did not get command OK\n");
 #endif
+  metricsCount( METRIC_MODEM_FAILURES );
+  metricsObserve( STAGE_MODEM_COMMAND, start );
   return( -1 );
 }
 
@@ -353,6 +778,44 @@ int send_timed_modem_command(int fd, char *command, int numSecs )
   return(0);
 }
 
+//
+// Send a modem command from the settings (which have no CR).
+//
+static int send_setting_command( int fd, const char *command )
+{
+  char buffer[CONFIG_COMMAND_LEN + 1];
+
+  snprintf( buffer, sizeof(buffer), "%s\r", command );
+  return send_modem_command( fd, buffer );
+}
+
+#ifdef DO_CONFIG
+//
+// Take the newest settings (see config.c). If the modem commands
+// changed, set the modem up again with them now.
+//
+static void use_config()
+{
+  jcbConfig old = *config;
+
+  config = configHold();
+  printf("Using settings %lu from %s\n", config->generation, CONFIG_FILE + 2);
+#ifdef DO_TONES
+  goertzelSetFixedThreshold( config->toneThreshold );
+#endif
+  if( strcmp( old.countryCommand, config->countryCommand ) != 0 ||
+      strcmp( old.callerIdCommand, config->callerIdCommand ) != 0 ||
+      strcmp( old.faxCommand, config->faxCommand ) != 0 ||
+      old.faxTone != config->faxTone )
+  {
+    if( init_modem( fd ) != 0 )
+    {
+      printf("init_modem() with the new settings failed\n");
+    }
+  }
+}
+#endif
+
 //
 // Wait (forever!) for calls...
 //
@@ -363,21 +826,31 @@ int wait_for_response(fd)
   int nbytes2;          // bytes in buffer2
   char buffer3[255];
   char bufRing[10];     // RING input buffer
+  long ringPollStart;   // ring-stop poll times (msec)
+  long lastRingTime;
+  long ringTimeout;
+#ifdef DO_TONES
+  int callProgress;     // call progress tone heard in the window
+#endif
   int nbytes;           // Number of bytes read
   int i, j;
   struct tm *tmPtr;
   time_t currentTime;
   int currentYear;
   char curYear[4];
+#if defined(DO_CALLSTATS) && defined(DEBUG)
+  char *nmbrPtr;
+  callStats numberStats; // counters for the calling number
+#endif
 
   // Get a string of characters from the modem
   while(1)
   {
 #ifdef DEBUG
     // Flush anything in stdout (needed if stdout is redirected to
-    // a disk file).
+    // a disk file). The kernel writes it to the disk; a sync() of
+    // every file system for each message is not needed.
     fflush(stdout);     // flush C library buffers to kernel buffers
-    sync();             // flush kernel buffers to disk
 #endif
 
     // Block until at least one character is available.
@@ -387,8 +860,18 @@ int wait_for_response(fd)
     // shouldn't happen, since VMIN is set larger than
     // the longest string expected).
 
+    // Wait for a message (or a Ctrl-C, see cleanup()). New
+    // settings are taken while waiting.
+    if( wait_for_modem( fd ) == FALSE )
+    {
+      return 0;
+    }
     inBlockedReadCall = TRUE;
+#ifdef DO_PRE_RING
+    nbytes = read_message( fd, buffer, 250 );
+#else
     nbytes = read( fd, buffer, 250 );
+#endif
     inBlockedReadCall = FALSE;
 
     // Occasionally a call comes in that has a caller ID
@@ -427,14 +910,22 @@ int wait_for_response(fd)
       continue;
     }
 
-    // Ignore a string "AT+VCID=1" returned from the modem.
-    if( strncmp( buffer, "AT+VCID=1", 9 ) == 0 )
+    // Ignore the caller ID command (e.g., "AT+VCID=1") echoed by
+    // the modem.
+    if( strncmp( buffer, config->callerIdCommand,
+                 strlen( config->callerIdCommand ) ) == 0 )
     {
       continue;
     }
 
+#ifdef DO_PRE_RING
+    // Caller ID data was received before the first ring.
+    numRings = 0;
+#else
     // Caller ID data was received after the first ring.
     numRings = 1;
+#endif
+    callStart = metricsNow();
 
     // A caller ID string was constructed.
 
@@ -504,19 +995,27 @@ int wait_for_response(fd)
     buffer3[13] = curYear[0];
     buffer3[14] = curYear[1];
 
-    // If a whitelist.dat file was present, compare the
-    // caller ID string to entries in the whitelist. If a match
+#if defined(DO_CALLSTATS) && defined(DEBUG)
+    // Show how often the number has called before (see
+    // callstats.c).
+    if( (nmbrPtr = strstr( buffer3, "NMBR = " )) != NULL &&
+        callstatsLookup( nmbrPtr + 7, &numberStats ) == 0 )
+    {
+      printf("Calls from this number: %u in the last %d days, %u in all\n",
+        numberStats.windowCalls, STATS_WINDOW_DAYS, numberStats.totalCalls);
+    }
+#endif
+
+    // Compare the caller ID string to entries in the whitelist
+    // (if whitelist.dat is not present, it has none). If a match
     // is found, accept the call and bypass the blacklist check.
-    if( fpWh != NULL )
+    if( check_whitelist( buffer3 ) == TRUE )
     {
-      if( check_whitelist( buffer3 ) == TRUE )
-      {
-        // Caller ID match was found so accept the call
+      // Caller ID match was found so accept the call
 
-        // Tag and write the call record to the callerID.dat file.
-        tag_and_write_callerID_record( buffer3, 'W');
-        continue;
-      }
+      // Tag and write the call record to the callerID.dat file.
+      tag_and_write_callerID_record( buffer3, 'W');
+      continue;
     }
 
     // Compare the caller ID string to entries in the blacklist. If
@@ -535,7 +1034,8 @@ int wait_for_response(fd)
       // Note: it is not necessary for this function to run for the
       // main program to operate normally. You may remove it if you
       // don't want automatic file truncation. All of its code is in
-      // truncate.c.
+      // truncate.c. The work is done by a background thread, so the
+      // call is not delayed.
       truncate_records();
 #endif                            // end DO_TRUNCATE
 
@@ -543,6 +1043,25 @@ int wait_for_response(fd)
       tag_and_write_callerID_record( buffer3, 'B');
       continue;
     }
+#ifdef DO_RATE_BLOCK
+    // If the number is calling too often, terminate the call.
+    else if( check_rate( buffer3 ) == TRUE )
+    {
+      // Tag and write the call record to the callerID.dat file.
+      tag_and_write_callerID_record( buffer3, 'R');
+      continue;
+    }
+#endif
+#ifdef DO_NEIGHBOR_BLOCK
+    // If the call is one of a burst from unknown numbers next to
+    // ours, terminate the call.
+    else if( check_neighbor( buffer3 ) == TRUE )
+    {
+      // Tag and write the call record to the callerID.dat file.
+      tag_and_write_callerID_record( buffer3, 'N');
+      continue;
+    }
+#endif
 #ifdef DO_TONES
     else
     {
@@ -565,15 +1084,30 @@ int wait_for_response(fd)
       open_port( OPEN_PORT_POLLED );
 
       // Now poll until 'RING' strings stop arriving.
-      // Note: seven seconds is just longer than the
-      // inter-ring time (six seconds).
-      while( (pollTime = time( NULL )) < pollStartTime + 7 )
+      // Note: seven seconds is just longer than the US
+      // inter-ring time (six seconds). Once two rings have
+      // been seen, the measured inter-ring time (plus a
+      // margin) is used instead, so the poll ends sooner
+      // where the rings come faster.
+      ringTimeout = RING_TIMEOUT;
+      lastRingTime = 0;
+      ringPollStart = msec_now();
+      while( msec_now() < ringPollStart + ringTimeout )
       {
         if( ( nbytes = read( fd, bufRing, 1 ) ) > 0 )
         {
           if(bufRing[0] == 'R')
           {
-            pollStartTime  = time( NULL );
+            ringPollStart = msec_now();
+            if( lastRingTime != 0 )
+            {
+              ringTimeout = ringPollStart - lastRingTime + RING_MARGIN;
+              if( ringTimeout < RING_TIMEOUT_MIN )
+                ringTimeout = RING_TIMEOUT_MIN;
+              if( ringTimeout > RING_TIMEOUT_MAX )
+                ringTimeout = RING_TIMEOUT_MAX;
+            }
+            lastRingTime = ringPollStart;
             numRings++;                   // count the ring
           }
         }
@@ -586,7 +1120,6 @@ int wait_for_response(fd)
       open_port( OPEN_PORT_BLOCKED );
       usleep( 250000 );         // quarter second
 
-#ifdef ANS_MACHINE
       // If the call is answered after two or three rings, poll for
       // a touchtone star (*) key press. Note that if an answering
       // machine is connected to the line, the star feature is only
@@ -595,15 +1128,30 @@ int wait_for_response(fd)
       // machines. The answering machine *must be* set to answer on
       // the fourth or later ring. See the README and UPDATES files
       // for further details.
-      if( numRings == 2 || numRings == 3 )
-      {
-#else
       // If no answering machine is connected to the same telephone
-      // line, the star key feature is available for calls answered
-      // after two or more rings.
-      if( TRUE )
+      // line (see ANS_MACHINE), the star key feature is available for
+      // calls answered after two or more rings.
+      if( !config->ansMachine || numRings == 2 || numRings == 3 )
       {
-#endif
+#ifdef DO_VOICE_TONES
+        // Send off-hook and on-hook commands to produce two clicks.
+        // The third click is heard when the modem connects to the
+        // line in voice mode to receive the line audio. That indicates
+        // the start of the timed window when a star (*) key press will
+        // be accepted.
+        send_modem_command(fd, "ATH1\r"); // off hook
+        send_modem_command(fd, "ATH0\r"); // on hook
+
+        if( voiceStart(fd) == FALSE )
+        {
+          printf("voiceStart() failed\n");
+          voiceStop(fd);
+          tag_and_write_callerID_record( buffer3, '-');
+          send_modem_command(fd, "ATZ\r");
+          send_setting_command(fd, config->callerIdCommand);
+          continue;
+        }
+#else
         //
         // Send an off-hook modem command so the mic can pick up the tones
         // generated by the star (*) key press. When the command is sent
@@ -622,6 +1170,7 @@ int wait_for_response(fd)
 	// Remove any audio samples currently in the audio buffer (from a
 	// previous call).
 	tonesClearBuffer();
+#endif
 
         // Get current time (seconds since Unix Epoch)
         if( (pollStartTime = time( NULL ) ) == -1 )
@@ -631,10 +1180,15 @@ int wait_for_response(fd)
         }
 
         // Poll for star (*) key press within the timeout window
-        // (ten seconds)
-        while( (pollTime = time( NULL )) < pollStartTime + 10 )
+        // (star_window seconds). If the far end hangs up (dial, busy
+        // or reorder tone, or silence, is heard) close the window now.
+        while( (pollTime = time( NULL )) < pollStartTime + config->starWindowSecs )
         {
+#ifdef DO_VOICE_TONES
+          if( voicePoll(fd) == TRUE )
+#else
           if( tonesPoll() == TRUE )
+#endif
           {
             // Write a caller ID entry to blacklist.dat.
             if( write_blacklist( buffer3 ) == TRUE)
@@ -650,21 +1204,41 @@ int wait_for_response(fd)
             }
             break;
           }
+
+          callProgress = goertzelCallProgress();
+#ifndef CLOSE_ON_SILENCE
+          if( callProgress == CP_SILENCE )
+          {
+            callProgress = CP_NONE;
+          }
+#endif
+          if( callProgress != CP_NONE )
+          {
+            printf("Far end hung up (%s), window closed\n",
+                          goertzelCallProgressName( callProgress ) );
+            tag_and_write_callerID_record( buffer3, '-');
+            break;
+          }
         }
 
         // If poll time expired...
-        if(pollTime >= pollStartTime + 10 )
+        if(pollTime >= pollStartTime + config->starWindowSecs )
         {
           // Tag and write the call record to the callerID.dat file.
           // (tag '-' just overwrites the existing same char).
           tag_and_write_callerID_record( buffer3, '-');
         }
 
+#ifdef DO_VOICE_TONES
+        // Stop the line audio stream and go on hook.
+        voiceStop(fd);
+#endif
+
         // Re-initialize the modem to return caller ID.
         // This also produces two clicks to signal the
         // end of the tone detection window.
         send_modem_command(fd, "ATZ\r");
-        send_modem_command(fd, "AT+VCID=1\r");
+        send_setting_command(fd, config->callerIdCommand);
         continue;
       }
     }
@@ -684,385 +1258,294 @@ int wait_for_response(fd)
 // The tag indicates if the call record matched an  entry in
 // the blacklist (tag 'B'), the whitelist (tag 'W'), was
 // put on the blacklist by pressing the star (*) key
-// (tag *) or was accepted (leaves the tag character as it
-// was: '-').
+// (tag *), was blocked for calling too often (tag 'R',
+// see check_rate()), was blocked as one of a burst of
+// calls from next to our own number (tag 'N', see
+// check_neighbor()) or was accepted (leaves the tag
+// character as it was: '-').
 //
 int tag_and_write_callerID_record( char *buffer, char tagChar)
 {
   // Overwrite the first character in the buffer with the tag.
   buffer[0] = tagChar;
+  metricsCallTag( tagChar );
 
-#ifdef SEND_ON_NETWORK
-    // Socket broadcast the buffer's contents.
-    broadcast(buffer);
-#endif
-
-  // Close and re-open file 'callerID.dat' (in case it was
-  // edited while the program was running!).
-  fclose(fpCa);
-  if( (fpCa = fopen( "./callerID.dat", "a+" ) ) == NULL )
-  {
-    printf("re-fopen() of callerID.dat failed\n");
-    return(-1);
-  }
-  // Write the record to the file
-  if( fputs( (const char *)buffer, fpCa ) == EOF )
+  // Queue the record for the call log writer. It appends the
+  // record to 'callerID.dat' with one write() (re-opening the file
+  // if it was edited while the program was running!) and syncs it
+  // as LOG_SYNC says, without holding up the call.
+  if( calllogWrite( (const char *)buffer ) == -1 )
   {
-    printf("fputs( (const char *)buffer, fpCa ) failed\n");
+    printf("calllogWrite() failed\n");
     return(-1);
   }
+  metricsObserve( STAGE_CALL, callStart );
 
-  // Flush the record to the file
-  if( fflush(fpCa) == EOF )
+#ifdef SEND_ON_NETWORK
+  // Queue the record to be sent on the network. The sender
+  // thread in radio.c sends it, so this never waits.
+  broadcast(buffer);
+#ifdef SEND_BINARY
   {
-    printf("fflush(fpCa) failed\n");
-    return(-1);
+    static uint32_t eventSeq;
+    unsigned char message[EVPROTO_MAX_LEN];
+    int len;
+
+    if( (len = evprotoEncode( buffer, eventSeq++, msec_now(), message,
+                              sizeof(message) )) > 0 )
+      broadcastBinary( message, len );
   }
+#endif
+#endif
+#ifdef DO_EVENTS
+  // And send it to the connected clients (see events.c)
+  eventsPublish(buffer);
+#endif
   return(0);
 }
 
 //
-// Compare strings in the 'whitelist.dat' file to fields in the
-// received caller ID string. If a whitelist string is present
+// Called by the call log writer thread (see calllog.c) for each
+// record it writes, to add the call to the call history and to the
+// counters for its number.
+//
+static int log_hook( const char *record )
+{
+#ifdef DO_CALLSTORE
+  callstoreAppend( record );
+#endif
+#ifdef DO_CALLSTATS
+  callstatsAppend( record );
+#endif
+  return 0;
+}
+
+//
+// Compare the whitelist.dat entries (kept in memory, see listindex.c)
+// to fields in the received caller ID string. If an entry matches
 // (or an error occurred), return TRUE; otherwise return FALSE.
 //
 static bool check_whitelist( char *callstr )
 {
-  char whitebuf[100];
-  char whitebufsave[100];
-  char *whitebufptr;
-  char call_date[10];
+  char whitebuf[LIST_LINE_LEN];
+  char whitebufnew[LIST_LINE_LEN];
   char *dateptr;
-  char *strptr;
-  long file_pos_last, file_pos_next;
-
-  // Close and re-open the whitelist.dat file. Note: this
-  // seems to be necessary to be able to write records
-  // back into the file. The write works the first time
-  // after the file is opened but not subsequently! :-(
-  // This also allows whitelist changes made while the
-  // program is running to be recognized.
-  //
-  fclose( fpWh );
-  // Re-open for reading and writing
-  if( (fpWh = fopen( "./whitelist.dat", "r+" ) ) == NULL )
-  {
-    printf("Re-open of whitelist.dat file failed\n" );
-    return(TRUE);           // accept the call
-  }
 
-  // Disable buffering for whitelist.dat writes
-  setbuf( fpWh, NULL );
-
-  // Seek to beginning of list
-  fseek( fpWh, 0, SEEK_SET );
-
-  // Save the file's current access location
-  if( (file_pos_next = ftell( fpWh )) == -1L )
+  // Find the first entry whose search string is in the caller ID
+  // string. The index reads whitelist.dat again if it was changed
+  // while the program was running.
+  if( listMatch( LIST_WHITE, callstr, whitebuf ) == FALSE )
   {
-    printf("ftell(fpWh) failed\n");
-    return(TRUE);           // accept the call
+    // No whitelist.dat entry matched, so return FALSE.
+    return(FALSE);
   }
+#ifdef DEBUG
+  printf("whitelist entry matches: %s\n", whitebuf );
+#endif
 
-  // Read and process records from the file
-  while( fgets( whitebuf, sizeof( whitebuf ), fpWh ) != NULL )
+  // Make sure the 'DATE = ' field is present
+  if( (dateptr = strstr( callstr, "DATE = " ) ) == NULL )
   {
-    // Save the start location of the string just read and get
-    // the location of the start of the next string in the file.
-    file_pos_last = file_pos_next;
-    file_pos_next = ftell( fpWh );
-
-    // Ignore lines that start with a '#' character (comment lines)
-    if( whitebuf[0] == '#' )
-      continue;
-
-    // Ignore lines containing just a '\n'
-    if( whitebuf[0] == '\n' )
-    {
-      continue;
-    }
+    printf( "DATE field not found in caller ID!\n" );
+    return(TRUE);     // accept the call
+  }
 
-    // Ignore records that are too short (don't have room for the date)
-    if( strlen( whitebuf ) < 26 )
-    {
-      printf("ERROR: whitelist.dat record is too short to hold date field.\n");
-      printf("       record: %s", whitebuf);
-      printf("       record is ignored (edit file and fix it).\n");
-      continue;
-    }
+  // Update the date (from the caller ID string) in a copy of the
+  // record
+  strcpy( whitebufnew, whitebuf );
+  strncpy( &whitebufnew[19], &dateptr[7], 6 );
 
-    // Save the string (for writing back to the file later)
-    strcpy( whitebufsave, whitebuf );
+  // Change the entry. The list writer changes the file.
+  if( listChange( LIST_WHITE, whitebuf, whitebufnew ) == -1 )
+  {
+    printf("listChange(whitelist.dat) failed\n" );
+  }
 
-    // Make sure a '?' char is present in the string
-    if( ( strptr = strstr( whitebuf, "?" ) ) == NULL )
-    {
-      printf("ERROR: all whitelist.dat entry first fields *must be*\n");
-      printf("       terminated with a \'?\' character!! Entry is:\n");
-      printf("       %s", whitebuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+  // A whitelist.dat entry matched, so return TRUE
+  return(TRUE);             // accept the call
+}
 
-    // Make sure the '?' character is within the first twenty characters
-    if( (int)( strptr - whitebuf ) > 18 )
-    {
-      printf("ERROR: terminator '?' is not within first 20 characters\n" );
-      printf("       %s", whitebuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+//
+// Terminate (answer and hang up) the current call, then prepare the
+// modem for the next call. Used for blacklisted and rate blocked
+// calls.
+//
+static void terminate_call()
+{
+  long start = metricsNow();
 
-    // Get a pointer to the search token in the string
-    if( ( whitebufptr = strtok( whitebuf, "?" ) ) == NULL )
-    {
-      printf("whitebuf strtok() failed\n");
-      return(TRUE);         // accept the call
-    }
+#ifndef DO_PRE_RING
+  sleep(1);
+#endif
 
-    // Scan the call string for the whitelist entry
-    if( strstr( callstr, whitebufptr ) != NULL )
-    {
+  if( config->faxTone )
+  {
+    // Send an ATA command. Don't wait for a response.
+    // Wait five seconds and return. This command starts
+    // with a CED tone (see UPDATES file for CED
+    // definition). That simulates a fax initial response.
 #ifdef DEBUG
-      printf("whitelist entry matches: %s\n", whitebuf );
+    printf("sending CED tone ATA command\n");
 #endif
-      // Make sure the 'DATE = ' field is present
-      if( (dateptr = strstr( callstr, "DATE = " ) ) == NULL )
-      {
-        printf( "DATE field not found in caller ID!\n" );
-        return(TRUE);     // accept the call
-      }
-
-      // Get the current date from the caller ID string
-      strncpy( call_date, &dateptr[7], 6 );
-
-      // Terminate the string
-      call_date[6] = 0;
-
-      // Update the date in the whitebufsave record
-      strncpy( &whitebufsave[19], call_date, 6 );
-
-      // Write the record back to the whitelist.dat file
-      fseek( fpWh, file_pos_last, SEEK_SET );
-      if( fputs( whitebufsave, fpWh ) == EOF )
-      {
-        printf("fputs(whitebufsave, fpWh) failed\n" );
-        return(TRUE);         // accept the call
-      }
-
-      // Flush the string to the file
-      if( fflush(fpWh) == EOF )
-      {
-        printf("fflush(fpWh) failed\n");
-        return(TRUE);         // accept the call
-      }
+    send_timed_modem_command(fd, "ATA\r", 5);
 
-      // Force kernel file buffers to the disk
-      // (probably not necessary)
-      sync();
-
-      // A whitelist.dat entry matched, so return TRUE
-      return(TRUE);             // accept the call
-    }
-  }                               // end of while()
+    // Terminate the call by closing the modem serial port.
+    // Then re-open it and re-initialize the modem to
+    // prepare for the next call.
+    close_open_port();
+  }
+  else                     // non-FAX mode
+  {
+#ifdef DO_USR5637_MODEM
+    // Terminate the call by sending off hook and
+    // on hook commands. Then re-initialize the modem
+    // to prepare for the next call.
+    send_modem_command(fd, "ATH1\r");  // off hook
+    usleep( 250000 );    // quarter second
+    send_modem_command(fd, "ATH0\r");  // on hook
+    usleep( 250000 );    // quarter second
+    init_modem(fd);
+#else                      // don't DO_USR5637_MODEM
+    // Send an ATA command. Don't wait for a response.
+    // Wait one second and return. This command seems to
+    // be needed in the non-FAX mode (don't know why!).
+    send_timed_modem_command(fd, "ATA\r", 1);
+
+    // Terminate the call by closing the modem serial port.
+    // Then re-open it and re-initialize the modem to
+    // prepare for the next call.
+    close_open_port();
+#endif                     // end of DO_USR5637_MODEM
+  }
 
-  // No whitelist.dat entry matched, so return FALSE.
-  return(FALSE);
+  metricsObserve( STAGE_TERMINATE, start );
 }
 
 //
-// Compare strings in the 'blacklist.dat' file to fields in the
-// received caller ID string. If a blacklist string is present,
+// Compare the blacklist.dat entries (kept in memory, see listindex.c)
+// to fields in the received caller ID string. If an entry matches,
 // send commands to the modem to that will terminate the call...
 //
 static bool check_blacklist( char *callstr )
 {
-  char blackbuf[100];
-  char blackbufsave[100];
-  char *blackbufptr;
-  char call_date[10];
+  char blackbuf[LIST_LINE_LEN];
+  char blackbufnew[LIST_LINE_LEN];
   char *dateptr;
-  char *strptr;
-  long file_pos_last, file_pos_next;
-
-  // Close and re-open the blacklist.dat file. Note: this
-  // seems to be necessary to be able to write records
-  // back into the file. The write works the first time
-  // after the file is opened but not subsequently! :-(
-  // This also allows blacklist changes made while the
-  // program is running to be recognized.
-  //
-  fclose( fpBl );
-  // Re-open for reading and writing
-  if( (fpBl = fopen( "./blacklist.dat", "r+" ) ) == NULL )
+
+  // Find the first entry whose search string is in the caller ID
+  // string. The index reads blacklist.dat again if it was changed
+  // while the program was running (or truncated, see truncate.c).
+  if( listMatch( LIST_BLACK, callstr, blackbuf ) == FALSE )
   {
-    printf("re-open fopen( blacklist) failed\n" );
+    /* A blacklist.dat entry was not matched, so return FALSE */
     return(FALSE);
   }
+#ifdef DEBUG
+  printf("blacklist entry matches: %s\n", blackbuf );
+#endif
+  terminate_call();
 
-  // Disable buffering for blacklist.dat writes
-  setbuf( fpBl, NULL );
-
-  // Seek to beginning of list
-  fseek( fpBl, 0, SEEK_SET );
-
-  // Save the file's current access location
-  if( (file_pos_next = ftell( fpBl )) == -1L )
+  // Make sure the 'DATE = ' field is present
+  if( (dateptr = strstr( callstr, "DATE = " ) ) == NULL )
   {
-    printf("ftell(fpBl) failed\n");
+    printf( "DATE field not found in caller ID!\n" );
     return(FALSE);
   }
 
-  // Read and process records from the file
-  while( fgets( blackbuf, sizeof( blackbuf ), fpBl ) != NULL )
+  // Check the date field of the entry. If it is not '++++++' (not
+  // a permanent record), change it.
+  if( strncmp( &blackbuf[19], "++++++", 6 ) != 0 )
   {
-    // Save the start location of the string just read and get
-    // the location of the start of the next string in the file.
-    file_pos_last = file_pos_next;
-    file_pos_next = ftell( fpBl );
+    // Update the date (from the caller ID string) in a copy of the
+    // record
+    strcpy( blackbufnew, blackbuf );
+    strncpy( &blackbufnew[19], &dateptr[7], 6 );
 
-    // Ignore lines that start with a '#' character (comment lines)
-    if( blackbuf[0] == '#' )
-      continue;
-
-    // Ignore lines containing just a '\n'
-    if( blackbuf[0] == '\n' )
+    // Change the entry. The list writer changes the file.
+    if( listChange( LIST_BLACK, blackbuf, blackbufnew ) == -1 )
     {
-      continue;
-    }
-
-    // Ignore records that are too short (don't have room for the date)
-    if( strlen( blackbuf ) < 26 )
-    {
-       printf("ERROR: blacklist.dat record is too short to hold date field.\n");
-       printf("       record: %s", blackbuf );
-       printf("       record is ignored (edit file and fix it).\n");
-       continue;
+      printf("listChange(blacklist.dat) failed\n" );
     }
+  }
 
-    // Save the string (for writing back to the file later)
-    strcpy( blackbufsave, blackbuf );
+  // A blacklist.dat entry matched, so return TRUE
+  return(TRUE);
+}
 
-    // Make sure a '?' char is present in the string
-    if( ( strptr = strstr( blackbuf, "?" ) ) == NULL )
-    {
-      printf("ERROR: all blacklist.dat entry first fields *must be*\n");
-      printf("       terminated with a \'?\' character!! Entry is:\n");
-      printf("       %s", blackbuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+#ifdef DO_RATE_BLOCK
+//
+// If the caller's number has already called RATE_MAX_CALLS times in
+// the last RATE_WINDOW_MINUTES minutes, terminate the call and
+// return TRUE. The call times are kept by callstats.c, so this
+// takes the same (short) time however many calls there have been.
+//
+static bool check_rate( char *callstr )
+{
+  char *nmbrPtr;
+  int calls;
 
-    // Make sure the '?' character is within the first twenty characters
-    // (could not be if the previous record was only partially written).
-    if( (int)( strptr - blackbuf ) > 18 )
-    {
-      printf("ERROR: terminator '?' is not within first 20 characters\n" );
-      printf("       %s", blackbuf);
-      printf("       Entry was ignored!\n");
-      continue;
-    }
+  // Only real numbers identify a caller (not "P" for private or
+  // "O" for out of area).
+  if( (nmbrPtr = strstr( callstr, "NMBR = " )) == NULL ||
+      nmbrPtr[7] < '0' || nmbrPtr[7] > '9' )
+  {
+    return(FALSE);
+  }
 
-    // Get a pointer to the search token in the string
-    if( ( blackbufptr = strtok( blackbuf, "?" ) ) == NULL )
-    {
-      printf("blackbuf strtok() failed\n");
-      return(FALSE);
-    }
+  calls = callstatsCallsWithin( nmbrPtr + 7, RATE_WINDOW_MINUTES );
+  if( calls < RATE_MAX_CALLS )
+  {
+    return(FALSE);
+  }
 
-    // Scan the call string for the blacklist entry
-    if( strstr( callstr, blackbufptr ) != NULL )
-    {
-#ifdef DEBUG
-      printf("blacklist entry matches: %s\n", blackbuf );
+  printf("Number called %d times in the last %d minutes: blocked\n",
+    calls, RATE_WINDOW_MINUTES );
+  terminate_call();
+  return(TRUE);
+}
 #endif
-      sleep(1);
 
-#ifdef DO_FAX_TONE
-      // Send an ATA command. Don't wait for a response.
-      // Wait five seconds and return. This command starts
-      // with a CED tone (see UPDATES file for CED
-      // definition). That simulates a fax initial response.
-#ifdef DEBUG
-      printf("sending CED tone ATA command\n");
+#ifdef DO_NEIGHBOR_BLOCK
+//
+// If the caller's number is unknown and is in (or next to) our own
+// exchange, and that exchange (or the exchanges next to ours) has
+// had a burst of calls from unknown numbers, terminate the call and
+// return TRUE. Each call is counted in constant time (see neighbor.c).
+//
+static bool check_neighbor( char *callstr )
+{
+  char *nmbrPtr;
+  unsigned calls;
+  int burst;
+#ifdef DO_CALLSTATS
+  callStats stats;
 #endif
-      send_timed_modem_command(fd, "ATA\r", 5);
-
-      // Terminate the call by closing the modem serial port.
-      // Then re-open it and re-initialize the modem to
-      // prepare for the next call.
-      close_open_port();
-
-#else                      // don't DO_FAX_TONE
-#ifdef DO_USR5637_MODEM
-      // Terminate the call by sending off hook and
-      // on hook commands. Then re-initialize the modem
-      // to prepare for the next call.
-      send_modem_command(fd, "ATH1\r");  // off hook
-      usleep( 250000 );    // quarter second
-      send_modem_command(fd, "ATH0\r");  // on hook
-      usleep( 250000 );    // quarter second
-      init_modem(fd);
-#else                      // don't DO_USR5637_MODEM
-      // Send an ATA command. Don't wait for a response.
-      // Wait one second and return. This command seems to
-      // be needed in the non-FAX mode (don't know why!).
-      send_timed_modem_command(fd, "ATA\r", 1);
-
-      // Terminate the call by closing the modem serial port.
-      // Then re-open it and re-initialize the modem to
-      // prepare for the next call.
-      close_open_port();
-#endif                     // end of DO_USR5637_MODEM
-#endif                     // end of DO_FAX_TONE
-      // Make sure the 'DATE = ' field is present
-      if( (dateptr = strstr( callstr, "DATE = " ) ) == NULL )
-      {
-        printf( "DATE field not found in caller ID!\n" );
-        return(FALSE);
-      }
-
-      // Check the date field in blackbufsave. If it is not
-      // '++++++' (not a permanent record), change it.
-      if( strncmp( &blackbufsave[19], "++++++", 6 ) != 0 )
-      {
-        // Get the current date from the caller ID string
-        strncpy( call_date, &dateptr[7], 6 );
 
-        // Terminate the string
-        call_date[6] = 0;
-
-        // Update the date in the blackbufsave record
-        strncpy( &blackbufsave[19], call_date, 6 );
-
-        // Write the record back to the blacklist.dat file
-        fseek( fpBl, file_pos_last, SEEK_SET );
-        if( fputs( blackbufsave, fpBl ) == EOF )
-        {
-          printf("fputs(blackbufsave, fpBl) failed\n" );
-          return(FALSE);
-        }
-
-        // Flush the string to the file
-        if( fflush(fpBl) == EOF )
-        {
-          printf("fflush(fpBl) failed\n");
-          return(FALSE);
-        }
-
-        // Force kernel file buffers to the disk
-        // (probably not necessary)
-        sync();
-      }
+  if( (nmbrPtr = strstr( callstr, "NMBR = " )) == NULL )
+  {
+    return(FALSE);
+  }
+#ifdef DO_CALLSTATS
+  // A number that has called before is not unknown
+  if( callstatsLookup( nmbrPtr + 7, &stats ) == 0 && stats.totalCalls > 0 )
+  {
+    return(FALSE);
+  }
+#endif
 
-      // A blacklist.dat entry matched, so return TRUE
-      return(TRUE);
-    }
-  }                                         // end of while()
+  burst = neighborCall( nmbrPtr + 7, time( NULL ), &calls );
+  if( burst == NEIGHBOR_NONE )
+  {
+    return(FALSE);
+  }
 
-  /* A blacklist.dat entry was not matched, so return FALSE */
-  return(FALSE);
+  printf("%u calls from unknown numbers %s in the last %d minutes: blocked\n",
+    calls, burst == NEIGHBOR_EXCHANGE ? "in this exchange" : "next to ours",
+    NEIGHBOR_WINDOW_MINUTES );
+  terminate_call();
+  return(TRUE);
 }
+#endif
 
 //
 // Add a record to the blacklist.dat file.
@@ -1070,44 +1553,19 @@ static bool check_blacklist( char *callstr )
 // construct a blacklist.dat entry. Then append it to the blacklist.dat file.
 // Return TRUE if an entry was made; FALSE on an error.
 // Note:
-// If you enter blacklist.dat records manually with some editors (e.g., vi
-// or gedit), the editor adds a '\n' character at the end of the file when
-// the file is closed if you didn't! Some editors don't do this (e.g., emacs).
-// The '\n' character can be in the last or second to last location since the
-// stored length is always even.
-// This function starts the record it constructs with a '\n'. It checks to see
-// if your editor added a '\n' at the end of the file. If one is present, it
-// writes the first character of the new record over it. If not, it appends
-// the new record to the end of the file.
+// The entry is queued for the list writer (see safefile.c), which adds it
+// to a new copy of the file. If the file was edited manually and its last
+// line has no '\n' (some editors, e.g. emacs, don't add one) the writer
+// adds one first.
 //
 bool write_blacklist( char *callstr )
 {
   char blacklistEntry[80];
-  char readbuf[10];
   char *srcDesc = "*-KEY ENTRY";
   char *nameStr, *nmbrStr, *nmbrStrEnd;
   int nameStrLength, nmbrStrLength;
   int i;
 
-  // Close and re-open the blacklist.dat file. Note: this
-  // seems to be necessary to be able to write records
-  // back into the file. The write works the first time
-  // after the file is opened but not subsequently! :-(
-  // This also allows blacklist changes made while the
-  // program is running to be recognized.
-  //
-  fclose( fpBl );
-
-  // Re-open for reading and writing
-  if( (fpBl = fopen( "./blacklist.dat", "r+" ) ) == NULL )
-  {
-    printf("write_blacklist: re-open fopen() failed\n" );
-    return(FALSE);
-  }
-
-  // Disable buffering for blacklist.dat writes
-  setbuf( fpBl, NULL );
-
   // Build a blacklist entry from the caller ID string.
   // First fill the build array with ' ' chars.
   for(i = 0; i < 80; i++)
@@ -1159,57 +1617,31 @@ bool write_blacklist( char *callstr )
   nmbrStrLength = (int)(nmbrStrEnd - nmbrStr);
 
   // Now build the new blacklist entry.
-  // Put a '\n' at the start of the string.
-  blacklistEntry[0] = '\n';
-
   // See if the NAME field starts with "Cell Phone".
   if( strstr( nameStr, "Cell Phone" ) != NULL )
   {
     // If it does, use the NMBR field instead.
-    strncpy( &blacklistEntry[1], &callstr[37], nmbrStrLength );
-    blacklistEntry[ nmbrStrLength + 1] = '?'; // Add the terminator
+    strncpy( &blacklistEntry[0], &callstr[37], nmbrStrLength );
+    blacklistEntry[ nmbrStrLength ] = '?'; // Add the terminator
   }
   else
   {
     // Get the call NAME field from the caller ID.
-    strncpy( &blacklistEntry[1], nameStr, nameStrLength );
-    blacklistEntry[nameStrLength + 1] = '?'; // Add the terminator
+    strncpy( &blacklistEntry[0], nameStr, nameStrLength );
+    blacklistEntry[nameStrLength] = '?'; // Add the terminator
   }
 
   // Get the date field from the caller ID.
-  strncpy( &blacklistEntry[20], &callstr[9], 6 );  
+  strncpy( &blacklistEntry[19], &callstr[9], 6 );  
 
   // Add the source descriptor string ("KEY-* ENTRY").
-  strncpy( &blacklistEntry[34], srcDesc, strlen(srcDesc) + 1 );
-
-  // Read the last two characters in the file. If either is a '\n',
-  // seek to its position so the following write will overwrite it.
-  // If a '\n' is not found, seek to the end of the file.
-  fseek( fpBl, -2, SEEK_END );
-  if( fread( readbuf, 1, 2, fpBl ) != 2 )
-  {
-    printf("write_blacklist: fread() failed\n");
-    return FALSE;
-  }
+  strncpy( &blacklistEntry[33], srcDesc, strlen(srcDesc) + 1 );
 
-  if( readbuf[0] == '\n' )
-  {
-    fseek( fpBl, -2, SEEK_END );
-  }
-  else if( readbuf[1] == '\n' )
-  {
-    fseek( fpBl, -1, SEEK_END );
-  }
-  else
+  // Add the new record to the blacklist (it is matched at once) and
+  // queue it for the blacklist.dat file.
+  if( listAdd( LIST_BLACK, blacklistEntry ) == -1 )
   {
-    fseek( fpBl, 0, SEEK_END );
-  }
-
-  // Write the new record to the file.
-  if( fwrite( blacklistEntry, 1, strlen(blacklistEntry), fpBl ) !=
-                                              strlen( blacklistEntry ) )
-  {
-    printf("write_blacklist: fwrite() failed\n");
+    printf("write_blacklist: listAdd() failed\n");
     return FALSE;
   }
   return TRUE;
@@ -1250,10 +1682,17 @@ static void open_port(int mode )
 
   if( mode == OPEN_PORT_BLOCKED )
   {
+#ifdef DO_PRE_RING
+    // Block read until a character is available, then return the
+    // characters there are (read_message() collects the message)
+    options.c_cc[VMIN]    = 1;
+    options.c_cc[VTIME]   = 0;
+#else
     // Block read until a character is available or inter-character
     // time exceeds 1 unit (in 0.1sec units)
     options.c_cc[VMIN]    = 80;
     options.c_cc[VTIME]   = 1;
+#endif
   }
   else                   // (mode == OPEN_PORT_POLLED)
   {
@@ -1263,15 +1702,88 @@ static void open_port(int mode )
     options.c_cc[VTIME]   = 0;
   }
 
-  // Set the baud rate (caller ID is sent at 1200 baud)
-  cfsetispeed( &options, B1200 );
-  cfsetospeed( &options, B1200 );
+  // Set the baud rate (see BAUD_RATE above)
+  cfsetispeed( &options, BAUD_RATE );
+  cfsetospeed( &options, BAUD_RATE );
 
   // Set options
   tcsetattr(fd, TCSANOW, &options);
 }
 
 
+#ifdef DO_PRE_RING
+//
+// Read a message from the modem into 'buffer' (at most 'size'
+// characters), as they arrive. The message ends at a pause of
+// MESSAGE_GAP_MSEC or, for a caller ID record, as soon as its NAME
+// line is complete, so the call can be dropped before the phone
+// rings. Returns the number of characters read (or read()'s -1 or 0).
+//
+static int read_message( int fd, char *buffer, int size )
+{
+  struct pollfd pfd;
+  char *name;
+  int n = 0, nbytes = 0;
+
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  while( n < size )
+  {
+    // Wait for the first character as long as it takes
+    if( n > 0 && poll( &pfd, 1, MESSAGE_GAP_MSEC ) <= 0 )
+      break;
+    if( (nbytes = read( fd, buffer + n, size - n )) <= 0 )
+      break;
+    n += nbytes;
+    buffer[n] = 0;
+    if( strstr( buffer, "DATE" ) != NULL &&
+        (name = strstr( buffer, "NAME" )) != NULL &&
+        strpbrk( name, "\r\n" ) != NULL )
+      break;
+  }
+  return( n > 0 ? n : nbytes );
+}
+#endif
+
+//
+// Wait until the modem has characters to read (returns TRUE) or the
+// program is to stop (returns FALSE). With DO_CONFIG, new settings
+// (read on a SIGHUP) are taken while waiting. Those taken here are
+// kept until the call that follows has been handled.
+//
+static bool wait_for_modem( int fd )
+{
+#ifdef DO_CONFIG
+  int ready;
+
+  while( (ready = configWait( fd, stopPipe[0] )) == 1 )
+  {
+    use_config();
+  }
+  return( ready != 2 && !stopProgram );
+#else
+  struct pollfd fds[2];
+
+  fds[0].fd = fd;
+  fds[1].fd = stopPipe[0];              // -1 is ignored by poll()
+  fds[0].events = fds[1].events = POLLIN;
+  while( poll( fds, 2, -1 ) == -1 && errno == EINTR && !stopProgram )
+    ;
+  return( !stopProgram );
+#endif
+}
+
+//
+// Return a time in milliseconds (for timing short intervals).
+//
+static long msec_now()
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
 //
 // Close the serial port connection to the modem to
 // disable its DTR line. Since the modem was initialized
@@ -1293,40 +1805,21 @@ static void close_open_port()
 }
 
 //
-// SIGINT (Ctrl-C) and SIGKILL signal handler
+// SIGINT (Ctrl-C) and SIGKILL signal handler. It only says that the
+// program is to stop: main() resets the modem and closes everything
+// when wait_for_response() returns, as that takes locks and waits for
+// threads (which a signal handler must not do).
 //
 static void cleanup( int signo )
 {
-  printf("\nin cleanup()...wait for kill...\n");
-
-  if( modemInitialized )
+  // If program is in a blocked read(...) call before the modem is
+  // initialized (happens when modem is not connected!), or this is
+  // the second Ctrl-C, terminate at once.
+  if( stopProgram || ( inBlockedReadCall && !modemInitialized ) )
   {
-    // Reset the modem
-#ifdef DEBUG
-  printf("sending ATZ command...\n");
-#endif
-    send_modem_command(fd, "ATZ\r");
-  }
-
-  // Close everything
-  close(fd);
-  fclose(fpCa);
-  fclose(fpBl);
-  fclose(fpWh);
-#ifdef DO_TONES
-  tonesClose();
-#endif
-  fflush(stdout);     // flush C library buffers to kernel buffers
-  sync();             // flush kernel buffers to disk
-
-  // If program is in a blocked read(...) call, use kill() to
-  // terminate program (happens when modem is not connected!).
-  if( inBlockedReadCall )
-  {
-    kill( 0, SIGKILL );
+    _exit(1);
   }
-
-  // Otherwise terminate normally
-  _exit(0);
+  stopProgram = TRUE;
+  serverWake( NULL, stopPipe, 's' );
 }
 
@@ -0,0 +1,247 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: libjcblock.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	A library that classifies calls with jcblock's whitelist.dat and
+ *	blacklist.dat, for programs other than jcblock (for example a SIP
+ *	gateway) that get caller ID some other way.
+ *
+ *	jcb_open() reads the list files into tables (see listtable.c) and
+ *	returns a handle. jcb_classify() gives the classification of one
+ *	call, as jcblock makes it: 'W' if a whitelist entry's search string
+ *	is in the call's record, else 'B' if a blacklist entry's is, else
+ *	'-'. The record is the caller ID text, such as the string jcblock
+ *	gets from the modem:
+ *
+ *	  --DATE = 0315--TIME = 1412--NMBR = 5551234567--NAME = SMITH JOHN--
+ *
+ *	jcb_classify_batch() classifies many calls at once (with one lock
+ *	for all of them). The library changes nothing: the dates of the
+ *	entries are not updated, calls are not counted for rate blocking
+ *	and nothing is written to callerID.dat. It has no global data, so
+ *	any number of handles can be open, and a handle may be used by
+ *	any number of threads at once. jcb_reload() reads the list files
+ *	again if they were changed; call it as often as changes should be
+ *	noticed (for example once a second). The calls being classified
+ *	meanwhile use the old lists until the new ones are ready.
+ *
+ *	Compile a program with the library with, e.g.:
+ *	  gcc -pthread -o gateway gateway.c libjcblock.c listtable.c callerid.c
+ *	or make libjcblock.so with ./makelibjcblock.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "libjcblock.h"
+#include "listtable.h"
+
+#if JCB_LINE_LEN != LIST_LINE_LEN
+#error "JCB_LINE_LEN must be the same as LIST_LINE_LEN"
+#endif
+
+#define JCB_WHITELIST   0
+#define JCB_BLACKLIST   1
+
+struct jcb
+{
+  char *path[2];                // the list files (NULL: none)
+  listTable t[2];
+  struct stat known[2];         // the files the tables were read from
+  pthread_rwlock_t lock;        // held for reading while classifying
+  pthread_mutex_t reloadMutex;  // one jcb_reload() at a time
+};
+
+static int sameFile(const struct stat *a, const struct stat *b)
+{
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+         a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+         a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+//
+// Read list file 'path' into table 't' and its identity into 'st'.
+//
+static int readList(const char *path, listTable *t, struct stat *st)
+{
+  FILE *fp;
+  int retVal;
+
+  memset( t, 0, sizeof(*t) );
+  if( listTableClear( t ) == -1 )
+    return -1;
+  if( (fp = fopen( path, "r" )) == NULL )
+  {
+    perror( path );
+    listTableFree( t );
+    return -1;
+  }
+  fstat( fileno( fp ), st );
+  if( (retVal = listTableRead( t, fp, path )) == -1 )
+    listTableFree( t );
+  fclose( fp );
+  return retVal;
+}
+
+/*
+ * Read the list files. Returns NULL if one can't be read.
+ */
+jcb *jcb_open(const jcb_lists *lists)
+{
+  const char *paths[2];
+  jcb *j;
+  int i;
+
+  if( (j = calloc( 1, sizeof(jcb) )) == NULL )
+  {
+    perror( "jcb_open: calloc" );
+    return NULL;
+  }
+  pthread_rwlock_init( &j->lock, NULL );
+  pthread_mutex_init( &j->reloadMutex, NULL );
+  paths[JCB_WHITELIST] = lists->whitelist;
+  paths[JCB_BLACKLIST] = lists->blacklist;
+  for( i = 0; i < 2; i++ )
+  {
+    if( paths[i] == NULL )
+    {
+      listTableClear( &j->t[i] );
+      continue;
+    }
+    if( (j->path[i] = strdup( paths[i] )) == NULL ||
+        readList( j->path[i], &j->t[i], &j->known[i] ) == -1 )
+    {
+      jcb_close( j );
+      return NULL;
+    }
+  }
+  return j;
+}
+
+void jcb_close(jcb *j)
+{
+  int i;
+
+  if( j == NULL )
+    return;
+  for( i = 0; i < 2; i++ )
+  {
+    listTableFree( &j->t[i] );
+    free( j->path[i] );
+  }
+  pthread_rwlock_destroy( &j->lock );
+  pthread_mutex_destroy( &j->reloadMutex );
+  free( j );
+}
+
+/*
+ * Read the list files that were changed again. Returns the number
+ * read, or -1 if one can't be read (its old table is kept).
+ */
+int jcb_reload(jcb *j)
+{
+  listTable t, old;
+  struct stat st;
+  int i, reloaded = 0;
+
+  pthread_mutex_lock( &j->reloadMutex );
+  for( i = 0; i < 2; i++ )
+  {
+    if( j->path[i] == NULL )
+      continue;
+    if( stat( j->path[i], &st ) == 0 && sameFile( &st, &j->known[i] ) )
+      continue;
+    if( readList( j->path[i], &t, &st ) == -1 )
+    {
+      reloaded = -1;
+      break;
+    }
+
+    // Classifications now in progress finish with the old table
+    pthread_rwlock_wrlock( &j->lock );
+    old = j->t[i];
+    j->t[i] = t;
+    pthread_rwlock_unlock( &j->lock );
+    listTableFree( &old );
+    j->known[i] = st;
+    reloaded++;
+  }
+  pthread_mutex_unlock( &j->reloadMutex );
+  return reloaded;
+}
+
+//
+// Classify one record (with the lock held).
+//
+static int classify(jcb *j, const char *record, jcb_result *result)
+{
+  long n;
+
+  if( (n = listTableMatch( &j->t[JCB_WHITELIST], record )) != -1 )
+  {
+    result->tag = JCB_WHITE;
+    strcpy( result->line, j->t[JCB_WHITELIST].entries[n].line );
+  }
+  else if( (n = listTableMatch( &j->t[JCB_BLACKLIST], record )) != -1 )
+  {
+    result->tag = JCB_BLACK;
+    strcpy( result->line, j->t[JCB_BLACKLIST].entries[n].line );
+  }
+  else
+  {
+    result->tag = JCB_ACCEPT;
+    result->line[0] = '\0';
+  }
+  return result->tag;
+}
+
+/*
+ * Classify one call's record. Returns the tag (also in 'result').
+ */
+int jcb_classify(jcb *j, const char *record, jcb_result *result)
+{
+  int tag;
+
+  pthread_rwlock_rdlock( &j->lock );
+  tag = classify( j, record, result );
+  pthread_rwlock_unlock( &j->lock );
+  return tag;
+}
+
+/*
+ * Classify 'n' records; results[i] is for records[i]. All of them are
+ * classified with the same lists. Returns the number blacklisted.
+ */
+int jcb_classify_batch(jcb *j, const char *const records[], int n,
+                       jcb_result results[])
+{
+  int i, blocked = 0;
+
+  pthread_rwlock_rdlock( &j->lock );
+  for( i = 0; i < n; i++ )
+  {
+    if( classify( j, records[i], &results[i] ) == JCB_BLACK )
+      blocked++;
+  }
+  pthread_rwlock_unlock( &j->lock );
+  return blocked;
+}
@@ -0,0 +1,59 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: libjcblock.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the call classification library in libjcblock.c.
+ *	This file does not need the other jcblock headers.
+ */
+#ifndef LIBJCBLOCK_H
+#define LIBJCBLOCK_H
+
+#define JCB_LINE_LEN    100     // longest list file line (with '\n')
+
+// Classifications (the callerID.dat tags jcblock would write)
+#define JCB_ACCEPT      '-'     // on neither list
+#define JCB_WHITE       'W'     // a whitelist entry matched
+#define JCB_BLACK       'B'     // a blacklist entry matched (and no
+                                // whitelist entry)
+
+typedef struct jcb jcb;
+
+// The list files to use
+typedef struct
+{
+  const char *whitelist;        // e.g. "./whitelist.dat" (NULL: none)
+  const char *blacklist;        // e.g. "./blacklist.dat" (NULL: none)
+} jcb_lists;
+
+// The result for one call
+typedef struct
+{
+  char tag;                     // JCB_ACCEPT, JCB_WHITE or JCB_BLACK
+  char line[JCB_LINE_LEN];      // the entry that matched ("" if none)
+} jcb_result;
+
+jcb *jcb_open(const jcb_lists *lists);
+void jcb_close(jcb *j);
+int jcb_reload(jcb *j);
+int jcb_classify(jcb *j, const char *record, jcb_result *result);
+int jcb_classify_batch(jcb *j, const char *const records[], int n,
+                       jcb_result results[]);
+
+#endif
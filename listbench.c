@@ -0,0 +1,151 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: listbench.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Benchmark for the entries added to blacklist.dat while the
+ *	program runs (listindex.c). In a new directory, a blacklist.dat
+ *	of junk call entries (100000 by default) is written and read.
+ *	Then calls not on the list arrive, and each is added as a *-key
+ *	entry would be (listAdd(), as write_blacklist() does). Each call
+ *	must not match before it is added, must match right after (before
+ *	the list writer has written the file), and must still match after
+ *	the writer has replaced the file (without the list being read
+ *	again). The time to add an entry and match the call is shown.
+ *
+ *	Compile with: ./makebench
+ *	Run with:     ./listbench [entries [calls]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "common.h"
+#include "safefile.h"
+#include "listindex.h"
+
+#define GROUP_MSEC	100		// list writer group time
+
+static double secondsNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+//
+// The caller ID string (as wait_for_response() makes it) and the
+// *-key entry (as write_blacklist() makes it) for call 'i'.
+//
+static void makeCall(long i, char *callstr, char *entry)
+{
+  char name[32];
+
+  snprintf( name, sizeof(name), "STARKEY %07ld", i % 10000000 );
+  sprintf( callstr, "--DATE = 1016--TIME = 1200--NMBR = %010ld--NAME = %s--\n",
+    4440000000L + i, name );
+  sprintf( entry, "%s?%*s101626        *-KEY ENTRY", name,
+    (int)(18 - strlen( name )), "" );
+}
+
+int main(int argc, char **argv)
+{
+  char dir[] = "/tmp/listbenchXXXXXX";
+  char callstr[128], entry[LIST_LINE_LEN], line[LIST_LINE_LEN];
+  long entries = 100000, calls = 1000, i, early = 0, missed = 0, lost = 0;
+  long appended = 0;
+  double start, addSecs;
+  listStats stats;
+  FILE *fp;
+
+  if( ( argc > 1 && (entries = atol( argv[1] )) <= 0 ) ||
+      ( argc > 2 && (calls = atol( argv[2] )) <= 0 ) )
+  {
+    fprintf(stderr, "usage: listbench [entries [calls]]\n");
+    return 1;
+  }
+
+  if( mkdtemp( dir ) == NULL || chdir( dir ) == -1 ||
+      (fp = fopen( "blacklist.dat", "w" )) == NULL )
+  {
+    perror( dir );
+    return 1;
+  }
+  for( i = 0; i < entries; i++ )
+  {
+    fprintf( fp, "%-18ld?101626        junk call\n", 5550000000L + i );
+  }
+  fclose( fp );
+
+  if( listEditsStart( GROUP_MSEC ) == -1 || listIndexOpen() == -1 )
+  {
+    printf("listbench: can't read blacklist.dat\n");
+    return 1;
+  }
+
+  // Each call is checked (and so cached) before its entry is added
+  addSecs = 0;
+  for( i = 0; i < calls; i++ )
+  {
+    makeCall( i, callstr, entry );
+    if( listMatch( LIST_BLACK, callstr, line ) )
+      early++;
+    start = secondsNow();
+    if( listAdd( LIST_BLACK, entry ) == -1 ||
+        !listMatch( LIST_BLACK, callstr, line ) )
+    {
+      missed++;
+    }
+    addSecs += secondsNow() - start;
+  }
+
+  // The same calls once the file has been written
+  listEditsFlush();
+  for( i = 0; i < calls; i++ )
+  {
+    makeCall( i, callstr, entry );
+    if( !listMatch( LIST_BLACK, callstr, line ) )
+      lost++;
+  }
+  listGetStats( LIST_BLACK, &stats );
+
+  if( (fp = fopen( "blacklist.dat", "r" )) != NULL )
+  {
+    while( fgets( line, sizeof(line), fp ) != NULL )
+    {
+      if( strstr( line, "*-KEY ENTRY" ) != NULL )
+        appended++;
+    }
+    fclose( fp );
+  }
+  listIndexClose();
+  listEditsStop();
+
+  printf("%ld entries, %ld calls added\n", entries, calls);
+  printf("add and match: %.2f usec per call\n", addSecs / calls * 1e6);
+  printf("matched before added: %ld, not matched after added: %ld, "
+    "not matched after written: %ld\n", early, missed, lost);
+  printf("entries in the file: %ld, times the list was read: %lu\n",
+    appended, stats.reloads);
+  printf("files are in %s\n", dir);
+  return early || missed || lost || appended != calls || stats.reloads != 1;
+}
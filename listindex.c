@@ -0,0 +1,535 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: listindex.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to keep whitelist.dat and blacklist.dat in memory.
+ *
+ *	The program used to read and parse each list file, line by line,
+ *	for every call. Now each file is read once into a table (see
+ *	listtable.c), where the entry that matches a call is found in the
+ *	same short time however long the list is. As before, the first
+ *	entry in the file that matches wins.
+ *
+ *	Changes (date updates, *-key entries and the control socket
+ *	commands, see control.c) are made to the index at once and then
+ *	queued for the list writer (safefile.c), which writes them in the
+ *	existing text format. When the writer replaces a file that had
+ *	only those changes, it tells the index (listEditsSetHook()), so
+ *	the index is not read again. A file changed any other way (edited
+ *	by hand, or truncated by truncate.c) is noticed (by stat()) at the
+ *	next check and read again.
+ *
+ *	Callers often call again within minutes (autodialers do). Each
+ *	list remembers the result for the last CACHE_SIZE different calls
+ *	(the CLOCK method decides which to forget), so a repeat call is
+ *	answered with one hash table probe. A call is known by a hash of
+ *	its caller ID string less the DATE and TIME values. The results
+ *	are forgotten when the list is read again or an entry is added or
+ *	removed. A list with a search string that could match the DATE
+ *	or TIME field (e.g., "0800") is not cached.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "safefile.h"
+#include "listindex.h"
+#include "metrics.h"
+
+#define CACHE_SIZE      1024    // calls remembered for each list
+#define CACHE_BUCKETS   1024    // a power of two
+
+// One remembered call
+typedef struct
+{
+  uint64_t hash;                // of the call string (see callHash())
+  uint32_t generation;          // of the index it was checked with
+  int32_t entry;                // the entry that matched, or -1
+  int32_t next;                 // the next in its bucket, or -1
+  bool referenced;              // used since the clock hand passed it
+} cacheEntry;
+
+typedef struct
+{
+  cacheEntry entries[CACHE_SIZE];
+  int32_t buckets[CACHE_BUCKETS]; // the first entry of each, or -1
+  uint32_t numUsed, hand;
+} decisionCache;
+
+// One list file
+typedef struct
+{
+  const char *path;
+  listTable t;                  // its entries
+  struct stat known;            // the file the index matches
+  bool stale;                   // read while changes were still queued
+  uint32_t generation;          // changed when a match could change
+  uint32_t timeKeys;            // search strings that look like a time
+  decisionCache cache;
+  listStats stats;
+} listIndex;
+
+static listIndex lists[2] =
+{
+  { "./whitelist.dat" },
+  { "./blacklist.dat" }
+};
+static pthread_mutex_t indexMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool sameFile(const struct stat *a, const struct stat *b)
+{
+  return a->st_dev == b->st_dev && a->st_ino == b->st_ino &&
+         a->st_size == b->st_size && a->st_mtim.tv_sec == b->st_mtim.tv_sec &&
+         a->st_mtim.tv_nsec == b->st_mtim.tv_nsec;
+}
+
+static bool sameLine(const char *a, const char *b)
+{
+  size_t aLen = strcspn( a, "\n" );
+
+  return aLen == strcspn( b, "\n" ) && memcmp( a, b, aLen ) == 0;
+}
+
+//
+// TRUE if the search string of 'line' could match a part of the
+// DATE or TIME field, so that whether it matches a number can
+// change from one call to the next.
+//
+static bool isTimeKey(const char *line, int keyLen)
+{
+  static const char fields[] = "--DATE = ######--TIME = ####--DATE = ######--";
+  char pattern[LIST_KEY_LEN + 1];
+  bool digits = FALSE;
+  int i;
+
+  for( i = 0; i < keyLen; i++ )
+  {
+    if( isdigit( (unsigned char)line[i] ) )
+    {
+      pattern[i] = '#';
+      digits = TRUE;
+    }
+    else
+      pattern[i] = line[i];
+  }
+  pattern[keyLen] = '\0';
+  return digits && strstr( fields, pattern ) != NULL;
+}
+
+//
+// A hash of a caller ID string, less the digits of its DATE and
+// TIME fields.
+//
+static uint64_t callHash(const char *callstr)
+{
+  const char *p = callstr;
+  uint64_t h = 14695981039346656037ull;
+  int i;
+
+  while( *p != '\0' )
+  {
+    if( (*p == 'D' && strncmp( p, "DATE = ", 7 ) == 0) ||
+        (*p == 'T' && strncmp( p, "TIME = ", 7 ) == 0) )
+    {
+      for( i = 0; i < 7; i++ )
+        h = (h ^ (unsigned char)*p++) * 1099511628211ull;
+      while( isdigit( (unsigned char)*p ) )
+        p++;
+      continue;
+    }
+    h = (h ^ (unsigned char)*p++) * 1099511628211ull;
+  }
+  return h;
+}
+
+static void cacheClear(decisionCache *c)
+{
+  memset( c->buckets, 0xff, sizeof(c->buckets) );   // all -1
+  c->numUsed = c->hand = 0;
+}
+
+//
+// The cache entry for 'hash', or -1.
+//
+static int32_t cacheFind(decisionCache *c, uint64_t hash)
+{
+  int32_t e;
+
+  for( e = c->buckets[hash & (CACHE_BUCKETS - 1)]; e != -1; e = c->entries[e].next )
+  {
+    if( c->entries[e].hash == hash )
+      return e;
+  }
+  return -1;
+}
+
+//
+// Remember that call 'hash' matched 'entry' (-1: none). When the
+// cache is full, the clock hand goes round the entries, clearing
+// their referenced flags, and the first one not used since the hand
+// last passed it is replaced.
+//
+static void cacheStore(decisionCache *c, uint64_t hash, uint32_t generation,
+                       int32_t entry)
+{
+  int32_t e, *link;
+
+  if( (e = cacheFind( c, hash )) == -1 )
+  {
+    if( c->numUsed < CACHE_SIZE )
+      e = c->numUsed++;
+    else
+    {
+      while( c->entries[c->hand].referenced )
+      {
+        c->entries[c->hand].referenced = FALSE;
+        c->hand = (c->hand + 1) % CACHE_SIZE;
+      }
+      e = c->hand;
+      c->hand = (c->hand + 1) % CACHE_SIZE;
+
+      // Take it out of its bucket
+      link = &c->buckets[c->entries[e].hash & (CACHE_BUCKETS - 1)];
+      while( *link != e )
+        link = &c->entries[*link].next;
+      *link = c->entries[e].next;
+    }
+    c->entries[e].hash = hash;
+    c->entries[e].next = c->buckets[hash & (CACHE_BUCKETS - 1)];
+    c->buckets[hash & (CACHE_BUCKETS - 1)] = e;
+  }
+  c->entries[e].generation = generation;
+  c->entries[e].entry = entry;
+  c->entries[e].referenced = TRUE;
+}
+
+//
+// Count the search strings that look like a time (with indexMutex
+// held).
+//
+static void countTimeKeys(listIndex *l)
+{
+  uint32_t n;
+
+  l->timeKeys = 0;
+  for( n = 0; n < l->t.numEntries; n++ )
+  {
+    if( !l->t.entries[n].removed &&
+        isTimeKey( l->t.entries[n].line, l->t.entries[n].keyLen ) )
+    {
+      l->timeKeys++;
+    }
+  }
+}
+
+//
+// Read a list file into its index (with the list file lock and
+// indexMutex held). A file that does not exist is an empty list.
+//
+static int loadList(listIndex *l)
+{
+  long start = metricsNow();
+  int list = l - lists;
+  FILE *fp;
+
+  memset( &l->known, 0, sizeof(l->known) );
+  l->generation++;
+  l->timeKeys = 0;
+  if( listTableClear( &l->t ) == -1 )
+    return -1;
+
+  if( (fp = fopen( l->path, "r" )) == NULL )
+  {
+    if( errno == ENOENT )
+    {
+      metricsSetGauge( GAUGE_ENTRIES_WHITE + list, 0 );
+      return 0;
+    }
+    perror( l->path );
+    return -1;
+  }
+  fstat( fileno( fp ), &l->known );
+  listTableRead( &l->t, fp, l->path );
+  fclose( fp );
+  countTimeKeys( l );
+
+  // Changes still waiting to be written are not in this file, so
+  // the file they are written to must be read again
+  l->stale = listEditsPending();
+  l->stats.reloads++;
+  metricsCount( METRIC_RELOADS_WHITE + list );
+  metricsSetGauge( GAUGE_ENTRIES_WHITE + list, l->t.numLive );
+  metricsObserve( STAGE_LIST_RELOAD, start );
+  return 0;
+}
+
+//
+// Read the list file again if it was changed (with indexMutex held).
+//
+static void checkList(listIndex *l)
+{
+  struct stat st;
+
+  if( stat( l->path, &st ) == -1 )
+    memset( &st, 0, sizeof(st) );
+  if( sameFile( &st, &l->known ) )
+    return;
+
+  // Changed: wait for any rewrite to finish, then look again
+  pthread_mutex_unlock( &indexMutex );
+  lock_blacklist();
+  pthread_mutex_lock( &indexMutex );
+  if( stat( l->path, &st ) == -1 )
+    memset( &st, 0, sizeof(st) );
+  if( !sameFile( &st, &l->known ) )
+  {
+#ifdef DEBUG
+    printf("%s changed: reading it again\n", l->path + 2);
+#endif
+    loadList( l );
+  }
+  unlock_blacklist( FALSE );
+}
+
+//
+// Called by the list writer after it replaced a list file.
+//
+static void commitHook(const char *path, const struct stat *before,
+                       const struct stat *after)
+{
+  int i;
+
+  pthread_mutex_lock( &indexMutex );
+  for( i = 0; i < 2; i++ )
+  {
+    if( strcmp( path, lists[i].path ) != 0 )
+      continue;
+    // If the changes were made to the file the index was read from,
+    // the new file holds nothing the index does not have
+    if( !lists[i].stale && sameFile( before, &lists[i].known ) )
+      lists[i].known = *after;
+    lists[i].stale = FALSE;
+  }
+  pthread_mutex_unlock( &indexMutex );
+}
+
+/*
+ * Read both list files. Returns -1 if blacklist.dat can't be read.
+ */
+int listIndexOpen(void)
+{
+  int retVal = 0;
+
+  lock_blacklist();
+  pthread_mutex_lock( &indexMutex );
+  cacheClear( &lists[LIST_WHITE].cache );
+  cacheClear( &lists[LIST_BLACK].cache );
+  loadList( &lists[LIST_WHITE] );
+  if( loadList( &lists[LIST_BLACK] ) == -1 || lists[LIST_BLACK].known.st_ino == 0 )
+    retVal = -1;
+  pthread_mutex_unlock( &indexMutex );
+  unlock_blacklist( FALSE );
+  listEditsSetHook( commitHook );
+  return retVal;
+}
+
+void listIndexClose(void)
+{
+  int i;
+
+  listEditsSetHook( NULL );
+  pthread_mutex_lock( &indexMutex );
+  for( i = 0; i < 2; i++ )
+  {
+    listTableFree( &lists[i].t );
+  }
+  pthread_mutex_unlock( &indexMutex );
+}
+
+/*
+ * Find the first entry of 'list' whose search string is in 'callstr'
+ * and copy its line to 'line' (LIST_LINE_LEN bytes). Returns TRUE if
+ * one was found.
+ */
+int listMatch(int list, const char *callstr, char *line)
+{
+  listIndex *l = &lists[list];
+  long best = -1, start = metricsNow();
+  uint64_t hash = 0;
+  int32_t e = -1;
+
+  pthread_mutex_lock( &indexMutex );
+  checkList( l );
+  l->stats.lookups++;
+
+  // A repeat call is answered from the cache
+  if( l->timeKeys == 0 )
+  {
+    hash = callHash( callstr );
+    if( (e = cacheFind( &l->cache, hash )) != -1 &&
+        l->cache.entries[e].generation == l->generation )
+    {
+      l->cache.entries[e].referenced = TRUE;
+      best = l->cache.entries[e].entry;
+      l->stats.cached++;
+    }
+    else
+      e = -1;
+  }
+  if( e == -1 )
+  {
+    best = listTableMatch( &l->t, callstr );
+    if( l->timeKeys == 0 )
+      cacheStore( &l->cache, hash, l->generation, best );
+  }
+
+  if( best != -1 )
+  {
+    strcpy( line, l->t.entries[best].line );
+    l->stats.matches++;
+  }
+  pthread_mutex_unlock( &indexMutex );
+  metricsObserve( STAGE_LIST_MATCH, start );
+  return best != -1;
+}
+
+/*
+ * Change the first entry that is the same as 'oldLine' to 'newLine'
+ * (which must have the same search string), and queue the change to
+ * the file.
+ */
+int listChange(int list, const char *oldLine, const char *newLine)
+{
+  listIndex *l = &lists[list];
+  int keyLen, retVal = -1;
+  long n;
+
+  keyLen = strcspn( oldLine, "?" );
+  if( keyLen > LIST_KEY_LEN || strncmp( oldLine, newLine, keyLen + 1 ) != 0 )
+  {
+    printf("listChange: the search string can't be changed\n");
+    return -1;
+  }
+
+  pthread_mutex_lock( &indexMutex );
+  for( n = listTableFind( &l->t, oldLine, keyLen ); n != -1 && n < l->t.numEntries; n++ )
+  {
+    if( !l->t.entries[n].removed && sameLine( l->t.entries[n].line, oldLine ) )
+    {
+      snprintf( l->t.entries[n].line, LIST_LINE_LEN, "%.*s\n",
+        (int)strcspn( newLine, "\n" ), newLine );
+      l->stats.changes++;
+      retVal = listReplaceLine( l->path, oldLine, newLine );
+      break;
+    }
+  }
+  pthread_mutex_unlock( &indexMutex );
+  return retVal;
+}
+
+/*
+ * Add 'line' to the end of the list, and queue it for the file.
+ */
+int listAdd(int list, const char *line)
+{
+  listIndex *l = &lists[list];
+  int keyLen, retVal = -1;
+
+  if( (keyLen = listTableParse( l->path, line )) <= 0 )
+    return -1;
+  pthread_mutex_lock( &indexMutex );
+  if( listTableAdd( &l->t, line, keyLen ) == 0 )
+  {
+    l->generation++;
+    if( isTimeKey( line, keyLen ) )
+      l->timeKeys++;
+    l->stats.changes++;
+    metricsSetGauge( GAUGE_ENTRIES_WHITE + list, l->t.numLive );
+    retVal = listAppendLine( l->path, line );
+  }
+  pthread_mutex_unlock( &indexMutex );
+  return retVal;
+}
+
+/*
+ * Remove all entries whose search string is 'key', and queue their
+ * removal from the file. Returns the number removed.
+ */
+int listRemove(int list, const char *key)
+{
+  listIndex *l = &lists[list];
+  int keyLen = strlen( key ), removed = 0;
+  long n;
+
+  if( keyLen == 0 || keyLen > LIST_KEY_LEN )
+    return 0;
+  pthread_mutex_lock( &indexMutex );
+  checkList( l );
+  while( (n = listTableFind( &l->t, key, keyLen )) != -1 )
+  {
+    l->t.entries[n].removed = TRUE;
+    l->t.numLive--;
+    listRemoveLine( l->path, l->t.entries[n].line );
+    l->stats.changes++;
+    removed++;
+  }
+  if( removed > 0 )
+  {
+    l->generation++;
+    countTimeKeys( l );
+  }
+  metricsSetGauge( GAUGE_ENTRIES_WHITE + list, l->t.numLive );
+  pthread_mutex_unlock( &indexMutex );
+  return removed;
+}
+
+/*
+ * TRUE if an entry's search string is 'key'.
+ */
+int listHasKey(int list, const char *key)
+{
+  listIndex *l = &lists[list];
+  int keyLen = strlen( key );
+  long n = -1;
+
+  pthread_mutex_lock( &indexMutex );
+  checkList( l );
+  if( keyLen > 0 && keyLen <= LIST_KEY_LEN )
+    n = listTableFind( &l->t, key, keyLen );
+  pthread_mutex_unlock( &indexMutex );
+  return n != -1;
+}
+
+void listGetStats(int list, listStats *stats)
+{
+  listIndex *l = &lists[list];
+
+  pthread_mutex_lock( &indexMutex );
+  checkList( l );
+  *stats = l->stats;
+  stats->path = l->path;
+  stats->entries = l->t.numLive;
+  pthread_mutex_unlock( &indexMutex );
+}
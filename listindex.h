@@ -0,0 +1,53 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: listindex.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the in-memory list index in listindex.c.
+ */
+#ifndef LISTINDEX_H
+#define LISTINDEX_H
+
+#include "listtable.h"
+
+#define LIST_WHITE      0       // whitelist.dat
+#define LIST_BLACK      1       // blacklist.dat
+
+// The counters shown by the control socket "list-stats" command
+typedef struct
+{
+  const char *path;
+  unsigned long entries;        // entries in the index
+  unsigned long lookups;        // calls checked against the list
+  unsigned long matches;
+  unsigned long cached;         // lookups answered from the cache
+  unsigned long reloads;        // times the file was read again
+  unsigned long changes;        // changes made by the program
+} listStats;
+
+int listIndexOpen(void);
+void listIndexClose(void);
+int listMatch(int list, const char *callstr, char *line);
+int listChange(int list, const char *oldLine, const char *newLine);
+int listAdd(int list, const char *line);
+int listRemove(int list, const char *key);
+int listHasKey(int list, const char *key);
+void listGetStats(int list, listStats *stats);
+
+#endif
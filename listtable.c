@@ -0,0 +1,355 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: listtable.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to hold the entries of a list file (whitelist.dat or
+ *	blacklist.dat) and find the entry that matches a call.
+ *
+ *	A table keeps the valid entries, in file order, and a hash table
+ *	of their search strings (the text before the '?'). A call is
+ *	checked by hashing each piece of the caller ID string that is as
+ *	long as some search string (at most LIST_KEY_LEN characters, from
+ *	each position), so the time taken does not grow with the length
+ *	of the list. The first entry in the file that matches wins.
+ *
+ *	A search string that is a telephone number, written in any of
+ *	the usual ways ("18005551234", "1-800-555-1234", "8005551234"),
+ *	is also kept in a second hash table by its E.164 form (see
+ *	callerid.c), and the call's NMBR is looked up there, so an entry
+ *	matches however the number was written in the list and however
+ *	it arrived.
+ *
+ *	Most pieces are not search strings. A bit map (four bits for each
+ *	hash table slot, so it is small enough to stay in the processor's
+ *	cache) says which hashes are in the table, so most pieces are
+ *	rejected without reading the table itself.
+ *
+ *	A table has no locks and uses no other part of the program: the
+ *	program's lists (listindex.c) and the library (libjcblock.c) each
+ *	keep their tables and lock them as they need.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "listtable.h"
+#include "callerid.h"
+
+#define FNV_OFFSET	2166136261u
+#define FNV_PRIME	16777619u
+
+static uint32_t hashNumber(uint64_t number)
+{
+  return (number * 0x9e3779b97f4a7c15ull) >> 32;   // Fibonacci hashing
+}
+
+static uint32_t hashKey(const char *key, int len)
+{
+  uint32_t h = FNV_OFFSET;
+
+  while( len-- > 0 )
+  {
+    h = (h ^ (unsigned char)*key++) * FNV_PRIME;
+  }
+  return h;
+}
+
+/*
+ * Check a list file line. Returns the length of its search string,
+ * 0 for a comment or empty line, or -1 (with a message) if the line
+ * is not valid.
+ */
+int listTableParse(const char *path, const char *line)
+{
+  const char *strptr;
+
+  // Ignore comment lines and lines containing just a '\n'
+  if( line[0] == '#' || line[0] == '\n' )
+    return 0;
+
+  if( strlen( line ) < 26 )
+  {
+    printf("ERROR: %s record is too short to hold date field.\n", path + 2);
+    printf("       record: %s", line);
+    printf("       record is ignored (edit file and fix it).\n");
+    return -1;
+  }
+  if( (strptr = strchr( line, '?' )) == NULL )
+  {
+    printf("ERROR: all %s entry first fields *must be*\n", path + 2);
+    printf("       terminated with a \'?\' character!! Entry is:\n");
+    printf("       %s", line);
+    printf("       Entry was ignored!\n");
+    return -1;
+  }
+  if( (int)( strptr - line ) > LIST_KEY_LEN || strptr == line )
+  {
+    printf("ERROR: terminator '?' is not within first 20 characters\n" );
+    printf("       %s", line);
+    printf("       Entry was ignored!\n");
+    return -1;
+  }
+  return strptr - line;
+}
+
+//
+// Put entry 'n' in the hash table.
+//
+static void tableInsert(listTable *t, uint32_t n)
+{
+  uint32_t h, slot;
+  uint64_t number;
+
+  h = hashKey( t->entries[n].line, t->entries[n].keyLen );
+  t->filter[(h >> 6) & (t->tableSize / 16 - 1)] |= 1ull << (h & 63);
+  slot = h & (t->tableSize - 1);
+  while( t->table[slot] != 0 )
+  {
+    slot = (slot + 1) & (t->tableSize - 1);
+  }
+  t->table[slot] = n + 1;
+
+  number = cidNumber( t->entries[n].line, t->entries[n].keyLen );
+  if( CID_KIND( number ) == CID_E164 )
+  {
+    slot = hashNumber( number ) & (t->tableSize - 1);
+    while( t->numbers[slot].entry != 0 )
+    {
+      slot = (slot + 1) & (t->tableSize - 1);
+    }
+    t->numbers[slot].number = number;
+    t->numbers[slot].entry = n + 1;
+    t->numNumbers++;
+  }
+}
+
+//
+// Make the hash table (again) for 'numEntries' entries. Removed
+// entries are left out.
+//
+static int tableBuild(listTable *t, uint32_t numEntries)
+{
+  uint32_t size = 64, n;
+  uint32_t *table;
+  uint64_t *filter;
+  listNumberSlot *numbers;
+
+  while( size < numEntries * 2 )
+    size *= 2;
+  table = calloc( size, sizeof(uint32_t) );
+  filter = calloc( size / 16, sizeof(uint64_t) );
+  numbers = calloc( size, sizeof(listNumberSlot) );
+  if( table == NULL || filter == NULL || numbers == NULL )
+  {
+    perror( "listtable: calloc" );
+    free( table );
+    free( filter );
+    free( numbers );
+    return -1;
+  }
+  free( t->table );
+  free( t->filter );
+  free( t->numbers );
+  t->table = table;
+  t->filter = filter;
+  t->numbers = numbers;
+  t->tableSize = size;
+  t->numNumbers = 0;
+  for( n = 0; n < t->numEntries; n++ )
+  {
+    if( !t->entries[n].removed )
+      tableInsert( t, n );
+  }
+  return 0;
+}
+
+/*
+ * Empty the table (keeping its memory for the entries).
+ */
+int listTableClear(listTable *t)
+{
+  t->numEntries = t->numLive = 0;
+  t->keyLengths = 0;
+  return tableBuild( t, 0 );
+}
+
+void listTableFree(listTable *t)
+{
+  free( t->entries );
+  free( t->table );
+  free( t->filter );
+  free( t->numbers );
+  memset( t, 0, sizeof(*t) );
+}
+
+/*
+ * Add the valid lines of list file 'fp' (named 'path' in messages)
+ * to the table.
+ */
+int listTableRead(listTable *t, FILE *fp, const char *path)
+{
+  char line[LIST_LINE_LEN];
+  int keyLen;
+
+  while( fgets( line, sizeof(line), fp ) != NULL )
+  {
+    if( (keyLen = listTableParse( path, line )) > 0 &&
+        listTableAdd( t, line, keyLen ) == -1 )
+    {
+      return -1;
+    }
+  }
+  return 0;
+}
+
+/*
+ * Add a line to the end of the table (it must be valid, with a search
+ * string 'keyLen' characters long).
+ */
+int listTableAdd(listTable *t, const char *line, int keyLen)
+{
+  listEntry *entries;
+  uint32_t size;
+
+  if( t->numEntries == t->size )
+  {
+    size = t->size ? t->size * 2 : 256;
+    if( (entries = realloc( t->entries, size * sizeof(listEntry) )) == NULL )
+    {
+      perror( "listtable: realloc" );
+      return -1;
+    }
+    t->entries = entries;
+    t->size = size;
+  }
+  if( (t->numEntries + 1) * 2 > t->tableSize &&
+      tableBuild( t, t->numEntries + 1 ) == -1 )
+  {
+    return -1;
+  }
+  snprintf( t->entries[t->numEntries].line, LIST_LINE_LEN, "%.*s\n",
+    (int)strcspn( line, "\n" ), line );
+  t->entries[t->numEntries].keyLen = keyLen;
+  t->entries[t->numEntries].removed = 0;
+  tableInsert( t, t->numEntries );
+  t->numEntries++;
+  t->numLive++;
+  t->keyLengths |= 1u << keyLen;
+  return 0;
+}
+
+/*
+ * The first entry (in file order) whose search string is 'key', or -1.
+ */
+long listTableFind(const listTable *t, const char *key, int keyLen)
+{
+  uint32_t slot, n;
+  long best = -1;
+
+  if( t->tableSize == 0 )
+    return -1;
+  slot = hashKey( key, keyLen ) & (t->tableSize - 1);
+  while( (n = t->table[slot]) != 0 )
+  {
+    n--;
+    if( t->entries[n].keyLen == keyLen && !t->entries[n].removed &&
+        memcmp( t->entries[n].line, key, keyLen ) == 0 &&
+        ( best == -1 || n < best ) )
+    {
+      best = n;
+    }
+    slot = (slot + 1) & (t->tableSize - 1);
+  }
+  return best;
+}
+
+//
+// The first entry whose search string is the same number as the
+// call's NMBR, or -1.
+//
+static long numberMatch(const listTable *t, const char *callstr)
+{
+  const char *nmbr;
+  uint64_t number;
+  uint32_t slot, n;
+  long best = -1;
+
+  if( t->numNumbers == 0 || (nmbr = strstr( callstr, "NMBR = " )) == NULL )
+    return -1;
+  number = cidNumber( nmbr + 7, -1 );
+  if( CID_KIND( number ) != CID_E164 )
+    return -1;
+  for( slot = hashNumber( number ) & (t->tableSize - 1);
+       (n = t->numbers[slot].entry) != 0; slot = (slot + 1) & (t->tableSize - 1) )
+  {
+    n--;
+    if( t->numbers[slot].number == number && !t->entries[n].removed &&
+        ( best == -1 || n < best ) )
+    {
+      best = n;
+    }
+  }
+  return best;
+}
+
+/*
+ * The first entry (in file order) whose search string is in
+ * 'callstr', or is the same number as its NMBR, or -1.
+ */
+long listTableMatch(const listTable *t, const char *callstr)
+{
+  uint32_t h, slot, n;
+  long best = -1;
+  int i, len, callLen, maxLen;
+
+  if( t->keyLengths == 0 )
+    return -1;
+  best = numberMatch( t, callstr );
+  maxLen = 31 - __builtin_clz( t->keyLengths );   // the longest search string
+
+  // Every piece of the call string as long as a search string
+  callLen = strlen( callstr );
+  for( i = 0; i < callLen; i++ )
+  {
+    h = FNV_OFFSET;
+    for( len = 1; len <= maxLen && i + len <= callLen; len++ )
+    {
+      h = (h ^ (unsigned char)callstr[i + len - 1]) * FNV_PRIME;
+      if( !(t->keyLengths & (1u << len)) ||
+          !(t->filter[(h >> 6) & (t->tableSize / 16 - 1)] & (1ull << (h & 63))) )
+      {
+        continue;
+      }
+      for( slot = h & (t->tableSize - 1); (n = t->table[slot]) != 0;
+           slot = (slot + 1) & (t->tableSize - 1) )
+      {
+        n--;
+        if( t->entries[n].keyLen == len && !t->entries[n].removed &&
+            ( best == -1 || n < best ) &&
+            memcmp( t->entries[n].line, callstr + i, len ) == 0 )
+        {
+          best = n;
+        }
+      }
+    }
+  }
+  return best;
+}
@@ -0,0 +1,72 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: listtable.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the list tables in listtable.c.
+ */
+#ifndef LISTTABLE_H
+#define LISTTABLE_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#define LIST_LINE_LEN   100     // longest list file line (with '\n')
+#define LIST_KEY_LEN    18      // longest search string ('?' at column 19)
+
+// One list entry
+typedef struct
+{
+  char line[LIST_LINE_LEN];     // as in the file (with its '\n')
+  unsigned char keyLen;         // the search string is line[0..keyLen)
+  unsigned char removed;
+} listEntry;
+
+// A search string that is a telephone number, in its packed E.164
+// form (see callerid.h)
+typedef struct
+{
+  uint64_t number;
+  uint32_t entry;               // entry number + 1 (0 is empty)
+} listNumberSlot;
+
+// The entries of one list file
+typedef struct
+{
+  listEntry *entries;           // in file order
+  uint32_t numEntries, size;
+  uint32_t numLive;             // entries not removed
+  uint32_t *table;              // entry number + 1 (0 is empty)
+  uint32_t tableSize;           // a power of two
+  uint64_t *filter;             // bit (hash & (tableSize*4-1)): a search
+                                // string may have that hash
+  uint32_t keyLengths;          // bit n set: a search string has length n
+  listNumberSlot *numbers;      // hash table (tableSize slots) of the
+  uint32_t numNumbers;          // search strings that are numbers
+} listTable;
+
+int listTableParse(const char *path, const char *line);
+int listTableClear(listTable *t);
+void listTableFree(listTable *t);
+int listTableRead(listTable *t, FILE *fp, const char *path);
+int listTableAdd(listTable *t, const char *line, int keyLen);
+long listTableFind(const listTable *t, const char *key, int keyLen);
+long listTableMatch(const listTable *t, const char *callstr);
+
+#endif
@@ -0,0 +1,430 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: metrics.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to count what the program does and how long it takes,
+ *	and to show the numbers.
+ *
+ *	The counters (calls by tag, modem command failures, ALSA
+ *	overruns, list file reads), gauges (list sizes) and latency
+ *	histograms (see the STAGE_ values in metrics.h) are shown in the
+ *	Prometheus text format:
+ *	 - to a client of the Unix socket METRICS_SOCKET (usable by its
+ *	   owner only) and, if a port is given, of that TCP port on
+ *	   127.0.0.1, as the answer to an HTTP request. E.g.:
+ *	     curl --unix-socket ./jcblock.metrics http://localhost/metrics
+ *	 - on stdout when the program gets a SIGUSR1 signal
+ *	   ("kill -USR1 <pid>").
+ *
+ *	Counting must not slow down the threads that count, and must not
+ *	need a lock. Each thread counts in its own block of counters (a
+ *	shard, on its own cache lines), which only it changes; showing
+ *	the counters adds up the shards. The counting functions work
+ *	whether or not the server was started (metricsOpen()).
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <poll.h>
+#include <signal.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "common.h"
+#include "metrics.h"
+#include "server.h"
+
+#define METRICS_SHARDS    16    // threads with their own counters
+#define METRICS_BUCKETS   8     // histogram buckets (the last is +Inf)
+
+// The bucket upper bounds (microseconds)
+static const long bucketUsec[METRICS_BUCKETS - 1] =
+{
+  10, 100, 1000, 10000, 100000, 1000000, 10000000
+};
+
+// One thread's counters
+typedef struct
+{
+  unsigned long counters[METRIC_COUNTERS];
+  unsigned long buckets[METRIC_STAGES][METRICS_BUCKETS];
+  unsigned long sumUsec[METRIC_STAGES];
+} __attribute__ ((aligned (64))) metricsShard;
+
+static metricsShard shards[METRICS_SHARDS];
+static int numShards;                   // shards handed out
+static __thread metricsShard *myShard;
+static __thread bool sharedShard;       // the last shard is shared
+static long gauges[METRIC_GAUGES];
+
+static const char *stageNames[METRIC_STAGES] =
+{
+  "call", "list_match", "list_reload", "terminate", "modem_command",
+  "log_write", "log_sync"
+};
+
+static int unixFd = -1, tcpFd = -1;
+static int wakePipe[2] = { -1, -1 };
+static char socketName[108];
+static volatile bool stopServer;
+static bool serverStarted;
+static pthread_t serverThread;
+
+//
+// This thread's shard (given out at its first count). If there are
+// more than METRICS_SHARDS threads, the others share the last one.
+//
+static metricsShard *shard(void)
+{
+  int n;
+
+  if( myShard == NULL )
+  {
+    n = __atomic_fetch_add( &numShards, 1, __ATOMIC_RELAXED );
+    if( n >= METRICS_SHARDS - 1 )
+    {
+      n = METRICS_SHARDS - 1;
+      sharedShard = TRUE;
+    }
+    myShard = &shards[n];
+  }
+  return myShard;
+}
+
+//
+// Add to a counter of this thread. Only this thread writes it, so a
+// plain (atomic, so it is never torn) load and store will do.
+//
+static void add(unsigned long *counter, unsigned long value)
+{
+  if( sharedShard )
+    __atomic_fetch_add( counter, value, __ATOMIC_RELAXED );
+  else
+    __atomic_store_n( counter, __atomic_load_n( counter, __ATOMIC_RELAXED ) + value,
+      __ATOMIC_RELAXED );
+}
+
+static unsigned long sum(const unsigned long *counter)
+{
+  unsigned long total = 0;
+  int n, used;
+
+  used = __atomic_load_n( &numShards, __ATOMIC_RELAXED );
+  if( used > METRICS_SHARDS )
+    used = METRICS_SHARDS;
+  for( n = 0; n < used; n++ )
+  {
+    // The same counter in shard n
+    total += __atomic_load_n( (const unsigned long *)
+      ((const char *)counter + n * sizeof(metricsShard)), __ATOMIC_RELAXED );
+  }
+  return total;
+}
+
+void metricsCount(int counter)
+{
+  add( &shard()->counters[counter], 1 );
+}
+
+//
+// Count a call by its callerID.dat tag.
+//
+void metricsCallTag(char tag)
+{
+  switch( tag )
+  {
+    case '-': metricsCount( METRIC_CALLS_ACCEPTED ); break;
+    case 'W': metricsCount( METRIC_CALLS_WHITE ); break;
+    case 'B': metricsCount( METRIC_CALLS_BLACK ); break;
+    case '*': metricsCount( METRIC_CALLS_STAR ); break;
+    case 'R': metricsCount( METRIC_CALLS_RATE ); break;
+    case 'N': metricsCount( METRIC_CALLS_NEIGHBOR ); break;
+    default:  metricsCount( METRIC_CALLS_OTHER ); break;
+  }
+}
+
+void metricsSetGauge(int gauge, long value)
+{
+  __atomic_store_n( &gauges[gauge], value, __ATOMIC_RELAXED );
+}
+
+//
+// The monotonic clock in microseconds (the start of a stage).
+//
+long metricsNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000000L + ts.tv_nsec / 1000;
+}
+
+//
+// A stage that started at 'startUsec' (metricsNow()) has ended.
+//
+void metricsObserve(int stage, long startUsec)
+{
+  metricsShard *s = shard();
+  long usec = metricsNow() - startUsec;
+  int b;
+
+  for( b = 0; b < METRICS_BUCKETS - 1 && usec > bucketUsec[b]; b++ )
+    ;
+  add( &s->buckets[stage][b], 1 );
+  add( &s->sumUsec[stage], usec );
+}
+
+//
+// Write all of the metrics in the Prometheus text format.
+//
+void metricsWrite(FILE *fp)
+{
+  static const char *tags[] = { "-", "W", "B", "*", "R", "N", "other" };
+  static const char *lists[] = { "whitelist", "blacklist" };
+  metricsShard *s0 = &shards[0];
+  unsigned long count;
+  int i, b;
+
+  fprintf( fp, "# HELP jcblock_calls_total Calls, by callerID.dat tag.\n"
+               "# TYPE jcblock_calls_total counter\n" );
+  for( i = 0; i <= METRIC_CALLS_OTHER - METRIC_CALLS_ACCEPTED; i++ )
+  {
+    fprintf( fp, "jcblock_calls_total{tag=\"%s\"} %lu\n", tags[i],
+      sum( &s0->counters[METRIC_CALLS_ACCEPTED + i] ) );
+  }
+  fprintf( fp, "# HELP jcblock_modem_command_failures_total Modem commands not answered OK.\n"
+               "# TYPE jcblock_modem_command_failures_total counter\n"
+               "jcblock_modem_command_failures_total %lu\n",
+    sum( &s0->counters[METRIC_MODEM_FAILURES] ) );
+  fprintf( fp, "# HELP jcblock_alsa_overruns_total Sound input overruns (star key tones).\n"
+               "# TYPE jcblock_alsa_overruns_total counter\n"
+               "jcblock_alsa_overruns_total %lu\n",
+    sum( &s0->counters[METRIC_ALSA_OVERRUNS] ) );
+
+  fprintf( fp, "# HELP jcblock_list_entries Entries in each list.\n"
+               "# TYPE jcblock_list_entries gauge\n" );
+  for( i = 0; i < 2; i++ )
+  {
+    fprintf( fp, "jcblock_list_entries{list=\"%s\"} %ld\n", lists[i],
+      __atomic_load_n( &gauges[GAUGE_ENTRIES_WHITE + i], __ATOMIC_RELAXED ) );
+  }
+  fprintf( fp, "# HELP jcblock_list_reloads_total Times each list file was read.\n"
+               "# TYPE jcblock_list_reloads_total counter\n" );
+  for( i = 0; i < 2; i++ )
+  {
+    fprintf( fp, "jcblock_list_reloads_total{list=\"%s\"} %lu\n", lists[i],
+      sum( &s0->counters[METRIC_RELOADS_WHITE + i] ) );
+  }
+
+  fprintf( fp, "# HELP jcblock_stage_seconds How long each stage of the work took.\n"
+               "# TYPE jcblock_stage_seconds histogram\n" );
+  for( i = 0; i < METRIC_STAGES; i++ )
+  {
+    count = 0;
+    for( b = 0; b < METRICS_BUCKETS; b++ )
+    {
+      count += sum( &s0->buckets[i][b] );
+      if( b < METRICS_BUCKETS - 1 )
+        fprintf( fp, "jcblock_stage_seconds_bucket{stage=\"%s\",le=\"%g\"} %lu\n",
+          stageNames[i], bucketUsec[b] / 1e6, count );
+      else
+        fprintf( fp, "jcblock_stage_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %lu\n",
+          stageNames[i], count );
+    }
+    fprintf( fp, "jcblock_stage_seconds_sum{stage=\"%s\"} %.6f\n", stageNames[i],
+      sum( &s0->sumUsec[i] ) / 1e6 );
+    fprintf( fp, "jcblock_stage_seconds_count{stage=\"%s\"} %lu\n", stageNames[i],
+      count );
+  }
+}
+
+//
+// SIGUSR1: ask the server thread to write the metrics to stdout.
+//
+static void dumpSignal(int signo)
+{
+  serverWake( NULL, wakePipe, 'd' );
+}
+
+//
+// Answer one client: read its request (which is not looked at) and
+// send the metrics as an HTTP response.
+//
+static void serveClient(int fd)
+{
+  struct timeval timeout = { 1, 0 };
+  char request[1024], header[128];
+  char *body = NULL;
+  size_t bodyLen = 0, len = 0;
+  ssize_t n;
+  FILE *fp;
+
+  setsockopt( fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout) );
+  setsockopt( fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout) );
+  while( len < sizeof(request) - 1 &&
+         (n = read( fd, request + len, sizeof(request) - 1 - len )) > 0 )
+  {
+    len += n;
+    request[len] = '\0';
+    if( strstr( request, "\r\n\r\n" ) != NULL || strstr( request, "\n\n" ) != NULL )
+      break;
+  }
+
+  if( (fp = open_memstream( &body, &bodyLen )) == NULL )
+  {
+    perror( "metrics: open_memstream" );
+    return;
+  }
+  metricsWrite( fp );
+  fclose( fp );
+  n = snprintf( header, sizeof(header), "HTTP/1.0 200 OK\r\n"
+    "Content-Type: text/plain; version=0.0.4\r\n"
+    "Content-Length: %lu\r\n\r\n", (unsigned long)bodyLen );
+  if( send( fd, header, n, MSG_NOSIGNAL ) == n )
+    send( fd, body, bodyLen, MSG_NOSIGNAL );
+  free( body );
+}
+
+//
+// The server thread.
+//
+static void *metricsServer(void *arg)
+{
+  struct pollfd fds[3];
+  sigset_t usr1;
+  int fd, i;
+
+  // This thread alone gets SIGUSR1
+  sigemptyset( &usr1 );
+  sigaddset( &usr1, SIGUSR1 );
+  pthread_sigmask( SIG_UNBLOCK, &usr1, NULL );
+
+  while( !stopServer )
+  {
+    fds[0].fd = wakePipe[0];
+    fds[1].fd = unixFd;
+    fds[2].fd = tcpFd;                  // -1 is ignored by poll()
+    for( i = 0; i < 3; i++ )
+      fds[i].events = POLLIN;
+    if( poll( fds, 3, -1 ) == -1 )
+    {
+      if( errno == EINTR )
+        continue;
+      perror( "metrics: poll" );
+      break;
+    }
+
+    if( (fds[0].revents & POLLIN) && serverPipeRead( wakePipe, 'd' ) &&
+        !stopServer )
+    {
+      metricsWrite( stdout );
+      fflush( stdout );
+    }
+    for( i = 1; i < 3; i++ )
+    {
+      if( !(fds[i].revents & POLLIN) )
+        continue;
+      if( (fd = accept( fds[i].fd, NULL, NULL )) == -1 )
+      {
+        if( errno != EAGAIN && errno != EINTR )
+          perror( "metrics: accept" );
+        continue;
+      }
+      fcntl( fd, F_SETFD, FD_CLOEXEC );
+      serveClient( fd );
+      close( fd );
+    }
+  }
+  return NULL;
+}
+
+//
+// Start the server: listen on Unix socket 'socketPath' and, if
+// 'tcpPort' is not zero, on that TCP port. Also catch SIGUSR1.
+//
+// Only the server thread gets the SIGUSR1 (a signal would cut short
+// the main thread's sleeps): it is blocked in the caller. Threads
+// started before this must have it blocked too.
+//
+int metricsOpen(const char *socketPath, int tcpPort)
+{
+  sigset_t usr1;
+  int err;
+
+  if( (unixFd = serverListenUnix( "metrics", socketPath )) == -1 )
+    return -1;
+  strncpy( socketName, socketPath, sizeof(socketName) - 1 );
+
+  // Of 127.0.0.1 only: the metrics are only for this computer (a
+  // local agent can pass them on)
+  if( tcpPort != 0 )
+    tcpFd = serverListenTcp( "metrics", tcpPort, TRUE );  // not required
+
+  if( serverPipeOpen( "metrics", wakePipe ) == -1 )
+  {
+    metricsClose();
+    return -1;
+  }
+
+  stopServer = FALSE;
+  sigemptyset( &usr1 );
+  sigaddset( &usr1, SIGUSR1 );
+  pthread_sigmask( SIG_BLOCK, &usr1, NULL );
+  signal( SIGUSR1, dumpSignal );
+  if( (err = pthread_create( &serverThread, NULL, metricsServer, NULL )) != 0 )
+  {
+    printf("metrics: can't create thread: %s\n", strerror(err));
+    signal( SIGUSR1, SIG_DFL );
+    pthread_sigmask( SIG_UNBLOCK, &usr1, NULL );
+    metricsClose();
+    return -1;
+  }
+  serverStarted = TRUE;
+  return 0;
+}
+
+//
+// Stop the server.
+//
+void metricsClose(void)
+{
+  if( serverStarted )
+  {
+    signal( SIGUSR1, SIG_IGN );
+    stopServer = TRUE;
+    serverWake( "metrics", wakePipe, 's' );
+    pthread_join( serverThread, NULL );
+    serverStarted = FALSE;
+  }
+  if( unixFd != -1 )
+  {
+    close( unixFd );
+    unlink( socketName );
+  }
+  if( tcpFd != -1 )
+    close( tcpFd );
+  unixFd = tcpFd = -1;
+  serverPipeClose( wakePipe );
+}
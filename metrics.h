@@ -0,0 +1,78 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: metrics.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the counters and latency histograms in metrics.c.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdio.h>
+
+#define METRICS_SOCKET    "./jcblock.metrics"   // Unix socket path
+
+// Counters
+enum
+{
+  METRIC_CALLS_ACCEPTED,        // callerID.dat tag '-'
+  METRIC_CALLS_WHITE,           // 'W'
+  METRIC_CALLS_BLACK,           // 'B'
+  METRIC_CALLS_STAR,            // '*'
+  METRIC_CALLS_RATE,            // 'R'
+  METRIC_CALLS_NEIGHBOR,        // 'N'
+  METRIC_CALLS_OTHER,
+  METRIC_MODEM_FAILURES,        // send_modem_command() errors
+  METRIC_ALSA_OVERRUNS,         // tonesPoll() overruns
+  METRIC_RELOADS_WHITE,         // list files read
+  METRIC_RELOADS_BLACK,
+  METRIC_COUNTERS
+};
+
+// Gauges
+enum
+{
+  GAUGE_ENTRIES_WHITE,          // list entries
+  GAUGE_ENTRIES_BLACK,
+  METRIC_GAUGES
+};
+
+// Latency histograms
+enum
+{
+  STAGE_CALL,                   // caller ID received to record queued
+  STAGE_LIST_MATCH,             // one list checked (listMatch())
+  STAGE_LIST_RELOAD,            // a list file read
+  STAGE_TERMINATE,              // a call terminated
+  STAGE_MODEM_COMMAND,          // send_modem_command()
+  STAGE_LOG_WRITE,              // a callerID.dat record written
+  STAGE_LOG_SYNC,               // callerID.dat fdatasync()
+  METRIC_STAGES
+};
+
+void metricsCount(int counter);
+void metricsCallTag(char tag);
+void metricsSetGauge(int gauge, long value);
+long metricsNow(void);
+void metricsObserve(int stage, long startUsec);
+void metricsWrite(FILE *fp);
+int metricsOpen(const char *socketPath, int tcpPort);
+void metricsClose(void);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: modemsim.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Modem simulator, to time how soon a blacklisted call is dropped.
+ *	A pseudo terminal stands in for the modem's serial port: the
+ *	program (jcblockAT, or jcblock) is started with "-p" and the
+ *	pseudo terminal's name, in a new directory whose blacklist.dat
+ *	blocks the number called. Each AT command is answered "OK", and
+ *	once the modem has been set up a call is made: RING then the
+ *	caller ID record, as in the US, or (-r) the caller ID record
+ *	first, as where caller ID comes before the first ring. The
+ *	record is sent at the speed of the caller ID signal (1200 baud).
+ *
+ *	The time from the end of the record to the off hook command
+ *	(ATH1, or ATA where the modem answers as a fax) is the time the
+ *	caller hears ringing; with the caller ID before the first ring,
+ *	the phone rings if it is longer than RING_DELAY_MSEC. Build the
+ *	program with and without DO_PRE_RING to compare.
+ *
+ *	Compile with: ./makebench
+ *	Run with:     ./modemsim [-r] [-c calls] [-n number] program
+ */
+#define _XOPEN_SOURCE 600               // posix_openpt() and ptsname()
+#define _DEFAULT_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <limits.h>
+#include <sys/wait.h>
+
+#define RING_DELAY_MSEC	200		// caller ID end to first ring (-r)
+#define CHAR_USEC	8333		// one character at 1200 baud
+#define CALL_TIMEOUT	15000		// msec to wait for the off hook
+#define IDLE_MSEC	1500		// no commands: the modem is set up
+#define STOP_MSEC	10000		// time the program has to stop
+
+// What serve() waits for
+#define SERVE_NONE	0
+#define SERVE_ANY	1		// any command
+#define SERVE_OFF_HOOK	2		// ATH1 or ATA
+#define SERVE_RESET	3		// ATZ (setting the modem up again)
+
+static int master = -1;
+static char command[256];
+static int commandLen;
+
+static long msecNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static void sendText(const char *text)
+{
+  if( write( master, text, strlen( text ) ) < 0 )
+    perror( "modemsim: write" );
+}
+
+//
+// Answer the commands that arrive in the next 'msec' milliseconds.
+// Returns the first command 'wait' asks for (it is kept in 'command'),
+// or NULL if none came.
+//
+static const char *serve(long msec, int wait)
+{
+  struct pollfd pfd;
+  long end = msecNow() + msec;
+  char c;
+  int n;
+
+  pfd.fd = master;
+  pfd.events = POLLIN;
+  while( (n = end - msecNow()) > 0 && poll( &pfd, 1, n ) > 0 )
+  {
+    if( read( master, &c, 1 ) != 1 )
+      return NULL;
+    if( c != '\r' && c != '\n' )
+    {
+      if( commandLen < (int)sizeof(command) - 1 )
+        command[commandLen++] = c;
+      continue;
+    }
+    if( commandLen == 0 )
+      continue;
+    command[commandLen] = '\0';
+    commandLen = 0;
+    if( strncmp( command, "AT", 2 ) != 0 )
+      continue;
+    if( strncmp( command, "ATA", 3 ) != 0 )
+      sendText( "\r\nOK\r\n" );
+    if( wait == SERVE_ANY ||
+        ( wait == SERVE_OFF_HOOK && ( strncmp( command, "ATH1", 4 ) == 0 ||
+                                     strncmp( command, "ATA", 3 ) == 0 ) ) ||
+        ( wait == SERVE_RESET && strncmp( command, "ATZ", 3 ) == 0 ) )
+      return command;
+  }
+  return NULL;
+}
+
+//
+// Answer commands until none arrive for IDLE_MSEC.
+//
+static void serveUntilIdle(void)
+{
+  while( serve( IDLE_MSEC, SERVE_ANY ) != NULL )
+    ;
+}
+
+//
+// Send 'text' at the caller ID speed, answering commands meanwhile.
+//
+static void sendSlowly(const char *text)
+{
+  while( *text )
+  {
+    if( write( master, text++, 1 ) < 0 )
+      perror( "modemsim: write" );
+    usleep( CHAR_USEC );
+  }
+}
+
+int main(int argc, char **argv)
+{
+  char dir[] = "/tmp/modemsimXXXXXX", program[PATH_MAX], record[128];
+  const char *number = "8005551234", *ptsName;
+  const char *offHook;
+  long calls = 5, i, sent, msec, total = 0, worst = 0, best = -1;
+  int preRing = 0, optChar, status;
+  struct tm *tmPtr;
+  time_t now;
+  pid_t pid;
+  FILE *fp;
+
+  while( (optChar = getopt( argc, argv, "rc:n:" )) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'r':
+        preRing = 1;
+        break;
+      case 'c':
+        calls = atol( optarg );
+        break;
+      case 'n':
+        number = optarg;
+        break;
+      default:
+        optind = argc;
+        break;
+    }
+  }
+  if( optind != argc - 1 || calls <= 0 )
+  {
+    fprintf(stderr, "usage: modemsim [-r] [-c calls] [-n number] program\n");
+    return 1;
+  }
+  if( realpath( argv[optind], program ) == NULL )
+  {
+    perror( argv[optind] );
+    return 1;
+  }
+
+  // The pseudo terminal, and a directory to run the program in
+  if( (master = posix_openpt( O_RDWR | O_NOCTTY )) == -1 ||
+      grantpt( master ) == -1 || unlockpt( master ) == -1 ||
+      (ptsName = ptsname( master )) == NULL )
+  {
+    perror( "modemsim: pseudo terminal" );
+    return 1;
+  }
+  if( mkdtemp( dir ) == NULL || chdir( dir ) == -1 ||
+      (fp = fopen( "blacklist.dat", "w" )) == NULL )
+  {
+    perror( dir );
+    return 1;
+  }
+  fprintf( fp, "%s?%*s010125        MODEMSIM\n", number,
+           (int)(18 - strlen( number )), "" );
+  fclose( fp );
+
+  if( (pid = fork()) == 0 )
+  {
+    if( freopen( "program.out", "w", stdout ) == NULL )
+      _exit( 1 );
+    dup2( 1, 2 );
+    execl( program, program, "-p", ptsName, (char *)NULL );
+    perror( program );
+    _exit( 1 );
+  }
+  printf("%s on %s in %s, caller ID %s the first ring\n", program, ptsName,
+    dir, preRing ? "before" : "after");
+
+  serveUntilIdle();
+  for( i = 0; i < calls; i++ )
+  {
+    now = time( NULL );
+    tmPtr = localtime( &now );
+    snprintf( record, sizeof(record),
+      "\r\nDATE = %02d%02d\r\nTIME = %02d%02d\r\nNMBR = %s\r\nNAME = MODEMSIM\r\n",
+      tmPtr->tm_mon + 1, tmPtr->tm_mday, tmPtr->tm_hour, tmPtr->tm_min,
+      number );
+    if( !preRing )
+    {
+      sendText( "\r\nRING\r\n" );
+      serve( 500, SERVE_NONE );
+    }
+    sendSlowly( record );
+    sent = msecNow();
+
+    // Wait for the off hook (ringing as we go, if the caller ID came
+    // first)
+    offHook = NULL;
+    if( preRing &&
+        (offHook = serve( RING_DELAY_MSEC, SERVE_OFF_HOOK )) == NULL )
+    {
+      sendText( "\r\nRING\r\n" );
+    }
+    while( offHook == NULL && msecNow() < sent + CALL_TIMEOUT )
+      offHook = serve( 100, SERVE_OFF_HOOK );
+    if( offHook == NULL )
+    {
+      printf("call %ld: not answered\n", i + 1);
+      break;
+    }
+    msec = msecNow() - sent;
+    printf("call %ld: off hook (%.4s) %ld msec after the caller ID%s\n",
+      i + 1, offHook, msec,
+      preRing && msec > RING_DELAY_MSEC ? " (the phone rang)" : "");
+    total += msec;
+    if( msec > worst )
+      worst = msec;
+    if( best == -1 || msec < best )
+      best = msec;
+
+    // The program hangs up, then sets the modem up again
+    serve( CALL_TIMEOUT, SERVE_RESET );
+    serveUntilIdle();
+  }
+  if( i > 0 )
+  {
+    printf("time to off hook: %ld msec best, %ld average, %ld worst\n",
+      best, total / i, worst);
+  }
+
+  // Stop the program (it may send commands as it stops). Once it
+  // has closed the port, serve() returns at once.
+  kill( pid, SIGINT );
+  msec = msecNow() + STOP_MSEC;
+  while( waitpid( pid, &status, WNOHANG ) == 0 && msecNow() < msec )
+  {
+    serve( 100, SERVE_NONE );
+    usleep( 10000 );
+  }
+  if( waitpid( pid, &status, WNOHANG ) == 0 )
+  {
+    printf("the program did not stop in %d msec, killed\n", STOP_MSEC);
+    kill( pid, SIGKILL );
+    waitpid( pid, &status, 0 );
+  }
+  printf("program output and files are in %s\n", dir);
+  return 0;
+}
@@ -0,0 +1,190 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: neighbor.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to detect "neighbor spoofing": junk calls from made up
+ *	numbers that start with our own area code and exchange (NPA-NXX),
+ *	so they look local. Each number is used once, so no list or
+ *	per-number counter (see callstats.c) catches them, but they come
+ *	in bursts from a few exchanges.
+ *
+ *	The calls from unknown numbers are counted per exchange, in an
+ *	array with a slot for every North American NPA-NXX (800 area
+ *	codes of 1000 exchanges, four bytes each). A slot holds the calls
+ *	in the current window period and in the one before, and the
+ *	calls in the last window are estimated from them (the current
+ *	count plus the part of the previous count the window still
+ *	covers), so counting a call takes constant time and nothing has
+ *	to be cleared as time passes. The home exchange and the 'span'
+ *	exchanges either side of it (in the same area code) are counted
+ *	together as well. A call from one of them is a burst if its
+ *	exchange, or the home exchanges together, have had too many
+ *	unknown calls in the window.
+ *
+ *	The counters are kept in memory only (a restart forgets them) and
+ *	are used by the main program's thread only, so they are not
+ *	locked.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "neighbor.h"
+#include "callerid.h"
+
+#define NUM_PREFIXES	(800 * 1000)	// NPA 200-999, NXX 000-999
+
+// The unknown calls from one exchange (or all home exchanges)
+typedef struct
+{
+  uint16_t period;              // window period of 'calls' (low 16 bits)
+  uint8_t calls;                // calls in that period (at most 255)
+  uint8_t lastCalls;            // calls in the period before it
+} prefixCounts;
+
+static prefixCounts *prefixes;  // by prefixIndex()
+static prefixCounts area;       // the home exchanges together
+static int homeNpa, homeNxx, homeSpan;
+static int window, exchangeLimit, areaLimit;
+
+//
+// The slot of a North American number's NPA-NXX, or -1.
+//
+static long prefixIndex(uint64_t number, int *npa, int *nxx)
+{
+  uint64_t nanp;
+
+  if( CID_KIND( number ) != CID_E164 || CID_DIGITS( number ) != 11 )
+    return -1;
+  nanp = (number & ((1ull << 56) - 1)) - 10000000000ull;
+  if( nanp >= 10000000000ull )
+    return -1;                  // not +1
+  *npa = nanp / 10000000;
+  *nxx = nanp / 10000 % 1000;
+  return (long)(*npa - 200) * 1000 + *nxx;
+}
+
+//
+// Count a call at minute 'minute' and return the calls in the window
+// up to it.
+//
+static unsigned countCall(prefixCounts *p, long minute)
+{
+  uint16_t period = minute / window;
+
+  if( p->period != period )
+  {
+    p->lastCalls = (uint16_t)(p->period + 1) == period ? p->calls : 0;
+    p->calls = 0;
+    p->period = period;
+  }
+  if( p->calls < 255 )
+    p->calls++;
+  return p->calls +
+         p->lastCalls * (unsigned)(window - minute % window) / window;
+}
+
+/*
+ * Start counting. 'home' is our number, or its first six digits
+ * ("978-909"); 'span' exchanges either side of its exchange are
+ * neighbors too. A call is a burst if its exchange has had
+ * 'maxExchange' unknown calls (counting it), or the neighbors
+ * together 'maxArea', in the last 'windowMinutes' minutes.
+ */
+int neighborOpen(const char *home, int span, int windowMinutes,
+                 int maxExchange, int maxArea)
+{
+  char digits[16];
+  int i, n = 0;
+
+  for( i = 0; home[i] != '\0' && n < 10; i++ )
+  {
+    if( home[i] >= '0' && home[i] <= '9' )
+      digits[n++] = home[i];
+  }
+  if( n > 6 && digits[0] == '1' )
+  {
+    memmove( digits, digits + 1, --n );
+  }
+  digits[n] = '\0';
+  if( n < 6 || digits[0] < '2' || windowMinutes <= 0 )
+  {
+    printf( "neighbor: \"%s\" is not an area code and exchange\n", home );
+    return -1;
+  }
+  homeNpa = (digits[0] - '0') * 100 + (digits[1] - '0') * 10 + digits[2] - '0';
+  homeNxx = (digits[3] - '0') * 100 + (digits[4] - '0') * 10 + digits[5] - '0';
+  homeSpan = span;
+  window = windowMinutes;
+  exchangeLimit = maxExchange;
+  areaLimit = maxArea;
+  memset( &area, 0, sizeof(area) );
+
+  free( prefixes );
+  if( (prefixes = calloc( NUM_PREFIXES, sizeof(prefixCounts) )) == NULL )
+  {
+    perror( "neighbor: calloc" );
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Count a call from an unknown 'number' (which may end at "--", as in
+ * a caller ID string) at time 'when'. Returns NEIGHBOR_EXCHANGE or
+ * NEIGHBOR_AREA, with the calls in the window in 'calls', if it is
+ * part of a burst from the home exchanges, else NEIGHBOR_NONE.
+ */
+int neighborCall(const char *number, time_t when, unsigned *calls)
+{
+  long i, minute = when / 60;
+  unsigned n, all;
+  int npa, nxx;
+
+  if( prefixes == NULL ||
+      (i = prefixIndex( cidNumber( number, -1 ), &npa, &nxx )) < 0 )
+  {
+    return NEIGHBOR_NONE;
+  }
+
+  // Every exchange is counted, but only neighbors are checked
+  n = countCall( &prefixes[i], minute );
+  if( npa != homeNpa || abs( nxx - homeNxx ) > homeSpan )
+    return NEIGHBOR_NONE;
+  all = countCall( &area, minute );
+  if( n >= (unsigned)exchangeLimit )
+  {
+    *calls = n;
+    return NEIGHBOR_EXCHANGE;
+  }
+  if( all >= (unsigned)areaLimit )
+  {
+    *calls = all;
+    return NEIGHBOR_AREA;
+  }
+  return NEIGHBOR_NONE;
+}
+
+void neighborClose(void)
+{
+  free( prefixes );
+  prefixes = NULL;
+}
@@ -0,0 +1,39 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: neighbor.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the neighbor spoofing detector in neighbor.c.
+ */
+#ifndef NEIGHBOR_H
+#define NEIGHBOR_H
+
+#include <time.h>
+
+// neighborCall() results
+#define NEIGHBOR_NONE     0     // not a burst (or not a home exchange)
+#define NEIGHBOR_EXCHANGE 1     // a burst from the caller's exchange
+#define NEIGHBOR_AREA     2     // a burst from the home exchanges
+
+int neighborOpen(const char *home, int span, int windowMinutes,
+                 int maxExchange, int maxArea);
+int neighborCall(const char *number, time_t when, unsigned *calls);
+void neighborClose(void);
+
+#endif
@@ -0,0 +1,244 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: pcmbench.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Benchmark for the sample conversion functions in pcmconv.c. Each
+ *	converter is checked against a plain C conversion of the same data
+ *	and timed over many periods of random samples. The per-sample loops
+ *	of the old front ends (tones.c for S8 mono, tonesRPi.c for S16
+ *	stereo) are timed too, for comparison. Times are reported in
+ *	nanoseconds per sample and (on x86 processors) in cycles per
+ *	sample.
+ *
+ *	Compile with: ./makebench
+ *	Run with:     ./pcmbench [periods]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "common.h"
+#include "goertzel.h"
+#include "pcmconv.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#define NUM_FRAMES	128		// frames per period, as in tones.c
+#define NUM_BUFFERS	64		// periods cycled through while timing
+
+// Old tones.c sample type and conversion
+#define SAMPLE		unsigned char
+
+// Old tonesRPi.c input frame and buffer union
+struct bufFrame {
+        short lSample;
+        short rSample;
+};
+
+static union {
+         char *buffer;
+         struct bufFrame *fPtr;
+}unIn;
+
+static char *inBuf;
+static FLOATING outBuf[NUM_FRAMES];
+static SAMPLE oldOutBuf[NUM_FRAMES];
+
+/*
+ * The per-sample loops of the old front ends.
+ */
+static void oldConvertS8(FLOATING *out, const void *in, int numFrames)
+{
+  const char *buffer = in;
+  int i;
+
+  for( i = 0; i < numFrames; i++ )
+  {
+    oldOutBuf[i] = (SAMPLE)( (buffer[i] * 100)/256 + 100 );
+  }
+}
+
+static void oldConvertS16Stereo(FLOATING *out, const void *in, int numFrames)
+{
+  int i;
+
+  unIn.buffer = (char *)in;
+  for( i = 0; i < numFrames; i++ )
+  {
+    out[i] = unIn.fPtr[i].lSample/32768.0;
+  }
+}
+
+struct converter {
+  char *name;
+  int bytesPerFrame;
+  int bytesPerSample;           // of the channel used (left)
+  pcmConverter convert;
+  bool old;                     // TRUE for an old per-sample loop
+};
+
+static const struct converter converters[] = {
+  { "S8 mono (old tones.c)",       1, 1, oldConvertS8,        TRUE  },
+  { "S8 mono",                     1, 1, pcmConvertS8,        FALSE },
+  { "S16 mono",                    2, 2, pcmConvertS16Mono,   FALSE },
+  { "S16 stereo (old tonesRPi.c)", 4, 2, oldConvertS16Stereo, TRUE  },
+  { "S16 stereo",                  4, 2, pcmConvertS16Stereo, FALSE },
+  { "S32 mono",                    4, 4, pcmConvertS32Mono,   FALSE },
+  { "S32 stereo",                  8, 4, pcmConvertS32Stereo, FALSE },
+};
+#define NUM_CONVERTERS (sizeof(converters) / sizeof(converters[0]))
+
+/*
+ * Plain C conversion of one left channel sample, used to check
+ * the converters.
+ */
+static FLOATING reference(const struct converter *c, const char *in, int i)
+{
+  const char *p = in + i * c->bytesPerFrame;
+
+  switch( c->bytesPerSample )
+  {
+    case 1:
+      return *(const signed char *)p / 128.0;
+    case 2:
+      return *(const short *)p / 32768.0;
+    default:
+      return *(const int *)p / 2147483648.0;
+  }
+}
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv)
+{
+  long periods = 200000;
+  long p;
+  int c, i;
+  double start, secs, maxErr;
+#ifdef HAVE_TSC
+  unsigned long long tsc;
+#endif
+
+  if( argc > 1 )
+  {
+    periods = atol( argv[1] );
+    if( periods <= 0 )
+    {
+      fprintf(stderr, "usage: pcmbench [periods]\n");
+      return 1;
+    }
+  }
+
+  // Random samples, large enough for the widest format (S32 stereo)
+  inBuf = malloc( NUM_BUFFERS * NUM_FRAMES * 8 );
+  if( inBuf == NULL )
+  {
+    perror("malloc");
+    return 1;
+  }
+  srand( 1 );
+  for( i = 0; i < NUM_BUFFERS * NUM_FRAMES * 8; i++ )
+  {
+    inBuf[i] = rand();
+  }
+
+  printf("%-30s %10s %10s %10s\n", "Converter", "ns/sample",
+#ifdef HAVE_TSC
+                                   "cyc/sample",
+#else
+                                   "",
+#endif
+                                   "max error");
+
+  for( c = 0; c < NUM_CONVERTERS; c++ )
+  {
+    const struct converter *cv = &converters[c];
+    int stride = NUM_FRAMES * cv->bytesPerFrame;
+
+    // Check (the old S8 loop has different output, so is not checked)
+    maxErr = 0.0;
+    if( !cv->old || cv->convert == oldConvertS16Stereo )
+    {
+      for( p = 0; p < NUM_BUFFERS; p++ )
+      {
+        cv->convert( outBuf, inBuf + p * stride, NUM_FRAMES );
+        for( i = 0; i < NUM_FRAMES; i++ )
+        {
+          double err = fabs( outBuf[i] -
+                          reference( cv, inBuf + p * stride, i ) );
+          if( err > maxErr )
+          {
+            maxErr = err;
+          }
+        }
+      }
+    }
+
+    // Time
+    start = now();
+#ifdef HAVE_TSC
+    tsc = __rdtsc();
+#endif
+    for( p = 0; p < periods; p++ )
+    {
+      cv->convert( outBuf, inBuf + (p % NUM_BUFFERS) * stride, NUM_FRAMES );
+    }
+#ifdef HAVE_TSC
+    tsc = __rdtsc() - tsc;
+#endif
+    secs = now() - start;
+
+    printf("%-30s %10.3f ", cv->name,
+                          secs * 1e9 / ((double)periods * NUM_FRAMES));
+#ifdef HAVE_TSC
+    printf("%10.3f ", (double)tsc / ((double)periods * NUM_FRAMES));
+#else
+    printf("%10s ", "-");
+#endif
+    if( cv->old && cv->convert == oldConvertS8 )
+    {
+      printf("%10s\n", "-");
+    }
+    else
+    {
+      printf("%10.2e\n", maxErr);
+    }
+  }
+
+  // Keep the results live
+  if( outBuf[0] > 2.0 || oldOutBuf[0] == 1 )
+  {
+    printf("\n");
+  }
+
+  free( inBuf );
+  return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: pcmconv.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to convert captured audio samples to the scaled FLOATING
+ *	samples used by the tone detector. There is one function for each
+ *	capture format tones.c can negotiate with ALSA, so no per-sample
+ *	format test is needed. On x86 processors the SSE2 instructions and
+ *	on ARM processors (e.g., the Raspberry Pi 2 and later) the NEON
+ *	instructions convert four to sixteen samples at a time. Other
+ *	processors use the plain C loops at the end of each function (they
+ *	also convert the samples left over by the vector loops).
+ *
+ *	Note: for NEON on a 32-bit Raspberry Pi, compile with:
+ *	    -mfpu=neon
+ */
+#include <stdio.h>
+
+#include "common.h"
+#include "goertzel.h"
+#include "pcmconv.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define USE_NEON
+#endif
+
+#define SCALE_S8	(1.0f / 128.0f)
+#define SCALE_S16	(1.0f / 32768.0f)
+#define SCALE_S32	(1.0f / 2147483648.0f)
+
+/*
+ * Signed 8-bit mono.
+ */
+void pcmConvertS8(FLOATING *out, const void *in, int numFrames)
+{
+  const signed char *src = in;
+  int i = 0;
+
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps( SCALE_S8 );
+  __m128i x, w0, w1;
+
+  for( ; i + 16 <= numFrames; i += 16 )
+  {
+    x = _mm_loadu_si128( (const __m128i *)&src[i] );
+    // Sign extend 8 -> 16 bits, then 16 -> 32 bits
+    w0 = _mm_srai_epi16( _mm_unpacklo_epi8( x, x ), 8 );
+    w1 = _mm_srai_epi16( _mm_unpackhi_epi8( x, x ), 8 );
+    _mm_storeu_ps( &out[i], _mm_mul_ps( scale, _mm_cvtepi32_ps(
+                 _mm_srai_epi32( _mm_unpacklo_epi16( w0, w0 ), 16 ) ) ) );
+    _mm_storeu_ps( &out[i + 4], _mm_mul_ps( scale, _mm_cvtepi32_ps(
+                 _mm_srai_epi32( _mm_unpackhi_epi16( w0, w0 ), 16 ) ) ) );
+    _mm_storeu_ps( &out[i + 8], _mm_mul_ps( scale, _mm_cvtepi32_ps(
+                 _mm_srai_epi32( _mm_unpacklo_epi16( w1, w1 ), 16 ) ) ) );
+    _mm_storeu_ps( &out[i + 12], _mm_mul_ps( scale, _mm_cvtepi32_ps(
+                 _mm_srai_epi32( _mm_unpackhi_epi16( w1, w1 ), 16 ) ) ) );
+  }
+#elif defined(USE_NEON)
+  int16x8_t w;
+
+  for( ; i + 8 <= numFrames; i += 8 )
+  {
+    w = vmovl_s8( vld1_s8( &src[i] ) );
+    vst1q_f32( &out[i], vmulq_n_f32( vcvtq_f32_s32(
+                           vmovl_s16( vget_low_s16( w ) ) ), SCALE_S8 ) );
+    vst1q_f32( &out[i + 4], vmulq_n_f32( vcvtq_f32_s32(
+                           vmovl_s16( vget_high_s16( w ) ) ), SCALE_S8 ) );
+  }
+#endif
+  for( ; i < numFrames; i++ )
+  {
+    out[i] = src[i] * SCALE_S8;
+  }
+}
+
+/*
+ * Signed 16-bit mono.
+ */
+void pcmConvertS16Mono(FLOATING *out, const void *in, int numFrames)
+{
+  const short *src = in;
+  int i = 0;
+
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps( SCALE_S16 );
+  __m128i x;
+
+  for( ; i + 8 <= numFrames; i += 8 )
+  {
+    x = _mm_loadu_si128( (const __m128i *)&src[i] );
+    _mm_storeu_ps( &out[i], _mm_mul_ps( scale, _mm_cvtepi32_ps(
+                 _mm_srai_epi32( _mm_unpacklo_epi16( x, x ), 16 ) ) ) );
+    _mm_storeu_ps( &out[i + 4], _mm_mul_ps( scale, _mm_cvtepi32_ps(
+                 _mm_srai_epi32( _mm_unpackhi_epi16( x, x ), 16 ) ) ) );
+  }
+#elif defined(USE_NEON)
+  int16x8_t x;
+
+  for( ; i + 8 <= numFrames; i += 8 )
+  {
+    x = vld1q_s16( &src[i] );
+    vst1q_f32( &out[i], vmulq_n_f32( vcvtq_f32_s32(
+                           vmovl_s16( vget_low_s16( x ) ) ), SCALE_S16 ) );
+    vst1q_f32( &out[i + 4], vmulq_n_f32( vcvtq_f32_s32(
+                           vmovl_s16( vget_high_s16( x ) ) ), SCALE_S16 ) );
+  }
+#endif
+  for( ; i < numFrames; i++ )
+  {
+    out[i] = src[i] * SCALE_S16;
+  }
+}
+
+/*
+ * Signed 16-bit interleaved stereo (left channel).
+ */
+void pcmConvertS16Stereo(FLOATING *out, const void *in, int numFrames)
+{
+  const short *src = in;
+  int i = 0;
+
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps( SCALE_S16 );
+  __m128i x;
+
+  for( ; i + 4 <= numFrames; i += 4 )
+  {
+    // Four frames; the left sample is the low half of each 32 bits
+    x = _mm_loadu_si128( (const __m128i *)&src[2 * i] );
+    _mm_storeu_ps( &out[i], _mm_mul_ps( scale, _mm_cvtepi32_ps(
+                 _mm_srai_epi32( _mm_slli_epi32( x, 16 ), 16 ) ) ) );
+  }
+#elif defined(USE_NEON)
+  int16x8x2_t x;
+
+  for( ; i + 8 <= numFrames; i += 8 )
+  {
+    x = vld2q_s16( &src[2 * i] );             // val[0] = left channel
+    vst1q_f32( &out[i], vmulq_n_f32( vcvtq_f32_s32(
+                    vmovl_s16( vget_low_s16( x.val[0] ) ) ), SCALE_S16 ) );
+    vst1q_f32( &out[i + 4], vmulq_n_f32( vcvtq_f32_s32(
+                    vmovl_s16( vget_high_s16( x.val[0] ) ) ), SCALE_S16 ) );
+  }
+#endif
+  for( ; i < numFrames; i++ )
+  {
+    out[i] = src[2 * i] * SCALE_S16;
+  }
+}
+
+/*
+ * Signed 32-bit mono.
+ */
+void pcmConvertS32Mono(FLOATING *out, const void *in, int numFrames)
+{
+  const int *src = in;
+  int i = 0;
+
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps( SCALE_S32 );
+
+  for( ; i + 4 <= numFrames; i += 4 )
+  {
+    _mm_storeu_ps( &out[i], _mm_mul_ps( scale, _mm_cvtepi32_ps(
+                 _mm_loadu_si128( (const __m128i *)&src[i] ) ) ) );
+  }
+#elif defined(USE_NEON)
+  for( ; i + 4 <= numFrames; i += 4 )
+  {
+    vst1q_f32( &out[i], vmulq_n_f32( vcvtq_f32_s32(
+                                   vld1q_s32( &src[i] ) ), SCALE_S32 ) );
+  }
+#endif
+  for( ; i < numFrames; i++ )
+  {
+    out[i] = src[i] * SCALE_S32;
+  }
+}
+
+/*
+ * Signed 32-bit interleaved stereo (left channel).
+ */
+void pcmConvertS32Stereo(FLOATING *out, const void *in, int numFrames)
+{
+  const int *src = in;
+  int i = 0;
+
+#if defined(__SSE2__)
+  const __m128 scale = _mm_set1_ps( SCALE_S32 );
+  __m128 a, b;
+
+  for( ; i + 4 <= numFrames; i += 4 )
+  {
+    // Pick the even (left) elements of two frame pairs
+    a = _mm_castsi128_ps( _mm_loadu_si128( (const __m128i *)&src[2 * i] ) );
+    b = _mm_castsi128_ps(
+                  _mm_loadu_si128( (const __m128i *)&src[2 * i + 4] ) );
+    _mm_storeu_ps( &out[i], _mm_mul_ps( scale, _mm_cvtepi32_ps(
+          _mm_castps_si128( _mm_shuffle_ps( a, b, _MM_SHUFFLE(2,0,2,0) ) ) ) ) );
+  }
+#elif defined(USE_NEON)
+  int32x4x2_t x;
+
+  for( ; i + 4 <= numFrames; i += 4 )
+  {
+    x = vld2q_s32( &src[2 * i] );             // val[0] = left channel
+    vst1q_f32( &out[i], vmulq_n_f32( vcvtq_f32_s32( x.val[0] ), SCALE_S32 ) );
+  }
+#endif
+  for( ; i < numFrames; i++ )
+  {
+    out[i] = src[2 * i] * SCALE_S32;
+  }
+}
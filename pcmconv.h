@@ -0,0 +1,38 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: pcmconv.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the sample conversion functions in pcmconv.c.
+ *	Each one converts 'numFrames' frames of one capture format (native
+ *	byte order) to samples scaled to -1.0..+1.0 for the tone detector.
+ *	For stereo formats the left channel is used.
+ */
+#ifndef PCMCONV_H
+#define PCMCONV_H
+
+typedef void (*pcmConverter)(FLOATING *out, const void *in, int numFrames);
+
+void pcmConvertS8(FLOATING *out, const void *in, int numFrames);
+void pcmConvertS16Mono(FLOATING *out, const void *in, int numFrames);
+void pcmConvertS16Stereo(FLOATING *out, const void *in, int numFrames);
+void pcmConvertS32Mono(FLOATING *out, const void *in, int numFrames);
+void pcmConvertS32Stereo(FLOATING *out, const void *in, int numFrames);
+
+#endif
@@ -0,0 +1,639 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: pollbench.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Latency and accuracy benchmark for the star (*) key detection as
+ *	jcblock runs it: through tonesPoll() in tones.c. Where tonesbench.c
+ *	measures the detector on recorded clips, this program measures how
+ *	the block sizes (N_LO, N_HI), DET_MIN and the beep rule (BEEP_DET_MIN
+ *	to BEEP_DET_MAX blocks) trade detection latency against accuracy.
+ *
+ *	This file replaces the ALSA library with a synthetic capture device
+ *	(the snd_pcm_*() functions below), so tones.c, pcmconv.c and
+ *	goertzel.c run unchanged without a sound card. The device plays:
+ *	 1) trials with a held *-key (about one second) or two short
+ *	    *-key beeps (DO_BEEPS), over speech-like audio and noise,
+ *	    with a chosen signal to noise ratio, twist and timing jitter.
+ *	    The detection latency is measured from the start of the key
+ *	    press (of the second beep) that completes the entry.
+ *	 2) a number of hours of speech-like audio and noise only, to
+ *	    count the false positives per hour.
+ *	The CPU time of tonesPoll() is reported in cycles per sample (on
+ *	x86 processors) and nanoseconds per sample.
+ *
+ *	Compile with: ./makebench  (needs the ALSA header files, but not
+ *	the library: the libasound2-dev package)
+ *	Run with:     ./pollbench [-s snr_dB] [-w twist_dB] [-j jitter_msec]
+ *	                  [-n trials] [-H hours] [-f s8|s16|s16s|s32|s32s]
+ *	                  [-m held|beeps|both]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+
+/* Use the newer ALSA API */
+#define ALSA_PCM_NEW_HW_PARAMS_API
+
+#include <alsa/asoundlib.h>
+
+#include "common.h"
+#include "goertzel.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC
+#endif
+
+#define PI		3.14159265
+#define RATE		8000
+
+#define TONE_LEVEL	0.1		// each tone, -20 dB full scale
+#define HELD_SECS	1.0		// held *-key duration
+#define BEEP_SECS	0.18		// one beep
+#define BEEP_GAP_SECS	0.6		// from one beep to the next
+#define LEAD_SECS	1.0		// audio before the key press
+#define TAIL_SECS	3.0		// audio after the key press
+#define CHUNK_SECS	10		// false positive audio chunk
+
+#define MAX_TRIALS	100000
+
+/*
+ * Options
+ */
+static double snrDb = 20.0;     // tone power / background power
+static double twistDb = 0.0;    // 941 Hz level - 1209 Hz level
+static double jitterMsec = 20.0;
+static int numTrials = 200;
+static double fpHours = 1.0;
+static int mode = 0;            // 0: both, 1: held only, 2: beeps only
+
+/*
+ * Synthetic capture device
+ */
+struct fakeFormat {
+  char *name;
+  snd_pcm_format_t format;
+  unsigned int channels;
+  int bytesPerSample;
+};
+
+static const struct fakeFormat fakeFormats[] = {
+  { "s8",   SND_PCM_FORMAT_S8,  1, 1 },
+  { "s16",  SND_PCM_FORMAT_S16, 1, 2 },
+  { "s16s", SND_PCM_FORMAT_S16, 2, 2 },
+  { "s32",  SND_PCM_FORMAT_S32, 1, 4 },
+  { "s32s", SND_PCM_FORMAT_S32, 2, 4 },
+};
+#define NUM_FAKE_FORMATS (sizeof(fakeFormats) / sizeof(fakeFormats[0]))
+
+static const struct fakeFormat *device = &fakeFormats[2];
+static snd_pcm_uframes_t devicePeriod = 128;
+static int deviceHandle;
+
+static char *stream;            // samples in the device format
+static long streamFrames;
+static long streamPos;          // next frame to deliver
+static bool streamDone;
+
+/*
+ * Deterministic random numbers so every run uses the same audio.
+ */
+static unsigned int seed = 12345;
+
+static double uniform(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return (seed & 0xffffff) / (double)0x1000000;
+}
+
+static double gaussian(void)
+{
+  double u1 = uniform() + 1e-12;
+  double u2 = uniform();
+  return sqrt( -2.0 * log(u1) ) * cos( 2.0 * PI * u2 );
+}
+
+/* Add a tone burst at sample 'first' lasting 'num' samples */
+static void addTone(double *buf, long len, double freq, double amp,
+                                  long first, long num)
+{
+  long i;
+  double phase = 2.0 * PI * uniform();
+
+  for( i = first; i < first + num && i < len; i++ )
+  {
+    buf[i] += amp * sin( 2.0 * PI * freq * i / RATE + phase );
+  }
+}
+
+/*
+ * Speech-like background (a glottal pulse train through two moving
+ * formant resonators, with a syllable envelope) plus white noise, at
+ * a total power of 'power'.
+ */
+static void addBackground(double *buf, long len, double power)
+{
+  static double pitch = 150, f1 = 500, f2 = 1500;
+  static double y1a, y1b, y2a, y2b, phase;
+  static long t;
+  double r = 0.97, x, y1, y2, env;
+  double *speech;
+  double sum = 0, scale;
+  long i;
+
+  if( power <= 0.0 || (speech = malloc( len * sizeof(double) )) == NULL )
+    return;
+
+  for( i = 0; i < len; i++, t++ )
+  {
+    if( t % 400 == 0 )              // every 50 msec move the formants
+    {
+      pitch += 10 * gaussian();
+      if( pitch < 80 ) pitch = 80;
+      if( pitch > 300 ) pitch = 300;
+      f1 = 300 + 600 * uniform();
+      f2 = 900 + 1500 * uniform();
+    }
+    phase += pitch / RATE;
+    x = 0.1 * gaussian();
+    if( phase >= 1.0 )
+    {
+      phase -= 1.0;
+      x += 1.0;
+    }
+    y1 = x + 2 * r * cos( 2 * PI * f1 / RATE ) * y1a - r * r * y1b;
+    y1b = y1a;  y1a = y1;
+    y2 = x + 2 * r * cos( 2 * PI * f2 / RATE ) * y2a - r * r * y2b;
+    y2b = y2a;  y2a = y2;
+    env = 0.5 + 0.5 * sin( 2 * PI * 4.0 * t / RATE );     // syllables
+    speech[i] = env * (y1 + 0.5 * y2) + 0.3 * gaussian();
+    sum += speech[i] * speech[i];
+  }
+
+  scale = sqrt( power / (sum / len + 1e-20) );
+  for( i = 0; i < len; i++ )
+  {
+    buf[i] += scale * speech[i];
+  }
+  free( speech );
+}
+
+/*
+ * Convert the audio to the device format (both channels of a stereo
+ * device get the same sample) and make it the device's stream.
+ */
+static void loadStream(const double *buf, long len)
+{
+  int bytesPerFrame = device->bytesPerSample * device->channels;
+  double v;
+  long i;
+  unsigned int ch;
+  char *p;
+
+  free( stream );
+  stream = malloc( len * bytesPerFrame );
+  p = stream;
+  for( i = 0; i < len; i++ )
+  {
+    v = buf[i] > 1.0 ? 1.0 : buf[i] < -1.0 ? -1.0 : buf[i];
+    for( ch = 0; ch < device->channels; ch++ )
+    {
+      switch( device->bytesPerSample )
+      {
+        case 1:
+          *(signed char *)p = (signed char)( v * 127.0 );
+          break;
+        case 2:
+          *(short *)p = (short)( v * 32767.0 );
+          break;
+        default:
+          *(int *)p = (int)( v * 2147483647.0 );
+          break;
+      }
+      p += device->bytesPerSample;
+    }
+  }
+  streamFrames = len;
+  streamPos = 0;
+  streamDone = FALSE;
+}
+
+/*
+ * The ALSA functions used by tones.c.
+ */
+int snd_pcm_open(snd_pcm_t **pcm, const char *name,
+                          snd_pcm_stream_t stream, int mode)
+{
+  *pcm = (snd_pcm_t *)&deviceHandle;
+  return 0;
+}
+
+const char *snd_strerror(int errnum)
+{
+  return "synthetic device error";
+}
+
+size_t snd_pcm_hw_params_sizeof(void)
+{
+  return 64;
+}
+
+int snd_pcm_hw_params_any(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
+{
+  return 0;
+}
+
+int snd_pcm_hw_params_set_access(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+                                 snd_pcm_access_t access)
+{
+  return 0;
+}
+
+int snd_pcm_hw_params_test_format(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+                                  snd_pcm_format_t val)
+{
+  return val == device->format ? 0 : -EINVAL;
+}
+
+int snd_pcm_hw_params_set_format(snd_pcm_t *pcm, snd_pcm_hw_params_t *params,
+                                 snd_pcm_format_t val)
+{
+  return val == device->format ? 0 : -EINVAL;
+}
+
+int snd_pcm_hw_params_get_format(const snd_pcm_hw_params_t *params,
+                                 snd_pcm_format_t *val)
+{
+  *val = device->format;
+  return 0;
+}
+
+int snd_pcm_hw_params_test_channels(snd_pcm_t *pcm,
+                          snd_pcm_hw_params_t *params, unsigned int val)
+{
+  return val == device->channels ? 0 : -EINVAL;
+}
+
+int snd_pcm_hw_params_set_channels(snd_pcm_t *pcm,
+                          snd_pcm_hw_params_t *params, unsigned int val)
+{
+  return val == device->channels ? 0 : -EINVAL;
+}
+
+int snd_pcm_hw_params_get_channels(const snd_pcm_hw_params_t *params,
+                                   unsigned int *val)
+{
+  *val = device->channels;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_rate_near(snd_pcm_t *pcm,
+                snd_pcm_hw_params_t *params, unsigned int *val, int *dir)
+{
+  *val = RATE;
+  return 0;
+}
+
+int snd_pcm_hw_params_set_period_size_near(snd_pcm_t *pcm,
+          snd_pcm_hw_params_t *params, snd_pcm_uframes_t *val, int *dir)
+{
+  devicePeriod = *val;
+  return 0;
+}
+
+int snd_pcm_hw_params_get_period_size(const snd_pcm_hw_params_t *params,
+                                 snd_pcm_uframes_t *frames, int *dir)
+{
+  *frames = devicePeriod;
+  return 0;
+}
+
+int snd_pcm_hw_params(snd_pcm_t *pcm, snd_pcm_hw_params_t *params)
+{
+  return 0;
+}
+
+/* Deliver the next frames of the stream; silence after its end */
+snd_pcm_sframes_t snd_pcm_readi(snd_pcm_t *pcm, void *buffer,
+                                snd_pcm_uframes_t size)
+{
+  int bytesPerFrame = device->bytesPerSample * device->channels;
+  long n = size;
+
+  if( streamPos + n > streamFrames )
+  {
+    n = streamFrames - streamPos;
+    if( n < 0 )
+      n = 0;
+    memset( (char *)buffer + n * bytesPerFrame, 0,
+                                  (size - n) * bytesPerFrame );
+    streamDone = TRUE;
+  }
+  memcpy( buffer, stream + streamPos * bytesPerFrame, n * bytesPerFrame );
+  streamPos += size;
+  return size;
+}
+
+int snd_pcm_drop(snd_pcm_t *pcm)    { return 0; }
+int snd_pcm_prepare(snd_pcm_t *pcm) { return 0; }
+int snd_pcm_drain(snd_pcm_t *pcm)   { return 0; }
+int snd_pcm_close(snd_pcm_t *pcm)   { return 0; }
+
+/*
+ * Timing of tonesPoll()
+ */
+static double pollSecs;
+#ifdef HAVE_TSC
+static unsigned long long pollCycles;
+#endif
+static long pollFrames;
+
+static double now(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Call tonesPoll() once and account for its time */
+static bool timedPoll(void)
+{
+  long startPos = streamPos;
+  double start = now();
+  bool detected;
+#ifdef HAVE_TSC
+  unsigned long long tsc = __rdtsc();
+#endif
+
+  detected = tonesPoll();
+
+#ifdef HAVE_TSC
+  pollCycles += __rdtsc() - tsc;
+#endif
+  pollSecs += now() - start;
+  pollFrames += streamPos - startPos;
+  return detected;
+}
+
+static double jitter(void)
+{
+  return ( 2.0 * uniform() - 1.0 ) * jitterMsec / 1000.0;
+}
+
+static int compareDoubles(const void *a, const void *b)
+{
+  double x = *(const double *)a, y = *(const double *)b;
+
+  return x < y ? -1 : x > y;
+}
+
+static double percentile(const double *sorted, int n, double p)
+{
+  int i = (int)( p / 100.0 * (n - 1) + 0.5 );
+
+  return n > 0 ? sorted[i] : 0.0;
+}
+
+/*
+ * Run the key press trials. Returns the number detected and fills
+ * 'latency' (msec) for each detected trial.
+ */
+static int runTrials(bool beeps, double *latency, int *numLatency)
+{
+  double lo = TONE_LEVEL;
+  double hi = TONE_LEVEL * pow( 10.0, -twistDb / 20.0 );
+  double background = ( lo * lo / 2 ) / pow( 10.0, snrDb / 10.0 );
+  long len = (long)( ( LEAD_SECS + 1.0 + TAIL_SECS ) * RATE );
+  double *buf = malloc( len * sizeof(double) );
+  long onset, first, dur, gap;
+  int trial, numDetected = 0;
+
+  *numLatency = 0;
+  for( trial = 0; trial < numTrials; trial++ )
+  {
+    memset( buf, 0, len * sizeof(double) );
+    addBackground( buf, len, background );
+
+    // Random start, so the key press falls anywhere in a block
+    first = (long)( ( LEAD_SECS * uniform() + 0.2 ) * RATE );
+    if( !beeps )
+    {
+      dur = (long)( ( HELD_SECS + jitter() ) * RATE );
+      addTone( buf, len, 941.0, lo, first, dur );
+      addTone( buf, len, 1209.0, hi, first, dur );
+      onset = first;
+    }
+    else
+    {
+      dur = (long)( ( BEEP_SECS + jitter() ) * RATE );
+      addTone( buf, len, 941.0, lo, first, dur );
+      addTone( buf, len, 1209.0, hi, first, dur );
+      gap = (long)( ( BEEP_GAP_SECS + jitter() ) * RATE );
+      dur = (long)( ( BEEP_SECS + jitter() ) * RATE );
+      addTone( buf, len, 941.0, lo, first + gap, dur );
+      addTone( buf, len, 1209.0, hi, first + gap, dur );
+      onset = first + gap;
+    }
+
+    loadStream( buf, len );
+    tonesClearBuffer();
+    while( !streamDone )
+    {
+      if( timedPoll() == TRUE )
+      {
+        numDetected++;
+        latency[(*numLatency)++] =
+                         1000.0 * ( streamPos - onset ) / RATE;
+        break;
+      }
+    }
+  }
+  free( buf );
+  return numDetected;
+}
+
+/*
+ * Run 'fpHours' of background audio. Returns the number of
+ * (false) detections.
+ */
+static int runBackground(double *hours)
+{
+  double lo = TONE_LEVEL;
+  double background = ( lo * lo / 2 ) / pow( 10.0, snrDb / 10.0 );
+  long len = CHUNK_SECS * RATE;
+  long numChunks = (long)( fpHours * 3600 / CHUNK_SECS + 0.5 );
+  double *buf = malloc( len * sizeof(double) );
+  long chunk;
+  int numFalse = 0;
+
+  tonesClearBuffer();
+  for( chunk = 0; chunk < numChunks; chunk++ )
+  {
+    memset( buf, 0, len * sizeof(double) );
+    addBackground( buf, len, background );
+    loadStream( buf, len );
+    while( !streamDone )
+    {
+      if( timedPoll() == TRUE )
+      {
+        numFalse++;
+      }
+    }
+  }
+  free( buf );
+  *hours = numChunks * (double)CHUNK_SECS / 3600.0;
+  return numFalse;
+}
+
+static void report(const char *name, int numDetected, double *latency,
+                                                    int numLatency)
+{
+  qsort( latency, numLatency, sizeof(double), compareDoubles );
+  printf( "%s:\n", name );
+  printf( "  detection rate:   %d/%d (%.1f%%)\n", numDetected, numTrials,
+                                     100.0 * numDetected / numTrials );
+  if( numLatency > 0 )
+  {
+    printf( "  latency (msec):   p50 %.0f  p90 %.0f  p99 %.0f  max %.0f\n",
+              percentile( latency, numLatency, 50 ),
+              percentile( latency, numLatency, 90 ),
+              percentile( latency, numLatency, 99 ),
+              latency[numLatency - 1] );
+  }
+}
+
+int main(int argc, char **argv)
+{
+  double *latency;
+  int numLatency, numDetected, numFalse;
+  double hours = 0;
+  int optChar, i, savedStdout, devNull;
+
+  while( ( optChar = getopt( argc, argv, "s:w:j:n:H:f:m:h" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 's':
+        snrDb = atof( optarg );
+        break;
+
+      case 'w':
+        twistDb = atof( optarg );
+        break;
+
+      case 'j':
+        jitterMsec = atof( optarg );
+        break;
+
+      case 'n':
+        numTrials = atoi( optarg );
+        break;
+
+      case 'H':
+        fpHours = atof( optarg );
+        break;
+
+      case 'f':
+        for( i = 0; i < NUM_FAKE_FORMATS; i++ )
+        {
+          if( strcmp( optarg, fakeFormats[i].name ) == 0 )
+            device = &fakeFormats[i];
+        }
+        break;
+
+      case 'm':
+        mode = strcmp( optarg, "held" ) == 0 ? 1 :
+                 strcmp( optarg, "beeps" ) == 0 ? 2 : 0;
+        break;
+
+      case 'h':
+      default:
+        fprintf( stderr, "Usage: pollbench [-s snr_dB] [-w twist_dB] "
+                    "[-j jitter_msec] [-n trials] [-H hours]\n"
+                    "                 [-f s8|s16|s16s|s32|s32s] "
+                    "[-m held|beeps|both]\n" );
+        return -1;
+    }
+  }
+  if( numTrials < 1 || numTrials > MAX_TRIALS )
+  {
+    fprintf( stderr, "trials must be 1 to %d\n", MAX_TRIALS );
+    return -1;
+  }
+  latency = malloc( numTrials * sizeof(double) );
+
+  printf( "SNR %.1f dB, twist %.1f dB, jitter %.0f msec, %d trials, "
+          "device format %s\n", snrDb, twistDb, jitterMsec, numTrials,
+          device->name );
+  tonesInit();
+  fflush( stdout );
+
+  // tonesPoll() prints every detection; hide those lines
+  savedStdout = dup( 1 );
+  devNull = open( "/dev/null", O_WRONLY );
+
+  if( mode != 2 )
+  {
+    dup2( devNull, 1 );
+    numDetected = runTrials( FALSE, latency, &numLatency );
+    fflush( stdout );
+    dup2( savedStdout, 1 );
+    report( "Held *-key", numDetected, latency, numLatency );
+  }
+  if( mode != 1 )
+  {
+    fflush( stdout );
+    dup2( devNull, 1 );
+    numDetected = runTrials( TRUE, latency, &numLatency );
+    fflush( stdout );
+    dup2( savedStdout, 1 );
+    report( "Two *-key beeps", numDetected, latency, numLatency );
+  }
+  if( fpHours > 0 )
+  {
+    fflush( stdout );
+    dup2( devNull, 1 );
+    numFalse = runBackground( &hours );
+    fflush( stdout );
+    dup2( savedStdout, 1 );
+    printf( "Background audio (%.2f hours):\n", hours );
+    printf( "  false positives:  %d (%.2f per hour)\n", numFalse,
+                                         hours > 0 ? numFalse / hours : 0 );
+  }
+
+  printf( "tonesPoll() time:   %.1f ns/sample", 1e9 * pollSecs /
+                                    ( pollFrames ? pollFrames : 1 ) );
+#ifdef HAVE_TSC
+  printf( ", %.1f cycles/sample", (double)pollCycles /
+                                    ( pollFrames ? pollFrames : 1 ) );
+#endif
+  printf( "\n" );
+
+  tonesClose();
+  free( latency );
+  return 0;
+}
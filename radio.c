@@ -25,6 +25,16 @@
  *  they might truly appreciate it. Even if it's just to hang up on people.
  *
  *  With DEBUG flag at compile time, you get some pretty output.
+ *
+ *  The sockets (one per interface address) are created once, by
+ *  radioOpen(), and made again only when the interfaces change: a
+ *  netlink socket tells us when an address or a link comes or goes
+ *  (if netlink is not available, the list is checked every
+ *  RADIO_REFRESH_SECS seconds). broadcast() just queues the message;
+ *  a sender thread sends it with non-blocking sendto() calls. If the
+ *  queue is full the oldest message is dropped, and a failed send is
+ *  reported and forgotten, so the network can never delay or stop
+ *  the handling of a call.
  */
 #include "radio.h"
 
@@ -32,87 +42,62 @@
 #include <netdb.h>
 #include <netinet/in.h>
 #include <net/if.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
 #include <sys/ioctl.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-// A buffer and its running pointer
-char broadcastbuffer[82], *bufferpointer;
+#include "server.h"
 
-void
-printAndExit(const char *what) {
-    printf("%.80s", what);
-    exit(-1);
-}
+#define RADIO_QUEUE         16      // messages waiting to be sent
+#define RADIO_MESSAGE       128     // longest message (text: 80 chars, '\n')
+#define RADIO_MAX_IFACES    16      // interface addresses used
+#define RADIO_REFRESH_SECS  60      // interface check without netlink
+
+// One interface address and its socket
+struct radioIface {
+    struct sockaddr_in address;
+    struct sockaddr_in broadcast;
+    int sock;
+};
+
+static struct radioIface ifaces[RADIO_MAX_IFACES];
+static int numIfaces;
+static int netlinkSocket = -1;
+
+// One queued message and the port it goes to
+struct radioMessage {
+    int port;
+    int len;
+    unsigned char data[RADIO_MESSAGE];
+};
+
+// The queue (a ring) and the sender thread
+static struct radioMessage queue[RADIO_QUEUE];
+static int queueHead, queueCount;
+static unsigned long dropped;
+static int wakePipe[2] = { -1, -1 };
+static int stopSender, senderStarted;
+static pthread_t senderThread;
+static pthread_mutex_t queueMutex = PTHREAD_MUTEX_INITIALIZER;
 
 void
 comment(const char *what) {
     printf("%.80s", what);
 }
 
-/**
- * This is what sends the broadcast out to the specified address. 
- */
 void
-sendTo(struct sockaddr_in *address, struct sockaddr_in *broadcast) {
-    int status;      /* Status return code */
-    int broadcastsocket;      /* Socket */
-    static int do_broadcast = 1;
-    /*
-     * Create a UDP socket to use:
-     */
-    broadcastsocket = socket(AF_INET,SOCK_DGRAM,0);
-    if ( broadcastsocket == -1 ) {
-        comment("socket()");
-        return;
-    }
-
-    /*
-     * Allow broadcasts:
-     */
-    status = setsockopt(broadcastsocket,
-            SOL_SOCKET,
-            SO_BROADCAST,
-            &do_broadcast,
-            sizeof do_broadcast);
-
-    if ( status == -1 ) {
-        comment("setsockopt(SO_BROADCAST)");
-        return;
-    }
-
-    /*
-     * Bind an address to our socket, so that
-     * client programs can listen to this
-     * server:
-     */
-    status = bind(broadcastsocket,
-            (struct sockaddr *)address,
-            sizeof(*address));
-
-    if ( status == -1 ) {
-        comment("bind()");
-        return;
-    }
-
-    /*
-     * Broadcast the updated info:
-     */
-    status = sendto(broadcastsocket,
-            broadcastbuffer,
-            strlen(broadcastbuffer),
-            0,
-            (struct sockaddr *)broadcast,
-            sizeof(*broadcast));
-
-    if ( status == -1 ) {
-        printAndExit("sendto()");
-        return;
-    }
+commentError(const char *what) {
+    printf("radio: %.60s: %.60s\n", what, strerror(errno));
 }
 
 static unsigned long SockAddrToUint32(struct sockaddr * a)
@@ -150,47 +135,309 @@ static unsigned long Inet_AtoN(const char * buf)
 }
 #endif
 
-void CallWithEachAddress(void (callme)(struct sockaddr_in *address, struct sockaddr_in *broadcast))
-{
-   struct ifaddrs * alladdrs;
-   if (getifaddrs(&alladdrs) == 0)
-   {
-      struct ifaddrs * current = alladdrs;
-      while(current)
-      {
-         unsigned long ifaAddr  = SockAddrToUint32(current->ifa_addr);
-         if (ifaAddr > 0)
-         {
+/**
+ * Create the (non-blocking) broadcast socket for one address.
+ */
+static int
+openSocket(struct sockaddr_in *address) {
+    int broadcastsocket;
+    int do_broadcast = 1;
+
+    broadcastsocket = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if ( broadcastsocket == -1 ) {
+        commentError("socket()");
+        return -1;
+    }
+
+    /*
+     * Allow broadcasts:
+     */
+    if ( setsockopt(broadcastsocket, SOL_SOCKET, SO_BROADCAST,
+            &do_broadcast, sizeof do_broadcast) == -1 ) {
+        commentError("setsockopt(SO_BROADCAST)");
+        close(broadcastsocket);
+        return -1;
+    }
+
+    /*
+     * Bind the interface address to our socket, so that
+     * the broadcast goes out of that interface:
+     */
+    if ( bind(broadcastsocket, (struct sockaddr *)address,
+            sizeof(*address)) == -1 ) {
+        commentError("bind()");
+        close(broadcastsocket);
+        return -1;
+    }
+    return broadcastsocket;
+}
+
+/**
+ * (Re)make the list of interface addresses. Sockets for addresses
+ * that are still present are kept.
+ */
+static void
+refreshInterfaces(void) {
+    struct radioIface newIfaces[RADIO_MAX_IFACES];
+    struct ifaddrs *alladdrs, *current;
+    int numNew = 0, i, j;
+
+    if (getifaddrs(&alladdrs) != 0) {
+        commentError("getifaddrs()");
+        return;
+    }
+    for (current = alladdrs; current && numNew < RADIO_MAX_IFACES;
+            current = current->ifa_next) {
+        unsigned long ifaAddr = SockAddrToUint32(current->ifa_addr);
+        // Only IPv4 addresses that have a broadcast (or peer) address
+        if (ifaAddr == 0 || current->ifa_dstaddr == NULL ||
+                current->ifa_dstaddr->sa_family != AF_INET)
+            continue;
 #ifdef DEBUG
-                unsigned long maskAddr = SockAddrToUint32(current->ifa_netmask);
-                unsigned long dstAddr  = SockAddrToUint32(current->ifa_dstaddr);
-                char ifaAddrStr[32];  Inet_NtoA(ifaAddr,  ifaAddrStr);
-                char maskAddrStr[32]; Inet_NtoA(maskAddr, maskAddrStr);
-                char dstAddrStr[32];  Inet_NtoA(dstAddr,  dstAddrStr);
-                printf("  Found interface:  name=[%s] desc=[%s] address=[%s] netmask=[%s] broadcastAddr=[%s]\n", current->ifa_name, "unavailable", ifaAddrStr, maskAddrStr, dstAddrStr);
+        {
+            unsigned long maskAddr = SockAddrToUint32(current->ifa_netmask);
+            unsigned long dstAddr  = SockAddrToUint32(current->ifa_dstaddr);
+            char ifaAddrStr[32];  Inet_NtoA(ifaAddr,  ifaAddrStr);
+            char maskAddrStr[32]; Inet_NtoA(maskAddr, maskAddrStr);
+            char dstAddrStr[32];  Inet_NtoA(dstAddr,  dstAddrStr);
+            printf("  Found interface:  name=[%s] desc=[%s] address=[%s] netmask=[%s] broadcastAddr=[%s]\n", current->ifa_name, "unavailable", ifaAddrStr, maskAddrStr, dstAddrStr);
+        }
 #endif
-                // Specific to our use, set the port for the broadcast so it can be found by the client.
-                // So help us if this is an sockaddr for ipv6
-                ((struct sockaddr_in *)current->ifa_dstaddr)->sin_port = htons(PORT);
-                callme((struct sockaddr_in *)current->ifa_addr, (struct sockaddr_in *)current->ifa_dstaddr);
-         }
-         current = current->ifa_next;
-      }
-      freeifaddrs(alladdrs);
-   }
+        memcpy(&newIfaces[numNew].address, current->ifa_addr, sizeof(struct sockaddr_in));
+        memcpy(&newIfaces[numNew].broadcast, current->ifa_dstaddr, sizeof(struct sockaddr_in));
+        newIfaces[numNew].address.sin_port = 0;
+        // Specific to our use, set the port for the broadcast so it can be found by the client.
+        newIfaces[numNew].broadcast.sin_port = htons(PORT);
+        newIfaces[numNew].sock = -1;
+        numNew++;
+    }
+    freeifaddrs(alladdrs);
+
+    // Keep the sockets of unchanged addresses, close the others
+    for (i = 0; i < numIfaces; i++) {
+        for (j = 0; j < numNew; j++) {
+            if (newIfaces[j].sock == -1 &&
+                    newIfaces[j].address.sin_addr.s_addr == ifaces[i].address.sin_addr.s_addr &&
+                    newIfaces[j].broadcast.sin_addr.s_addr == ifaces[i].broadcast.sin_addr.s_addr) {
+                newIfaces[j].sock = ifaces[i].sock;
+                break;
+            }
+        }
+        if (j == numNew && ifaces[i].sock != -1)
+            close(ifaces[i].sock);
+    }
+    for (j = 0; j < numNew; j++) {
+        if (newIfaces[j].sock == -1)
+            newIfaces[j].sock = openSocket(&newIfaces[j].address);
+    }
+    memcpy(ifaces, newIfaces, sizeof(newIfaces[0]) * numNew);
+    numIfaces = numNew;
+}
+
+/**
+ * Listen for address and link changes (netlink). Without it the
+ * interfaces are checked every RADIO_REFRESH_SECS seconds.
+ */
+static void
+openNetlink(void) {
+    struct sockaddr_nl snl;
+
+    netlinkSocket = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (netlinkSocket == -1) {
+        commentError("netlink socket()");
+        return;
+    }
+    memset(&snl, 0, sizeof(snl));
+    snl.nl_family = AF_NETLINK;
+    snl.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR;
+    if (bind(netlinkSocket, (struct sockaddr *)&snl, sizeof(snl)) == -1) {
+        commentError("netlink bind()");
+        close(netlinkSocket);
+        netlinkSocket = -1;
+    }
+}
+
+/**
+ * This is what sends a message out of every interface.
+ */
+static void
+sendAll(const struct radioMessage *message) {
+    struct sockaddr_in to;
+    int i;
+
+    for (i = 0; i < numIfaces; i++) {
+        if (ifaces[i].sock == -1)
+            continue;
+        to = ifaces[i].broadcast;
+        to.sin_port = htons(message->port);
+        if (sendto(ifaces[i].sock, message->data, message->len, MSG_DONTWAIT,
+                (struct sockaddr *)&to, sizeof(to)) == -1) {
+            // Report it and carry on (the message is lost on this
+            // interface)
+            commentError("sendto()");
+        }
+    }
+}
+
+/**
+ * The sender thread.
+ */
+static void *
+sender(void *arg) {
+    struct radioMessage message;
+    char buf[4096];
+    struct pollfd fds[2];
+    int numFds, changed;
+
+    for (;;) {
+        fds[0].fd = wakePipe[0];
+        fds[0].events = POLLIN;
+        numFds = 1;
+        if (netlinkSocket != -1) {
+            fds[1].fd = netlinkSocket;
+            fds[1].events = POLLIN;
+            numFds = 2;
+        }
+        if (poll(fds, numFds, netlinkSocket != -1 ? -1 : RADIO_REFRESH_SECS * 1000) == 0) {
+            refreshInterfaces();            // no netlink: time to check
+            continue;
+        }
+
+        // Interfaces changed? (read all of the notices, then refresh once)
+        if (numFds == 2 && (fds[1].revents & POLLIN)) {
+            changed = 0;
+            while (recv(netlinkSocket, buf, sizeof(buf), MSG_DONTWAIT) > 0)
+                changed = 1;
+            if (changed)
+                refreshInterfaces();
+        }
+
+        if (fds[0].revents & POLLIN)
+            serverPipeRead(wakePipe, 's');  // stopSender says why
+
+        // Send everything queued
+        for (;;) {
+            pthread_mutex_lock(&queueMutex);
+            if (queueCount == 0) {
+                pthread_mutex_unlock(&queueMutex);
+                break;
+            }
+            message = queue[queueHead];
+            queueHead = (queueHead + 1) % RADIO_QUEUE;
+            queueCount--;
+            pthread_mutex_unlock(&queueMutex);
+            sendAll(&message);
+        }
+
+        pthread_mutex_lock(&queueMutex);
+        if (stopSender) {
+            pthread_mutex_unlock(&queueMutex);
+            break;
+        }
+        pthread_mutex_unlock(&queueMutex);
+    }
+    return NULL;
+}
+
+/**
+ * Create the sockets and start the sender thread.
+ */
+int
+radioOpen(void) {
+    int err;
+
+    if (senderStarted)
+        return 0;
+    if (serverPipeOpen("radio", wakePipe) == -1)
+        return -1;
+    openNetlink();
+    refreshInterfaces();
+
+    stopSender = 0;
+    if ((err = pthread_create(&senderThread, NULL, sender, NULL)) != 0) {
+        printf("radio: pthread_create(): %s\n", strerror(err));
+        radioClose();
+        return -1;
+    }
+    senderStarted = 1;
+    return 0;
+}
+
+/**
+ * Send what is queued, stop the sender thread and close the sockets.
+ */
+void
+radioClose(void) {
+    int i;
+
+    if (senderStarted) {
+        pthread_mutex_lock(&queueMutex);
+        stopSender = 1;
+        pthread_mutex_unlock(&queueMutex);
+        serverWake("radio", wakePipe, 's');
+        pthread_join(senderThread, NULL);
+        senderStarted = 0;
+    }
+    for (i = 0; i < numIfaces; i++) {
+        if (ifaces[i].sock != -1)
+            close(ifaces[i].sock);
+    }
+    numIfaces = 0;
+    if (netlinkSocket != -1)
+        close(netlinkSocket);
+    netlinkSocket = -1;
+    serverPipeClose(wakePipe);
+    if (dropped)
+        printf("radio: %lu messages dropped (queue full)\n", dropped);
+}
+
+/**
+ * Queue a message for 'port'. If the queue is full, the oldest
+ * message is dropped.
+ */
+static int
+enqueue(int port, const void *data, int len) {
+    struct radioMessage *message;
+
+    if (!senderStarted)
+        return -1;
+    if (len > RADIO_MESSAGE)
+        len = RADIO_MESSAGE;
+
+    pthread_mutex_lock(&queueMutex);
+    if (queueCount == RADIO_QUEUE) {
+        queueHead = (queueHead + 1) % RADIO_QUEUE;
+        queueCount--;
+        dropped++;
+    }
+    message = &queue[(queueHead + queueCount) % RADIO_QUEUE];
+    message->port = port;
+    message->len = len;
+    memcpy(message->data, data, len);
+    queueCount++;
+    pthread_mutex_unlock(&queueMutex);
+
+    // Wake the sender (if the pipe is full, it is awake anyway)
+    serverWake("radio", wakePipe, 'm');
+    return 0;
 }
 
 int
 broadcast(const char * const what) {
+    char message[RADIO_MESSAGE];
+
     /*
      * Form a message to send out:
      * Max length of 80, no crazy please.
      */
-    bufferpointer = broadcastbuffer;
-    sprintf(bufferpointer,
-            "%.80s\n", what);
-    bufferpointer += strlen(bufferpointer);
+    snprintf(message, sizeof(message), "%.80s\n", what);
+    return enqueue(PORT, message, strlen(message));
+}
 
-    CallWithEachAddress(sendTo);
-    return 0;
+/**
+ * Queue a binary message (see evproto.c) for BINARY_PORT.
+ */
+int
+broadcastBinary(const unsigned char *data, int len) {
+    return enqueue(BINARY_PORT, data, len);
 }
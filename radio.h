@@ -19,7 +19,8 @@
  *	Description:
  *  Coupled with the jcblock program, this library will broadcast the callerID
  *  format string over the network over udp on port 9753, sent via each
- *  available IPv4 address.
+ *  available IPv4 address. broadcastBinary() sends binary messages (see
+ *  evproto.c) the same way, on port 9754.
  *
  *  Remember when you post code, you never know who might need it and how much
  *  they might truly appreciate it. Even if it's just to hang up on people.
@@ -30,6 +31,10 @@
 #define MKADDR_H
 
 static const int PORT = 9753;
+static const int BINARY_PORT = 9754;
+int radioOpen(void);
+void radioClose(void);
 int broadcast(const char * const what);
+int broadcastBinary(const unsigned char *data, int len);
  
 #endif
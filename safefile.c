@@ -0,0 +1,558 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: safefile.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to change the data files so that a power failure (or a
+ *	crash) can never leave one half written.
+ *
+ *	The list files used to be changed in place: the date field of a
+ *	matching record was overwritten, and a new *-key record was
+ *	written over the newline at the end of blacklist.dat. A power
+ *	failure at the wrong moment could leave a damaged blacklist.dat.
+ *	Now every change writes a complete new copy of the file to a
+ *	temporary file, forces it to the disk (fsync()), renames it over
+ *	the old file and forces the directory to the disk (so the rename
+ *	itself is not lost). After a power failure the file is either the
+ *	old one or the new one.
+ *
+ *	Rewriting a list file and the fsync() calls cost much more than
+ *	the old in-place write, so list changes are batched: the main
+ *	program queues them (listReplaceLine(), listAppendLine(),
+ *	listRemoveLine()) and a writer thread applies all of the changes
+ *	queued in 'groupMsec' milliseconds, in the order they were
+ *	queued, with one rewrite of each file, and one directory
+ *	fsync(). Records are found by their contents (not their file
+ *	position), so changes still apply if the file is edited, or
+ *	truncated by truncate.c, in the meantime. After each rewrite the
+ *	hook (listEditsSetHook()) is told which file was replaced by
+ *	which, so the list index (listindex.c) knows the new file holds
+ *	only changes it already has.
+ *
+ *	A file that can't be written (e.g., the disk is full) is left as
+ *	it was, and its changes are tried again with the next group
+ *	(EDIT_TRIES times in all).
+ *
+ *	The list file lock (lock_blacklist()) is held by the main program
+ *	while it reads a list file, by truncate.c while it replaces
+ *	blacklist.dat and by the writer thread while it rewrites a list
+ *	file.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "common.h"
+#include "safefile.h"
+
+#define PATH_LEN	256
+#define LINE_LEN	128
+#define EDIT_TRIES	5	// groups a change is tried in before it is dropped
+
+// A queued list change
+typedef struct listEdit
+{
+  struct listEdit *next;
+  char path[PATH_LEN];
+  bool append;                          // append newLine (else replace)
+  char oldLine[LINE_LEN];
+  char newLine[LINE_LEN];               // "" removes oldLine
+  bool used;                            // applied in this rewrite
+  bool failed;                          // its file was not written
+  int tries;
+} listEdit;
+
+static listEdit *editHead, *editTail;
+static bool writerBusy, stopWriter, writerStarted;
+static int editGroupMsec;
+static pthread_t writerThread;
+static pthread_mutex_t editMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t editWork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t editDone = PTHREAD_COND_INITIALIZER;
+static void (*commitHook)(const char *path, const struct stat *before,
+                          const struct stat *after);
+
+static pthread_mutex_t listMutex = PTHREAD_MUTEX_INITIALIZER;
+static unsigned long listGeneration;
+
+/*
+ * Lock the list files (see above). 'changed' tells truncate.c that
+ * blacklist.dat was changed while it was locked.
+ */
+void lock_blacklist()
+{
+  pthread_mutex_lock( &listMutex );
+}
+
+void unlock_blacklist( bool changed )
+{
+  if( changed )
+  {
+    listGeneration++;
+  }
+  pthread_mutex_unlock( &listMutex );
+}
+
+/*
+ * The number of changes so far (call with the lock held).
+ */
+unsigned long blacklist_generation()
+{
+  return listGeneration;
+}
+
+/*
+ * Force the directory that holds 'path' to the disk (after a file in
+ * it was created, renamed or removed).
+ */
+int safeSyncDir(const char *path)
+{
+  char dir[PATH_LEN];
+  char *slash;
+  int dirFd, retVal = 0;
+
+  strncpy( dir, path, sizeof(dir) - 1 );
+  dir[sizeof(dir) - 1] = '\0';
+  if( (slash = strrchr( dir, '/' )) == NULL )
+    strcpy( dir, "." );
+  else if( slash == dir )
+    slash[1] = '\0';
+  else
+    *slash = '\0';
+
+  if( (dirFd = open( dir, O_RDONLY | O_DIRECTORY )) == -1 )
+  {
+    perror( "safeSyncDir: open" );
+    return -1;
+  }
+  if( fsync( dirFd ) == -1 )
+  {
+    perror( "safeSyncDir: fsync" );
+    retVal = -1;
+  }
+  close( dirFd );
+  return retVal;
+}
+
+/*
+ * Finish a new copy of a file: flush and fsync() 'fp' (the
+ * temporary file 'tempPath'), close it and rename it to 'path'. The
+ * caller syncs the directory (safeSyncDir()), once for any number of
+ * files. On an error (including any earlier write error on 'fp') the
+ * temporary file is removed and 'path' is not touched.
+ */
+int safeCommit(FILE *fp, const char *tempPath, const char *path)
+{
+  if( fflush( fp ) == EOF || ferror( fp ) || fsync( fileno( fp ) ) == -1 )
+  {
+    perror( tempPath );
+    fclose( fp );
+    remove( tempPath );
+    return -1;
+  }
+  if( fclose( fp ) == EOF )
+  {
+    perror( tempPath );
+    remove( tempPath );
+    return -1;
+  }
+  if( rename( tempPath, path ) == -1 )
+  {
+    perror( path );
+    remove( tempPath );
+    return -1;
+  }
+  return 0;
+}
+
+/*
+ * Compare two lines, ignoring their (optional) '\n' terminators.
+ */
+static bool sameLine(const char *a, size_t aLen, const char *b)
+{
+  size_t bLen = strcspn( b, "\n" );
+
+  if( aLen > 0 && a[aLen - 1] == '\n' )
+    aLen--;
+  return aLen == bLen && memcmp( a, b, aLen ) == 0;
+}
+
+/*
+ * Apply the replace and remove edits from 'e' on (for 'path') to one
+ * line, in order: a line that was changed can be changed again by a
+ * later edit. Returns the line's new contents ('*lineLen' bytes,
+ * NULL if it was removed).
+ */
+static const char *editLine(const char *path, listEdit *e, const char *line,
+                            size_t *lineLen)
+{
+  for( ; e != NULL; e = e->next )
+  {
+    if( !e->append && !e->used &&
+        strcmp( e->path, path ) == 0 && sameLine( line, *lineLen, e->oldLine ) )
+    {
+      e->used = TRUE;                   // each edit replaces one line
+      if( e->newLine[0] == '\0' )
+        return NULL;                    // removed
+      line = e->newLine;
+      *lineLen = strcspn( line, "\n" );
+    }
+  }
+  return line;
+}
+
+/*
+ * Apply the queued edits for 'path' (all edits in the list 'edits'
+ * with the same path) to a new copy of the file. A file that does
+ * not exist is made.
+ */
+static int applyEdits(const char *path, listEdit *edits)
+{
+  char tempPath[PATH_LEN + 8];
+  char *data = NULL, *line, *end, *newData;
+  const char *out;
+  size_t len = 0, size = 0, n, lineLen;
+  struct stat before, after;
+  listEdit *e;
+  FILE *fp;
+
+  for( e = edits; e != NULL; e = e->next )
+  {
+    e->used = FALSE;
+  }
+
+  // Read the whole file
+  memset( &before, 0, sizeof(before) );
+  if( (fp = fopen( path, "r" )) == NULL && errno != ENOENT )
+  {
+    perror( path );
+    return -1;
+  }
+  if( fp != NULL )
+    fstat( fileno( fp ), &before );
+  do
+  {
+    if( len + 4096 + 1 > size )
+    {
+      size = size ? size * 2 : 8192;
+      if( (newData = realloc( data, size )) == NULL )
+      {
+        perror( "applyEdits: realloc" );
+        free( data );
+        if( fp != NULL )
+          fclose( fp );
+        return -1;
+      }
+      data = newData;
+    }
+    n = fp != NULL ? fread( data + len, 1, 4096, fp ) : 0;
+    len += n;
+  } while( n > 0 );
+  if( fp != NULL )
+    fclose( fp );
+
+  snprintf( tempPath, sizeof(tempPath), "%s.tmp", path );
+  if( (fp = fopen( tempPath, "w" )) == NULL )
+  {
+    perror( tempPath );
+    free( data );
+    return -1;
+  }
+
+  // Write each line, changed by the edits that match it
+  for( line = data; line < data + len; line = end )
+  {
+    if( (end = memchr( line, '\n', data + len - line )) != NULL )
+      end++;
+    else
+      end = data + len;
+    lineLen = end - line;
+
+    if( (out = editLine( path, edits, line, &lineLen )) == NULL )
+      continue;
+    fwrite( out, 1, lineLen, fp );
+    if( lineLen == 0 || out[lineLen - 1] != '\n' )
+      fputc( '\n', fp );                // the last line had none
+  }
+  free( data );
+
+  // Then the appended lines (changed only by edits queued after them)
+  for( e = edits; e != NULL; e = e->next )
+  {
+    if( e->append && strcmp( e->path, path ) == 0 )
+    {
+      lineLen = strcspn( e->newLine, "\n" );
+      if( (out = editLine( path, e->next, e->newLine, &lineLen )) != NULL )
+        fprintf( fp, "%.*s\n", (int)lineLen, out );
+    }
+  }
+
+  if( safeCommit( fp, tempPath, path ) == -1 )
+    return -1;
+  if( commitHook != NULL && stat( path, &after ) == 0 )
+    commitHook( path, &before, &after );
+  return 0;
+}
+
+/*
+ * The writer thread.
+ */
+static void *editWriter(void *arg)
+{
+  listEdit *edits, *e, *f, *kept, *keptTail;
+  struct timespec delay;
+  const char *lastPath;
+  bool done;
+  int lost;
+
+  pthread_mutex_lock( &editMutex );
+  while( TRUE )
+  {
+    while( editHead == NULL && !stopWriter )
+    {
+      pthread_cond_wait( &editWork, &editMutex );
+    }
+    if( editHead == NULL && stopWriter )
+      break;
+
+    // Let the group collect (unless stopping)
+    if( !stopWriter )
+    {
+      pthread_mutex_unlock( &editMutex );
+      delay.tv_sec = editGroupMsec / 1000;
+      delay.tv_nsec = (editGroupMsec % 1000) * 1000000L;
+      nanosleep( &delay, NULL );
+      pthread_mutex_lock( &editMutex );
+    }
+
+    edits = editHead;
+    editHead = editTail = NULL;
+    writerBusy = TRUE;
+    pthread_mutex_unlock( &editMutex );
+
+    // One rewrite per file, then one directory sync
+    lastPath = NULL;
+    for( e = edits; e != NULL; e = e->next )
+    {
+      for( f = edits, done = FALSE; f != e; f = f->next )
+      {
+        if( strcmp( f->path, e->path ) == 0 )
+          done = TRUE;                  // already rewritten
+      }
+      if( done )
+        continue;
+      lock_blacklist();
+      if( applyEdits( e->path, edits ) == 0 )
+      {
+        unlock_blacklist( TRUE );
+        lastPath = e->path;
+        continue;
+      }
+      unlock_blacklist( FALSE );
+      printf("listEdits: %s not written\n", e->path + 2);
+      for( f = e; f != NULL; f = f->next )
+      {
+        if( strcmp( f->path, e->path ) == 0 )
+          f->failed = TRUE;
+      }
+    }
+    if( lastPath != NULL )
+      safeSyncDir( lastPath );
+
+    // The changes to a file that was not written are tried again
+    // with the next group, EDIT_TRIES times at most
+    kept = keptTail = NULL;
+    lost = 0;
+    while( edits != NULL )
+    {
+      e = edits;
+      edits = e->next;
+      if( e->failed && ++e->tries < EDIT_TRIES )
+      {
+        e->failed = FALSE;
+        e->next = NULL;
+        if( keptTail != NULL )
+          keptTail->next = e;
+        else
+          kept = e;
+        keptTail = e;
+        continue;
+      }
+      if( e->failed )
+        lost++;
+      free( e );
+    }
+    if( lost > 0 )
+      printf("listEdits: %d list file changes were not written and are lost\n",
+        lost);
+
+    pthread_mutex_lock( &editMutex );
+    if( kept != NULL )
+    {
+      keptTail->next = editHead;        // before any queued since
+      editHead = kept;
+      if( editTail == NULL )
+        editTail = keptTail;
+    }
+    writerBusy = FALSE;
+    if( editHead == NULL )
+      pthread_cond_broadcast( &editDone );
+  }
+  writerBusy = FALSE;
+  pthread_cond_broadcast( &editDone );
+  pthread_mutex_unlock( &editMutex );
+  return NULL;
+}
+
+/*
+ * Start the writer thread. Changes are written 'groupMsec'
+ * milliseconds after the first change of a group is queued.
+ */
+int listEditsStart(int groupMsec)
+{
+  int err;
+
+  editGroupMsec = groupMsec > 0 ? groupMsec : 0;
+  stopWriter = FALSE;
+  if( (err = pthread_create( &writerThread, NULL, editWriter, NULL )) != 0 )
+  {
+    printf("listEditsStart: can't create thread: %s\n", strerror(err));
+    return -1;
+  }
+  writerStarted = TRUE;
+  return 0;
+}
+
+static int queueEdit(const char *path, bool append, const char *oldLine,
+                     const char *newLine)
+{
+  listEdit *e;
+
+  if( !writerStarted )
+  {
+    printf("queueEdit: writer not started\n");
+    return -1;
+  }
+  if( (e = calloc( 1, sizeof(listEdit) )) == NULL )
+  {
+    perror( "queueEdit: calloc" );
+    return -1;
+  }
+  strncpy( e->path, path, sizeof(e->path) - 1 );
+  e->append = append;
+  if( oldLine != NULL )
+    strncpy( e->oldLine, oldLine, sizeof(e->oldLine) - 1 );
+  strncpy( e->newLine, newLine, sizeof(e->newLine) - 1 );
+
+  pthread_mutex_lock( &editMutex );
+  if( editTail != NULL )
+    editTail->next = e;
+  else
+    editHead = e;
+  editTail = e;
+  pthread_cond_signal( &editWork );
+  pthread_mutex_unlock( &editMutex );
+  return 0;
+}
+
+/*
+ * Queue a change of the first line of 'path' that is the same as
+ * 'oldLine' to 'newLine'.
+ */
+int listReplaceLine(const char *path, const char *oldLine, const char *newLine)
+{
+  return queueEdit( path, FALSE, oldLine, newLine );
+}
+
+/*
+ * Queue the addition of 'line' at the end of 'path'.
+ */
+int listAppendLine(const char *path, const char *line)
+{
+  return queueEdit( path, TRUE, NULL, line );
+}
+
+/*
+ * Queue the removal of the first line of 'path' that is the same as
+ * 'line'.
+ */
+int listRemoveLine(const char *path, const char *line)
+{
+  return queueEdit( path, FALSE, line, "" );
+}
+
+/*
+ * Set the function called (with the list file lock held) after the
+ * writer replaces a list file: 'before' is the file the changes were
+ * made to (all zero if there was none) and 'after' the new file.
+ */
+void listEditsSetHook(void (*hook)(const char *path, const struct stat *before,
+                                   const struct stat *after))
+{
+  pthread_mutex_lock( &editMutex );
+  commitHook = hook;
+  pthread_mutex_unlock( &editMutex );
+}
+
+/*
+ * TRUE if changes are queued or being written.
+ */
+int listEditsPending(void)
+{
+  int pending;
+
+  pthread_mutex_lock( &editMutex );
+  pending = editHead != NULL || writerBusy;
+  pthread_mutex_unlock( &editMutex );
+  return pending;
+}
+
+/*
+ * Wait until all queued changes are on the disk.
+ */
+void listEditsFlush(void)
+{
+  pthread_mutex_lock( &editMutex );
+  while( editHead != NULL || writerBusy )
+  {
+    pthread_cond_wait( &editDone, &editMutex );
+  }
+  pthread_mutex_unlock( &editMutex );
+}
+
+/*
+ * Write any queued changes (without waiting for the group to
+ * collect) and stop the writer thread.
+ */
+void listEditsStop(void)
+{
+  if( !writerStarted )
+    return;
+  pthread_mutex_lock( &editMutex );
+  stopWriter = TRUE;
+  pthread_cond_signal( &editWork );
+  pthread_mutex_unlock( &editMutex );
+  pthread_join( writerThread, NULL );
+  writerStarted = FALSE;
+}
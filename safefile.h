@@ -0,0 +1,46 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: safefile.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the crash-safe file update functions in
+ *	safefile.c.
+ */
+#ifndef SAFEFILE_H
+#define SAFEFILE_H
+
+#include <stdio.h>
+#include <sys/stat.h>
+
+// Atomic file replacement
+int safeSyncDir(const char *path);
+int safeCommit(FILE *fp, const char *tempPath, const char *path);
+
+// Batched edits of the list files (blacklist.dat, whitelist.dat)
+int listEditsStart(int groupMsec);
+int listReplaceLine(const char *path, const char *oldLine, const char *newLine);
+int listAppendLine(const char *path, const char *line);
+int listRemoveLine(const char *path, const char *line);
+void listEditsSetHook(void (*hook)(const char *path, const struct stat *before,
+                                   const struct stat *after));
+int listEditsPending(void);
+void listEditsFlush(void);
+void listEditsStop(void);
+
+#endif
@@ -0,0 +1,188 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: server.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions shared by the program's server threads (events.c,
+ *	control.c, metrics.c), the settings reader (config.c) and the
+ *	network sender (radio.c): the
+ *	listening sockets, and the pipe that wakes a thread waiting in
+ *	poll() (to stop it, or from a signal handler).
+ *
+ *	'who' (e.g. "events") starts each error message.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "server.h"
+
+#define SERVER_BACKLOG  8
+
+/*
+ * Listen on Unix socket 'path', readable and writable by its owner
+ * only. Returns the (non-blocking) socket, or -1.
+ */
+int serverListenUnix(const char *who, const char *path)
+{
+  struct sockaddr_un addr;
+  int fd;
+
+  memset( &addr, 0, sizeof(addr) );
+  addr.sun_family = AF_UNIX;
+  if( strlen( path ) >= sizeof(addr.sun_path) )
+  {
+    printf("%s: socket path too long: %s\n", who, path);
+    return -1;
+  }
+  strcpy( addr.sun_path, path );
+  if( (fd = socket( AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 )) == -1 )
+  {
+    printf("%s: socket(AF_UNIX): %s\n", who, strerror(errno));
+    return -1;
+  }
+  unlink( path );                       // left by an earlier run
+
+  // No client can connect before listen(), so the socket is never
+  // open to others
+  if( bind( fd, (struct sockaddr *)&addr, sizeof(addr) ) == -1 ||
+      chmod( path, 0600 ) == -1 || listen( fd, SERVER_BACKLOG ) == -1 )
+  {
+    perror( path );
+    close( fd );
+    return -1;
+  }
+  return fd;
+}
+
+/*
+ * Listen on TCP port 'port': of 127.0.0.1 only if 'loopbackOnly',
+ * else of every address, IPv6 and IPv4 (or IPv4 only if there is no
+ * IPv6). Returns the (non-blocking) socket, or -1.
+ */
+int serverListenTcp(const char *who, int port, int loopbackOnly)
+{
+  struct sockaddr_in6 addr6;
+  struct sockaddr_in addr4;
+  int fd, on = 1, off = 0;
+
+  if( !loopbackOnly &&
+      (fd = socket( AF_INET6, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 )) != -1 )
+  {
+    setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+    setsockopt( fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off) );
+    memset( &addr6, 0, sizeof(addr6) );
+    addr6.sin6_family = AF_INET6;
+    addr6.sin6_addr = in6addr_any;
+    addr6.sin6_port = htons( port );
+    if( bind( fd, (struct sockaddr *)&addr6, sizeof(addr6) ) == 0 &&
+        listen( fd, SERVER_BACKLOG ) == 0 )
+    {
+      return fd;
+    }
+    close( fd );
+  }
+
+  if( (fd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 )) == -1 )
+  {
+    printf("%s: socket(AF_INET): %s\n", who, strerror(errno));
+    return -1;
+  }
+  setsockopt( fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on) );
+  memset( &addr4, 0, sizeof(addr4) );
+  addr4.sin_family = AF_INET;
+  addr4.sin_addr.s_addr = htonl( loopbackOnly ? INADDR_LOOPBACK : INADDR_ANY );
+  addr4.sin_port = htons( port );
+  if( bind( fd, (struct sockaddr *)&addr4, sizeof(addr4) ) == -1 ||
+      listen( fd, SERVER_BACKLOG ) == -1 )
+  {
+    printf("%s: TCP port %d: %s\n", who, port, strerror(errno));
+    close( fd );
+    return -1;
+  }
+  return fd;
+}
+
+/*
+ * Make a wake pipe (both ends non-blocking, and closed by exec()
+ * like the sockets). Returns 0, or -1.
+ */
+int serverPipeOpen(const char *who, int pipeFds[2])
+{
+  if( pipe( pipeFds ) == -1 )
+  {
+    printf("%s: pipe: %s\n", who, strerror(errno));
+    pipeFds[0] = pipeFds[1] = -1;
+    return -1;
+  }
+  fcntl( pipeFds[0], F_SETFL, O_NONBLOCK );
+  fcntl( pipeFds[1], F_SETFL, O_NONBLOCK );
+  fcntl( pipeFds[0], F_SETFD, FD_CLOEXEC );
+  fcntl( pipeFds[1], F_SETFD, FD_CLOEXEC );
+  return 0;
+}
+
+/*
+ * Wake the thread reading the pipe, with 'c' to say why. If the pipe
+ * is full the thread is awake anyway. A signal handler may call this
+ * (with 'who' NULL: nothing is printed, and errno is kept).
+ */
+void serverWake(const char *who, int pipeFds[2], char c)
+{
+  int saveErrno = errno;
+
+  if( write( pipeFds[1], &c, 1 ) == -1 && errno != EAGAIN && who != NULL )
+    printf("%s: write: %s\n", who, strerror(errno));
+  errno = saveErrno;
+}
+
+/*
+ * Empty the pipe. Returns 1 if 'c' was in it.
+ */
+int serverPipeRead(int pipeFds[2], char c)
+{
+  char buf[64];
+  int n, found = 0;
+
+  while( (n = read( pipeFds[0], buf, sizeof(buf) )) > 0 )
+  {
+    if( memchr( buf, c, n ) != NULL )
+      found = 1;
+  }
+  return found;
+}
+
+void serverPipeClose(int pipeFds[2])
+{
+  int i;
+
+  for( i = 0; i < 2; i++ )
+  {
+    if( pipeFds[i] != -1 )
+      close( pipeFds[i] );
+    pipeFds[i] = -1;
+  }
+}
@@ -0,0 +1,34 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: server.h
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Declarations for the socket and wake pipe functions in server.c.
+ */
+#ifndef SERVER_H
+#define SERVER_H
+
+int serverListenUnix(const char *who, const char *path);
+int serverListenTcp(const char *who, int port, int loopbackOnly);
+int serverPipeOpen(const char *who, int pipeFds[2]);
+void serverWake(const char *who, int pipeFds[2], char c);
+int serverPipeRead(int pipeFds[2], char c);
+void serverPipeClose(int pipeFds[2]);
+
+#endif
@@ -23,39 +23,20 @@
  *	of tones (941 Hz and 1209 Hz) produced by pressing the star (*) key
  *	on a touch tone telephone.
  *
+ *	This file serves both the PC (a sound card microphone input, which
+ *	used to deliver signed 8-bit mono samples) and the Raspberry Pi
+ *	with a Cirrus Logic Audio Card (a.k.a., Wolfson Audio Card+, which
+ *	requires signed 16-bit stereo samples). It replaces the separate
+ *	tonesRPi.c file. The sample format and number of channels are
+ *	negotiated with ALSA (see captureFormats[] below) and the samples
+ *	are converted by the matching function in pcmconv.c.
+ *
  *	Audio recording based on:
  *	  "Introduction to Sound Programming with ALSA",
  * 	  by Jeff Tranter, Linux Journal, October 2004.
  *
- *	Tone detection based on:
- *	  "The Goretzel Algorithm", Kevin Banks,
- *	  Embedded Systems Programming, September 2002.
- *
- *	Choosing N, the block size (N = SAMPLING_RATE/BIN_WIDTH):
- *	  The objective is to choose N such that the tone frequency is
- *	  close to an integer multiple of the bin width.
- *
- *	    For 941 Hz, try N = 528:
- *	     BIN_WIDTH = 8000.0/528 = 15.15 Hz. Then: 941/15.15 = 62.11
- *	     which is close to integer 62, so we choose it.
- *
- *	    For 1209 Hz, try N = 410:
- *	     BIN_WIDTH = 8000.0/410 = 19.51 Hz. Then 1209/19.51 = 61.97
- *	     which is close to integer 62, so we choose it.
- *
- *	  Note that, subject to the above, the larger N is the better the
- *	  algorithm works -- but the longer the *-key tones must be
- *	  present. The chosen values are a compromise.
- *
- *	Choosing THRESHOLD:
- *	   Objective is to put THRESHOLD safely above the non-detection
- *	   amplitudes and below the detection amplitudes. From the
- *	   program's printf outputs, you can determine a safe threshold
- *	   that will work for both tones when the star (*) key is pressed.
- *	   The value depends on how close the microphone is to the speaker
- *	   and therefore will vary for different hardware systems. You may
- *         have to adjust the value to get the program to work with your
- *         computer.
+ *	The tone detection itself (Goertzel filters with an adaptive
+ *	noise floor, so no THRESHOLD needs to be tuned) is in goertzel.c.
  */
 #include <stdio.h>
 #include <math.h>
@@ -66,69 +47,14 @@
 #include <alsa/asoundlib.h>
 
 #include "common.h"
+#include "goertzel.h"
+#include "pcmconv.h"
+#include "metrics.h"
 
-// For phones that send a time-limited "beep" when the *-key is
-// pressed (e.g., wireless and some wired phones), this option allows
-// the operator to press the *-key twice to indicate that a blacklist
-// entry should be added for the call. Note that there is some risk
-// that a "false positive" result may occur. That is, the algorithm
-// may interpret "audio noise" as a beep and create an unintended
-// blacklist entry for the call. The noise can come from: 1) caller
-// audio, 2) audio in the room where the phone is located or 3) audio
-// from the room where the modem is located. Requiring two beeps helps
-// to mitigate the risk. A way to avoid the risk is to put important
-// calls on the whitelist. This option is activated by default.
-// Note that the original detection method (for phones with non-time-
-// limited tone generation when the *-key is pressed) is still present
-// whether DO_BEEPS is active or not. To deactivate it, comment out
-// '#define DO_BEEPS' below.
-#define DO_BEEPS
-
-/* Goetzel globals */
-
-#define FLOATING	float
-#define SAMPLE		unsigned char
-
-#define SAMPLING_RATE           8000.0		//8kHz
-
-/* Low tone (941 Hz) parameters */
-#define TARGET_FREQ_LO		941.0		//941 Hz
-#define N_LO                    528            //941 Hz block size
-
-/* High (1209 Hz) tone parameters */
-#define TARGET_FREQ_HI         1209.0           //1209 Hz
-#define N_HI                    410             //1209 Hz block size
-
-#define THRESHOLD               0.1
-
-#define DET_MIN                  10
-
-
-#define PI			3.14159265
-
-#define DEBUG 1
-
-int numDetLo = 0;
-int numDetLoWas = 0;
-int numDetHi = 0;
-int numDetHiWas = 0;
-int numBeeps = 0;
-
-FLOATING coeff_lo, coeff_hi;
-FLOATING Q1;
-FLOATING Q2;
-FLOATING sine_lo, sine_hi;
-FLOATING cosine_lo, cosine_hi;
-
-int N_max = N_LO;
-
-/* Make the array large enough for largest block size */
-SAMPLE testData[N_LO];
-
-/* ALSA globals */
-snd_pcm_t *handle;
-char *buffer;
-int rc;
+// The capture device. "default" works for most systems (and for the
+// Raspberry Pi Cirrus Logic Audio Card if no other audio device is
+// present). Otherwise name the device, e.g., "hw:sndrpiwsp".
+#define PCM_DEVICE		"default"
 
 /*
  * NOTE: Unfortunately, the value of the 'frames' parameter
@@ -142,129 +68,61 @@ int rc;
  * be compatible with newer versions of ALSA. Be aware that
  * you may need to set it to 32 for your version.
  */
-snd_pcm_uframes_t frames = 128;
-
-/* Prototypes */
-void InitGoertzel(int N, int target_freq, FLOATING *sine, 
-                       FLOATING *cosine, FLOATING *coeff);
-void ProcessSample(FLOATING coeff, SAMPLE sample);
-void GetRealImag(FLOATING *realPart, FLOATING *imagPart, 
-                          FLOATING sine, FLOATING cosine);
-bool ProcessToneSamples(int N, FLOATING sine, 
-                        FLOATING cosine, FLOATING coeff );
-void InitALSA();
+#define NUM_FRAMES		128  // Number frames in a sample
+				     // period (in a readi())
 
 /*
- * Goertzel algorithm functions:
+ * Capture formats, in order of preference. The first one the
+ * device accepts is used. 16-bit formats are native byte order
+ * (S16_LE on the PC and the Raspberry Pi).
  */
+struct captureFormat {
+  snd_pcm_format_t format;
+  unsigned int channels;
+  int bytesPerFrame;
+  pcmConverter convert;
+  char *name;
+};
+
+static const struct captureFormat captureFormats[] = {
+  { SND_PCM_FORMAT_S16, 1, 2, pcmConvertS16Mono,   "S16 mono" },
+  { SND_PCM_FORMAT_S16, 2, 4, pcmConvertS16Stereo, "S16 stereo" },
+  { SND_PCM_FORMAT_S32, 1, 4, pcmConvertS32Mono,   "S32 mono" },
+  { SND_PCM_FORMAT_S32, 2, 8, pcmConvertS32Stereo, "S32 stereo" },
+  { SND_PCM_FORMAT_S8,  1, 1, pcmConvertS8,        "S8 mono" },
+};
+#define NUM_FORMATS (sizeof(captureFormats) / sizeof(captureFormats[0]))
+
+static const struct captureFormat *captureFormat;
+
+/* One block of scaled samples for the detector */
+FLOATING testData[GOERTZEL_BLOCK];
 
-/* Call this routine before every "block" (size=N) of samples. */
-void ResetGoertzel(void)
-{
-  Q2 = 0;
-  Q1 = 0;
-}
-
-/* Call this once for each tone, to precompute the constants. */
-void InitGoertzel(int N, int target_freq, FLOATING *sine,
-                               FLOATING *cosine, FLOATING *coeff)
-{
-  int			k;
-  FLOATING		floatN;
-  FLOATING		omega;
-
-  floatN = (FLOATING) N;
-  k = (int) (0.5 + ((floatN * target_freq) / SAMPLING_RATE));
-  omega = (2.0 * PI * k) / floatN;
-  *sine = sin(omega);
-  *cosine = cos(omega);
-  *coeff = 2.0 * (*cosine);
-}
-
-/* Call this routine for every sample. */
-void ProcessSample(FLOATING coeff, SAMPLE sample)
-{
-  FLOATING Q0;
-  Q0 = coeff * Q1 - Q2 + (FLOATING) sample;
-  Q2 = Q1;
-  Q1 = Q0;
-}
-
-/* Basic Goertzel */
-/* Call this routine after every block to get the complex result. */
-void GetRealImag(FLOATING *realPart, FLOATING *imagPart,
-                            FLOATING sine, FLOATING cosine)
-{
-  *realPart = (Q1 - Q2 * cosine);
-  *imagPart = (Q2 * sine);
-}
-
-/* Process the tone samples */
-bool ProcessToneSamples(int N, FLOATING sine,
-                           FLOATING cosine, FLOATING coeff )
-{
-  FLOATING real, imag;
-  FLOATING magnitude;
-  FLOATING magnitudeSquared;
-  int index;
-
-  /* Process the samples */
-  ResetGoertzel();
-  for( index = 0; index < N; index++ )
-  {
-    ProcessSample(coeff, testData[index]);
-  }
-
-  /* Do the "standard Goertzel" processing */
-  GetRealImag( &real, &imag, sine, cosine );
-
-  magnitudeSquared = real*real + imag*imag;
+/* ALSA globals */
+snd_pcm_t *handle;
+char *buffer;
+int rc;
 
-  magnitude = sqrt( magnitudeSquared );
+/* Set the number of frames in a sample period */
+snd_pcm_uframes_t frames = NUM_FRAMES;
 
-  if(N == N_LO)
-  {
-#ifdef DEBUG
-    printf("\nN_LO: ");
-    printf("rel mag=%12.5f  ", magnitude);
-#endif
-  }
-  else
-  {
-#ifdef DEBUG
-    printf("N_HI: ");
-    printf("rel mag=%12.5f  ", magnitude);
-#endif
-  }
-
-  if( magnitude > THRESHOLD )
-  {
-#ifdef DEBUG
-    printf("detection is TRUE\n");
-#endif
-    return TRUE;
-  }
-  else
-  {
-#ifdef DEBUG
-    printf("detection is FALSE\n");
-#endif
-    return FALSE;
-  }
-}
+/* Prototypes */
+void InitALSA();
 
 /*
  * ALSA functions:
  */
 void InitALSA(void)
 {
-  int size;
   snd_pcm_hw_params_t *params;
+  snd_pcm_format_t format;
+  unsigned int channels;
   unsigned int val;
   int dir;
+  int i;
 
   /* Open PCM device for recording (capture). */
-  rc = snd_pcm_open(&handle, "default",
+  rc = snd_pcm_open(&handle, PCM_DEVICE,
                     SND_PCM_STREAM_CAPTURE, 0);
   if (rc < 0) {
     fprintf(stderr,
@@ -285,15 +143,29 @@ void InitALSA(void)
   snd_pcm_hw_params_set_access(handle, params,
                       SND_PCM_ACCESS_RW_INTERLEAVED);
 
-  /* Signed 8-bit little-endian format */
+  /* Use the first sample format and channel count the device accepts */
+  for( i = 0; i < NUM_FORMATS; i++ )
+  {
+    if( snd_pcm_hw_params_test_format(handle, params,
+                               captureFormats[i].format) == 0 &&
+        snd_pcm_hw_params_test_channels(handle, params,
+                               captureFormats[i].channels) == 0 )
+    {
+      break;
+    }
+  }
+  if( i == NUM_FORMATS ) {
+    fprintf(stderr, "pcm device supports no usable sample format\n");
+    exit(1);
+  }
   snd_pcm_hw_params_set_format(handle, params,
-                              SND_PCM_FORMAT_S8);
-
-  /* One channel (monoral) */
-  snd_pcm_hw_params_set_channels(handle, params, 1);
+                              captureFormats[i].format);
+  snd_pcm_hw_params_set_channels(handle, params,
+                              captureFormats[i].channels);
 
   /* 8000 samples/second sampling rate (Telephone quality) */
   val = 8000;
+  dir = 0;                  /* set rate exactly */
   snd_pcm_hw_params_set_rate_near(handle, params,
                                   &val, &dir);
 
@@ -312,28 +184,47 @@ void InitALSA(void)
     exit(1);
   }
 
-  /* Use a buffer large enough to hold one period */
+  /* Select the converter for the format actually negotiated */
+  snd_pcm_hw_params_get_format(params, &format);
+  snd_pcm_hw_params_get_channels(params, &channels);
+  captureFormat = NULL;
+  for( i = 0; i < NUM_FORMATS; i++ )
+  {
+    if( captureFormats[i].format == format &&
+                            captureFormats[i].channels == channels )
+    {
+      captureFormat = &captureFormats[i];
+      break;
+    }
+  }
+  if( captureFormat == NULL ) {
+    fprintf(stderr, "unexpected pcm format negotiated\n");
+    exit(1);
+  }
+  printf("Audio capture format: %s\n", captureFormat->name);
+
+  /*
+     Use a read buffer large enough to hold one period.
+     Get the actual period size in frames.
+   */
   snd_pcm_hw_params_get_period_size(params,
-                                      &frames, &dir);
-  size = frames * 1; /* 1 byte/sample, 1 channel */
-  buffer = (char *) malloc(size);
+                                &frames, &dir);
+  buffer = (char *) malloc(frames * captureFormat->bytesPerFrame);
 }
 
-
 void tonesInit()
 {
   /* Initialize the audio interface to the microphone */
   InitALSA();
 
-  /* Initialize Goertzel parameters for the high and low frequencies */
-  InitGoertzel( N_LO, TARGET_FREQ_LO, &sine_lo, &cosine_lo, &coeff_lo );
-  InitGoertzel( N_HI, TARGET_FREQ_HI, &sine_hi, &cosine_hi, &coeff_hi );
+  /* Initialize the tone detector */
+  goertzelInit();
 }
 
 /*
  * Remove any samples left in the audio buffer from a
- * previous call. Also, zero numBeeps (not related to buffer
- * clearing, but done here for convenience).
+ * previous call. Also, zero the detection counters (not related
+ * to buffer clearing, but done here for convenience).
  */
 void tonesClearBuffer()
 {
@@ -349,120 +240,60 @@ void tonesClearBuffer()
     exit(1);
   }
 
-  numBeeps = 0;	// in case it was still set from the previous call
+  goertzelReset();	// in case a beep was counted in the previous call
 }
 
 bool tonesPoll()
 {
   int index;
-  int numSamples;
-  int i;
+  int numFrames;
 
   /*
-   * Read and condition 'frames' blocks of samples until N_max
-   * samples have been read.
+   * Read and convert 'frames' blocks of samples until
+   * GOERTZEL_BLOCK samples have been read.
    */
-  index = 0;
-  for( numSamples = 0; numSamples < N_max; numSamples += frames )
+  for( index = 0; index < GOERTZEL_BLOCK; index += numFrames )
   {
-    /* Read a block of samples */
+    /* Read 'frames' interleaved frames */
     rc = snd_pcm_readi(handle, buffer, frames);
 
     if (rc == -EPIPE)
     {
       /* EPIPE means overrun */
       fprintf(stderr, "overrun occurred (not serious)\n");
+      metricsCount(METRIC_ALSA_OVERRUNS);
       snd_pcm_prepare(handle);
-      numBeeps = 0;
-      numDetLoWas = numDetHiWas = 0;
-      numDetLo = numDetHi = 0;
+      goertzelReset();
       return FALSE;
     }
     else if (rc < 0)
     {
       fprintf(stderr, "error from read: %s\n", snd_strerror(rc));
-      numBeeps = 0;
-      numDetLoWas = numDetHiWas = 0;
-      numDetLo = numDetHi = 0;
+      goertzelReset();
       return FALSE;
     }
     else if (rc != (int)frames)
     {
       fprintf(stderr, "short read, read %d frames\n", rc);
-      numBeeps = 0;
-      numDetLoWas = numDetHiWas = 0;
-      numDetLo = numDetHi = 0;
+      goertzelReset();
       return FALSE;
     }
 
-    /* Condition the data for the Goertzel algorithm */
-    for( i = 0; i < frames && index < N_max; i++ )
+    /* Convert (and scale) the samples; stereo uses the left channel */
+    numFrames = frames;
+    if( numFrames > GOERTZEL_BLOCK - index )
     {
-      testData[index++] = (SAMPLE)( (buffer[i] * 100)/256 + 100 );
+      numFrames = GOERTZEL_BLOCK - index;
     }
+    captureFormat->convert( &testData[index], buffer, numFrames );
   }
 
-  /* Process the samples for each tone */
-  if( ProcessToneSamples( N_LO, sine_lo, cosine_lo, coeff_lo ) == TRUE )
-  {
-    numDetLo++;
-  }
-  else
-  {
-    numDetLoWas = numDetLo;
-    numDetLo = 0;
-  }
-  if( ProcessToneSamples( N_HI, sine_hi, cosine_hi, coeff_hi ) == TRUE )
-  {
-    numDetHi++;
-  }
-  else
-  {
-    numDetHiWas = numDetHi;
-    numDetHi = 0;
-  }
-
-  /*
-   * For phones that send the tones continuously as long as the
-   * *-key is pressed...
-   * Require at least DET_MIN consecutive detections of both tones
-   * to declare a *-KEY press detection.
-   */
-  if( numDetLo >= DET_MIN && numDetHi >= DET_MIN )
+  /* Process the block */
+  if( goertzelBlock( testData ) == TRUE )
   {
     printf("*-KEY press detected\n");
-    numDetLo = numDetHi = 0;
-    numDetLoWas = numDetHiWas = 0;
     return TRUE;
   }
-#ifdef DO_BEEPS
-  /*
-   * For phones that send a time-limited "beep" when the *-key
-   * is pressed...
-   * Require two or three consecutive detections of both tones
-   * twice (two *-key press detections) to declare an operator
-   * auto-blacklist entry request. Note: the number of detections
-   * may have to be adjusted depending on the speed of your
-   * processor and the duration of your phone's beep.
-   */
-  else if( ( numDetLoWas == 2 || numDetLoWas == 3 ) &&
-                 ( numDetHiWas == 2 || numDetHiWas == 3 ) )
-  {
-    if(numBeeps == 0)     // If first *-key press detection
-    {
-      numBeeps = 1;
-      numDetLoWas = numDetHiWas = 0;
-    }
-    else                  // If second *-key press detection
-    {
-      printf("Two *-key presses detected\n");
-      numBeeps = 0;
-      numDetLoWas = numDetHiWas = 0;
-      numDetLo = numDetHi = 0;
-      return TRUE;
-    }
-  }
-#endif                               // end of DO_BEEPS
   return FALSE;
 }
 
@@ -476,7 +307,7 @@ void tonesClose()
 #if 0
 // This main() function may be activated to test tone detection separately.
 // Compile it with:
-//     gcc -o tones tones.c -lasound -ldl -lm
+//     gcc -o tones tones.c goertzel.c pcmconv.c -lasound -ldl -lm
 // It may then be tested by attaching a microphone to a telephone ear piece
 // and pressing the star (*) key while the program is running. The output
 // should indicate that both tones were detected (show TRUE).
@@ -497,4 +328,3 @@ int main()
   return 0;
 }
 #endif
-
@@ -0,0 +1,453 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: tonesbench.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Benchmark for the star (*) key tone detector in goertzel.c. It
+ *	runs a labelled corpus of audio clips through the detector and
+ *	reports the detection rate (clips labelled "star" that were
+ *	detected) and the false positive rate (clips labelled "none" that
+ *	were detected), for the adaptive rule and for the old fixed
+ *	THRESHOLD rule.
+ *
+ *	A corpus is a list file with one clip per line:
+ *		<label> <file>
+ *	where <label> is "star" or "none" and <file> holds raw signed
+ *	16-bit little-endian mono samples at 8000 samples/second (e.g.,
+ *	recorded with: arecord -f S16_LE -r 8000 -c 1 -t raw clip.raw).
+ *	Lines starting with '#' are ignored. If no list file is given a
+ *	built-in synthetic corpus is used. Option -g <dir> writes the
+ *	synthetic corpus to <dir> (with list file <dir>/corpus.lst) so
+ *	recordings from your own system can be added to it.
+ *
+ *	Compile with: ./makebench
+ *	Run with:     ./tonesbench [-t threshold] [-g dir] [corpus.lst]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+
+#include "common.h"
+#include "goertzel.h"
+
+#define CLIP_SAMPLES	(3 * 8000)	// synthetic clips are 3 seconds
+#define MAX_CLIPS	64
+#define PI		3.14159265
+
+struct clip {
+  char name[80];
+  bool star;                    // label: TRUE if a *-key entry
+  short *samples;
+  int numSamples;
+};
+
+static struct clip clips[MAX_CLIPS];
+static int numClips = 0;
+
+/*
+ * Deterministic random numbers so every run uses the same corpus.
+ */
+static unsigned int seed = 12345;
+
+static double uniform(void)
+{
+  seed ^= seed << 13;
+  seed ^= seed >> 17;
+  seed ^= seed << 5;
+  return (seed & 0xffffff) / (double)0x1000000;
+}
+
+static double gaussian(void)
+{
+  double u1 = uniform() + 1e-12;
+  double u2 = uniform();
+  return sqrt( -2.0 * log(u1) ) * cos( 2.0 * PI * u2 );
+}
+
+/* Add a tone burst at 'start' seconds lasting 'secs' seconds */
+static void addTone(double *buf, double freq, double amp,
+                                  double start, double secs)
+{
+  int i, first = start * 8000, last = (start + secs) * 8000;
+  double phase = 2.0 * PI * uniform();
+
+  for( i = first; i < last && i < CLIP_SAMPLES; i++ )
+  {
+    buf[i] += amp * sin( 2.0 * PI * freq * i / 8000.0 + phase );
+  }
+}
+
+static void addNoise(double *buf, double amp)
+{
+  int i;
+
+  for( i = 0; i < CLIP_SAMPLES; i++ )
+  {
+    buf[i] += amp * gaussian();
+  }
+}
+
+/*
+ * Speech-like audio: a glottal pulse train with a wandering pitch,
+ * shaped by two moving formant resonators and a syllable envelope.
+ */
+static void addSpeech(double *buf, double amp)
+{
+  double pitch = 120 + 80 * uniform();
+  double f1 = 500, f2 = 1500;
+  double y1a = 0, y1b = 0, y2a = 0, y2b = 0;
+  double r = 0.97, phase = 0, x, y1, y2, env;
+  int i;
+
+  for( i = 0; i < CLIP_SAMPLES; i++ )
+  {
+    if( i % 400 == 0 )              // every 50 msec move the formants
+    {
+      pitch += 10 * gaussian();
+      if( pitch < 80 ) pitch = 80;
+      if( pitch > 300 ) pitch = 300;
+      f1 = 300 + 600 * uniform();
+      f2 = 900 + 1500 * uniform();
+    }
+    phase += pitch / 8000.0;
+    x = 0.1 * gaussian();
+    if( phase >= 1.0 )
+    {
+      phase -= 1.0;
+      x += 1.0;
+    }
+    y1 = x + 2 * r * cos( 2 * PI * f1 / 8000 ) * y1a - r * r * y1b;
+    y1b = y1a;  y1a = y1;
+    y2 = x + 2 * r * cos( 2 * PI * f2 / 8000 ) * y2a - r * r * y2b;
+    y2b = y2a;  y2a = y2;
+    env = 0.5 + 0.5 * sin( 2 * PI * 4.0 * i / 8000.0 );   // syllables
+    buf[i] += amp * env * (y1 + 0.5 * y2) / 20.0;
+  }
+}
+
+/* A few seconds of chords (tones with harmonics) */
+static void addMusic(double *buf, double amp)
+{
+  static const double notes[] = { 220.0, 277.2, 329.6, 440.0, 470.0,
+                                  587.3, 659.3, 880.0, 932.3, 1174.7 };
+  int chord, n, h;
+
+  for( chord = 0; chord < 6; chord++ )
+  {
+    for( n = 0; n < 3; n++ )
+    {
+      double f = notes[ (int)(uniform() * 10) ];
+      for( h = 1; h <= 3; h++ )
+      {
+        addTone( buf, f * h, amp / h, chord * 0.5, 0.5 );
+      }
+    }
+  }
+}
+
+static void addClip(const char *name, bool star, double *buf)
+{
+  struct clip *c = &clips[numClips++];
+  int i;
+  double v;
+
+  strncpy( c->name, name, sizeof(c->name) - 1 );
+  c->star = star;
+  c->numSamples = CLIP_SAMPLES;
+  c->samples = malloc( CLIP_SAMPLES * sizeof(short) );
+  for( i = 0; i < CLIP_SAMPLES; i++ )
+  {
+    v = buf[i] * 32767.0;
+    c->samples[i] = v > 32767 ? 32767 : v < -32768 ? -32768 : v;
+  }
+  memset( buf, 0, CLIP_SAMPLES * sizeof(double) );
+}
+
+/*
+ * Build the synthetic corpus. The levels cover a microphone close to
+ * the modem speaker (-10 dB) down to a distant one (-50 dB).
+ */
+static void buildCorpus(void)
+{
+  static double buf[CLIP_SAMPLES];
+  static const double levels[] = { 0.3, 0.03, 0.003 };
+  char name[80];
+  int i;
+
+  for( i = 0; i < 3; i++ )
+  {
+    // Held *-key, quiet room
+    addNoise( buf, levels[i] / 100 );
+    addTone( buf, 941.0, levels[i], 1.0, 1.0 );
+    addTone( buf, 1209.0, levels[i], 1.0, 1.0 );
+    sprintf( name, "held-star-%g", levels[i] );
+    addClip( name, TRUE, buf );
+
+    // Held *-key, 4 dB twist, noisy room
+    addNoise( buf, levels[i] / 10 );
+    addTone( buf, 941.0, levels[i], 1.0, 1.0 );
+    addTone( buf, 1209.0, levels[i] * 0.63, 1.0, 1.0 );
+    sprintf( name, "held-star-twist-%g", levels[i] );
+    addClip( name, TRUE, buf );
+
+    // Two *-key beeps
+    addNoise( buf, levels[i] / 100 );
+    addTone( buf, 941.0, levels[i], 0.8, 0.18 );
+    addTone( buf, 1209.0, levels[i], 0.8, 0.18 );
+    addTone( buf, 941.0, levels[i], 1.6, 0.18 );
+    addTone( buf, 1209.0, levels[i], 1.6, 0.18 );
+    sprintf( name, "two-beeps-%g", levels[i] );
+    addClip( name, TRUE, buf );
+
+    // Held *-key over the caller talking
+    addSpeech( buf, levels[i] / 3 );
+    addTone( buf, 941.0, levels[i], 1.0, 1.0 );
+    addTone( buf, 1209.0, levels[i], 1.0, 1.0 );
+    sprintf( name, "held-star-speech-%g", levels[i] );
+    addClip( name, TRUE, buf );
+
+    // Caller talking
+    addNoise( buf, levels[i] / 100 );
+    addSpeech( buf, levels[i] );
+    sprintf( name, "speech-%g", levels[i] );
+    addClip( name, FALSE, buf );
+
+    // Music on hold
+    addMusic( buf, levels[i] );
+    sprintf( name, "music-%g", levels[i] );
+    addClip( name, FALSE, buf );
+
+    // One beep only
+    addNoise( buf, levels[i] / 100 );
+    addTone( buf, 941.0, levels[i], 1.0, 0.18 );
+    addTone( buf, 1209.0, levels[i], 1.0, 0.18 );
+    sprintf( name, "one-beep-%g", levels[i] );
+    addClip( name, FALSE, buf );
+
+    // Other keys: 0 (941+1336), 7 (852+1209), # (941+1477)
+    addNoise( buf, levels[i] / 100 );
+    addTone( buf, 941.0, levels[i], 0.2, 0.8 );
+    addTone( buf, 1336.0, levels[i], 0.2, 0.8 );
+    addTone( buf, 852.0, levels[i], 1.1, 0.8 );
+    addTone( buf, 1209.0, levels[i], 1.1, 0.8 );
+    addTone( buf, 941.0, levels[i], 2.0, 0.8 );
+    addTone( buf, 1477.0, levels[i], 2.0, 0.8 );
+    sprintf( name, "other-keys-%g", levels[i] );
+    addClip( name, FALSE, buf );
+
+    // Noise bursts (e.g., a door, a dog)
+    addNoise( buf, levels[i] / 100 );
+    addTone( buf, 941.0, levels[i] / 3, 0.0, 3.0 );
+    addNoise( buf, levels[i] );
+    sprintf( name, "noise-%g", levels[i] );
+    addClip( name, FALSE, buf );
+  }
+
+  // Ringback tone (440 Hz + 480 Hz) and silence
+  addNoise( buf, 0.0003 );
+  addTone( buf, 440.0, 0.1, 0.0, 2.0 );
+  addTone( buf, 480.0, 0.1, 0.0, 2.0 );
+  addClip( "ringback", FALSE, buf );
+  addClip( "silence", FALSE, buf );
+}
+
+/*
+ * Write the synthetic corpus to directory 'dir'.
+ */
+static int writeCorpus(const char *dir)
+{
+  char path[256];
+  FILE *fpList, *fpClip;
+  int i;
+
+  snprintf( path, sizeof(path), "%.160s/corpus.lst", dir );
+  if( (fpList = fopen( path, "w" )) == NULL )
+  {
+    perror( path );
+    return -1;
+  }
+  fprintf( fpList, "# <label> <raw S16_LE mono 8 kHz file>\n" );
+  for( i = 0; i < numClips; i++ )
+  {
+    snprintf( path, sizeof(path), "%.160s/%.79s.raw", dir, clips[i].name );
+    if( (fpClip = fopen( path, "w" )) == NULL )
+    {
+      perror( path );
+      fclose( fpList );
+      return -1;
+    }
+    fwrite( clips[i].samples, sizeof(short), clips[i].numSamples, fpClip );
+    fclose( fpClip );
+    fprintf( fpList, "%s %s\n", clips[i].star ? "star" : "none", path );
+  }
+  fclose( fpList );
+  printf( "wrote %d clips to %s\n", numClips, dir );
+  return 0;
+}
+
+/*
+ * Read a corpus list file and its clips.
+ */
+static int readCorpus(const char *listName)
+{
+  char line[300], label[20], path[256];
+  FILE *fpList, *fpClip;
+  struct clip *c;
+  long size;
+
+  if( (fpList = fopen( listName, "r" )) == NULL )
+  {
+    perror( listName );
+    return -1;
+  }
+  while( fgets( line, sizeof(line), fpList ) != NULL && numClips < MAX_CLIPS )
+  {
+    if( line[0] == '#' || sscanf( line, "%19s %255s", label, path ) != 2 )
+      continue;
+
+    if( (fpClip = fopen( path, "r" )) == NULL )
+    {
+      perror( path );
+      continue;
+    }
+    fseek( fpClip, 0, SEEK_END );
+    size = ftell( fpClip );
+    rewind( fpClip );
+
+    c = &clips[numClips];
+    snprintf( c->name, sizeof(c->name), "%.79s",
+                   strrchr( path, '/' ) ? strrchr( path, '/' ) + 1 : path );
+    c->star = ( strcmp( label, "star" ) == 0 );
+    c->numSamples = size / sizeof(short);
+    c->samples = malloc( size );
+    if( fread( c->samples, sizeof(short), c->numSamples, fpClip ) ==
+                                                      (size_t)c->numSamples )
+    {
+      numClips++;
+    }
+    fclose( fpClip );
+  }
+  fclose( fpList );
+  return 0;
+}
+
+/*
+ * Run one clip through the detector (as for one call). Returns TRUE
+ * if a *-key entry was detected.
+ */
+static bool runClip(const struct clip *c)
+{
+  FLOATING block[GOERTZEL_BLOCK];
+  int pos, i;
+
+  goertzelInit();
+  for( pos = 0; pos + GOERTZEL_BLOCK <= c->numSamples; pos += GOERTZEL_BLOCK )
+  {
+    for( i = 0; i < GOERTZEL_BLOCK; i++ )
+    {
+      block[i] = c->samples[pos + i] / 32768.0;
+    }
+    if( goertzelBlock( block ) == TRUE )
+    {
+      return TRUE;
+    }
+  }
+  return FALSE;
+}
+
+static void runCorpus(const char *rule, FLOATING threshold)
+{
+  int i, numStar = 0, numNone = 0, numHit = 0, numFalse = 0;
+  bool detected;
+
+  goertzelSetFixedThreshold( threshold );
+  printf( "\n%s rule:\n", rule );
+  for( i = 0; i < numClips; i++ )
+  {
+    detected = runClip( &clips[i] );
+    if( clips[i].star )
+    {
+      numStar++;
+      numHit += detected;
+    }
+    else
+    {
+      numNone++;
+      numFalse += detected;
+    }
+    if( detected != clips[i].star )
+    {
+      printf( "  %-28s %s\n", clips[i].name,
+                     detected ? "FALSE POSITIVE" : "missed" );
+    }
+  }
+  printf( "  detection rate:      %3d/%-3d (%5.1f%%)\n", numHit, numStar,
+                         numStar ? 100.0 * numHit / numStar : 0.0 );
+  printf( "  false positive rate: %3d/%-3d (%5.1f%%)\n", numFalse, numNone,
+                         numNone ? 100.0 * numFalse / numNone : 0.0 );
+}
+
+int main(int argc, char **argv)
+{
+  FLOATING threshold = 1.5;       // tonesRPi.c THRESHOLD value
+  char *outDir = NULL;
+  int optChar;
+
+  while( ( optChar = getopt( argc, argv, "t:g:h" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 't':
+        threshold = atof( optarg );
+        break;
+
+      case 'g':
+        outDir = optarg;
+        break;
+
+      case 'h':
+      default:
+        fprintf( stderr, "Usage: tonesbench [-t threshold] [-g dir] "
+                                                   "[corpus.lst]\n" );
+        return -1;
+    }
+  }
+
+  if( optind < argc )
+  {
+    if( readCorpus( argv[optind] ) != 0 )
+      return -1;
+  }
+  else
+  {
+    buildCorpus();
+  }
+
+  if( outDir != NULL )
+  {
+    return writeCorpus( outDir );
+  }
+
+  printf( "%d clips\n", numClips );
+  runCorpus( "Adaptive", 0.0 );
+  runCorpus( "Fixed THRESHOLD", threshold );
+  return 0;
+}
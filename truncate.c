@@ -22,7 +22,7 @@
  *	Functions to manage the truncation (removal) of records from the
  *	blacklist.dat and callerID.dat files. Records in the blacklist.dat
  *	file that have not been used to terminate a call in the last nine
- *	months are removed. Records in the callerID.dat file that are older
+ *	months are removed. Monthly callerID.dat segments that are older
  *	than nine months are removed. The operations are performed every
  *	thirty days.
  */
@@ -35,22 +35,83 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdlib.h>
+#include <glob.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
 #include "common.h"
+#include "safefile.h"
 
 #define CHECK_SECS    30*24*60*60       // seconds in thirty days
-#define KEEP_SECS  (365-90)*24*60*60    // seconds in (about) nine months
+#define KEEP_DAYS  (365-90)             // days in (about) nine months
+#define TRUNCATE_NICE 10                // worker thread's nice value
 static FILE *fpTime;                    // Pointer for file .jcblock
-static FILE *fpCaN;                     // Pointer for file callerID.dat.new
+static FILE *fpBlS;                     // Pointer for the blacklist.dat snapshot
 static FILE *fpBlN;                     // Pointer for tile blacklist.dat.new
-static time_t currentTime, recordTime;
-static char callerBuf[100];
+static time_t currentTime;
+static long currentDay;                 // today, as days since 1 Jan 1970
 static char blacklistBuf[100];
-static char month[3], day[3], year[3];
-static int imonth, iday, iyear;
 static int numRecsWritten;
-static struct tm tmStruct;
 static int tm_isdst_saved;
 
+// The truncation worker thread
+static pthread_mutex_t truncateMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t truncateDone = PTHREAD_COND_INITIALIZER;
+static bool truncateRunning = FALSE;
+
+// Days before the first of each month (in a year that is not a
+// leap year).
+static const short daysBeforeMonth[13] =
+  { 0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334, 365 };
+
+//
+// Function to convert a date to the number of days since 1 Jan 1970
+// (the same as mktime() of local midnight divided by 86400, but with
+// no time zone lookups). 'month' is 1 to 12.
+//
+long days_from_civil( int year, int month, int day )
+{
+  long y = year - 1;
+  long days;
+
+  // Days to 1 Jan of 'year', counting the leap days of the years
+  // before it (477 of them are before 1970).
+  days = (year - 1970) * 365L + (y / 4 - y / 100 + y / 400) - 477;
+
+  days += daysBeforeMonth[month - 1] + day - 1;
+  if( month > 2 &&
+      ( (year % 4 == 0 && year % 100 != 0) || year % 400 == 0 ) )
+  {
+    days++;
+  }
+  return days;
+}
+
+//
+// Function to convert a six digit MMDDYY date field (as in callerID.dat
+// and blacklist.dat records) to days since 1 Jan 1970. Returns -1 if
+// the field is not a valid date.
+//
+long days_from_mmddyy( const char *date )
+{
+  int month, day, year;
+
+  if( (unsigned)(date[0] - '0') > 9 || (unsigned)(date[1] - '0') > 9 ||
+      (unsigned)(date[2] - '0') > 9 || (unsigned)(date[3] - '0') > 9 ||
+      (unsigned)(date[4] - '0') > 9 || (unsigned)(date[5] - '0') > 9 )
+  {
+    return -1;
+  }
+  month = (date[0] - '0') * 10 + date[1] - '0';
+  day = (date[2] - '0') * 10 + date[3] - '0';
+  year = (date[4] - '0') * 10 + date[5] - '0';
+  if( month < 1 || month > 12 || day < 1 || day > 31 )
+  {
+    return -1;
+  }
+  return days_from_civil( 2000 + year, month, day );
+}
+
 //
 // Function to create file .jcblock if it does not already exist. If it does not
 // exist, the current UNIX Epoch time (in seconds) is stored in it. The file is
@@ -226,201 +287,96 @@ time_t get_saved_time()
 void close_time_save_file()
 {
   fclose( fpTime );
+  fpTime = NULL;
 }
 
 //
 // Function to truncate (remove) callerID.dat records that are older
-// than nine months.
+// than nine months. The call log is kept in monthly segment files
+// (callerID.dat.YYMM, see calllog.c), so this just removes the
+// segments whose month ended more than nine months ago; nothing is
+// read or rewritten. Returns the number of segments removed.
 //
 int truncate_callerID_records()
 {
-  int i;
-  struct stat statBuf;
+  glob_t globBuf;
+  size_t i;
+  char *suffix;
+  int yymm, numRemoved = 0;
+  long endDay;
 
-  // Close callerID.dat and reopen it for reading.
-  fclose( fpCa );
-  if( (fpCa = fopen( "./callerID.dat", "r" )) == NULL )
+  if( glob( "./callerID.dat.[0-9][0-9][0-9][0-9]", 0, NULL, &globBuf ) != 0 )
   {
-    perror( "truncate_callerID_records:fopen(1)" );
-    return -1;
+    return 0;                   // no segments
   }
 
-  // Open file callerID.dat.new for appending.
-  if( (fpCaN = fopen( "./callerID.dat.new", "a+" )) == NULL )
+  for( i = 0; i < globBuf.gl_pathc; i++ )
   {
-    perror( "truncate_callerID_records:fopen(2)" );
-    return -1;
-  }
+    suffix = strrchr( globBuf.gl_pathv[i], '.' ) + 1;
+    yymm = atoi( suffix );
 
-  // Read and process all records in file callerID.dat.
-  numRecsWritten = 0;
-  while( fgets( callerBuf, sizeof( callerBuf ), fpCa ) != NULL )
-  {
-    // If a line starts with a '#' (comment), just write it to file
-    // callerID.dat.new.
-    if( callerBuf[0] == '#' )
-    {
-      if( fputs( callerBuf, fpCaN ) < 0 )
-      {
-        perror( "truncate_callerID_records: fputs(1)" );
-        return -1;
-      }
-      numRecsWritten++;
-      continue;
-    }
-
-    // Ignore lines that start with a '\n' character (blank lines).
-    if( callerBuf[0] == '\n' )
-    {
-      continue;
-    }
-
-    // Make sure the DATE field is present and valid (sometimes
-    // (rarely) a record gets scrambled -- due to send timing).
-    if( (strlen( callerBuf ) < 14 ) ||
-          ( strstr( callerBuf, "DATE = " ) == NULL ) )
-    {
-      // Just ignore the record
-      continue;
-    }
-
-    // Check the DATE value for valid digit chars.
-    for( i = 9; i < 13; i++ )
-    {
-      if( !isdigit( callerBuf[i] ) )
-      {
-        break;
-      }
-    }
-    if( i < 13 )
+    if( yymm % 100 < 1 || yymm % 100 > 12 )
     {
       continue;
     }
 
-    // Get the month, day and year from the DATE field
-    strncpy( month, &callerBuf[9], 2 );
-    month[2] = '\0';
-    imonth = atoi( month );
-
-    strncpy( day, &callerBuf[11], 2 );
-    day[2] = '\0';
-    iday = atoi( day );
-
-    strncpy( year, &callerBuf[13], 2 );
-    year[2] = '\0';
-    iyear = atoi( year );
-
-    // Convert local time to UNIX Epoch time.
-    tmStruct.tm_sec = 0;
-    tmStruct.tm_min = 0;
-    tmStruct.tm_hour = 0;
-    tmStruct.tm_mday = iday;
-    tmStruct.tm_mon = imonth - 1;
-    tmStruct.tm_year = iyear + 100; 
-    tmStruct.tm_sec = 0;
-    tmStruct.tm_sec = 0;
-    tmStruct.tm_isdst = tm_isdst_saved;
-
-    if( (recordTime = mktime( &tmStruct )) == -1 )
-    {
-      perror( "truncate_callerID_records: mktime" );
-      return -1;
-    }
-
-    // If recordTime is less than KEEP_SECS old, add the record
-    // to file callerID.dat.new. Otherwise, ignore (truncate) it.
-    if( (currentTime - recordTime) < KEEP_SECS )
-    {
-      if( fputs( callerBuf, fpCaN ) < 0 )
-      {
-        perror( "truncate_callerID_records: fputs(2)" );
-        return -1;
-      }
-      numRecsWritten++;
-    }
-  }                            // end of while() loop
-
-  fclose(fpCaN);
+    // The end of the segment's month (the first day of the next
+    // month).
+    if( yymm % 100 == 12 )
+      endDay = days_from_civil( 2000 + yymm / 100 + 1, 1, 1 );
+    else
+      endDay = days_from_civil( 2000 + yymm / 100, yymm % 100 + 1, 1 );
 
-  // If records were written to callerID.dat.new, rename
-  // callerID.dat to callerID.dat.old and callerID.dat.new
-  // to callerID.dat.
-  if( numRecsWritten )
-  {
-    // If file callerID.dat.old exists, remove it.
-    if( stat( "./callerID.dat.old", &statBuf ) != -1 )
+    // If every record in the segment is at least KEEP_DAYS old,
+    // remove the segment.
+    if( (currentDay - endDay) >= KEEP_DAYS )
     {
-      if( remove( "./callerID.dat.old" ) == -1 )
+      if( remove( globBuf.gl_pathv[i] ) == -1 )
       {
-        perror( "truncate_callerID_records: remove(1)" );
-        return -1;
+        perror( "truncate_callerID_records: remove" );
+        continue;
       }
+      numRemoved++;
     }
-
-    // Before renaming it, close it.
-    fclose(fpCa);
-    if( rename( "./callerID.dat", "./callerID.dat.old" ) == -1 )
-    {
-      perror( "truncate_callerID_records: rename(1)" );
-      return -1;
-    }
-
-    if( rename ( "./callerID.dat.new", "./callerID.dat" ) == -1 )
-    {
-      perror( "truncate_callerID_records: rename(2)" );
-      return -1;
-    }
-
-    // The main() function expects fpCa to be open.
-    if( (fpCa = fopen( "callerID.dat", "a+" ) ) == NULL )
-    {
-      perror( "truncate_callerID_records: fopen" );
-      return -1;
-    }
-
-    return numRecsWritten;
   }
-  // If no records were written, remove file callerID.dat.new.
-  else
+  globfree( &globBuf );
+
+  // Force the removals to the disk.
+  if( numRemoved )
   {
-    if( remove( "./callerID.dat.new" ) == -1 )
-    {
-      perror( "truncate_callerID_records: remove(2)" );
-      return -1;
-    }
-    return 0;
+    safeSyncDir( "./callerID.dat" );
   }
+  return numRemoved;
 }
 
 //
-// Function to truncate (remove) blacklist.dat records that have
-// not been used to terminate a call within the last nine months.
-// Note that the date field in blacklist.dat records is updated
-// each time a record is used to terminate a call.
+// Function to copy the blacklist.dat records to keep to file
+// blacklist.dat.new. It reads blacklist.dat without locking it (a
+// snapshot); truncate_blacklist_records() checks that the main
+// program did not change the file meanwhile.
 //
-int truncate_blacklist_records()
+static int snapshot_blacklist_records()
 {
-  int i;
-  struct stat statBuf;
+  long recordDay;
 
-  // Close blacklist.dat and reopen it for reading and writing.
-  fclose( fpBl );
-  if( (fpBl = fopen( "./blacklist.dat", "r+" )) == NULL )
+  // Open blacklist.dat for reading.
+  if( (fpBlS = fopen( "./blacklist.dat", "r" )) == NULL )
   {
     perror( "truncate_blacklist_records:fopen(1)" );
     return -1;
   }
 
-  // Open file blacklist.dat.new for appending.
-  if( (fpBlN = fopen( "./blacklist.dat.new", "a+" )) == NULL )
+  // Create file blacklist.dat.new (replacing any left by a crash).
+  if( (fpBlN = fopen( "./blacklist.dat.new", "w" )) == NULL )
   {
     perror( "truncate_blacklist_records:fopen(2)" );
+    fclose( fpBlS );
     return -1;
   }
 
   // Read and process all records in file blacklist.dat.
   numRecsWritten = 0;
-  while( fgets( blacklistBuf, sizeof( blacklistBuf ), fpBl ) != NULL )
+  while( fgets( blacklistBuf, sizeof( blacklistBuf ), fpBlS ) != NULL )
   {
     // If a line starts with a '#' (comment), just write it to file
     // blacklist.dat.new.
@@ -429,6 +385,8 @@ int truncate_blacklist_records()
       if( fputs( blacklistBuf, fpBlN ) < 0 )
       {
         perror( "truncate_blacklist_records: fputs(1)" );
+        fclose( fpBlS );
+        fclose( fpBlN );
         return -1;
       }
       numRecsWritten++;
@@ -457,73 +415,94 @@ int truncate_blacklist_records()
       if( fputs(  blacklistBuf, fpBlN ) < 0 )
       {
         perror( "truncate_blacklist_records: fputs(1a)" );
+        fclose( fpBlS );
+        fclose( fpBlN );
         return -1;
       }
       numRecsWritten++;
       continue;
     }
 
-    // Check the date value for valid digit chars.
-    for( i = 19; i < 25; i++ )
-    {
-      if( !isdigit( blacklistBuf[i] ) )
-      {
-        break;
-      }
-    }
-    if( i < 25 )
+    // Convert the date field to a day number (records with a
+    // date field that is not valid are ignored).
+    if( (recordDay = days_from_mmddyy( &blacklistBuf[19] )) == -1 )
     {
       continue;
     }
 
-    // Get the month, day and year from the date field
-    strncpy( month, &blacklistBuf[19], 2 );
-    month[2] = '\0';
-    imonth = atoi( month );
-
-    strncpy( day, &blacklistBuf[21], 2 );
-    day[2] = '\0';
-    iday = atoi( day );
-
-    strncpy( year, &blacklistBuf[23], 2 );
-    year[2] = '\0';
-    iyear = atoi( year );
-
-    // Convert local time to UNIX Epoch time.
-    tmStruct.tm_sec = 0;
-    tmStruct.tm_min = 0;
-    tmStruct.tm_hour = 0;
-    tmStruct.tm_mday = iday;
-    tmStruct.tm_mon = imonth - 1;
-    tmStruct.tm_year = iyear + 100;
-    tmStruct.tm_sec = 0;
-    tmStruct.tm_sec = 0;
-    tmStruct.tm_isdst = tm_isdst_saved;
-
-    if( (recordTime = mktime( &tmStruct )) == -1 )
-    {
-      perror( "truncate_blacklist_records: mktime" );
-      return -1;
-    }
-
-    // If recordTime is less than KEEP_SECS old, add the record
-    // to file blacklist.dat.new. Otherwise, ignore it.
-    if( (currentTime - recordTime) < KEEP_SECS )
+    // If the record is less than KEEP_DAYS old, add it to file
+    // blacklist.dat.new. Otherwise, ignore it.
+    if( (currentDay - recordDay) < KEEP_DAYS )
     {
       if( fputs( blacklistBuf, fpBlN ) < 0 )
       {
         perror( "truncate_blacklist_records: fputs(2)" );
+        fclose( fpBlS );
+        fclose( fpBlN );
         return -1;
       }
       numRecsWritten++;
     }
   }                            // end of while() loop
 
-  fclose(fpBlN);                 // close blacklist.dat.new
+  fclose(fpBlS);
 
-  // If records were written to blacklist.dat.new, rename
-  // blacklist.dat to blacklist.dat.old and blacklist.dat.new
+  // Force blacklist.dat.new to the disk before it can be renamed
   // to blacklist.dat.
+  if( fflush( fpBlN ) == EOF || fsync( fileno( fpBlN ) ) == -1 )
+  {
+    perror( "truncate_blacklist_records: fsync" );
+    fclose( fpBlN );
+    return -1;
+  }
+  fclose(fpBlN);                 // close blacklist.dat.new
+  return numRecsWritten;
+}
+
+//
+// Function to truncate (remove) blacklist.dat records that have
+// not been used to terminate a call within the last nine months.
+// Note that the date field in blacklist.dat records is updated
+// each time a record is used to terminate a call.
+//
+int truncate_blacklist_records()
+{
+  struct stat statBuf;
+  unsigned long generation;
+  int attempt;
+
+  for( attempt = 1; ; attempt++ )
+  {
+    lock_blacklist();
+    generation = blacklist_generation();
+    unlock_blacklist( FALSE );
+
+    if( snapshot_blacklist_records() == -1 )
+    {
+      return -1;
+    }
+
+    // If blacklist.dat was not changed while it was being read,
+    // replace it (keeping it locked). Otherwise read it again.
+    lock_blacklist();
+    if( generation == blacklist_generation() )
+    {
+      break;
+    }
+    unlock_blacklist( FALSE );
+    if( attempt == 3 )
+    {
+      printf( "truncate_blacklist_records: blacklist.dat busy, not truncated\n" );
+      remove( "./blacklist.dat.new" );
+      return 0;
+    }
+  }
+
+  // If records were written to blacklist.dat.new, keep
+  // blacklist.dat as blacklist.dat.old (a second link, so that
+  // blacklist.dat always exists) and rename blacklist.dat.new
+  // to blacklist.dat. The main program re-opens blacklist.dat
+  // each time it uses it.
   if( numRecsWritten )
   {
     // If file blacklist.dat.old exists, remove it.
@@ -532,36 +511,34 @@ int truncate_blacklist_records()
       if( remove( "./blacklist.dat.old" ) == -1 )
       {
         perror( "truncate_blacklist_records: remove(1)" );
+        unlock_blacklist( FALSE );
         return -1;
       }
     }
 
-    // Before renaming blacklist.dat, close it.
-    fclose(fpBl);
-    if( rename( "./blacklist.dat", "./blacklist.dat.old" ) == -1 )
+    if( link( "./blacklist.dat", "./blacklist.dat.old" ) == -1 )
     {
-      perror( "truncate_blacklist_records: rename(1)" );
+      perror( "truncate_blacklist_records: link" );
+      unlock_blacklist( FALSE );
       return -1;
     }
 
     if( rename ( "./blacklist.dat.new", "./blacklist.dat" ) == -1 )
     {
-      perror( "truncate_blacklist_records: rename(2)" );
-      return -1;
-    }
-
-    // The main() function expects fpBl to be open.
-    if( (fpBl = fopen( "blacklist.dat", "r+" ) ) == NULL )
-    {
-      perror( "truncate_blacklist_records: fopen" );
+      perror( "truncate_blacklist_records: rename" );
+      unlock_blacklist( FALSE );
       return -1;
     }
 
+    // Force the new directory entries to the disk.
+    safeSyncDir( "./blacklist.dat" );
+    unlock_blacklist( TRUE );
     return numRecsWritten;
   }
   // If no records were written, remove file blacklist.dat.new.
   else
   {
+    unlock_blacklist( FALSE );
     if( remove( "./blacklist.dat.new" ) == -1 )
     {
       perror( "truncate_blacklist_records: remove(2)" );
@@ -572,10 +549,12 @@ int truncate_blacklist_records()
 }
 
 //
-// Function to manage the truncation of records from data files.
+// Function to manage the truncation of records from data files
+// (run by the worker thread).
 //
-int truncate_records()
+static int run_truncation()
 {
+  struct tm tmNow;
   time_t savedTime;
   int callerIDRetVal;
   int blacklistRetVal;
@@ -610,6 +589,12 @@ int truncate_records()
       break;
     }
 
+    // Today's (local) date as a day number, for comparing with the
+    // record dates.
+    localtime_r( &currentTime, &tmNow );
+    currentDay = days_from_civil( tmNow.tm_year + 1900, tmNow.tm_mon + 1,
+                                  tmNow.tm_mday );
+
     callerIDRetVal = truncate_callerID_records();
     blacklistRetVal = truncate_blacklist_records();
 
@@ -635,38 +620,109 @@ int truncate_records()
     break;
   }
 
-  close_time_save_file();
+  // The file is not open if create_time_save_file() failed to open it
+  if( fpTime != NULL )
+  {
+    close_time_save_file();
+  }
   return retVal;
 }
 
-
-// The following main() may be activated to test the code in this
-// file as a separate program. Compile it with:
-//      gcc -o truncate truncate.c
-// Manually add some records to the callerID.dat and blacklist.dat
-// files that have time fields older than nine months. The program
-// should remove them.
-#if 0
-int main()
+//
+// The truncation worker thread. It runs at a lower priority so that
+// it never delays the handling of a call.
+//
+static void *truncate_worker( void *arg )
 {
+  struct timespec start, end;
   int retVal;
 
-  // Note: in main() in file jcblock.c, callerID.dat and
-  // blacklist.dat are open when truncate_records() is called.
-  // That is simulated here.
-  if( (fpCa = fopen( "./callerID.dat", "a+" )) == NULL )
+  setpriority( PRIO_PROCESS, syscall( SYS_gettid ), TRUNCATE_NICE );
+
+  clock_gettime( CLOCK_MONOTONIC, &start );
+  retVal = run_truncation();
+  clock_gettime( CLOCK_MONOTONIC, &end );
+
+  // Report how long it took (if it did anything)
+  if( retVal != 0 )
   {
-    printf( "main:fopen(1)" );
-    return -1;
+    printf( "truncate_records: %s in %ld msec\n",
+      retVal == 1 ? "records truncated" : "failed",
+      (end.tv_sec - start.tv_sec) * 1000 +
+      (end.tv_nsec - start.tv_nsec) / 1000000 );
   }
 
-  if( (fpBl = fopen( "./blacklist.dat", "r+" )) == NULL )
+  pthread_mutex_lock( &truncateMutex );
+  truncateRunning = FALSE;
+  pthread_cond_broadcast( &truncateDone );
+  pthread_mutex_unlock( &truncateMutex );
+  return NULL;
+}
+
+//
+// Function to manage the truncation of records from data files. The
+// work (including the check for whether thirty days have passed) is
+// done by a background worker thread, so this returns at once: 0 if
+// the worker was started (or is already running), -1 if it could not
+// be started.
+//
+int truncate_records()
+{
+  pthread_t thread;
+  pthread_attr_t attr;
+  int err;
+
+  pthread_mutex_lock( &truncateMutex );
+  if( truncateRunning )
   {
-    printf( "main:fopen(2)" );
+    pthread_mutex_unlock( &truncateMutex );
+    return 0;
+  }
+  truncateRunning = TRUE;
+  pthread_mutex_unlock( &truncateMutex );
+
+  pthread_attr_init( &attr );
+  pthread_attr_setdetachstate( &attr, PTHREAD_CREATE_DETACHED );
+  err = pthread_create( &thread, &attr, truncate_worker, NULL );
+  pthread_attr_destroy( &attr );
+  if( err != 0 )
+  {
+    printf( "truncate_records: can't create thread: %s\n", strerror( err ) );
+    pthread_mutex_lock( &truncateMutex );
+    truncateRunning = FALSE;
+    pthread_mutex_unlock( &truncateMutex );
     return -1;
   }
+  return 0;
+}
+
+//
+// Function to wait for the worker thread (if running) to finish.
+//
+void truncate_wait()
+{
+  pthread_mutex_lock( &truncateMutex );
+  while( truncateRunning )
+  {
+    pthread_cond_wait( &truncateDone, &truncateMutex );
+  }
+  pthread_mutex_unlock( &truncateMutex );
+}
+
+
+// The following main() may be activated to test the code in this
+// file as a separate program. Compile it with:
+//      gcc -pthread -o truncate truncate.c
+// Manually add some records to the blacklist.dat file, and some
+// callerID.dat.YYMM segment files, that have time fields older than
+// nine months. The program should remove them.
+#if 0
+int main()
+{
+  int retVal;
 
   retVal = truncate_records();
+  truncate_wait();
 
   printf( "main: truncate_records() returned: %d\n", retVal );
 }
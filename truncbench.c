@@ -0,0 +1,205 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: truncbench.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Benchmark for the record date conversion in truncate.c. A file of
+ *	blacklist.dat records with random dates (a million lines by
+ *	default) is written, then read and filtered twice, as
+ *	truncate_blacklist_records() does: once with the old conversion
+ *	(strncpy(), atoi() and mktime() for each record) and once with
+ *	days_from_mmddyy(). The conversions alone are also timed, with the
+ *	records already in memory. The two methods must keep the same
+ *	records.
+ *
+ *	Compile with: ./makebench
+ *	Run with:     ./truncbench [lines]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <time.h>
+
+#include "common.h"
+
+#define BENCH_FILE	"./truncbench.dat"
+#define KEEP_SECS	(365-90)*24*60*60	// as truncate.c used
+#define KEEP_DAYS	(365-90)
+#define LINE_LEN	39		// length of each record
+
+static time_t currentTime;
+static long currentDay;
+static int tm_isdst_saved;
+
+static double secondsNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * The old truncate.c conversion: returns 1 to keep the record, 0 to
+ * drop it.
+ */
+static int oldKeep(const char *buf)
+{
+  char month[3], day[3], year[3];
+  int imonth, iday, iyear, i;
+  struct tm tmStruct;
+  time_t recordTime;
+
+  for( i = 19; i < 25; i++ )
+  {
+    if( !isdigit( buf[i] ) )
+      return 0;
+  }
+  strncpy( month, &buf[19], 2 );
+  month[2] = '\0';
+  imonth = atoi( month );
+  strncpy( day, &buf[21], 2 );
+  day[2] = '\0';
+  iday = atoi( day );
+  strncpy( year, &buf[23], 2 );
+  year[2] = '\0';
+  iyear = atoi( year );
+
+  memset( &tmStruct, 0, sizeof(tmStruct) );
+  tmStruct.tm_mday = iday;
+  tmStruct.tm_mon = imonth - 1;
+  tmStruct.tm_year = iyear + 100;
+  tmStruct.tm_isdst = tm_isdst_saved;
+  if( (recordTime = mktime( &tmStruct )) == -1 )
+    return 0;
+  return (currentTime - recordTime) < KEEP_SECS;
+}
+
+static int newKeep(const char *buf)
+{
+  long recordDay;
+
+  if( (recordDay = days_from_mmddyy( &buf[19] )) == -1 )
+    return 0;
+  return (currentDay - recordDay) < KEEP_DAYS;
+}
+
+/*
+ * Read the file and count the records 'keep' keeps (as truncation
+ * does, less the writing).
+ */
+static long filterFile(int (*keep)(const char *), double *secs)
+{
+  char buf[100];
+  long kept = 0;
+  double start;
+  FILE *fp;
+
+  if( (fp = fopen( BENCH_FILE, "r" )) == NULL )
+  {
+    perror( BENCH_FILE );
+    exit( 1 );
+  }
+  start = secondsNow();
+  while( fgets( buf, sizeof(buf), fp ) != NULL )
+  {
+    if( buf[0] == '#' || strlen( buf ) < 26 )
+      continue;
+    kept += keep( buf );
+  }
+  *secs = secondsNow() - start;
+  fclose( fp );
+  return kept;
+}
+
+int main(int argc, char **argv)
+{
+  long lines = 1000000, i, kept, oldKept, newKept, mismatches = 0;
+  double oldSecs, newSecs, start, oldConv, newConv;
+  struct tm tmNow;
+  char *recs;
+  FILE *fp;
+
+  if( argc > 1 && (lines = atol( argv[1] )) <= 0 )
+  {
+    fprintf(stderr, "usage: truncbench [lines]\n");
+    return 1;
+  }
+
+  time( &currentTime );
+  localtime_r( &currentTime, &tmNow );
+  tm_isdst_saved = tmNow.tm_isdst;
+  currentDay = days_from_civil( tmNow.tm_year + 1900, tmNow.tm_mon + 1,
+                                tmNow.tm_mday );
+
+  // Records with dates spread over the last three years
+  if( (recs = malloc( lines * LINE_LEN + 1 )) == NULL )
+  {
+    perror( "malloc" );
+    return 1;
+  }
+  srand( 1 );
+  for( i = 0; i < lines; i++ )
+  {
+    sprintf( &recs[i * LINE_LEN], "%-18ld?%02d%02d%02d    junk call\n",
+      5550000000L + i, rand() % 12 + 1, rand() % 28 + 1,
+      (tmNow.tm_year - 100) - rand() % 3 );
+  }
+  if( (fp = fopen( BENCH_FILE, "w" )) == NULL ||
+      fwrite( recs, LINE_LEN, lines, fp ) != (size_t)lines ||
+      fclose( fp ) == EOF )
+  {
+    perror( BENCH_FILE );
+    return 1;
+  }
+
+  // Check that both methods keep the same records
+  for( i = 0; i < lines; i++ )
+  {
+    if( oldKeep( &recs[i * LINE_LEN] ) != newKeep( &recs[i * LINE_LEN] ) )
+      mismatches++;
+  }
+
+  // The conversions alone
+  start = secondsNow();
+  for( i = 0, oldKept = 0; i < lines; i++ )
+    oldKept += oldKeep( &recs[i * LINE_LEN] );
+  oldConv = secondsNow() - start;
+  start = secondsNow();
+  for( i = 0, newKept = 0; i < lines; i++ )
+    newKept += newKeep( &recs[i * LINE_LEN] );
+  newConv = secondsNow() - start;
+
+  // Reading and filtering the file
+  kept = filterFile( oldKeep, &oldSecs );
+  if( filterFile( newKeep, &newSecs ) != kept )
+    mismatches++;
+
+  printf("%ld records, %ld kept, %ld mismatches\n", lines, kept, mismatches);
+  printf("%-28s %12s %12s %8s\n", "", "old (mktime)", "new (table)", "speedup");
+  printf("%-28s %9.1f ns %9.1f ns %7.1fx\n", "conversion per record",
+    oldConv * 1e9 / lines, newConv * 1e9 / lines, oldConv / newConv);
+  printf("%-28s %9.1f ms %9.1f ms %7.1fx\n", "filter whole file",
+    oldSecs * 1e3, newSecs * 1e3, oldSecs / newSecs);
+
+  remove( BENCH_FILE );
+  free( recs );
+  return mismatches != 0;
+}
@@ -0,0 +1,375 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: voice.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	Functions to detect the star (*) key tones in the telephone line
+ *	audio streamed by a voice modem over its serial port, instead of
+ *	from a microphone placed next to the modem speaker (tones.c). No
+ *	microphone, sound card or ALSA library is needed.
+ *
+ *	The modem is put in voice mode (AT+FCLASS=8), connected to the
+ *	line (AT+VLS=1) and told to send the line audio (AT+VRX). The
+ *	audio arrives as a stream of bytes in which a DLE (0x10) byte
+ *	introduces a "shielded" code: DLE DLE is a data byte of value
+ *	0x10, DLE ETX marks the end of the stream and DLE followed by
+ *	another character reports an event (e.g., DLE '*' for a modem
+ *	that detects touch tone keys itself, as the ATian modem does,
+ *	see jcblockAT.c). The data bytes are decoded, scaled and fed to
+ *	the tone detector in goertzel.c. The busy ('b'), dial tone ('d')
+ *	and silence ('s', 'q') events of modems that detect those tones
+ *	themselves are passed on with goertzelSetCallProgress().
+ *
+ *	Voice modems differ in the sample formats they offer. Send
+ *	AT+VSM=? to your modem to list them, then set VOICE_VSM_COMMAND
+ *	and VOICE_FORMAT below to match. The serial port must run much
+ *	faster than 1200 baud to carry the audio (8000 bytes/second for
+ *	8-bit samples), see BAUD_RATE in jcblock.c.
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/select.h>
+
+#include "common.h"
+#include "goertzel.h"
+
+#define DEBUG
+
+// Sample formats
+#define VOICE_U8	1	// 8-bit unsigned linear
+#define VOICE_ULAW	2	// 8-bit G.711 u-law
+#define VOICE_ADPCM	3	// 4-bit IMA ADPCM, two samples per byte
+
+// Voice sample mode command and the format it selects. The 8-bit
+// linear modes are usually: AT+VSM=128,8000 (US Robotics) or
+// AT+VSM=1,8000 (Conexant/Rockwell). For ADPCM (half the serial
+// port rate) try AT+VSM=129,8000 (US Robotics) or AT+VSM=140,8000
+// (Conexant/Rockwell).
+#define VOICE_VSM_COMMAND	"AT+VSM=128,8000\r"
+#define VOICE_FORMAT		VOICE_U8
+
+// Comment out the following define if your modem sends the low
+// ADPCM nibble (4 bits) of each byte first.
+#define ADPCM_HIGH_NIBBLE_FIRST
+
+#define DLE	0x10	// Data Link Escape
+#define ETX	0x03	// End of text (end of the audio stream)
+
+#define READ_SIZE	256
+
+/* One block of scaled samples for the detector */
+static FLOATING testData[GOERTZEL_BLOCK];
+static int blockIndex;
+static bool afterDLE;
+
+#if VOICE_FORMAT == VOICE_ADPCM
+static int adpcmPredicted;
+static int adpcmStepIndex;
+
+static const int stepIndexTable[16] = {
+  -1, -1, -1, -1, 2, 4, 6, 8,
+  -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+static const int stepTable[89] = {
+  7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34,
+  37, 41, 45, 50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143,
+  157, 173, 190, 209, 230, 253, 279, 307, 337, 371, 408, 449, 494,
+  544, 598, 658, 724, 796, 876, 963, 1060, 1166, 1282, 1411, 1552,
+  1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327, 3660, 4026, 4428,
+  4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+  12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086,
+  29794, 32767
+};
+#endif
+
+/* Prototypes */
+static bool voiceCommand(int fd, char *command, char *reply);
+static bool addSample(FLOATING sample);
+static bool decodeByte(unsigned char byte);
+
+/*
+ * Send a command to the modem and wait (up to two seconds) for
+ * a reply containing 'reply'. Return TRUE if it arrived.
+ */
+static bool voiceCommand(int fd, char *command, char *reply)
+{
+  char buffer[255];
+  int nbytes = 0;
+  int n;
+  fd_set readFds;
+  struct timeval timeout;
+
+#ifdef DEBUG
+  printf("sending %.*s command...\n", (int)strlen(command) - 1, command);
+#endif
+  if( write(fd, command, strlen(command) ) != strlen(command) )
+  {
+    printf("voiceCommand: write() failed\n" );
+    return FALSE;
+  }
+
+  timeout.tv_sec = 2;
+  timeout.tv_usec = 0;
+  while( nbytes < sizeof(buffer) - 1 )
+  {
+    FD_ZERO( &readFds );
+    FD_SET( fd, &readFds );
+    if( select( fd + 1, &readFds, NULL, NULL, &timeout ) <= 0 )
+    {
+      break;
+    }
+    if( ( n = read( fd, &buffer[nbytes], sizeof(buffer) - 1 - nbytes ) ) <= 0 )
+    {
+      break;
+    }
+    nbytes += n;
+    buffer[nbytes] = 0;
+    if( strstr( buffer, reply ) != NULL )
+    {
+      return TRUE;
+    }
+  }
+#ifdef DEBUG
+  printf("did not get %s\n", reply);
+#endif
+  return FALSE;
+}
+
+/*
+ * Put the modem in voice mode, connect it to the line and start
+ * the line audio stream. The modem goes off hook when it connects
+ * to the line (a "click" is heard). Return FALSE if the modem did
+ * not accept the commands.
+ */
+bool voiceStart(int fd)
+{
+  goertzelInit();		// new audio path: new noise floors
+  blockIndex = 0;
+  afterDLE = FALSE;
+#if VOICE_FORMAT == VOICE_ADPCM
+  adpcmPredicted = 0;
+  adpcmStepIndex = 0;
+#endif
+
+  if( voiceCommand(fd, "AT+FCLASS=8\r", "OK") == FALSE ||
+      voiceCommand(fd, "AT+VIP\r", "OK") == FALSE ||
+      voiceCommand(fd, VOICE_VSM_COMMAND, "OK") == FALSE ||
+      voiceCommand(fd, "AT+VLS=1\r", "OK") == FALSE )
+  {
+    return FALSE;
+  }
+
+  // Discard anything left over, then start voice receive mode
+  tcflush( fd, TCIFLUSH );
+  return voiceCommand(fd, "AT+VRX\r", "CONNECT");
+}
+
+/*
+ * Add a scaled sample to the current block. If the block is full,
+ * process it. Return TRUE if the star key tones were detected.
+ */
+static bool addSample(FLOATING sample)
+{
+  testData[blockIndex++] = sample;
+  if( blockIndex < GOERTZEL_BLOCK )
+  {
+    return FALSE;
+  }
+  blockIndex = 0;
+  return goertzelBlock( testData );
+}
+
+/*
+ * Decode one (unescaped) data byte into one or two samples.
+ * Return TRUE if the star key tones were detected.
+ */
+static bool decodeByte(unsigned char byte)
+{
+#if VOICE_FORMAT == VOICE_U8
+  return addSample( ( (int)byte - 128 ) / 128.0 );
+
+#elif VOICE_FORMAT == VOICE_ULAW
+  int exponent, mantissa, value;
+
+  // G.711 u-law expansion (the bits are sent inverted)
+  byte = ~byte;
+  exponent = ( byte >> 4 ) & 0x07;
+  mantissa = byte & 0x0f;
+  value = ( ( ( mantissa << 3 ) + 0x84 ) << exponent ) - 0x84;
+  if( byte & 0x80 )
+  {
+    value = -value;
+  }
+  return addSample( value / 32768.0 );
+
+#elif VOICE_FORMAT == VOICE_ADPCM
+  int nibbles[2];
+  int i, code, step, diff;
+  bool detected = FALSE;
+
+#ifdef ADPCM_HIGH_NIBBLE_FIRST
+  nibbles[0] = byte >> 4;
+  nibbles[1] = byte & 0x0f;
+#else
+  nibbles[0] = byte & 0x0f;
+  nibbles[1] = byte >> 4;
+#endif
+  for( i = 0; i < 2; i++ )
+  {
+    code = nibbles[i];
+    step = stepTable[adpcmStepIndex];
+
+    // diff = (code & 7 + 0.5) * step / 4
+    diff = step >> 3;
+    if( code & 4 ) diff += step;
+    if( code & 2 ) diff += step >> 1;
+    if( code & 1 ) diff += step >> 2;
+    adpcmPredicted += ( code & 8 ) ? -diff : diff;
+    if( adpcmPredicted > 32767 ) adpcmPredicted = 32767;
+    if( adpcmPredicted < -32768 ) adpcmPredicted = -32768;
+
+    adpcmStepIndex += stepIndexTable[code];
+    if( adpcmStepIndex < 0 ) adpcmStepIndex = 0;
+    if( adpcmStepIndex > 88 ) adpcmStepIndex = 88;
+
+    if( addSample( adpcmPredicted / 32768.0 ) == TRUE )
+    {
+      detected = TRUE;
+    }
+  }
+  return detected;
+#endif
+}
+
+/*
+ * Read the audio received so far (waiting up to 100 msec for some
+ * to arrive), remove the DLE codes and run it through the tone
+ * detector. Return TRUE if a star (*) key press was detected (or
+ * reported by the modem itself).
+ */
+bool voicePoll(int fd)
+{
+  unsigned char buffer[READ_SIZE];
+  int nbytes;
+  int i;
+  bool detected = FALSE;
+  fd_set readFds;
+  struct timeval timeout;
+
+  FD_ZERO( &readFds );
+  FD_SET( fd, &readFds );
+  timeout.tv_sec = 0;
+  timeout.tv_usec = 100000;          // 100 msec
+  if( select( fd + 1, &readFds, NULL, NULL, &timeout ) <= 0 )
+  {
+    return FALSE;
+  }
+
+  if( ( nbytes = read( fd, buffer, sizeof(buffer) ) ) <= 0 )
+  {
+    return FALSE;
+  }
+
+  for( i = 0; i < nbytes; i++ )
+  {
+    if( afterDLE )
+    {
+      afterDLE = FALSE;
+      switch( buffer[i] )
+      {
+        case DLE:                    // a data byte of value DLE
+          if( decodeByte( DLE ) == TRUE )
+          {
+            detected = TRUE;
+          }
+          break;
+
+        case '*':                    // the modem detected the *-key
+#ifdef DEBUG
+          printf("modem reported *-key\n");
+#endif
+          detected = TRUE;
+          break;
+
+        case 'b':                    // the modem heard a busy tone
+          goertzelSetCallProgress( CP_BUSY );
+          break;
+
+        case 'd':                    // ...a dial tone
+          goertzelSetCallProgress( CP_DIAL );
+          break;
+
+        case 's':                    // ...silence (presumed hang-up)
+        case 'q':                    // ...quiet (presumed end of message)
+          goertzelSetCallProgress( CP_SILENCE );
+          break;
+
+        case ETX:                    // end of the audio stream
+#ifdef DEBUG
+          printf("voice receive stream ended\n");
+#endif
+          break;
+
+        default:                     // other events (ignored)
+#ifdef DEBUG
+          printf("voice event: DLE 0x%x\n", buffer[i]);
+#endif
+          break;
+      }
+    }
+    else if( buffer[i] == DLE )
+    {
+      afterDLE = TRUE;
+    }
+    else if( decodeByte( buffer[i] ) == TRUE )
+    {
+      detected = TRUE;
+    }
+  }
+
+  if( detected )
+  {
+    printf("*-KEY press detected\n");
+  }
+  return detected;
+}
+
+/*
+ * Stop the audio stream and put the modem back on hook. The
+ * caller re-initializes the modem for caller ID afterwards.
+ */
+void voiceStop(int fd)
+{
+  static char stopStr[] = { DLE, '!' };
+
+  // DLE '!' ends voice receive mode; the modem ends the stream
+  // with DLE ETX and returns to command mode.
+  if( write( fd, stopStr, sizeof(stopStr) ) != sizeof(stopStr) )
+  {
+    printf("voiceStop: write() failed\n" );
+  }
+  usleep( 250000 );	// quarter second
+  tcflush( fd, TCIFLUSH );
+
+  voiceCommand(fd, "AT+VLS=0\r", "OK");
+  voiceCommand(fd, "ATH0\r", "OK");
+}
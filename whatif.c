@@ -0,0 +1,488 @@
+/*
+ *	Program name: jcblock
+ *
+ *	File name: whatif.c
+ *
+ *	Copyright:      Copyright 2008 Walter S. Heath
+ *
+ *	Copy permission:
+ *	This program is free software: you can redistribute it and/or modify
+ *	it under the terms of the GNU General Public License as published by
+ *	the Free Software Foundation, either version 3 of the License, or
+ *	(at your option) any later version.
+ *
+ *	This program is distributed in the hope that it will be useful,
+ *	but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *	GNU General Public License for more details.
+ *
+ *	You may view a copy of the GNU General Public License at:
+ *	           <http://www.gnu.org/licenses/>.
+ *
+ *	"jcblock whatif": shows what a whitelist and blacklist (for
+ *	example a new blacklist.dat, before it is put in place) would have
+ *	done with the calls in the call history.
+ *
+ *	Each call in the callerID.dat segments is classified again with
+ *	the lists given (see libjcblock.c) and the result is compared with
+ *	the tag it was given: 'W' (whitelisted), 'B' (blacklisted) or
+ *	anything else (on neither list; calls tagged '*', 'R' or 'N' were
+ *	not on a list either). The counts of each old and new result are
+ *	printed, and each call whose result would be different.
+ *
+ *	The history is divided into pieces of about WHATIF_CHUNK bytes
+ *	(whole records), which are shared out among a number of threads
+ *	in turn. A thread that has done its own pieces takes half of the
+ *	pieces another thread has not started (work stealing), so the
+ *	threads all finish at about the same time even if some records
+ *	take longer than others. The calls that differ are printed in
+ *	the order of the history.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "libjcblock.h"
+#include "whatif.h"
+
+#define WHATIF_CHUNK        (64 * 1024) // bytes of history in a piece
+#define WHATIF_BATCH        64          // calls per jcb_classify_batch()
+#define WHATIF_RECORD_LEN   256         // longest record
+#define WHATIF_MAX_THREADS  64
+
+// The results (index of counts[][])
+#define WAS_NEITHER   0
+#define WAS_WHITE     1
+#define WAS_BLACK     2
+
+// One piece of the history
+typedef struct
+{
+  const char *start;
+  size_t len;
+  FILE *fp;                     // the differences (open_memstream())
+  char *diffs;
+  size_t diffsLen;
+} whatifChunk;
+
+// One thread
+typedef struct
+{
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  long next, end;               // its pieces not yet started
+  long counts[3][3];            // calls by old [] and new [] result
+  long skipped;                 // lines that are not calls
+  long stolen;                  // times it took another thread's pieces
+} whatifWorker;
+
+static jcb *lists;
+static whatifChunk *chunks;
+static long numChunks;
+static whatifWorker workers[WHATIF_MAX_THREADS];
+static int numWorkers;
+static bool countOnly;
+
+static double secondsNow(void)
+{
+  struct timespec ts;
+
+  clock_gettime( CLOCK_MONOTONIC, &ts );
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int resultOf(char tag)
+{
+  if( tag == JCB_WHITE )
+    return WAS_WHITE;
+  if( tag == JCB_BLACK )
+    return WAS_BLACK;
+  return WAS_NEITHER;
+}
+
+//
+// Divide a history file (mapped at 'data') into pieces.
+//
+static int addChunks(const char *data, size_t size)
+{
+  const char *end, *nl;
+  whatifChunk *more;
+  size_t start = 0, len;
+
+  while( start < size )
+  {
+    len = size - start;
+    if( len > WHATIF_CHUNK )
+    {
+      end = data + start + WHATIF_CHUNK;
+      nl = memchr( end, '\n', data + size - end );
+      len = nl != NULL ? (size_t)(nl + 1 - (data + start)) : size - start;
+    }
+    if( (numChunks & 255) == 0 )
+    {
+      if( (more = realloc( chunks, (numChunks + 256) * sizeof(whatifChunk) )) == NULL )
+      {
+        perror( "whatif: realloc" );
+        return -1;
+      }
+      chunks = more;
+    }
+    memset( &chunks[numChunks], 0, sizeof(whatifChunk) );
+    chunks[numChunks].start = data + start;
+    chunks[numChunks].len = len;
+    numChunks++;
+    start += len;
+  }
+  return 0;
+}
+
+//
+// Classify 'n' records and count (and keep) the results.
+//
+static void classifyBatch(whatifWorker *w, whatifChunk *c, int n,
+                          const char *records[], const char *lines[],
+                          const int lens[])
+{
+  jcb_result results[WHATIF_BATCH];
+  int i, was, now;
+
+  jcb_classify_batch( lists, records, n, results );
+  for( i = 0; i < n; i++ )
+  {
+    was = resultOf( lines[i][0] );
+    now = resultOf( results[i].tag );
+    w->counts[was][now]++;
+    if( was == now || countOnly )
+      continue;
+    if( c->fp == NULL &&
+        (c->fp = open_memstream( &c->diffs, &c->diffsLen )) == NULL )
+    {
+      perror( "whatif: open_memstream" );
+      continue;
+    }
+    fprintf( c->fp, "now %c: %.*s\n", results[i].tag, lens[i], lines[i] );
+  }
+}
+
+//
+// Classify the calls in one piece.
+//
+static void doChunk(whatifWorker *w, whatifChunk *c)
+{
+  char buf[WHATIF_BATCH][WHATIF_RECORD_LEN];
+  const char *records[WHATIF_BATCH], *lines[WHATIF_BATCH];
+  const char *p = c->start, *end = c->start + c->len, *eol;
+  int lens[WHATIF_BATCH], len, n = 0;
+
+  for( ; p < end; p = eol + 1 )
+  {
+    if( (eol = memchr( p, '\n', end - p )) == NULL )
+      eol = end;
+    len = eol - p;
+    if( len == 0 || p[0] == '#' )
+      continue;
+    if( len >= WHATIF_RECORD_LEN || memchr( p, '=', len ) == NULL )
+    {
+      w->skipped++;
+      continue;
+    }
+
+    // The record as it was checked, before it was tagged
+    memcpy( buf[n], p, len );
+    buf[n][len] = '\0';
+    buf[n][0] = '-';
+    records[n] = buf[n];
+    lines[n] = p;
+    lens[n] = len;
+    if( ++n == WHATIF_BATCH )
+    {
+      classifyBatch( w, c, n, records, lines, lens );
+      n = 0;
+    }
+  }
+  if( n > 0 )
+    classifyBatch( w, c, n, records, lines, lens );
+  if( c->fp != NULL )
+    fclose( c->fp );
+}
+
+//
+// The next of a thread's own pieces, or -1.
+//
+static long nextChunk(whatifWorker *w)
+{
+  long c = -1;
+
+  pthread_mutex_lock( &w->mutex );
+  if( w->next < w->end )
+    c = w->next++;
+  pthread_mutex_unlock( &w->mutex );
+  return c;
+}
+
+//
+// Take the second half of another thread's pieces. Returns the
+// first (the rest become this thread's own), or -1 if there are none.
+//
+static long stealChunks(whatifWorker *w)
+{
+  whatifWorker *v;
+  long first = -1, last = 0;
+  int i;
+
+  for( i = 1; i < numWorkers && first == -1; i++ )
+  {
+    v = &workers[(w - workers + i) % numWorkers];
+    pthread_mutex_lock( &v->mutex );
+    if( v->end > v->next )
+    {
+      first = v->next + (v->end - v->next) / 2;
+      last = v->end;
+      v->end = first;
+    }
+    pthread_mutex_unlock( &v->mutex );
+  }
+  if( first == -1 )
+    return -1;
+
+  pthread_mutex_lock( &w->mutex );
+  w->next = first + 1;
+  w->end = last;
+  pthread_mutex_unlock( &w->mutex );
+  w->stolen++;
+  return first;
+}
+
+static void *worker(void *arg)
+{
+  whatifWorker *w = arg;
+  long c;
+
+  while( (c = nextChunk( w )) != -1 || (c = stealChunks( w )) != -1 )
+  {
+    doChunk( w, &chunks[c] );
+  }
+  return NULL;
+}
+
+static void whatifCleanup(void **maps, size_t *mapSizes, int numFiles,
+                          glob_t *globBuf)
+{
+  int i;
+
+  for( i = 0; maps != NULL && i < numFiles; i++ )
+  {
+    if( maps[i] != NULL )
+      munmap( maps[i], mapSizes[i] );
+  }
+  free( maps );
+  free( mapSizes );
+  free( chunks );
+  chunks = NULL;
+  jcb_close( lists );
+  lists = NULL;
+  globfree( globBuf );
+}
+
+static void whatifUsage(void)
+{
+  fprintf( stderr,
+    "Usage: jcblock whatif [-w whitelist] [-b blacklist] [-j threads] [-c] [file ...]\n"
+    "  -w  the whitelist to use (default ./whitelist.dat)\n"
+    "  -b  the blacklist to use (default ./blacklist.dat)\n"
+    "  -j  the number of threads (default: one for each processor)\n"
+    "  -c  only count the calls (don't list the calls that differ)\n"
+    "  The calls in 'file's are classified (default: the callerID.dat segments).\n" );
+}
+
+//
+// "jcblock whatif ..." (argv[0] is "whatif").
+//
+int whatifQuery(int argc, char **argv)
+{
+  static const char *names[3] = { "neither", "whitelist", "blacklist" };
+  jcb_lists paths = { "./whitelist.dat", "./blacklist.dat" };
+  char **files, *fallback[1] = { "./callerID.dat" };
+  long counts[3][3], calls = 0, differ = 0, skipped = 0, stolen = 0;
+  int numFiles, optChar, i, k, fd, err;
+  bool started[WHATIF_MAX_THREADS], failed = FALSE;
+  struct stat statBuf;
+  glob_t globBuf;
+  double start;
+  void **maps;
+  size_t *mapSizes;
+
+  memset( &globBuf, 0, sizeof(globBuf) );
+  numWorkers = sysconf( _SC_NPROCESSORS_ONLN );
+  countOnly = FALSE;
+  optind = 1;
+  while( ( optChar = getopt( argc, argv, "w:b:j:ch" ) ) != EOF )
+  {
+    switch( optChar )
+    {
+      case 'w':
+        paths.whitelist = optarg;
+        break;
+
+      case 'b':
+        paths.blacklist = optarg;
+        break;
+
+      case 'j':
+        numWorkers = atoi( optarg );
+        break;
+
+      case 'c':
+        countOnly = TRUE;
+        break;
+
+      case 'h':
+      default:
+        whatifUsage();
+        return -1;
+    }
+  }
+  if( numWorkers < 1 )
+    numWorkers = 1;
+  if( numWorkers > WHATIF_MAX_THREADS )
+    numWorkers = WHATIF_MAX_THREADS;
+
+  numFiles = argc - optind;
+  files = argv + optind;
+  if( numFiles == 0 )
+  {
+    if( glob( "./callerID.dat.[0-9][0-9][0-9][0-9]", 0, NULL, &globBuf ) == 0 )
+    {
+      numFiles = globBuf.gl_pathc;
+      files = globBuf.gl_pathv;
+    }
+    else
+    {
+      numFiles = 1;
+      files = fallback;
+    }
+  }
+
+  // A whitelist is not required
+  if( access( paths.whitelist, F_OK ) != 0 )
+    paths.whitelist = NULL;
+  if( (lists = jcb_open( &paths )) == NULL )
+  {
+    globfree( &globBuf );
+    return -1;
+  }
+
+  // Map the history files and divide them into pieces
+  numChunks = 0;
+  maps = calloc( numFiles, sizeof(void *) );
+  mapSizes = calloc( numFiles, sizeof(size_t) );
+  if( maps == NULL || mapSizes == NULL )
+  {
+    perror( "whatif: calloc" );
+    failed = TRUE;
+  }
+  for( i = 0; i < numFiles && !failed; i++ )
+  {
+    if( (fd = open( files[i], O_RDONLY )) == -1 )
+    {
+      perror( files[i] );
+      continue;
+    }
+    if( fstat( fd, &statBuf ) == 0 && statBuf.st_size > 0 )
+    {
+      maps[i] = mmap( NULL, statBuf.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+      if( maps[i] == MAP_FAILED )
+      {
+        perror( files[i] );
+        maps[i] = NULL;
+      }
+      else
+      {
+        mapSizes[i] = statBuf.st_size;
+        failed = addChunks( maps[i], mapSizes[i] ) == -1;
+      }
+    }
+    close( fd );
+  }
+  if( failed )
+  {
+    whatifCleanup( maps, mapSizes, numFiles, &globBuf );
+    return -1;
+  }
+
+  printf( "Classifying the calls in %d file(s) with %s and %s in %d thread(s)\n",
+    numFiles, paths.whitelist ? paths.whitelist : "(no whitelist)",
+    paths.blacklist, numWorkers );
+  fflush( stdout );
+  start = secondsNow();
+
+  // Give each thread an equal share of the pieces to start with
+  for( i = 0; i < numWorkers; i++ )
+  {
+    memset( &workers[i], 0, sizeof(whatifWorker) );
+    pthread_mutex_init( &workers[i].mutex, NULL );
+    workers[i].next = numChunks * i / numWorkers;
+    workers[i].end = numChunks * (i + 1) / numWorkers;
+  }
+  for( i = 1; i < numWorkers; i++ )
+  {
+    // If a thread can't be started, the others take its pieces
+    err = pthread_create( &workers[i].thread, NULL, worker, &workers[i] );
+    started[i] = err == 0;
+    if( err != 0 )
+      printf("whatif: can't create thread: %s\n", strerror(err));
+  }
+  worker( &workers[0] );
+  for( i = 1; i < numWorkers; i++ )
+  {
+    if( started[i] )
+      pthread_join( workers[i].thread, NULL );
+  }
+
+  // The calls that would be handled differently, in file order
+  for( i = 0; i < numChunks; i++ )
+  {
+    if( chunks[i].diffs != NULL )
+    {
+      fwrite( chunks[i].diffs, 1, chunks[i].diffsLen, stdout );
+      free( chunks[i].diffs );
+    }
+  }
+
+  memset( counts, 0, sizeof(counts) );
+  for( i = 0; i < numWorkers; i++ )
+  {
+    for( k = 0; k < 9; k++ )
+      counts[k / 3][k % 3] += workers[i].counts[k / 3][k % 3];
+    skipped += workers[i].skipped;
+    stolen += workers[i].stolen;
+    pthread_mutex_destroy( &workers[i].mutex );
+  }
+  for( k = 0; k < 9; k++ )
+  {
+    calls += counts[k / 3][k % 3];
+    if( k / 3 != k % 3 )
+      differ += counts[k / 3][k % 3];
+  }
+
+  printf( "%ld calls (%ld lines skipped) in %.2f seconds (%ld pieces, %ld stolen)\n",
+    calls, skipped, secondsNow() - start, numChunks, stolen );
+  printf( "%-16s%12s%12s%12s\n", "", "now neither", "whitelist", "blacklist" );
+  for( i = 0; i < 3; i++ )
+  {
+    printf( "was %-12s%12ld%12ld%12ld\n", names[i], counts[i][0],
+      counts[i][1], counts[i][2] );
+  }
+  printf( "%ld calls would be handled differently\n", differ );
+
+  whatifCleanup( maps, mapSizes, numFiles, &globBuf );
+  return 0;
+}